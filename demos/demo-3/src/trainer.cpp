@@ -44,28 +44,15 @@ Mat<float> Trainer::generateContourPredictions(void)
 	return predictions;
 }
 
-float Trainer::calculateAccuracy(void)
+Metrics<float> Trainer::calculateMetrics(void)
 {
 	if (!X_ptr_ || !Y_ptr_ || X_ptr_->empty()) {
-		return 0.0f;
+		return Metrics<float>();
 	}
 	
-	std::size_t correct = 0;
-	std::size_t total = X_ptr_->size();
-	
-	for (std::size_t i = 0; i < total; i++) {
-		Mat<float> pred = (*model_)((*X_ptr_)[i]);
-		
-		// Clasificar: > 0.5 = clase 1, <= 0.5 = clase 0
-		float predicted_class = (pred(0, 0) > 0.5f) ? 1.0f : 0.0f;
-		float true_class = (*Y_ptr_)[i](0, 0);
-		
-		if (std::abs(predicted_class - true_class) < 0.1f) {
-			correct++;
-		}
-	}
-	
-	return static_cast<float>(correct) / static_cast<float>(total);
+	// Una sola pasada repartida entre los hilos del pool global
+	// (clasifica: > 0.5 = clase 1, <= 0.5 = clase 0)
+	return model_->evaluate(*X_ptr_, *Y_ptr_);
 }
 
 void Trainer::train(void)
@@ -102,12 +89,13 @@ void Trainer::train(void)
 		
 		// Después de cada época, actualizar métricas y contour plot
 		
-		// 1. Calcular cross entropy
-		float crossEntropy = model_->test(X_ptr_, Y_ptr_)(0, 0);
+		// 1. Calcular cross entropy (media por muestra) y accuracy
+		Metrics<float> metrics = calculateMetrics();
+		float crossEntropy = metrics.loss();
 		emit updateCrossEntropy(crossEntropy);
 		
-		// 2. Calcular accuracy
-		float accuracy = calculateAccuracy();
+		// 2. Emitir accuracy
+		float accuracy = metrics.accuracy();
 		emit updateAccuracy(accuracy);
 		
 		// 3. Actualizar número de época
@@ -122,7 +110,8 @@ void Trainer::train(void)
 		
 		qDebug() << "Epoch:" << (e + 1) << "/" << nepochs_ 
 		         << "| CrossEntropy:" << crossEntropy 
-		         << "| Accuracy:" << (accuracy * 100.0f) << "%";
+		         << "| Accuracy:" << (accuracy * 100.0f) << "%"
+		         << "| AUC:" << metrics.auc();
 		
 		// Pequeña pausa para no saturar la UI
 		// if ((e + 1) % 10 == 0) {
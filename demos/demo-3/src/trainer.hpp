@@ -46,8 +46,8 @@ private:
 	// Generar la matriz de predicciones para el contour plot
 	Mat<float> generateContourPredictions(void);
 	
-	// Calcular accuracy
-	float calculateAccuracy(void);
+	// Calcular cross entropy, accuracy, precision, recall y AUC en paralelo
+	Metrics<float> calculateMetrics(void);
 	
 	std::shared_ptr<Sequential<float>> model_;
 	std::size_t nepochs_;
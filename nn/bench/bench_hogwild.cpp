@@ -0,0 +1,106 @@
+/*
+ * Convergence per wall-clock second of the training modes of `Sequential`.
+ *
+ * The data set is a wide and sparse binary classification problem (few
+ * active features per sample) labeled by a random linear teacher, the
+ * kind of model where Hogwild updates rarely collide.
+ *
+ * Usage: bench_hogwild [nthreads] [nepochs]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+
+using namespace nn::models;
+using namespace nn::activation_funcs;
+
+static constexpr std::size_t nfeatures = 512;
+static constexpr std::size_t nactive = 8;
+static constexpr std::size_t nsamples = 8192;
+static constexpr std::size_t batch_size = 32;
+
+static void make_data(std::vector<Mat<float>> &X, std::vector<Mat<float>> &Y)
+{
+	std::mt19937 rng(1234);
+	std::normal_distribution<float> normal(0.0f, 1.0f);
+	std::uniform_int_distribution<std::size_t> feature(0, nfeatures - 1);
+
+	std::vector<float> teacher(nfeatures);
+	for (auto &w : teacher)
+		w = normal(rng);
+
+	for (std::size_t n = 0; n < nsamples; n++) {
+		Mat<float> x = Mat<float>(nfeatures, 1).fill(0.0f);
+		float z = 0.0f;
+		for (std::size_t k = 0; k < nactive; k++) {
+			std::size_t i = feature(rng);
+			x(i, 0) = 1.0f;
+			z += teacher[i];
+		}
+		X.push_back(x);
+		Y.push_back(Mat<float>({{z > 0.0f ? 1.0f : 0.0f}}));
+	}
+}
+
+static std::shared_ptr<Sequential<float>> make_model(void)
+{
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Dense<float>>(nfeatures, 1, std::make_shared<SigmoidFunc<float>>(),
+						       std::make_shared<RandUniformInitializer<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.5f));
+	model->set_loss(std::make_shared<CrossEntropy<float>>());
+	model->build();
+	return model;
+}
+
+static float mean_loss(Sequential<float> &model, std::shared_ptr<std::vector<Mat<float>>> X,
+		       std::shared_ptr<std::vector<Mat<float>>> Y)
+{
+	return model.test(X, Y).grand_sum() / static_cast<float>(X->size());
+}
+
+static void run(const std::string &name, FitMode mode, std::size_t nthreads, std::size_t nepochs,
+		std::shared_ptr<std::vector<Mat<float>>> X, std::shared_ptr<std::vector<Mat<float>>> Y)
+{
+	auto model = make_model();
+	model->set_fit_mode(mode, nthreads);
+
+	double seconds = 0.0;
+	std::printf("%-14s %6d %10.4f %10.4f\n", name.c_str(), 0, seconds, mean_loss(*model, X, Y));
+	for (std::size_t epoch = 1; epoch <= nepochs; epoch++) {
+		// Only the training is timed, not the evaluation of the loss
+		auto start = std::chrono::steady_clock::now();
+		model->fit(X, Y, 1, batch_size);
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::printf("%-14s %6zu %10.4f %10.4f\n", name.c_str(), epoch, seconds, mean_loss(*model, X, Y));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::size_t nthreads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : nn::parallel::hardware_threads();
+	std::size_t nepochs = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 5;
+
+	auto X = std::make_shared<std::vector<Mat<float>>>();
+	auto Y = std::make_shared<std::vector<Mat<float>>>();
+	make_data(*X, *Y);
+
+	std::printf("samples=%zu features=%zu active=%zu batch=%zu threads=%zu\n",
+		    nsamples, nfeatures, nactive, batch_size, nthreads);
+	std::printf("%-14s %6s %10s %10s\n", "mode", "epoch", "seconds", "loss");
+
+	run("serial", FitMode::Serial, 1, nepochs, X, Y);
+	run("data-parallel", FitMode::DataParallel, nthreads, nepochs, X, Y);
+	run("hogwild", FitMode::Hogwild, nthreads, nepochs, X, Y);
+
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Epochs and wall-clock seconds each optimizer needs to bring a small MLP
+ * under a target loss on a noisy two moons style problem.
+ *
+ * Usage: bench_optimizers [target_loss] [max_epochs]
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+
+using namespace nn::models;
+using namespace nn::activation_funcs;
+
+static constexpr std::size_t nsamples = 1024;
+static constexpr std::size_t batch_size = 32;
+
+static void make_data(std::vector<Mat<float>> &X, std::vector<Mat<float>> &Y)
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> angle(0.0f, 3.14159265f);
+	std::normal_distribution<float> noise(0.0f, 0.1f);
+
+	for (std::size_t n = 0; n < nsamples; n++) {
+		bool upper = n % 2 == 0;
+		float t = angle(rng);
+		float x = upper ? std::cos(t) : 1.0f - std::cos(t);
+		float y = upper ? std::sin(t) : 0.5f - std::sin(t);
+		X.push_back(Mat<float>({{x + noise(rng)}, {y + noise(rng)}}));
+		Y.push_back(Mat<float>({{upper ? 1.0f : 0.0f}}));
+	}
+}
+
+static std::shared_ptr<Sequential<float>> make_model(std::shared_ptr<Optimizer> optimizer)
+{
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Dense<float>>(2, 16, std::make_shared<TanhFunc<float>>(),
+						       std::make_shared<RandNormalInitializer<float>>(0.0f, 0.5f)),
+			std::make_unique<Dense<float>>(16, 1, std::make_shared<SigmoidFunc<float>>(),
+						       std::make_shared<RandNormalInitializer<float>>(0.0f, 0.5f)),
+		});
+	model->set_optimizer(optimizer);
+	model->set_loss(std::make_shared<CrossEntropy<float>>());
+	model->set_fit_mode(FitMode::DataParallel, 1);
+	model->build();
+	return model;
+}
+
+static void run(const std::string &name, std::shared_ptr<Optimizer> optimizer, float target, std::size_t max_epochs,
+		std::shared_ptr<std::vector<Mat<float>>> X, std::shared_ptr<std::vector<Mat<float>>> Y)
+{
+	auto model = make_model(optimizer);
+
+	double seconds = 0.0;
+	float loss = model->test(X, Y).grand_sum() / static_cast<float>(X->size());
+	std::size_t epoch = 0;
+	while (loss > target && epoch < max_epochs) {
+		auto start = std::chrono::steady_clock::now();
+		model->fit(X, Y, 1, batch_size);
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		loss = model->test(X, Y).grand_sum() / static_cast<float>(X->size());
+		epoch++;
+	}
+
+	std::printf("%-10s %8zu %10.4f %10.4f%s\n", name.c_str(), epoch, seconds, loss,
+		    loss > target ? "  (not reached)" : "");
+}
+
+int main(int argc, char **argv)
+{
+	float target = argc > 1 ? std::strtof(argv[1], nullptr) : 0.1f;
+	std::size_t max_epochs = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 500;
+
+	auto X = std::make_shared<std::vector<Mat<float>>>();
+	auto Y = std::make_shared<std::vector<Mat<float>>>();
+	make_data(*X, *Y);
+
+	std::printf("samples=%zu batch=%zu target=%.4f\n", nsamples, batch_size, target);
+	std::printf("%-10s %8s %10s %10s\n", "optimizer", "epochs", "seconds", "loss");
+
+	run("sgd", std::make_shared<GradientDescentOptimizer<float>>(0.1f), target, max_epochs, X, Y);
+	run("momentum", std::make_shared<MomentumOptimizer<float>>(0.1f, 0.9f), target, max_epochs, X, Y);
+	run("nesterov", std::make_shared<MomentumOptimizer<float>>(0.1f, 0.9f, true), target, max_epochs, X, Y);
+	run("rmsprop", std::make_shared<RMSPropOptimizer<float>>(0.01f), target, max_epochs, X, Y);
+	run("adam", std::make_shared<AdamOptimizer<float>>(0.01f), target, max_epochs, X, Y);
+	run("adamw", std::make_shared<AdamWOptimizer<float>>(0.01f, 0.001f), target, max_epochs, X, Y);
+
+	return 0;
+}
@@ -95,6 +95,29 @@ namespace nn::activation_funcs {
 		ReluFunc &register_funcs(void) override;
 	};
 
+	// ======================
+	// Softmax
+	// ======================
+	// Normalizes every column (a sample) into probabilities. It isn't
+	// element-wise: `backward` is the Jacobian-vector product in O(n) per
+	// sample, `jacobian` still builds the dense (n, n) matrix, and
+	// `gradient` is only its diagonal p * (1 - p)
+	template <typename T>
+	class SoftmaxFunc : public ActivationFunc {
+	public:
+		using ActivationFunc::ActivationFunc;
+
+		SoftmaxFunc(void);
+		~SoftmaxFunc(void) override = default;
+
+		SoftmaxFunc &build(const Shape &input_shape, const Shape &output_shape) override;
+		SoftmaxFunc &build(std::size_t input_size, std::size_t output_size) override;
+		SoftmaxFunc &build(void) override;
+
+	private:
+		SoftmaxFunc &register_funcs(void) override;
+	};
+
 }
 
 #endif
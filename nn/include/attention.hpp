@@ -0,0 +1,97 @@
+#ifndef NN_ATTENTION_INCLUDED
+#define NN_ATTENTION_INCLUDED
+
+#include <memory>
+#include <vector>
+
+#include "layer.hpp"
+
+namespace nn::layers {
+	/**
+	 * @brief Multi-head self-attention over sequences of `seq_len` tokens
+	 * of `dim` features, a sample is a column of (seq_len * dim) with the
+	 * tokens one after the other (the output of `Embedding`) and the output
+	 * has the same shape. The tokens are projected to Q, K and V with one
+	 * product, every head of `dim / nheads` features attends on its own and
+	 * the heads go through the output projection W_o.
+	 *
+	 * The attention is the tiled kernel of libmat (`Mat_attention`): the
+	 * scores are made and consumed by tiles with an online softmax, the
+	 * memory grows with seq_len and not with its square. The forward keeps
+	 * the log-sum-exp of every query, the backward recomputes the tiles of
+	 * probabilities from it. Every thread keeps the trace of its last
+	 * forward, the backward of a batch runs after its forward in the same
+	 * thread.
+	 *
+	 * The parameters are W_qkv (3 * dim, dim), its bias, W_o (dim, dim) and
+	 * its bias.
+	 */
+	template <typename T>
+	class MultiHeadAttention : public WeightedLayer {
+	public:
+		// causal: a token only attends to itself and the tokens before it
+		MultiHeadAttention(std::size_t dim, std::size_t nheads, std::size_t seq_len, bool causal = false,
+				   std::shared_ptr<RandInitializer> rand_init = nullptr);
+		~MultiHeadAttention(void) override = default;
+
+		std::size_t get_dim(void) const;
+		std::size_t get_nheads(void) const;
+		std::size_t get_seq_len(void) const;
+		bool is_causal(void) const;
+		// get_qkv_weights: (3 * dim, dim), the rows of Q, then K, then V, a head after the other
+		Mat<T> &get_qkv_weights(void) const;
+		Mat<T> &get_qkv_bias(void) const;
+		Mat<T> &get_output_weights(void) const;
+		Mat<T> &get_output_bias(void) const;
+
+		MultiHeadAttention &build(const Shape &input_shape, const Shape &output_shape) override;
+		MultiHeadAttention &build(std::size_t input_size, std::size_t output_size) override;
+		MultiHeadAttention &build(void) override;
+	private:
+		// The buffers of a pass over a batch, one token per column (see `Mat_attention`), they only grow
+		struct Trace {
+			std::size_t ncols = 0;		// the capacity of the buffers
+			std::size_t size = 0;		// samples of the last forward
+			const T *input = nullptr;	// the data of its X
+			AlignedBuffer<T> inputs;	// (dim, b * seq_len)
+			AlignedBuffer<T> qkv;		// (3 * dim, b * seq_len)
+			AlignedBuffer<T> heads;		// (dim, b * seq_len), the attention before W_o
+			AlignedBuffer<T> lse;		// (b * nheads * seq_len)
+			AlignedBuffer<T> work;		// the scratch of the attention kernels
+			AlignedBuffer<T> outputs;	// (dim, b * seq_len), Y or dY
+			AlignedBuffer<T> dheads;
+			AlignedBuffer<T> dqkv;
+		};
+
+		MultiHeadAttention &register_funcs(void) override;
+		MultiHeadAttention &alloc_weights(void);
+		MultiHeadAttention &alloc_gradients(void);
+
+		Mat_attention geometry(std::size_t nbatch) const;
+		void reserve(Trace &trace, std::size_t ncols) const;
+		// forward_tokens: Y of X, what the backward needs stays in `trace`
+		void forward_tokens(const Mat<T> &X, Trace &trace, Mat<T> &Y) const;
+		// backward_tokens: from the `trace` of X, dX and `grads` (added to) are nullable
+		void backward_tokens(Trace &trace, const Mat<T> &dY, Mat<T> *dX, Mat<T> *grads) const;
+		// thread_trace: the trace of the forward of this batch, throws if this thread didn't run it
+		Trace &thread_trace(const Mat<T> &X);
+		// gradient_tokens: the forward of X then the gradients (added to `grads`) of dY, for `fit` and `accumulate`
+		void gradient_tokens(const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads);
+
+		std::size_t dim_;
+		std::size_t nheads_;
+		std::size_t seq_len_;
+		bool causal_;
+		// W_qkv, b_qkv, W_o, b_o
+		std::vector<std::unique_ptr<Mat<T>>> params_;
+		std::vector<std::unique_ptr<Mat<T>>> grads_;
+		std::size_t grad_count_ = 0;
+		bool weights_bound_ = false;
+		// The trace of `forward_into` for `backward_into`, a compiled plan runs in one thread
+		Trace trace_;
+		// The trace of `feedforward` for `backward`, the batches of other threads keep their own
+		utils::PerThread<Trace> traces_;
+	};
+}
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef NN_AUTODIFF_INCLUDED
+#define NN_AUTODIFF_INCLUDED
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include "mat.hpp"
+
+namespace nn::autodiff {
+	using namespace mathops;
+
+	// Var: handle of a node of a `Tape`, only valid for the tape that returned it
+	struct Var {
+		std::size_t id;
+	};
+
+	/**
+	 * @brief Reverse-mode automatic differentiation over `Mat` operations.
+	 *
+	 * Every operation is evaluated when it is recorded and appended to the
+	 * tape together with its vector-Jacobian product (VJP). `backward` walks
+	 * the tape from the end and the VJPs accumulate the gradients into the
+	 * inputs of every node, down to the parameters, whose gradients are
+	 * added (+=) into the matrices given to `parameter`.
+	 *
+	 * The lifetimes of the buffers are planned while recording: an operation
+	 * declares which values its VJP reads, so the tape knows the last node
+	 * of the backward that needs every value. The values nobody reads are
+	 * dropped when the backward starts, the others right after their last
+	 * reader, and the gradient of a node right after its own VJP. Nodes that
+	 * don't depend on any parameter nor input are never differentiated.
+	 *
+	 * @code
+	 * Tape<float> tape;
+	 * Var x = tape.constant(X);
+	 * Var w = tape.parameter(W, dW);
+	 * Var b = tape.parameter(B, dB);
+	 * Var z = tape.add_colvec(tape.dot(w, x), b);
+	 * tape.backward(tape.sigmoid_cross_entropy(z, Y));	// dW and dB += dL/dW and dL/dB
+	 * @endcode
+	 *
+	 * New operations are added with `custom`, a layer records its forward
+	 * with `Layer::record` and gets `Layer::backward` from the tape.
+	 */
+	template <typename T>
+	class Tape {
+	public:
+		// Vjp: gets the gradient of the output of the node and calls `accumulate` on its inputs
+		using Vjp = std::function<void(Tape &tape, const Mat<T> &grad)>;
+
+		Tape(void);
+
+		Tape(const Tape &) = delete;
+		Tape &operator=(const Tape &) = delete;
+
+		// Leaves
+		// constant: a copy of `value` without gradient
+		Var constant(const Mat<T> &value);
+		// input: a copy of `value` whose gradient is kept for `grad` after the backward
+		Var input(const Mat<T> &value);
+		// parameter: a view of `value`, the backward adds its gradient into `grad` (same shape)
+		Var parameter(Mat<T> &value, Mat<T> &grad);
+
+		// Operations, batches have one sample per column
+		Var dot(Var A, Var B);
+		Var add(Var A, Var B);
+		Var sub(Var A, Var B);
+		Var mul(Var A, Var B);			// element-wise
+		Var scale(Var A, T a);
+		Var add_colvec(Var A, Var v);		// A(i, j) + v(i, 0)
+		Var sigmoid(Var A);
+		Var tanh(Var A);
+		Var relu(Var A);
+		Var softmax(Var A);			// of every column
+		Var sum(Var A);				// (1, 1)
+		// Summed losses (1, 1) of the logits Z against the targets Y, the gradients come fused from libmat
+		Var sigmoid_cross_entropy(Var Z, const Mat<T> &Y);
+		Var softmax_cross_entropy(Var Z, const Mat<T> &Y);
+
+		/*
+		 * custom: record an operation whose output `value` was computed by the
+		 * caller. `reads` are the inputs whose values `vjp` uses (through
+		 * `value`), `reads_output` tells if it uses its own output
+		 */
+		Var custom(Mat<T> value, const std::vector<Var> &inputs, Vjp vjp,
+			   const std::vector<Var> &reads = {}, bool reads_output = false);
+
+		// backward: backpropagate `seed` (dL/d`out`), a (1, 1) output can omit it
+		Tape &backward(Var out);
+		Tape &backward(Var out, const Mat<T> &seed);
+		// accumulate: add `grad` to the gradient of `var`, to be used from the VJPs
+		Tape &accumulate(Var var, const Mat<T> &grad);
+		// clear: drop all the nodes, the tape can record again
+		Tape &clear(void);
+
+		// value: value of a node, throws std::logic_error if it was already released
+		const Mat<T> &value(Var var) const;
+		// grad: gradient of an input after the backward, throws std::logic_error for the other nodes
+		const Mat<T> &grad(Var var) const;
+		bool requires_grad(Var var) const;
+
+		std::size_t size(void) const;
+		// Buffers owned by the tape (values and gradients) alive now and at most since the last clear
+		std::size_t live_buffers(void) const;
+		std::size_t peak_buffers(void) const;
+
+	private:
+		enum class Kind { Constant, Input, Parameter, Operation };
+		static constexpr std::size_t never = std::numeric_limits<std::size_t>::max();
+
+		struct Node {
+			Node(Kind kind, Mat<T> value, bool requires_grad, Mat<T> *param_grad = nullptr);
+
+			Kind kind;
+			Shape shape;
+			std::vector<std::size_t> inputs;
+			Vjp vjp;
+			bool requires_grad;
+			// The backward can drop the value once the node `release` was processed
+			std::size_t release;
+
+			Mat<T> value;
+			Mat<T> grad;
+			bool has_value;
+			bool has_grad;
+			Mat<T> *param_grad;	// parameters only
+		};
+
+		Var push(Node node);
+		void read(std::size_t reader, std::size_t id);
+		void drop_value(Node &node);
+		void drop_grad(Node &node);
+		const Node &node_of(Var var) const;
+
+		// A deque never moves the nodes, the views of the parameters stay views
+		std::deque<Node> nodes_;
+		std::size_t live_;
+		std::size_t peak_;
+		bool done_;		// backpropagated, nothing can be recorded until `clear`
+	};
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef NN_CHECKPOINT_INCLUDED
+#define NN_CHECKPOINT_INCLUDED
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "serialize.hpp"
+
+namespace nn::io {
+	/**
+	 * @brief Periodic, asynchronous checkpoints of a `Sequential` model.
+	 *
+	 * At the end of every `interval` epochs the weights, biases and the
+	 * optimizer state are copied into a staging buffer that is allocated
+	 * once, and a background thread writes and fsyncs the file while the
+	 * training goes on. The training loop only waits if the previous
+	 * checkpoint is still being written.
+	 *
+	 * The files are named `<prefix>-<epoch>.nnm` inside of `directory`, only
+	 * the newest `keep_last` are kept (zero keeps all of them). They use the
+	 * regular model format, so `load_sequential` can open them too.
+	 *
+	 * @code
+	 * model->set_checkpointer(std::make_shared<Checkpointer<float>>("ckpt", 5, 3));
+	 * model->fit(X, Y, 100);	// resumes from the newest checkpoint in "ckpt"
+	 * @endcode
+	 */
+	template <typename T>
+	class Checkpointer {
+	public:
+		Checkpointer(const std::string &directory, std::size_t interval = 1, std::size_t keep_last = 3,
+			     const std::string &prefix = "checkpoint");
+		~Checkpointer(void);
+
+		Checkpointer(const Checkpointer &) = delete;
+		Checkpointer &operator=(const Checkpointer &) = delete;
+
+		// on_epoch_end: `epoch` epochs were completed, snapshot the model if it is a multiple of the interval
+		bool on_epoch_end(const Sequential<T> &model, std::uint64_t epoch);
+		// snapshot: copy the model into the staging buffer and queue the write
+		Checkpointer &snapshot(const Sequential<T> &model, std::uint64_t epoch);
+		// flush: wait for the queued write, the errors of the writer are rethrown here
+		Checkpointer &flush(void);
+
+		// resume: restore the newest checkpoint into a built model, returns its epoch (zero if there is none)
+		std::uint64_t resume(Sequential<T> &model);
+		// list: paths of the checkpoints in the directory, sorted from the oldest to the newest
+		std::vector<std::string> list(void) const;
+		std::string latest(void) const;
+		std::string path_of(std::uint64_t epoch) const;
+
+		Checkpointer &set_resume(bool resume);
+		bool get_resume(void) const;
+		const std::string &get_directory(void) const;
+		std::size_t get_interval(void) const;
+		std::size_t get_keep_last(void) const;
+
+	private:
+		void write_loop(void);
+		void prune(void) const;
+
+		std::string directory_;
+		std::string prefix_;
+		std::size_t interval_;
+		std::size_t keep_last_;
+		bool resume_;
+
+		ModelImage<T> image_;		// its tensors point into `staging_`
+		std::vector<T> staging_;
+
+		bool pending_;			// `image_` is owned by the writer until it is written
+		bool stopped_;
+		std::exception_ptr error_;
+		std::mutex mutex_;
+		std::condition_variable cv_;
+		std::thread writer_;
+	};
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef NN_CONV_INCLUDED
+#define NN_CONV_INCLUDED
+
+#include <memory>
+
+#include "layer.hpp"
+
+namespace nn::layers {
+	// How `Conv2D` computes the convolution
+	enum class ConvAlgorithm {
+		Auto,		// direct for 3x3 kernels of stride 1, im2col otherwise
+		Im2col,		// unfold the patches and multiply them with the libmat GEMM
+		Direct,		// shift the whole rows of the images without unfolding them, stride 1 only
+	};
+
+	/**
+	 * @brief A 2D convolution of `filters` square kernels over images of
+	 * (channels, height, width).
+	 *
+	 * Like every layer a sample is a column, the image flattened in CHW
+	 * order, and a batch (channels * height * width, b) holds one image per
+	 * column: every pixel keeps the whole batch contiguous. The output is
+	 * (filters * out_height * out_width, b) with the same layout, ready for
+	 * another convolution or a `Dense` layer.
+	 *
+	 * The weights are (filters, channels * kernel * kernel) and the bias
+	 * (filters, 1). With im2col the product W . cols is already the output
+	 * and the backward is two more GEMMs and a col2im. The direct path
+	 * never builds the unfolded patches, kernel * kernel times the input,
+	 * which keeps the memory traffic of the 3x3 kernels low.
+	 */
+	template <typename T>
+	class Conv2D : public WeightedLayer {
+	public:
+		using WeightedLayer::WeightedLayer;
+
+		Conv2D(std::size_t channels, std::size_t height, std::size_t width, std::size_t filters,
+		       std::size_t kernel_size, std::size_t stride = 1, std::size_t padding = 0, std::size_t dilation = 1,
+		       std::shared_ptr<Layer> activation_func = nullptr, std::shared_ptr<RandInitializer> rand_init = nullptr);
+
+		~Conv2D(void) override = default;
+
+		Mat<T> &get_weights(void) const;
+		Mat<T> &get_bias(void) const;
+
+		std::size_t get_channels(void) const;
+		std::size_t get_height(void) const;
+		std::size_t get_width(void) const;
+		std::size_t get_filters(void) const;
+		std::size_t get_kernel_size(void) const;
+		std::size_t get_stride(void) const;
+		std::size_t get_padding(void) const;
+		std::size_t get_dilation(void) const;
+		std::size_t get_out_height(void) const;
+		std::size_t get_out_width(void) const;
+
+		// set_algorithm: `Direct` throws std::invalid_argument with a stride other than 1
+		Conv2D &set_algorithm(ConvAlgorithm algorithm);
+		ConvAlgorithm get_algorithm(void) const;
+
+		Conv2D &build(const Shape &input_shape, const Shape &output_shape) override;
+		Conv2D &build(std::size_t input_size, std::size_t output_size) override;
+		Conv2D &build(void) override;
+	private:
+		Conv2D &register_funcs(void) override;
+		Conv2D &alloc_weights(void);
+		Conv2D &alloc_gradients(void);
+
+		Mat_conv2d geometry(std::size_t nbatch) const;
+		bool direct(void) const;
+		// Elements of scratch of the im2col path for a batch, the patches and their gradient
+		std::size_t workspace_size(std::size_t nbatch) const;
+		// convolve: Z = W * X + B, `workspace` has room for the patches
+		void convolve(const Mat<T> &X, Mat<T> &Z, T *workspace) const;
+		// convolve_backward: the gradients of the logits into `grads` and, if not null, dX
+		void convolve_backward(const Mat<T> &X, const Mat<T> &dZ, Mat<T> *dX, Mat<T> *grads, T *workspace) const;
+
+		std::size_t channels_;
+		std::size_t height_;
+		std::size_t width_;
+		std::size_t filters_;
+		std::size_t kernel_size_;
+		std::size_t stride_;
+		std::size_t padding_;
+		std::size_t dilation_;
+		std::size_t out_height_;
+		std::size_t out_width_;
+		ConvAlgorithm algorithm_ = ConvAlgorithm::Auto;
+
+		std::unique_ptr<Mat<T>> weights_;
+		std::unique_ptr<Mat<T>> bias_;
+		std::unique_ptr<Mat<T>> grad_weights_;
+		std::unique_ptr<Mat<T>> grad_bias_;
+		std::size_t grad_count_ = 0;
+		bool weights_bound_ = false;
+		// Scratch of `forward_into` and `backward_into`, a compiled plan runs in one thread
+		AlignedBuffer<T> workspace_;
+	};
+}
+
+#endif
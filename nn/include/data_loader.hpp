@@ -0,0 +1,122 @@
+#ifndef NN_DATA_LOADER_INCLUDED
+#define NN_DATA_LOADER_INCLUDED
+
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "mat.hpp"
+#include "parallel.hpp"
+
+namespace nn::data {
+	using namespace mathops;
+
+	/**
+	 * @brief A minibatch assembled by the `DataLoader`.
+	 *
+	 * Every sample is flattened into one column, so `X` has shape
+	 * (input_rows * input_cols, size) and `Y` has shape
+	 * (output_rows * output_cols, size). The memory behind `X` and `Y` is
+	 * allocated once by the loader and reused for the whole training run.
+	 */
+	template <typename T>
+	class Batch {
+	public:
+		Batch(const Shape &input_shape, const Shape &output_shape, std::size_t capacity);
+
+		// get_sample: copy the `j` column of the batch into `x` and `y` (no allocations)
+		void get_sample(std::size_t j, Mat<T> &x, Mat<T> &y) const;
+
+		Mat<T> X;
+		Mat<T> Y;
+		std::size_t size;	// valid columns of this batch (the last one could be smaller)
+		std::size_t epoch;
+		std::size_t index;	// index of the batch inside of its epoch
+	};
+
+	// pack_columns: copy the samples [first, first + count) of `src` as the columns of `dst`, of `count` columns
+	template <typename T>
+	void pack_columns(const std::vector<Mat<T>> &src, std::size_t first, std::size_t count, Mat<T> &dst);
+
+	/**
+	 * @brief Background prefetching loader of shuffled minibatches.
+	 *
+	 * The indices of the data set are permuted every epoch and the
+	 * minibatches are assembled into a ring of `nbuffers` preallocated
+	 * `Batch` slots (two slots is double buffering) by tasks of the global
+	 * `ThreadPool`. A slot is scheduled again as soon as the consumer gives
+	 * it back, the training loop only consumes ready batches through
+	 * `next()`:
+	 *
+	 * @code
+	 * DataLoader<float> loader(X_ptr, Y_ptr, 32);
+	 * loader.start(nepochs);
+	 * while (const Batch<float> *batch = loader.next()) {
+	 *     ...
+	 * }
+	 * @endcode
+	 *
+	 * The slot returned by `next()` stays owned by the consumer until the
+	 * following call to `next()`. The order is a function of the seed, two
+	 * loaders with the same seed hand out the same batches.
+	 */
+	template <typename T>
+	class DataLoader {
+	public:
+		static constexpr unsigned int default_seed = std::mt19937::default_seed;
+
+		DataLoader(std::shared_ptr<std::vector<Mat<T>>> X, std::shared_ptr<std::vector<Mat<T>>> Y,
+			   std::size_t batch_size = 1, bool shuffle = true, std::size_t nbuffers = 2,
+			   unsigned int seed = default_seed);
+		~DataLoader(void);
+
+		DataLoader(const DataLoader &) = delete;
+		DataLoader &operator=(const DataLoader &) = delete;
+
+		// start: schedule the first batches of `nepochs` epochs
+		DataLoader &start(std::size_t nepochs);
+		/*
+		 * next: wait for the next batch (running pool tasks meanwhile), returns
+		 * nullptr once all the epochs were consumed
+		 */
+		const Batch<T> *next(void);
+		// stop: cancel the pending batches and wait for the running ones, it is safe to call it more than once
+		DataLoader &stop(void);
+
+		std::size_t get_batch_size(void) const;
+		std::size_t get_nbatches(void) const;
+		std::size_t get_nbuffers(void) const;
+		// get_indices: a copy of the permutation, the producer shuffles it in place
+		std::vector<std::size_t> get_indices(void) const;
+
+	private:
+		// schedule: start the assembly of the batches that fit in the free slots, the lock must be held
+		void schedule(void);
+		void assemble(Batch<T> &batch, const std::vector<std::size_t> &indices);
+
+		std::shared_ptr<std::vector<Mat<T>>> X_;
+		std::shared_ptr<std::vector<Mat<T>>> Y_;
+		std::size_t batch_size_;
+		bool shuffle_;
+		std::mt19937 rng_;
+
+		std::vector<std::size_t> indices_;	// the permutation, we never move the samples
+		std::vector<std::unique_ptr<Batch<T>>> slots_;
+		std::vector<std::vector<std::size_t>> slot_indices_;	// samples of the batch of every slot
+		std::vector<bool> ready_;
+		std::size_t produced_;	// sequence number of the next batch to be scheduled
+		std::size_t consumed_;	// sequence number of the next batch to be consumed
+		std::size_t total_;	// batches of all the epochs
+		bool holding_;		// the consumer still holds the previous slot
+		bool stopped_;
+		std::exception_ptr error_;
+
+		mutable std::mutex mutex_;
+		parallel::TaskGroup tasks_;
+	};
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef NN_DROPOUT_INCLUDED
+#define NN_DROPOUT_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "layer.hpp"
+
+namespace nn::layers {
+	/**
+	 * @brief Inverted dropout: while training (`set_training`) every
+	 * element is zeroed with probability `rate` and the rest are scaled
+	 * by 1 / (1 - rate), outside training the layer is the identity and
+	 * a `Sequential` skips it.
+	 *
+	 * The mask is a packed bitmask, one bit per element, drawn by a
+	 * counter-based generator in the same pass that applies it. Every
+	 * forward takes its own range of counters, so the data parallel
+	 * workers draw different masks without sharing any state but one
+	 * atomic. A thread keeps the mask of its last forward for its
+	 * backward, the forward and the backward of a batch go in the same
+	 * thread and nothing runs the dropout again in between (a layer that
+	 * wraps it keeps the trace of its forward, see `Residual`).
+	 */
+	template <typename T>
+	class Dropout : public Layer {
+	public:
+		using Layer::Layer;
+
+		// A seed of 0 takes one from std::random_device
+		Dropout(std::size_t size, T rate, std::uint64_t seed = 0);
+		~Dropout(void) override = default;
+
+		T get_rate(void) const;
+		std::uint64_t get_seed(void) const;
+
+		Dropout &build(const Shape &input_shape, const Shape &output_shape) override;
+		Dropout &build(std::size_t input_size, std::size_t output_size) override;
+		Dropout &build(void) override;
+		bool is_identity(void) const override;
+	private:
+		// The mask of a thread, the number of elements it covers and the input it was drawn for
+		struct Mask {
+			std::vector<std::uint64_t> bits;
+			std::size_t size = 0;
+			const T *input = nullptr;
+		};
+
+		Dropout &register_funcs(void) override;
+		// forward_mask: Y = the dropout of X with a new mask, kept for the backward of this thread
+		void forward_mask(const Mat<T> &X, Mat<T> &Y);
+		// thread_mask: the mask of the forward of this batch, throws if this thread didn't run it
+		const Mask &thread_mask(const Mat<T> &X);
+
+		T rate_;
+		std::uint64_t seed_;
+		std::atomic<std::uint64_t> counter_{0};
+		utils::PerThread<Mask> masks_;
+	};
+}
+
+#endif
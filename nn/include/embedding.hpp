@@ -0,0 +1,87 @@
+#ifndef NN_EMBEDDING_INCLUDED
+#define NN_EMBEDDING_INCLUDED
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "layer.hpp"
+
+namespace nn::layers {
+	/**
+	 * @brief A lookup table of `dim` values per ID of a vocabulary. The
+	 * input (seq_len, b) holds categorical IDs (exact in a float up to
+	 * 2^24), the output (seq_len * dim, b) their rows of the table one
+	 * after the other.
+	 *
+	 * The gradient of the table is sparse: the backward adds the rows of
+	 * the IDs it saw to an accumulator of the layer, and `step` applies
+	 * them with `Optimizer::apply_rows`, so a step costs the rows used and
+	 * not the vocabulary. The table isn't among `parameters` for that: a
+	 * `Sequential` steps the layer together with its dense parameters
+	 * (`has_sparse_gradients`) and finds it in `sparse_parameters` for the
+	 * model files, the checkpoints and the optimizer state. Every worker
+	 * of a `WorkerGroup` adds to an accumulator of its own, `step` sums
+	 * them in worker order: the data parallel training steps the same
+	 * rows with the same values whatever the timing of its workers (a
+	 * Hogwild worker steps its own one). The IDs have no gradient, dL/dX
+	 * is zero.
+	 */
+	template <typename T>
+	class Embedding : public WeightedLayer {
+	public:
+		using WeightedLayer::WeightedLayer;
+
+		Embedding(std::size_t vocab_size, std::size_t dim, std::size_t seq_len = 1,
+			  std::shared_ptr<RandInitializer> rand_init = nullptr);
+		~Embedding(void) override = default;
+
+		// get_table: (vocab_size, dim), the row of an ID is contiguous
+		Mat<T> &get_table(void) const;
+		std::size_t get_vocab_size(void) const;
+		std::size_t get_dim(void) const;
+		// touched_rows: the rows with an accumulated gradient, the ones of the worker zero first, in the order they were first seen
+		std::vector<std::size_t> touched_rows(void);
+
+		Embedding &build(const Shape &input_shape, const Shape &output_shape) override;
+		Embedding &build(std::size_t input_size, std::size_t output_size) override;
+		Embedding &build(void) override;
+		bool has_sparse_gradients(void) const override;
+	private:
+		// The sparse gradient of a worker: the row k of `values` goes to the row `rows[k]` of the table
+		struct SparseGradient {
+			std::vector<std::size_t> rows;
+			std::unordered_map<std::size_t, std::size_t> slots;
+			std::vector<T> values;
+			std::size_t count = 0;		// samples
+			std::mutex mutex;		// only contended out of a worker group
+
+			// row: the values of the row `id` of the table, zeros the first time
+			T *row(std::size_t id, std::size_t dim);
+			void clear(void);
+		};
+
+		Embedding &register_funcs(void) override;
+
+		// id: the row of the table of X(t, j), checked against the vocabulary
+		std::size_t id(const Mat<T> &X, std::size_t t, std::size_t j) const;
+		// gather: Y = the rows of the IDs of X
+		void gather(const Mat<T> &X, Mat<T> &Y) const;
+		// scatter: the rows of dY added to the accumulator of the worker at the IDs of X
+		void scatter(const Mat<T> &X, const Mat<T> &dY);
+		// accumulator: the one of the worker `w`, the one of the worker zero out of a worker group
+		SparseGradient &accumulator(std::size_t w);
+		// step_rows: the mean gradient of `grad` applied to its rows, then it is cleared
+		void step_rows(SparseGradient &grad);
+
+		std::size_t vocab_size_;
+		std::size_t dim_;
+		std::unique_ptr<Mat<T>> table_;
+		// One per worker, they only grow (a worker keeps the memory of its rows for the next step)
+		std::vector<std::unique_ptr<SparseGradient>> grads_;
+		std::mutex grads_mutex_;
+	};
+}
+
+#endif
@@ -1,9 +1,12 @@
 #ifndef NN_LAYER_INCLUDED
 #define NN_LAYER_INCLUDED
 
+#include <functional>
 #include <memory>
+#include <vector>
 
 #include "mat.hpp"
+#include "autodiff.hpp"
 #include "optimizer.hpp"
 #include "model.hpp"
 #include "rand.hpp"
@@ -36,6 +39,19 @@ namespace nn::layers {
 		const std::size_t &get_output_size(void) const;
 		const std::string &get_name(void) const;
 
+		// set_training: Layers with batch statistics or dropout behave as in
+		// training while it is set, `Sequential::fit` sets it. Off by default
+		virtual Layer &set_training(bool training);
+		bool is_training(void) const;
+		// is_identity: the layer passes its input as it is in its current
+		// mode, a `Sequential` skips it without copying the activations.
+		// Such a layer must be element-wise, a plan can run it in place
+		virtual bool is_identity(void) const;
+		// has_sparse_gradients: the layer keeps gradients out of `parameters`
+		// (only the rows used of a table), it is a `WeightedLayer` and its
+		// `step` applies them
+		virtual bool has_sparse_gradients(void) const;
+
 		// NOTE: Needs to override these functions
 		template <typename T>
 		Mat<T> operator()(const Mat<T> &X)
@@ -57,6 +73,173 @@ namespace nn::layers {
 			return get_func<Mat<T>, const Mat<T> &>("gradient", __FILE__, __LINE__)(X);
 		}
 		
+		/*
+		 * backward: Backpropagate through the layer, X (n, batch) is the input of
+		 * the layer and dY (m, batch) the gradient of the loss with respect to its
+		 * output. The gradients of the parameters are accumulated (+=) in `grads`,
+		 * one per matrix of `parameters`, and dL/dX (n, batch) is returned.
+		 * A layer without its own backward that can `record` is differentiated
+		 * by a tape.
+		 */
+		template <typename T>
+		Mat<T> backward(const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads)
+		{
+			if (!has_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>("backward") && can_record<T>()) {
+				autodiff::Tape<T> tape;
+				autodiff::Var x = tape.input(X);
+				tape.backward(record<T>(tape, x, grads), dY);
+				return tape.grad(x);
+			}
+			return get_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+				("backward", __FILE__, __LINE__)(X, dY, grads);
+		}
+
+		template <typename T>
+		bool can_record(void) const
+		{
+			return has_func<autodiff::Var, autodiff::Tape<T> &, autodiff::Var, Mat<T> *>("record");
+		}
+
+		/*
+		 * record: Record the forward of the layer on `tape`, X is the node of
+		 * its input. The parameters are recorded with the gradients of `grads`,
+		 * one per matrix of `parameters`. Returns the node of the output.
+		 */
+		template <typename T>
+		autodiff::Var record(autodiff::Tape<T> &tape, autodiff::Var X, Mat<T> *grads)
+		{
+			return get_func<autodiff::Var, autodiff::Tape<T> &, autodiff::Var, Mat<T> *>
+				("record", __FILE__, __LINE__)(tape, X, grads);
+		}
+
+		/*
+		 * logits: The output of the layer before its activation. Together with
+		 * `backward_logits` (dZ is the gradient with respect to the logits) it
+		 * lets a loss fused with the activation skip it in the backward.
+		 */
+		template <typename T>
+		bool has_logits(void) const
+		{
+			return has_func<Mat<T>, const Mat<T> &>("logits");
+		}
+
+		template <typename T>
+		Mat<T> logits(const Mat<T> &X)
+		{
+			return get_func<Mat<T>, const Mat<T> &>("logits", __FILE__, __LINE__)(X);
+		}
+
+		template <typename T>
+		Mat<T> backward_logits(const Mat<T> &X, const Mat<T> &dZ, Mat<T> *grads)
+		{
+			return get_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+				("backward_logits", __FILE__, __LINE__)(X, dZ, grads);
+		}
+
+		/*
+		 * forward_into: The feedforward written into Y, already allocated with
+		 * the output shape of the batch. The element-wise layers accept Y
+		 * aliased to X. With `backward_into` it lets a compiled `Sequential`
+		 * run over its own buffers without allocating.
+		 */
+		template <typename T>
+		using ForwardInto = std::function<void(const Mat<T> &, Mat<T> &)>;
+		/*
+		 * backward_into: `backward` with dL/dX written into dX. X and Y are the
+		 * input and the output of the forward, the layer can use dY as scratch
+		 * and the element-wise layers accept dX aliased to dY.
+		 */
+		template <typename T>
+		using BackwardInto = std::function<void(const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *)>;
+
+		template <typename T>
+		bool can_run_into(void) const
+		{
+			return has_func<void, const Mat<T> &, Mat<T> &>("forward_into")
+				&& has_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>("backward_into");
+		}
+
+		template <typename T>
+		void forward_into(const Mat<T> &X, Mat<T> &Y)
+		{
+			get_forward_into<T>()(X, Y);
+		}
+
+		template <typename T>
+		void backward_into(const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads)
+		{
+			get_backward_into<T>()(X, Y, dY, dX, grads);
+		}
+
+		// The functions themselves, looking them up allocates and the hot loops keep them
+		template <typename T>
+		ForwardInto<T> get_forward_into(void) const
+		{
+			return get_func<void, const Mat<T> &, Mat<T> &>("forward_into", __FILE__, __LINE__);
+		}
+
+		template <typename T>
+		BackwardInto<T> get_backward_into(void) const
+		{
+			return get_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+				("backward_into", __FILE__, __LINE__);
+		}
+
+		/* parameters: The trainable matrices of the layer, empty if it has none. */
+		template <typename T>
+		std::vector<Mat<T> *> parameters(void)
+		{
+			if (!has_func<std::vector<Mat<T> *>>("parameters"))
+				return {};
+			return get_func<std::vector<Mat<T> *>>("parameters", __FILE__, __LINE__)();
+		}
+
+		/*
+		 * sparse_parameters: The trainable matrices that the layer steps by
+		 * itself (`has_sparse_gradients`), out of `parameters`. They are
+		 * still part of the model: saved, checkpointed and with optimizer state.
+		 */
+		template <typename T>
+		std::vector<Mat<T> *> sparse_parameters(void)
+		{
+			if (!has_func<std::vector<Mat<T> *>>("sparse_parameters"))
+				return {};
+			return get_func<std::vector<Mat<T> *>>("sparse_parameters", __FILE__, __LINE__)();
+		}
+
+		/*
+		 * gradients: The gradient accumulators of the layer, one per matrix of
+		 * `parameters` and with its shape, empty if it has none.
+		 */
+		template <typename T>
+		std::vector<Mat<T> *> gradients(void)
+		{
+			if (!has_func<std::vector<Mat<T> *>>("gradients"))
+				return {};
+			return get_func<std::vector<Mat<T> *>>("gradients", __FILE__, __LINE__)();
+		}
+
+		template <typename T>
+		bool can_bind_parameters(void) const
+		{
+			return has_func<void, const std::vector<T *> &>("bind_parameters");
+		}
+
+		/*
+		 * bind_parameters: Move the parameters to external memory, one pointer per
+		 * matrix of `parameters` with room for it. The caller already copied the
+		 * values there, the layer only starts to use it. Returns false if the
+		 * layer can't live in external memory.
+		 */
+		template <typename T>
+		bool bind_parameters(const std::vector<T *> &memory)
+		{
+			if (!can_bind_parameters<T>())
+				return false;
+			get_func<void, const std::vector<T *> &>("bind_parameters", __FILE__, __LINE__)(memory);
+			return true;
+		}
+		
 		virtual Layer &build(const Shape &input_shape, const Shape &output_shape) = 0;
 		virtual Layer &build(std::size_t input_size, std::size_t output_size) = 0;
 		virtual Layer &build(void) = 0;
@@ -66,6 +249,7 @@ namespace nn::layers {
 		Shape output_shape_;
 		bool trainable_;
 		bool built_;
+		bool training_ = false;
 		std::string name_;
 	};
 	
@@ -94,6 +278,33 @@ namespace nn::layers {
 			get_func<void, const Mat<T> &, const Mat<T> &>("fit", __FILE__, __LINE__)(signal_update, input);
 			return *this;
 		}
+
+		/*
+		 * accumulate: Like `fit`, but the gradient is added to the accumulators
+		 * of the layer (`gradients`) and the weights are left alone. The input
+		 * can be a batch (n, b), every column counts as a sample.
+		 */
+		template <typename T>
+		WeightedLayer &accumulate(const Mat<T> &signal_update, const Mat<T> &input)
+		{
+			get_func<void, const Mat<T> &, const Mat<T> &>("accumulate", __FILE__, __LINE__)(signal_update, input);
+			return *this;
+		}
+
+		// step: One optimizer update with the mean of the accumulated gradients,
+		// then they are zeroed. Does nothing if nothing was accumulated
+		WeightedLayer &step(void)
+		{
+			get_func<void>("step", __FILE__, __LINE__)();
+			return *this;
+		}
+
+		// zero_grad: Drop the accumulated gradients without updating the weights
+		WeightedLayer &zero_grad(void)
+		{
+			get_func<void>("zero_grad", __FILE__, __LINE__)();
+			return *this;
+		}
 		
 	protected:
 		
@@ -124,15 +335,29 @@ namespace nn::layers {
 		
 		Mat<T> &get_weights(void) const;
 		Mat<T> &get_bias(void) const;		
+
+		// bind_weights: Use external memory for the weights (output_size, input_size)
+		// and the bias (output_size, 1) instead of allocating it on build, the
+		// `storage` owner (an mmaped file for example) is kept alive by the layer
+		Dense &bind_weights(T *weights, T *bias, std::shared_ptr<void> storage = nullptr);
+		bool has_bound_weights(void) const;
 		
 		Dense &build(const Shape &input_shape, const Shape &output_shape) override;
 		Dense &build(std::size_t input_size, std::size_t output_size) override;
 		Dense &build(void) override;
 	private:
 		Dense &register_funcs(void) override;
+		Dense &alloc_weights(void);
+		// alloc_gradients: the accumulators are only allocated when they are first used
+		Dense &alloc_gradients(void);
 		
+		std::shared_ptr<void> storage_;
+		bool weights_bound_ = false;
 		std::unique_ptr<Mat<T>> weights_;
 		std::unique_ptr<Mat<T>> bias_;
+		std::unique_ptr<Mat<T>> grad_weights_;
+		std::unique_ptr<Mat<T>> grad_bias_;
+		std::size_t grad_count_ = 0;		// samples accumulated since the last step
 	};
 }
 
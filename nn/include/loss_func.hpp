@@ -1,6 +1,7 @@
 #ifndef NN_LOSS_FUNC_INCLUDED
 #define NN_LOSS_FUNC_INCLUDED
 
+#include <cstddef>
 #include <vector>
 #include <memory>
 #include <string>
@@ -27,12 +28,18 @@ namespace nn::loss_funcs {
 		Loss &set_model(std::shared_ptr<Model> model);
 		Loss &set_inputs(std::shared_ptr<std::vector<Mat<T>>> inputs);
 		Loss &set_outputs(std::shared_ptr<std::vector<Mat<T>>> outputs);
+		// set_keep_predictions: keep a copy of every prediction of `operator()()` (on by default)
+		Loss &set_keep_predictions(bool keep);
+		// set_batch_size: samples of every forward of `operator()()`, throws std::invalid_argument if zero
+		Loss &set_batch_size(std::size_t batch_size);
 
 		// Getters
 		std::shared_ptr<std::vector<Mat<T>>> get_inputs(void) const;
 		std::shared_ptr<std::vector<Mat<T>>> get_outputs(void) const;
 		const std::vector<Mat<T>> &get_predictions(void) const;
 		const std::string &get_name(void) const;
+		bool get_keep_predictions(void) const;
+		std::size_t get_batch_size(void) const;
 
 		// Input/Output shapes and sizes
 		const Shape &get_input_shape(void) const;  
@@ -56,7 +63,37 @@ namespace nn::loss_funcs {
 		// To run the gradient to  all the setted batch
 		Mat<T> gradient(void);
 
+		// dL/dY of already computed predictions, element-wise so it also
+		// works for batches (one sample per column)
+		virtual Mat<T> gradient(const Mat<T> &y_pred, const Mat<T> &y_true) const = 0;
+
+		/*
+		 * fused_activation: Name of the output activation that the loss can
+		 * be fused with, empty if none. When the last layer of a `Sequential`
+		 * ends with it, the backward starts from the logits of that layer
+		 * with `gradient_logits` and the activation is skipped
+		 */
+		virtual std::string fused_activation(void) const;
+		// gradient_logits: dL/dZ of the logits Z (one sample per column), the summed loss goes to `loss` if not null
+		virtual Mat<T> gradient_logits(const Mat<T> &Z, const Mat<T> &y_true, T *loss = nullptr) const;
+
+		/*
+		 * accumulate_loss: sums(i) += sum_j loss(y_pred(i, j), y_true(i, j)) of
+		 * a batch (one sample per column). It doesn't touch the state of the
+		 * loss, many threads can use it at the same time
+		 */
+		virtual void accumulate_loss(const Mat<T> &y_pred, const Mat<T> &y_true, Mat<T> &sums) const;
+
 	protected:
+		/*
+		 * evaluate: sum of the loss of all the inputs into `last_loss_`.
+		 * Column samples are packed into contiguous (n, batch_size) and
+		 * (m, batch_size) buffers reused by every batch, the model runs once
+		 * per batch and `accumulate_loss` reduces its rows. Without keeping
+		 * the predictions the memory doesn't grow with the number of samples
+		 */
+		const Mat<T> &evaluate(void);
+
 		std::shared_ptr<std::vector<Mat<T>>> inputs_;
 		std::shared_ptr<std::vector<Mat<T>>> outputs_;
 		std::vector<Mat<T>> predictions_;
@@ -66,6 +103,9 @@ namespace nn::loss_funcs {
 		Shape input_shape_;
 		Shape output_shape_;
 		Mat<T> last_loss_;
+
+		bool keep_predictions_;
+		std::size_t batch_size_;
 	};
 
 	template <typename T>
@@ -83,7 +123,9 @@ namespace nn::loss_funcs {
 		Mat<T> operator()(const std::pair<Mat<T>, Mat<T>> &example) override;
 
 		Mat<T> gradient(const std::pair<Mat<T>, Mat<T>> &example) override;
+		Mat<T> gradient(const Mat<T> &y_pred, const Mat<T> &y_true) const override;
 		Mat<T> jacobian(const std::pair<Mat<T>, Mat<T>> &example) override;
+		void accumulate_loss(const Mat<T> &y_pred, const Mat<T> &y_true, Mat<T> &sums) const override;
 	};
 
 
@@ -101,7 +143,61 @@ namespace nn::loss_funcs {
 		Mat<T> operator()(const std::pair<Mat<T>, Mat<T>> &example) override;
 
 		Mat<T> gradient(const std::pair<Mat<T>, Mat<T>> &example) override;
+		Mat<T> gradient(const Mat<T> &y_pred, const Mat<T> &y_true) const override;
+		Mat<T> jacobian(const std::pair<Mat<T>, Mat<T>> &example) override;
+		void accumulate_loss(const Mat<T> &y_pred, const Mat<T> &y_true, Mat<T> &sums) const override;
+	};
+
+
+	/**
+	 * @brief Binary cross-entropy fused with the sigmoid of the output layer.
+	 *
+	 * Evaluated on the outputs of the model it is the `CrossEntropy`, but in
+	 * the training of a `Sequential` whose last layer uses `SigmoidFunc` the
+	 * loss and dL/dZ = sigmoid(Z) - Y come from the logits in a single
+	 * stable pass, without dividing by a(1 - a) to multiply by it again.
+	 */
+	template <typename T>
+	class SigmoidCrossEntropy : public CrossEntropy<T> {
+	public:
+		SigmoidCrossEntropy(std::shared_ptr<std::vector<Mat<T>>> inputs = nullptr,
+				    std::shared_ptr<std::vector<Mat<T>>> outputs = nullptr);
+		~SigmoidCrossEntropy(void) override = default;
+
+		std::string fused_activation(void) const override;
+		Mat<T> gradient_logits(const Mat<T> &Z, const Mat<T> &y_true, T *loss = nullptr) const override;
+	};
+
+
+	/**
+	 * @brief Categorical cross-entropy fused with a softmax output.
+	 *
+	 * The targets are one column of class probabilities per sample (usually
+	 * one-hot). On the outputs of the model it is -sum(y * log(p)), in the
+	 * training of a `Sequential` whose last layer uses `SoftmaxFunc` the
+	 * log-softmax and dL/dZ = p - y come from the logits in one pass, the
+	 * (n, n) Jacobian of the softmax is never built.
+	 */
+	template <typename T>
+	class SoftmaxCrossEntropy : public Loss<T> {
+	public:
+		using Loss<T>::Loss;
+
+		SoftmaxCrossEntropy(std::shared_ptr<std::vector<Mat<T>>> inputs = nullptr,
+				    std::shared_ptr<std::vector<Mat<T>>> outputs = nullptr);
+		~SoftmaxCrossEntropy(void) override = default;
+
+		Mat<T> operator()(void) override;
+		Mat<T> operator()(const std::vector<std::pair<Mat<T>, Mat<T>>> &batch) override;
+		Mat<T> operator()(const std::pair<Mat<T>, Mat<T>> &example) override;
+
+		Mat<T> gradient(const std::pair<Mat<T>, Mat<T>> &example) override;
+		Mat<T> gradient(const Mat<T> &y_pred, const Mat<T> &y_true) const override;
 		Mat<T> jacobian(const std::pair<Mat<T>, Mat<T>> &example) override;
+
+		std::string fused_activation(void) const override;
+		Mat<T> gradient_logits(const Mat<T> &Z, const Mat<T> &y_true, T *loss = nullptr) const override;
+		void accumulate_loss(const Mat<T> &y_pred, const Mat<T> &y_true, Mat<T> &sums) const override;
 	};
 
 
@@ -119,7 +215,9 @@ namespace nn::loss_funcs {
 		Mat<T> operator()(const std::pair<Mat<T>, Mat<T>> &example) override;
 
 		Mat<T> gradient(const std::pair<Mat<T>, Mat<T>> &example) override;
+		Mat<T> gradient(const Mat<T> &y_pred, const Mat<T> &y_true) const override;
 		Mat<T> jacobian(const std::pair<Mat<T>, Mat<T>> &example) override;
+		void accumulate_loss(const Mat<T> &y_pred, const Mat<T> &y_true, Mat<T> &sums) const override;
 	};
 	
 }
@@ -2,6 +2,7 @@
 #define NN_MAT_INCLUDED
 
 #include <cstddef>
+#include <cstdint>
 #include <initializer_list>
 #include <ostream>
 #include <unordered_map>
@@ -96,6 +97,201 @@ namespace nn::mathops {
 			Matf32_transpose(A, B, shape.rows, shape.cols);
 		}
 
+		inline static void Mat_axpy(const float *A, float *B, const Shape &shape, float a) {
+			Matf32_axpy(A, B, shape.rows, shape.cols, a);
+		}
+
+		inline static void Mat_add_colvec(float *A, const float *v, const Shape &shape) {
+			Matf32_add_colvec(A, v, shape.rows, shape.cols);
+		}
+
+		inline static void Mat_add_row_sum(const float *A, float *v, const Shape &shape) {
+			Matf32_add_row_sum(A, v, shape.rows, shape.cols);
+		}
+
+		inline static void Mat_dot_nt_acc(const float *A, const float *B, float *C,
+						  const Shape &shapeA, size_t nrowsB) {
+			Matf32_dot_nt_acc(A, B, C, shapeA.rows, shapeA.cols, nrowsB);
+		}
+
+		inline static void Mat_dot_tn(const float *A, const float *B, float *C,
+					      const Shape &shapeA, size_t ncolsB) {
+			Matf32_dot_tn(A, B, C, shapeA.rows, shapeA.cols, ncolsB);
+		}
+
+		// --- Fused optimizer steps, `n` elements of the parameter P ---
+		inline static void Mat_momentum_step(float *P, const float *G, float *V, size_t n,
+						     float lr, float mu, bool nesterov) {
+			Matf32_momentum_step(P, G, V, n, lr, mu, nesterov);
+		}
+
+		inline static void Mat_rmsprop_step(float *P, const float *G, float *S, size_t n,
+						    float lr, float rho, float eps) {
+			Matf32_rmsprop_step(P, G, S, n, lr, rho, eps);
+		}
+
+		inline static void Mat_adam_step(float *P, const float *G, float *M, float *V, size_t n,
+						 float lr, float beta1, float beta2, float eps, float wd,
+						 float c1, float c2) {
+			Matf32_adam_step(P, G, M, V, n, lr, beta1, beta2, eps, wd, c1, c2);
+		}
+
+		// --- Fused losses, `n` elements ---
+		inline static float Mat_sigmoid_cross_entropy(const float *Z, const float *Y, float *G, size_t n) {
+			return Matf32_sigmoid_cross_entropy(Z, Y, G, n);
+		}
+
+		inline static void Mat_softmax_cols(const float *Z, float *P, const Shape &shape) {
+			Matf32_softmax_cols(Z, P, shape.rows, shape.cols);
+		}
+
+		inline static float Mat_softmax_cross_entropy(const float *Z, const float *Y, float *G, const Shape &shape) {
+			return Matf32_softmax_cross_entropy(Z, Y, G, shape.rows, shape.cols);
+		}
+
+		// Row sums of the losses of a batch (one sample per column) added to S
+		inline static void Mat_abs_error_rows(const float *P, const float *Y, float *S, const Shape &shape) {
+			Matf32_abs_error_rows(P, Y, S, shape.rows, shape.cols);
+		}
+
+		inline static void Mat_squared_error_rows(const float *P, const float *Y, float *S, const Shape &shape) {
+			Matf32_squared_error_rows(P, Y, S, shape.rows, shape.cols);
+		}
+
+		inline static void Mat_binary_cross_entropy_rows(const float *P, const float *Y, float *S, const Shape &shape) {
+			Matf32_binary_cross_entropy_rows(P, Y, S, shape.rows, shape.cols);
+		}
+
+		inline static void Mat_categorical_cross_entropy_rows(const float *P, const float *Y, float *S, const Shape &shape) {
+			Matf32_categorical_cross_entropy_rows(P, Y, S, shape.rows, shape.cols);
+		}
+
+		// 2D convolutions of a batch of images stored one per column, see `Mat_conv2d`
+		inline static void Mat_im2col(const float *X, float *cols, const Mat_conv2d &conv) {
+			Matf32_im2col(X, cols, &conv);
+		}
+
+		inline static void Mat_col2im_acc(const float *cols, float *X, const Mat_conv2d &conv) {
+			Matf32_col2im_acc(cols, X, &conv);
+		}
+
+		inline static void Mat_conv2d_direct(const float *X, const float *W, float *Y, size_t nfilters,
+						     const Mat_conv2d &conv) {
+			Matf32_conv2d_direct(X, W, Y, nfilters, &conv);
+		}
+
+		inline static void Mat_conv2d_direct_backward(const float *X, const float *W, const float *dY, float *dX,
+							      float *dW, size_t nfilters, const Mat_conv2d &conv) {
+			Matf32_conv2d_direct_backward(X, W, dY, dX, dW, nfilters, &conv);
+		}
+
+		inline static void Mat_maxpool2d(const float *X, float *Y, size_t *argmax, const Mat_conv2d &conv) {
+			Matf32_maxpool2d(X, Y, argmax, &conv);
+		}
+
+		inline static void Mat_maxpool2d_backward(const float *dY, const size_t *argmax, float *dX,
+							  const Mat_conv2d &conv) {
+			Matf32_maxpool2d_backward(dY, argmax, dX, &conv);
+		}
+
+		inline static void Mat_avgpool2d(const float *X, float *Y, const Mat_conv2d &conv) {
+			Matf32_avgpool2d(X, Y, &conv);
+		}
+
+		inline static void Mat_avgpool2d_backward(const float *dY, float *dX, const Mat_conv2d &conv) {
+			Matf32_avgpool2d_backward(dY, dX, &conv);
+		}
+
+		// Normalization of every row over the batch, `shape` is the one of X
+		inline static void Mat_batchnorm_forward(const float *X, float *Y, const float *gamma, const float *beta,
+							 float *mean, float *invstd, const Shape &shape, float eps,
+							 bool batch_stats) {
+			Matf32_batchnorm_forward(X, Y, gamma, beta, mean, invstd, shape.rows, shape.cols, eps, batch_stats);
+		}
+
+		inline static void Mat_batchnorm_backward(const float *X, const float *dY, const float *gamma,
+							  const float *mean, const float *invstd, float *dX, float *dgamma,
+							  float *dbeta, const Shape &shape, bool batch_stats) {
+			Matf32_batchnorm_backward(X, dY, gamma, mean, invstd, dX, dgamma, dbeta, shape.rows, shape.cols,
+						  batch_stats);
+		}
+
+		// Normalization of every column over its rows, with the residual R (nullable) added first
+		inline static void Mat_layernorm_forward(const float *X, const float *R, float *S, float *Y,
+							 const float *gamma, const float *beta, float *mean, float *invstd,
+							 const Shape &shape, float eps) {
+			Matf32_layernorm_forward(X, R, S, Y, gamma, beta, mean, invstd, shape.rows, shape.cols, eps);
+		}
+
+		inline static void Mat_layernorm_backward(const float *S, const float *dY, const float *gamma,
+							  const float *mean, const float *invstd, float *dX, float *dgamma,
+							  float *dbeta, const Shape &shape) {
+			Matf32_layernorm_backward(S, dY, gamma, mean, invstd, dX, dgamma, dbeta, shape.rows, shape.cols);
+		}
+
+		inline static void Mat_dropout_forward(const float *X, float *Y, std::uint64_t *mask, const Shape &shape,
+						       float rate, std::uint64_t seed, std::uint64_t counter) {
+			Matf32_dropout_forward(X, Y, mask, shape.rows * shape.cols, rate, seed, counter);
+		}
+
+		inline static void Mat_dropout_backward(const float *dY, const std::uint64_t *mask, float *dX,
+							const Shape &shape, float rate) {
+			Matf32_dropout_backward(dY, mask, dX, shape.rows * shape.cols, rate);
+		}
+
+		// One step of a recurrent cell, Gx is a window of rows `ldx` apart
+		inline static void Mat_lstm_cell(const float *Gx, std::size_t ldx, const float *Z, const float *bias,
+						 const float *c_prev, float *gates, float *c, float *h, std::size_t hidden,
+						 std::size_t ncols) {
+			Matf32_lstm_cell(Gx, ldx, Z, bias, c_prev, gates, c, h, hidden, ncols);
+		}
+
+		inline static void Mat_lstm_cell_backward(const float *gates, const float *c_prev, const float *c,
+							  const float *dh, float *dc, float *dZ, float *dG, std::size_t ldg,
+							  std::size_t hidden, std::size_t ncols) {
+			Matf32_lstm_cell_backward(gates, c_prev, c, dh, dc, dZ, dG, ldg, hidden, ncols);
+		}
+
+		inline static void Mat_gru_cell(const float *Gx, std::size_t ldx, const float *Z, const float *bias_x,
+						const float *bias_h, const float *h_prev, float *gates, float *h,
+						std::size_t hidden, std::size_t ncols) {
+			Matf32_gru_cell(Gx, ldx, Z, bias_x, bias_h, h_prev, gates, h, hidden, ncols);
+		}
+
+		inline static void Mat_gru_cell_backward(const float *gates, const float *h_prev, const float *dh,
+							 float *dZ, float *dG, std::size_t ldg, float *dh_prev,
+							 std::size_t hidden, std::size_t ncols) {
+			Matf32_gru_cell_backward(gates, h_prev, dh, dZ, dG, ldg, dh_prev, hidden, ncols);
+		}
+
+		// Attention of every head of a batch of sequences by tiles, see `Mat_attention`
+		inline static void Mat_attention_forward(const float *Q, const float *K, const float *V, float *O,
+							 float *lse, float *work, const Mat_attention &att) {
+			Matf32_attention_forward(Q, K, V, O, lse, work, &att);
+		}
+
+		inline static void Mat_attention_backward(const float *Q, const float *K, const float *V, const float *O,
+							  const float *dO, const float *lse, float *dQ, float *dK,
+							  float *dV, float *work, const Mat_attention &att) {
+			Matf32_attention_backward(Q, K, V, O, dO, lse, dQ, dK, dV, work, &att);
+		}
+
+		// Products of a sparse matrix stored by blocks, see `Mat_bsr`
+		inline static void Mat_bsr_dot(const Mat_bsr &A, const float *values, const float *B, float *C,
+					       std::size_t ncolsB) {
+			Matf32_bsr_dot(&A, values, B, C, ncolsB);
+		}
+
+		inline static void Mat_bsr_dot_tn(const Mat_bsr &A, const float *values, const float *B, float *C,
+						  std::size_t ncolsB) {
+			Matf32_bsr_dot_tn(&A, values, B, C, ncolsB);
+		}
+
+		inline static void Mat_bsr_sampled_dot_nt_acc(const Mat_bsr &A, const float *X, const float *Y,
+							      float *values, std::size_t ncols) {
+			Matf32_bsr_sampled_dot_nt_acc(&A, X, Y, values, ncols);
+		}
+
 		constexpr static double eq_tolerance = 1e-8;
 		inline static bool Mat_equal(const float *A, const float *B, const Shape &shape) {
 			return Matf32_equal(A, B, shape.rows, shape.cols, static_cast<float>(eq_tolerance));
@@ -116,7 +312,10 @@ namespace nn::mathops {
 		
 		void operator=(const std::initializer_list<std::initializer_list<T>> &A);
 		void operator=(Mat<T> &&A);              // move constructor
+		// operator=: an owning copy of A, even if this matrix is a view
 		void operator=(const Mat<T> &A);
+		// assign: the values of A copied into the memory of this matrix (through a view), same shape only
+		Mat<T> &assign(const Mat<T> &A);
 		Mat<T> dot(const Mat<T> &A) const;
 		Mat<T> &dot_and_assign(const Mat<T> &A);
 		Mat<T> operator+(const Mat<T> &A) const;
@@ -139,6 +338,13 @@ namespace nn::mathops {
 		Mat<T> operator/(T a) const;
 		Mat<T> &operator/=(T a);
 
+		// Batched helpers, a batch stores one sample per column
+		Mat<T> &axpy(T a, const Mat<T> &A);			// this += a * A
+		Mat<T> &add_colvec(const Mat<T> &v);			// this(i, j) += v(i, 0)
+		Mat<T> &add_row_sum(const Mat<T> &A);			// this(i, 0) += sum_j A(i, j)
+		Mat<T> &add_dot_transposed(const Mat<T> &A, const Mat<T> &B);	// this += A . B^T
+		Mat<T> transpose_dot(const Mat<T> &A) const;		// this^T . A
+
 		Mat<T> &transpose(void);
 		Mat<T> transpose_copy(void) const;
 		Mat<T> &resize(const Shape &shape);
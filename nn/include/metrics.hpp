@@ -0,0 +1,76 @@
+#ifndef NN_METRICS_INCLUDED
+#define NN_METRICS_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mat.hpp"
+
+namespace nn::metrics {
+	using namespace mathops;
+
+	/**
+	 * @brief Streaming and mergeable evaluation metrics.
+	 *
+	 * `update` takes the predictions and the targets of a batch (one sample
+	 * per column) and only keeps counters, the memory doesn't depend on the
+	 * number of samples. Two accumulators of disjoint parts of a data set
+	 * `merge` into the accumulator of the whole set, which is how the shards
+	 * of `WeightedModel::evaluate` are put together.
+	 *
+	 * With a single output the problem is binary: a prediction is positive
+	 * above `threshold`, a target above one half. With more outputs the
+	 * class is the row of the maximum, precision, recall and AUC are the
+	 * macro average of every class against the rest.
+	 *
+	 * The AUC comes from histograms of `nbins` scores over [0, 1] (the
+	 * scores outside are clamped), the ties inside of a bin count as half.
+	 * The metrics without any sample to be defined on are zero.
+	 */
+	template <typename T>
+	class Metrics {
+	public:
+		Metrics(T threshold = static_cast<T>(0.5), std::size_t nbins = 1024);
+
+		// update: add a batch, `loss` is the loss summed over its samples
+		Metrics &update(const Mat<T> &y_pred, const Mat<T> &y_true, T loss = static_cast<T>(0));
+		// merge: add the counters of `other`, throws std::invalid_argument if they aren't compatible
+		Metrics &merge(const Metrics &other);
+		Metrics &reset(void);
+
+		std::size_t get_nsamples(void) const;
+		std::size_t get_nclasses(void) const;
+
+		// loss: mean over the samples of the loss given to `update`
+		T loss(void) const;
+		T accuracy(void) const;
+		T precision(void) const;
+		T recall(void) const;
+		T auc(void) const;
+
+	private:
+		// Counters of the class `c` against the rest
+		T precision(std::size_t c) const;
+		T recall(std::size_t c) const;
+		T auc(std::size_t c) const;
+		std::size_t bin(T score) const;
+
+		T threshold_;
+		std::size_t nbins_;
+		std::size_t nclasses_;	// zero until the first update
+
+		std::uint64_t nsamples_;
+		std::uint64_t correct_;
+		double loss_;
+
+		std::vector<std::uint64_t> true_positives_;
+		std::vector<std::uint64_t> false_positives_;
+		std::vector<std::uint64_t> false_negatives_;
+		// (nclasses, nbins) histograms of the scores of the positive and negative samples
+		std::vector<std::uint64_t> positives_;
+		std::vector<std::uint64_t> negatives_;
+	};
+}
+
+#endif
@@ -3,16 +3,31 @@
 
 #include "mat.hpp"
 #include "layer.hpp"
+#include "conv.hpp"
+#include "pool.hpp"
+#include "norm.hpp"
+#include "residual.hpp"
+#include "dropout.hpp"
+#include "embedding.hpp"
+#include "rnn.hpp"
+#include "attention.hpp"
+#include "sparse.hpp"
 #include "loss_func.hpp"
+#include "metrics.hpp"
+#include "data_loader.hpp"
+#include "parallel.hpp"
 #include <memory>
 
-
-// TODO: Build a module to get graphs over the layer and mat objects to create computable grpahs
+namespace nn::io {
+	template <typename T> class Checkpointer;
+}
 
 namespace nn::models {
 	using namespace layers;
 	using namespace optimizers;
 	using namespace loss_funcs;
+	using namespace data;
+	using namespace metrics;
 
 	template <typename T>
 	class WeightedModel : public WeightedLayer, public std::enable_shared_from_this<WeightedModel<T>>  {
@@ -23,9 +38,22 @@ namespace nn::models {
 		// TODO: Add the settters and getters and also lets add the X_train_ shared pointers
 		virtual WeightedModel &fit(const std::shared_ptr<std::vector<Mat<T>>> X_train, const std::shared_ptr<std::vector<Mat<T>>> Y_train, std::size_t nepochs = 100, std::size_t batch_size = 1) = 0;
 		
-		// TODO: Add matrics object
 		Mat<T> test(const std::shared_ptr<std::vector<Mat<T>>> X_test, const std::shared_ptr<std::vector<Mat<T>>> Y_test);
 
+		/*
+		 * evaluate: metrics of the model over a data set of column samples.
+		 * The samples are split into `nshards` contiguous shards (0 is one
+		 * per thread of the global pool), every shard runs the model on
+		 * batches of `batch_size` columns into its own `Metrics` and the
+		 * shards are merged at the end. The loss is the one set with
+		 * `set_loss` summed over the outputs, it is zero without a loss.
+		 * `metrics` gives the threshold and the bins, its counters are
+		 * replaced
+		 */
+		Metrics<T> evaluate(const std::vector<Mat<T>> &X, const std::vector<Mat<T>> &Y,
+				    std::size_t nshards = 0, std::size_t batch_size = 256,
+				    const Metrics<T> &metrics = Metrics<T>()) const;
+
 		WeightedModel &set_loss(std::shared_ptr<Loss<T>> loss);
 		const std::shared_ptr<Loss<T>> get_loss(void) const;
 
@@ -51,6 +79,9 @@ namespace nn::models {
 		Mat<T> &get_weights(void) const;
 
 		Mat<T> &get_bias(void) const;
+
+		// bind_weights: see `Dense::bind_weights`
+		Perceptron &bind_weights(T *weights, T *bias, std::shared_ptr<void> storage = nullptr);
 		
 		Perceptron &build(const Shape &input_shape, const Shape &output_shape) override;
 		Perceptron &build(std::size_t input_size, std::size_t output_size) override;
@@ -75,6 +106,9 @@ namespace nn::models {
 		
 		Mat<T> &get_weights(void) const;
 		Mat<T> &get_bias(void) const;
+
+		// bind_weights: see `Dense::bind_weights`
+		Adeline &bind_weights(T *weights, T *bias, std::shared_ptr<void> storage = nullptr);
 		
 		Adeline &build(const Shape &input_shape, const Shape &output_shape) override;
 		Adeline &build(std::size_t input_size, std::size_t output_size) override;
@@ -86,6 +120,13 @@ namespace nn::models {
 	};
 
 
+	// How `Sequential::fit` consumes the minibatches
+	enum class FitMode {
+		Serial,		// one update per sample, in the order of the batch (per minibatch with a BatchNorm)
+		DataParallel,	// one update per minibatch, its samples are sharded between threads
+		Hogwild,	// every thread updates the shared weights with its own minibatches, without locks
+	};
+
 	template <typename T>
 	class Sequential : public WeightedModel<T> {
 	public:
@@ -99,10 +140,245 @@ namespace nn::models {
 		Sequential &fit(const std::shared_ptr<std::vector<Mat<T>>> X_train, const std::shared_ptr<std::vector<Mat<T>>> Y_train, std::size_t nepochs = 100, std::size_t batch_size = 1) override;
 		
 		const std::vector<std::unique_ptr<Layer>> &get_layers(void) const;
+		// add: append a layer, the model needs to be built again after it
+		Sequential &add(std::unique_ptr<Layer> layer);
+		// set_training: the model and all its layers
+		Sequential &set_training(bool training) override;
+
+		/*
+		 * fold_batchnorm: for inference, every `BatchNorm` right after a
+		 * `Dense` without activation is folded into it with its running
+		 * statistics, W' = s * W and B' = s * (B - mean) + beta row by row
+		 * with s = gamma / sqrt(var + eps), and the folded layer takes the
+		 * activation of the `BatchNorm`. The normalized model then costs the
+		 * same as one without normalization. The plan and the optimizer
+		 * state of the replaced parameters are dropped. The running
+		 * statistics only move in training mode, `accumulate_batch` and
+		 * `accumulate_gradients` need `set_training(true)` (as `fit` does)
+		 * for them to mean anything. Returns the number of folds
+		 */
+		std::size_t fold_batchnorm(void);
+
+		/*
+		 * prune_weights: magnitude pruning of every `Dense` of the model
+		 * (see `prune_dense`), each one becomes a `SparseDense` with the
+		 * same activation and optimizer, so the pruned model can be
+		 * fine-tuned with `fit`. The plan and the optimizer state of the
+		 * replaced weights are dropped. Returns the number of layers pruned
+		 */
+		std::size_t prune_weights(double sparsity, SparseFormat format = SparseFormat::CSR,
+					  std::size_t block_rows = 1, std::size_t block_cols = 1);
+
+		/*
+		 * prune_neurons: structured pruning, every `Dense` followed by
+		 * another `Dense` loses the `fraction` of its neurons with the
+		 * lowest scores: their rows of W and B and their columns of the
+		 * next W go, and both layers are replaced by smaller `Dense` ones
+		 * with the same activations and optimizer. `BatchNorm` and
+		 * `Dropout` layers between the two lose the same rows, any other
+		 * layer in between leaves the pair unpruned. The model stays dense
+		 * and can be fine-tuned. The number removed per layer is rounded
+		 * down, at least one neuron stays. The plan and the optimizer
+		 * state of the replaced parameters are dropped. Returns the
+		 * neurons removed.
+		 *
+		 * By weight, a neuron scores the norm of its row of W (scaled by
+		 * a `BatchNorm` in between) times the one of its column of the
+		 * next W, and its output without inputs, act(B) through the
+		 * layers in between, goes to the next bias. With a calibration
+		 * batch X, it scores the deviation of its activation at the input
+		 * of the next `Dense` over X times that column, and its mean
+		 * activation goes to the next bias: the pruned model is exact for
+		 * a neuron with a constant output. The batch runs through the
+		 * layers as they are, calibrate out of training mode
+		 */
+		std::size_t prune_neurons(double fraction);
+		std::size_t prune_neurons(double fraction, const Mat<T> &X);
+
+		// The training data is fed by a prefetching `DataLoader`, these
+		// options are forwarded to it. The shuffle is seeded, two fits
+		// with the same seed visit the samples in the same order
+		Sequential &set_shuffle(bool shuffle);
+		Sequential &set_seed(unsigned int seed);
+		Sequential &set_prefetch(std::size_t nbuffers);
+		bool get_shuffle(void) const;
+		unsigned int get_seed(void) const;
+		std::size_t get_prefetch(void) const;
+
+		// set_fit_mode: `nthreads` zero uses every hardware thread, the
+		// data parallel updates are deterministic for a fixed `nthreads`,
+		// the Hogwild ones are not (the threads race on the weights)
+		Sequential &set_fit_mode(FitMode mode, std::size_t nthreads = 0);
+		FitMode get_fit_mode(void) const;
+		std::size_t get_nthreads(void) const;
+
+		// accumulate_gradients: add dL/dθ of the batch X (n, b), Y (m, b) to
+		// `grads`, one matrix per element of `parameters<T>()`
+		Sequential &accumulate_gradients(const Mat<T> &X, const Mat<T> &Y, Mat<T> *grads);
+
+		/*
+		 * accumulate_batch: add dL/dθ of the batch X (n, b), Y (m, b) to the
+		 * accumulators of the model (`gradients<T>()`), the weights only
+		 * change with `step()`, which takes the mean over all the samples
+		 * accumulated since the last step. Out of `fit` the model is in
+		 * inference mode, a `BatchNorm` then uses its running statistics
+		 * and never updates them: call `set_training(true)` first
+		 */
+		Sequential &accumulate_batch(const Mat<T> &X, const Mat<T> &Y);
+
+		/*
+		 * set_accumulation_steps: `fit` accumulates the gradients of `nsteps`
+		 * micro-batches (a sample in serial mode without BatchNorm, a minibatch otherwise)
+		 * before one update with their mean. The leftovers are applied at
+		 * the end of every epoch
+		 */
+		Sequential &set_accumulation_steps(std::size_t nsteps);
+		std::size_t get_accumulation_steps(void) const;
+
+		// set_checkpointer: `fit` resumes from its newest checkpoint and
+		// snapshots the model at the end of its epochs, nullptr disables it
+		Sequential &set_checkpointer(std::shared_ptr<io::Checkpointer<T>> checkpointer);
+		std::shared_ptr<io::Checkpointer<T>> get_checkpointer(void) const;
+
+		/*
+		 * set_flat_parameters: `build` moves the parameters of all the layers
+		 * into one aligned slab (the default), every layer keeps views into it.
+		 * The optimizer then steps the whole model as a single matrix. Models
+		 * mapped from a file turn it off to keep using the mapped weights
+		 */
+		Sequential &set_flat_parameters(bool flat);
+		// has_flat_parameters: the parameters live in the slab right now
+		bool has_flat_parameters(void) const;
+		// get_flat_parameters: the slab as one (1, n) matrix, padding between the parameters included
+		Mat<T> &get_flat_parameters(void);
+		const Mat<T> &get_flat_parameters(void) const;
+		// optimizer_parameters: the matrices given to the optimizer, the slab or every parameter, then the sparse ones
+		std::vector<Mat<T> *> optimizer_parameters(void);
+
+		/*
+		 * compile: freeze the shapes for batches of `batch_size` columns and
+		 * plan the memory of the forward, and of the backward with `training`.
+		 * Every activation and gradient gets its lifetime over the steps of
+		 * the plan and the ones that never overlap share a buffer, a forward
+		 * alone ping-pongs between two. The buffers are 64-byte aligned blocks
+		 * of one arena, once compiled `forward_compiled` and `backward_compiled`
+		 * don't allocate as long as every layer can run into buffers (see
+		 * `Layer::forward_into`), the others still run through their own
+		 * feedforward and backward. The layers that are the identity when
+		 * compiled (`Layer::is_identity`, a dropout out of training) are
+		 * skipped without a copy while they stay so. `build` and `add` drop
+		 * the plan, it isn't shared between threads
+		 */
+		Sequential &compile(std::size_t batch_size, bool training = false);
+		bool is_compiled(void) const;
+		// Buffers of the plan and their size (elements, the padding included)
+		std::size_t get_plan_buffers(void) const;
+		std::size_t get_plan_size(void) const;
+		// forward_compiled: output of X (n, batch_size), a view into the plan valid until the next compiled call
+		const Mat<T> &forward_compiled(const Mat<T> &X);
+		/*
+		 * backward_compiled: dL/dX of the batch X after its `forward_compiled`,
+		 * dY is dL/dY of that output and the gradients of the parameters are
+		 * added to `grads` like in `backward`. Needs a training plan
+		 */
+		const Mat<T> &backward_compiled(const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads);
 		
 	private:
+		/*
+		 * Gradients with the layout of the parameter slab: one aligned block,
+		 * a view per parameter for the layers and a flat view for the
+		 * optimizer and the reductions
+		 */
+		struct Gradients {
+			AlignedBuffer<T> memory;
+			std::vector<Mat<T>> views;	// same shapes as `params_`
+			Mat<T> flat;
+			std::size_t nsamples = 0;	// accumulated since the last step
+			std::size_t nmicro = 0;		// micro-batches accumulated since the last step
+		};
+
+		// Static memory plan of `compile`, the views are placed over `arena`
+		struct Plan {
+			std::size_t batch_size = 0;	// zero if not compiled
+			bool training = false;
+			AlignedBuffer<T> arena;
+			std::size_t nbuffers = 0;
+			std::vector<Mat<T>> activations;	// output of every layer
+			std::vector<Mat<T>> gradients;		// dL/d input of every layer and dL/dY last, training only
+			std::vector<Layer::ForwardInto<T>> forward;	// empty for the layers that can't run into buffers
+			std::vector<Layer::BackwardInto<T>> backward;
+			// The identities when compiled, skipped while they still are
+			std::vector<bool> skip;
+			// Where the last forward left the output of every layer, nullptr for the input
+			std::vector<const Mat<T> *> outputs;
+		};
+
+		// Buffers of one worker of the data parallel training
+		struct Replica {
+			Mat<T> X;			// its shard of the batch
+			Mat<T> Y;
+			Gradients grads;
+		};
+
 		Sequential &register_funcs(void) override;
+		// collect_parameters: the parameters of the built layers, their slab, gradients and shapes
+		void collect_parameters(void);
+		/*
+		 * replace_parameters: after some layers were swapped for new ones,
+		 * forget the optimizer state of their old parameters (and of the
+		 * slab, its layout changed) and collect the parameters again
+		 */
+		void replace_parameters(const std::vector<Mat<T> *> &replaced);
+		/*
+		 * forward_cached: feedforward keeping the input of every layer in
+		 * `inputs`, with `logits` the last layer stops before its activation
+		 * and `backward_cached` takes dY as the gradient of those logits
+		 */
+		Mat<T> forward_cached(const Mat<T> &X, std::vector<Mat<T>> &inputs, bool logits = false);
+		Mat<T> backward_cached(const std::vector<Mat<T>> &inputs, const Mat<T> &dY, Mat<T> *grads, bool logits = false);
+		// fused_output: the loss is fused with the activation of the last layer
+		bool fused_output(void) const;
+		/*
+		 * record_layers: record the forward of all the layers on `tape`, the
+		 * ones that can't record are a single node that calls their backward
+		 */
+		autodiff::Var record_layers(autodiff::Tape<T> &tape, autodiff::Var X, Mat<T> *grads);
+		// batch_statistics: a layer, or a layer of a residual block, normalizes with the statistics of its batch
+		bool batch_statistics(void) const;
+		// data_parallel_step: `last` forces the step, the micro-batches of an epoch aren't carried to the next
+		void data_parallel_step(const Batch<T> &batch, std::vector<Replica> &replicas,
+					parallel::WorkerGroup &workers, bool last);
+		void hogwild_epochs(const std::vector<Mat<T>> &X, const std::vector<Mat<T>> &Y,
+				    std::size_t first_epoch, std::size_t nepochs, std::size_t batch_size);
+		// prune_neurons_by: `prune_neurons` by activation over X, by weight if it is null
+		std::size_t prune_neurons_by(double fraction, const Mat<T> *X);
+		// bind_slab: copy the parameters into a new slab and bind the layers to it
+		void bind_slab(void);
+		void alloc_gradients(Gradients &grads) const;
+		// apply_gradients: one optimizer step with the (already averaged) gradients
+		void apply_gradients(Gradients &grads);
+		// step_gradients: apply the mean of the accumulated gradients and zero them
+		void step_gradients(Gradients &grads);
+		void zero_gradients(Gradients &grads) const;
+
 		std::vector<std::unique_ptr<Layer>> layers_;
+		std::vector<Mat<T> *> params_;			// parameters of all the layers, in order
+		std::vector<std::size_t> param_offsets_;	// first parameter of every layer in `params_`
+		std::vector<WeightedLayer *> sparse_layers_;	// the layers with sparse gradients, stepped by `apply_gradients`
+		std::vector<std::size_t> slab_offsets_;		// offset of every parameter in the slab (aligned)
+		std::size_t slab_size_ = 0;
+		bool flat_parameters_ = true;
+		AlignedBuffer<T> slab_;
+		Mat<T> flat_params_;				// view over the whole `slab_`, if the layers are bound to it
+		Gradients grads_;				// of the serial training and `accumulate_batch`
+		Plan plan_;
+		std::size_t accumulation_steps_ = 1;
+		bool shuffle_ = true;
+		unsigned int seed_ = DataLoader<T>::default_seed;
+		std::size_t prefetch_ = 2;
+		FitMode fit_mode_ = FitMode::Serial;
+		std::size_t nthreads_ = 1;
+		std::shared_ptr<io::Checkpointer<T>> checkpointer_;
 	};
 }
 
@@ -0,0 +1,112 @@
+#ifndef NN_NORM_INCLUDED
+#define NN_NORM_INCLUDED
+
+#include <memory>
+#include <mutex>
+
+#include "layer.hpp"
+
+namespace nn::layers {
+	/**
+	 * @brief Batch normalization of every feature (row) over the samples of
+	 * the batch, Y = f(gamma * (X - mean) / sqrt(var + eps) + beta).
+	 *
+	 * While training (`set_training`) the mean and the variance are the ones
+	 * of the batch and every forward moves the running statistics by
+	 * `momentum`, otherwise the running statistics are used and the layer is
+	 * an affine map: `Sequential::fold_batchnorm` folds it into the `Dense`
+	 * before it. The statistics of a batch need more than one sample, train
+	 * it with batches (`accumulate_batch`, the data parallel `fit`).
+	 */
+	template <typename T>
+	class BatchNorm : public WeightedLayer {
+	public:
+		using WeightedLayer::WeightedLayer;
+
+		BatchNorm(std::size_t size, std::shared_ptr<Layer> activation_func = nullptr,
+			  T momentum = static_cast<T>(0.1), T eps = static_cast<T>(1e-5));
+		~BatchNorm(void) override = default;
+
+		Mat<T> &get_gamma(void) const;
+		Mat<T> &get_beta(void) const;
+		Mat<T> &get_running_mean(void) const;
+		Mat<T> &get_running_var(void) const;
+		T get_momentum(void) const;
+		T get_eps(void) const;
+
+		BatchNorm &build(const Shape &input_shape, const Shape &output_shape) override;
+		BatchNorm &build(std::size_t input_size, std::size_t output_size) override;
+		BatchNorm &build(void) override;
+	private:
+		BatchNorm &register_funcs(void) override;
+		BatchNorm &alloc_weights(void);
+		BatchNorm &alloc_gradients(void);
+
+		/*
+		 * normalize: Z = the normalization of X, the statistics used go to
+		 * `mean` and `invstd` (one per feature). With `update` a training
+		 * forward moves the running statistics
+		 */
+		void normalize(const Mat<T> &X, Mat<T> &Z, T *mean, T *invstd, bool update);
+		// normalize_backward: dL/dX of dZ into `dX` and the gradients of gamma and beta into `grads`, both nullable
+		void normalize_backward(const Mat<T> &X, const Mat<T> &dZ, const T *mean, const T *invstd,
+					Mat<T> *dX, Mat<T> *grads) const;
+
+		T momentum_;
+		T eps_;
+		std::unique_ptr<Mat<T>> gamma_;
+		std::unique_ptr<Mat<T>> beta_;
+		std::unique_ptr<Mat<T>> running_mean_;
+		std::unique_ptr<Mat<T>> running_var_;
+		std::unique_ptr<Mat<T>> grad_gamma_;
+		std::unique_ptr<Mat<T>> grad_beta_;
+		std::size_t grad_count_ = 0;
+		bool weights_bound_ = false;
+		// The data parallel workers update the running statistics at the same time
+		std::mutex stats_mutex_;
+		// Statistics of `forward_into` for `backward_into`, a compiled plan runs in one thread
+		AlignedBuffer<T> mean_;
+		AlignedBuffer<T> invstd_;
+	};
+
+	/**
+	 * @brief Layer normalization of every sample (column) over its
+	 * features, Y = gamma * (X - mean) / sqrt(var + eps) + beta with gamma
+	 * and beta per feature. It behaves the same in training and inference.
+	 * The kernel takes the statistics of blocks of columns with Welford's
+	 * update in one pass, see `Residual` for the fused residual sum.
+	 */
+	template <typename T>
+	class LayerNorm : public WeightedLayer {
+	public:
+		using WeightedLayer::WeightedLayer;
+
+		LayerNorm(std::size_t size, T eps = static_cast<T>(1e-5));
+		~LayerNorm(void) override = default;
+
+		Mat<T> &get_gamma(void) const;
+		Mat<T> &get_beta(void) const;
+		T get_eps(void) const;
+
+		LayerNorm &build(const Shape &input_shape, const Shape &output_shape) override;
+		LayerNorm &build(std::size_t input_size, std::size_t output_size) override;
+		LayerNorm &build(void) override;
+	private:
+		LayerNorm &register_funcs(void) override;
+		LayerNorm &alloc_weights(void);
+		LayerNorm &alloc_gradients(void);
+
+		T eps_;
+		std::unique_ptr<Mat<T>> gamma_;
+		std::unique_ptr<Mat<T>> beta_;
+		std::unique_ptr<Mat<T>> grad_gamma_;
+		std::unique_ptr<Mat<T>> grad_beta_;
+		std::size_t grad_count_ = 0;
+		bool weights_bound_ = false;
+		// Statistics of `forward_into` for `backward_into`, one per column of the batch
+		AlignedBuffer<T> mean_;
+		AlignedBuffer<T> invstd_;
+	};
+}
+
+#endif
@@ -1,6 +1,13 @@
 #ifndef NN_OPTIMIZER_INCLUDED
 #define NN_OPTIMIZER_INCLUDED
 
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
 #include "mat.hpp"
 #include "utils.hpp"
 
@@ -58,11 +65,149 @@ namespace nn::optimizers {
 			get_func<void, Mat<T> &, const Mat<T> &>
 				("update_bias", __FILE__, __LINE__)(bias, signal_update);
 		}
+		/**
+		 * @brief Apply one step to a parameter given its gradient.
+		 *
+		 * Used by the batched training, where the gradient dL/dθ was already
+		 * computed (and averaged over the batch) by `Layer::backward`:
+		 *     θ ← θ - η * dL/dθ
+		 *
+		 * @tparam T  Numeric type of the matrix (e.g., float or double)
+		 * @param param  Any trainable matrix of a layer (weights or bias).
+		 * @param grad   The gradient dL/dθ, same shape as `param`.
+		 */
+		template <typename T>
+		void apply(Mat<T> &param, const Mat<T> &grad)
+		{
+			get_func<void, Mat<T> &, const Mat<T> &>
+				("apply", __FILE__, __LINE__)(param, grad);
+		}
+
+		/**
+		 * @brief Apply one step to some rows of a parameter (sparse gradient).
+		 *
+		 * The row k of `grad` is dL/dθ of the row rows[k] of `param`, the other
+		 * rows and their state aren't touched: the stateful optimizers are
+		 * lazy, their moments only move when a row gets a gradient. A row
+		 * appears at most once in `rows`. Used by the layers that look up a few
+		 * rows of a large table (`Embedding`), the step costs the rows used.
+		 *
+		 * @tparam T  Numeric type of the matrix (e.g., float or double)
+		 * @param param  The trainable matrix, one row per entry.
+		 * @param grad   The gradients of the rows, (rows.size(), param.cols()).
+		 * @param rows   The rows of `param` that get a step.
+		 */
+		template <typename T>
+		void apply_rows(Mat<T> &param, const Mat<T> &grad, const std::vector<std::size_t> &rows)
+		{
+			get_func<void, Mat<T> &, const Mat<T> &, const std::vector<std::size_t> &>
+				("apply_rows", __FILE__, __LINE__)(param, grad, rows);
+		}
+
+		/**
+		 * @brief Internal state of the optimizer (moments, velocities, ...).
+		 *
+		 * Optimizers without state don't register the "state" function and
+		 * return an empty list. The matrices are owned by the optimizer, a
+		 * checkpoint copies them out and restores them in the same order.
+		 *
+		 * @tparam T  Numeric type of the matrix (e.g., float or double)
+		 */
+		template <typename T>
+		std::vector<Mat<T> *> get_state(void)
+		{
+			if (!has_func<std::vector<Mat<T> *>>("state"))
+				return {};
+			return get_func<std::vector<Mat<T> *>>("state", __FILE__, __LINE__)();
+		}
+
+		/**
+		 * @brief Allocate the state of the given parameters ahead of the training.
+		 *
+		 * Stateful optimizers otherwise allocate the state of a parameter on
+		 * its first step. `Sequential::fit` calls this before training, so the
+		 * concurrent workers never allocate and `get_state` lists every
+		 * parameter in the order of the model.
+		 *
+		 * @tparam T  Numeric type of the matrix (e.g., float or double)
+		 */
+		template <typename T>
+		void prepare(const std::vector<Mat<T> *> &params)
+		{
+			if (!has_func<void, const std::vector<Mat<T> *> &>("prepare"))
+				return;
+			get_func<void, const std::vector<Mat<T> *> &>("prepare", __FILE__, __LINE__)(params);
+		}
+
+		/**
+		 * @brief Drop the state of a parameter that is going away.
+		 *
+		 * The state is keyed by the address of the parameter, a model that
+		 * replaces some of its layers (folding, pruning) forgets their old
+		 * parameters so their moments are neither checkpointed nor picked up
+		 * by a new matrix at the same address. Stateless optimizers ignore it.
+		 *
+		 * @tparam T  Numeric type of the matrix (e.g., float or double)
+		 */
+		template <typename T>
+		void forget(const Mat<T> &param)
+		{
+			if (!has_func<void, const Mat<T> &>("forget"))
+				return;
+			get_func<void, const Mat<T> &>("forget", __FILE__, __LINE__)(param);
+		}
 	protected:
 		std::string name_;
 		double learning_rate_;
 	};
 
+	/**
+	 * @brief Per parameter state of the stateful optimizers.
+	 *
+	 * Every parameter gets one aligned block that holds `nmoments` matrices
+	 * of its shape (velocity, first and second moments, ...), an optional
+	 * 1x1 step counter. The scratch gradient of the per sample updates
+	 * (`update`) is only allocated by them, on their first call.
+	 * The state matrices are `Mat` views over the block, so the fused
+	 * kernels stream over flat memory and nothing is allocated per step.
+	 *
+	 * Lookups only take a shared lock, the workers of Hogwild can step
+	 * different parameters concurrently once `prepare` allocated them.
+	 */
+	template <typename T>
+	class OptimizerState {
+	public:
+		struct Slot {
+			Shape shape;			// of the parameter
+			AlignedBuffer<T> memory;
+			std::vector<Mat<T>> tensors;	// the moments and the counter, checkpointed
+			Mat<T> scratch;			// dL/dW of `update`, not part of the state
+			std::once_flag scratch_once;	// `update` allocates the scratch once
+		};
+
+		OptimizerState(std::size_t nmoments, bool counter);
+
+		// get: the state of `param`, allocated (zeros) on the first call and again if its shape changed
+		Slot &get(const Mat<T> &param);
+		OptimizerState &prepare(const std::vector<Mat<T> *> &params);
+		// forget: drop the state of `param`, nothing happens if it has none
+		OptimizerState &forget(const Mat<T> &param);
+		// tensors: the state matrices of all the parameters, in the order they were allocated
+		std::vector<Mat<T> *> tensors(void);
+		std::size_t size(void) const;
+
+	private:
+		Slot &allocate(const Mat<T> &param);
+		// erase: drop a slot, the unique lock must be held
+		void erase(typename std::unordered_map<const Mat<T> *, Slot *>::iterator it);
+
+		std::size_t nmoments_;
+		bool counter_;
+		std::vector<std::unique_ptr<Slot>> slots_;
+		std::unordered_map<const Mat<T> *, Slot *> index_;
+		mutable std::shared_mutex mutex_;
+	};
+
 	template <typename T>
 	class PerceptronOptimizer : public Optimizer {
 	public:
@@ -88,6 +233,94 @@ namespace nn::optimizers {
 	private:
 		GradientDescentOptimizer &register_funcs(void) override;
 	};
+
+	/**
+	 * @brief Gradient descent with (heavy ball or Nesterov) momentum.
+	 *
+	 *     v ← μ v + dL/dθ
+	 *     θ ← θ - η v               (Nesterov: θ ← θ - η (dL/dθ + μ v))
+	 */
+	template <typename T>
+	class MomentumOptimizer : public Optimizer {
+	public:
+		MomentumOptimizer(T learning_rate = 0.01, T momentum = 0.9, bool nesterov = false);
+		~MomentumOptimizer(void) override = default;
+
+		T get_momentum(void) const;
+		bool is_nesterov(void) const;
+	private:
+		MomentumOptimizer &register_funcs(void) override;
+
+		T momentum_;
+		bool nesterov_;
+		OptimizerState<T> state_;
+	};
+
+	/**
+	 * @brief RMSProp, the step of every weight is scaled by its recent gradient magnitude.
+	 *
+	 *     s ← ρ s + (1 - ρ) (dL/dθ)²
+	 *     θ ← θ - η dL/dθ / (√s + ε)
+	 */
+	template <typename T>
+	class RMSPropOptimizer : public Optimizer {
+	public:
+		RMSPropOptimizer(T learning_rate = 0.001, T rho = 0.9, T epsilon = 1e-8);
+		~RMSPropOptimizer(void) override = default;
+
+		T get_rho(void) const;
+		T get_epsilon(void) const;
+	private:
+		RMSPropOptimizer &register_funcs(void) override;
+
+		T rho_;
+		T epsilon_;
+		OptimizerState<T> state_;
+	};
+
+	/**
+	 * @brief Adam, momentum on the gradient and RMSProp scaling with bias correction.
+	 *
+	 *     m ← β1 m + (1 - β1) dL/dθ
+	 *     v ← β2 v + (1 - β2) (dL/dθ)²
+	 *     θ ← θ - η (m / (1 - β1ᵗ)) / (√(v / (1 - β2ᵗ)) + ε)
+	 *
+	 * The step t is counted per parameter and saved with the moments.
+	 */
+	template <typename T>
+	class AdamOptimizer : public Optimizer {
+	public:
+		AdamOptimizer(T learning_rate = 0.001, T beta1 = 0.9, T beta2 = 0.999, T epsilon = 1e-8);
+		~AdamOptimizer(void) override = default;
+
+		T get_beta1(void) const;
+		T get_beta2(void) const;
+		T get_epsilon(void) const;
+		T get_weight_decay(void) const;
+	protected:
+		AdamOptimizer(std::string name, T learning_rate, T beta1, T beta2, T epsilon, T weight_decay);
+		AdamOptimizer &register_funcs(void) override;
+
+		T beta1_;
+		T beta2_;
+		T epsilon_;
+		T weight_decay_;
+		OptimizerState<T> state_;
+	};
+
+	/**
+	 * @brief Adam with decoupled weight decay (Loshchilov & Hutter).
+	 *
+	 * The decay shrinks the weights directly, θ ← θ - η λ θ, instead of
+	 * being added to the gradient where Adam would rescale it.
+	 */
+	template <typename T>
+	class AdamWOptimizer : public AdamOptimizer<T> {
+	public:
+		AdamWOptimizer(T learning_rate = 0.001, T weight_decay = 0.01, T beta1 = 0.9, T beta2 = 0.999,
+			       T epsilon = 1e-8);
+		~AdamWOptimizer(void) override = default;
+	};
 }
 
 #endif
@@ -0,0 +1,236 @@
+#ifndef NN_PARALLEL_INCLUDED
+#define NN_PARALLEL_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nn::parallel {
+	// hardware_threads: number of hardware threads, at least one
+	std::size_t hardware_threads(void);
+
+	/**
+	 * @brief Process-wide work-stealing scheduler.
+	 *
+	 * Every worker owns a deque: it pushes and pops its own tasks at the
+	 * back (newest first, the data is still in cache) while the idle workers
+	 * steal from the front of the others (oldest first, the biggest pieces
+	 * of work). Tasks submitted from outside the pool go to a shared
+	 * injection queue.
+	 *
+	 * The libmat kernels, the `DataLoader` and the training of `Sequential`
+	 * all run on `ThreadPool::global()`, so they never oversubscribe the
+	 * cores. Blocking on a task is done with `TaskGroup::wait`, which runs
+	 * pending tasks instead of sleeping and makes nested parallelism safe.
+	 * With nothing left to run the waiters sleep on a condition variable,
+	 * new work or `notify_waiters` wakes them up.
+	 *
+	 * Tasks given to `submit` must not throw, `TaskGroup` is the way to get
+	 * the exceptions back.
+	 *
+	 * `parallel_for` doesn't go through the deques: the loop is published
+	 * in one of a fixed set of slots and every thread claims chunks of it
+	 * with an atomic counter, so the kernels of libmat never allocate.
+	 */
+	class ThreadPool {
+	public:
+		using Task = std::function<void(void)>;
+
+		// Counters of a worker, only updated by the worker itself
+		struct WorkerStats {
+			std::uint64_t executed;		// tasks run by the worker
+			std::uint64_t steals;		// tasks taken from the deque of another worker
+			std::uint64_t failed_steals;	// rounds over all the victims without finding work
+			std::uint64_t idles;		// times the worker went to sleep
+		};
+
+		// pin: bind the worker `i` to the cpu `i % hardware_threads()` (only on linux)
+		ThreadPool(std::size_t nworkers, bool pin = false);
+		~ThreadPool(void);
+
+		ThreadPool(const ThreadPool &) = delete;
+		ThreadPool &operator=(const ThreadPool &) = delete;
+
+		/*
+		 * global: the shared pool, created on the first use. Its size is the
+		 * one given to `configure`, otherwise NN_NUM_THREADS or else the
+		 * number of hardware threads
+		 */
+		static ThreadPool &global(void);
+		// configure: set up the global pool, throws std::logic_error if it already exists
+		static void configure(std::size_t nworkers, bool pin = false);
+
+		void submit(Task task);
+		// try_run_one: run one pending task in the calling thread, false if there was none
+		bool try_run_one(void);
+		/*
+		 * help_until: run pending tasks in the calling thread until `done()`
+		 * is true, sleeping while there is nothing to run. Whoever makes the
+		 * condition true must call `notify_waiters` afterwards. Without
+		 * `tasks` only the chunks of the `parallel_for` loops are run
+		 */
+		void help_until(const std::function<bool(void)> &done, bool tasks = true);
+		void notify_waiters(void);
+		/*
+		 * parallel_for: call `body(begin, end)` over chunks of at least `grain`
+		 * items that cover [0, n) and wait for all of them. The caller claims
+		 * chunks like the workers, the loop runs serially if all the slots
+		 * are in use. The exception of the first failed chunk is rethrown.
+		 * While it waits the caller runs chunks but never a whole task: the
+		 * task could be the forward and backward of another batch, in a
+		 * thread in the middle of its own, and the layers keep the trace of
+		 * a forward per thread (dropout masks, ...)
+		 */
+		void parallel_for(std::size_t n, std::size_t grain,
+				  const std::function<void(std::size_t, std::size_t)> &body);
+
+		std::size_t size(void) const;
+		bool is_pinned(void) const;
+		// worker_index: index of the calling thread in this pool, size() for threads outside of it
+		std::size_t worker_index(void) const;
+
+		std::vector<WorkerStats> stats(void) const;
+		ThreadPool &reset_stats(void);
+
+	private:
+		struct Worker {
+			std::mutex mutex;
+			std::deque<Task> tasks;
+			std::thread thread;
+
+			std::atomic<std::uint64_t> executed{0};
+			std::atomic<std::uint64_t> steals{0};
+			std::atomic<std::uint64_t> failed_steals{0};
+			std::atomic<std::uint64_t> idles{0};
+		};
+
+		// A `parallel_for` in flight, it lives on the stack of its caller
+		struct Job {
+			const std::function<void(std::size_t, std::size_t)> *body;
+			std::size_t n;
+			std::size_t nchunks;
+			std::atomic<std::size_t> next{0};	// the next chunk to be claimed
+			std::atomic<std::size_t> remaining;	// chunks not finished yet
+			std::atomic<bool> failed{false};
+			std::exception_ptr error;
+		};
+
+		// Where the threads find the jobs, `users` keeps a job alive while somebody looks at it
+		struct JobSlot {
+			std::atomic<Job *> job{nullptr};
+			std::atomic<std::size_t> users{0};
+			std::atomic<bool> taken{false};
+		};
+
+		static constexpr std::size_t max_jobs = 64;
+
+		void loop(std::size_t id);
+		// pop: own deque, then the injection queue, then steal
+		bool pop(std::size_t self, Task &task);
+		void run_task(std::size_t self, Task &task);
+		// run_chunk: run one chunk of any published job, false if there was none
+		bool run_chunk(std::size_t self);
+		// claim_chunk: run the next chunk of `job`, false once all of them were claimed
+		bool claim_chunk(Job &job);
+
+		std::vector<std::unique_ptr<Worker>> workers_;
+		bool pinned_;
+
+		std::mutex injected_mutex_;
+		std::deque<Task> injected_;
+
+		std::atomic<std::size_t> queued_;	// tasks in all the queues
+		std::mutex sleep_mutex_;
+		std::condition_variable sleep_cv_;
+		bool stopped_;
+
+		JobSlot jobs_[max_jobs];
+		std::atomic<std::size_t> open_jobs_;	// published jobs with chunks left to claim
+
+		// The threads in `help_until`, woken by new tasks and by `notify_waiters`
+		std::condition_variable waiters_cv_;
+		std::size_t waiters_;
+		std::atomic<std::uint64_t> notifications_;
+	};
+
+	/**
+	 * @brief A set of tasks that can be waited for together.
+	 *
+	 * @code
+	 * TaskGroup group;
+	 * for (auto &shard : shards)
+	 *     group.run([&] { shard.compute(); });
+	 * group.wait();
+	 * @endcode
+	 *
+	 * `wait` executes pending tasks of the pool while the group isn't done,
+	 * a task can create and wait for its own groups without deadlocks.
+	 */
+	class TaskGroup {
+	public:
+		TaskGroup(ThreadPool &pool = ThreadPool::global());
+		// The destructor waits but drops the exceptions, call `wait` to get them
+		~TaskGroup(void);
+
+		TaskGroup(const TaskGroup &) = delete;
+		TaskGroup &operator=(const TaskGroup &) = delete;
+
+		TaskGroup &run(std::function<void(void)> fn);
+		// wait: the exception of the first failed task is rethrown after all of them finished
+		TaskGroup &wait(void);
+
+	private:
+		ThreadPool &pool_;
+		std::size_t pending_;
+		std::exception_ptr error_;
+
+		std::mutex mutex_;
+	};
+
+	/**
+	 * @brief A fixed group of workers that run the same task in lockstep.
+	 *
+	 * `run(fn)` calls `fn(i)` once for every worker `i` in [0, size()) and
+	 * returns when all of them are done, the calling thread is the worker
+	 * zero. The calls are tasks of the global `ThreadPool`, no threads are
+	 * created, which makes it cheap enough to be used at every step of the
+	 * training.
+	 *
+	 * @code
+	 * WorkerGroup workers(4);
+	 * workers.run([&](std::size_t i) { shards[i].compute(); });
+	 * @endcode
+	 *
+	 * `current()` is the `i` of the calling thread while it runs `fn(i)`,
+	 * so state shared by the workers (the sparse gradients of a layer) can
+	 * keep a part per worker and reduce them in worker order.
+	 */
+	class WorkerGroup {
+	public:
+		static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+		WorkerGroup(std::size_t nworkers);
+
+		WorkerGroup(const WorkerGroup &) = delete;
+		WorkerGroup &operator=(const WorkerGroup &) = delete;
+
+		// run: the exception of the first failed worker is rethrown after all of them finished
+		WorkerGroup &run(const std::function<void(std::size_t)> &fn);
+		std::size_t size(void) const;
+		// current: the worker the calling thread runs in the innermost `run`, npos outside of one
+		static std::size_t current(void);
+
+	private:
+		std::size_t nworkers_;
+	};
+}
+
+#endif
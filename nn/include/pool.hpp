@@ -0,0 +1,104 @@
+#ifndef NN_POOL_INCLUDED
+#define NN_POOL_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "layer.hpp"
+
+namespace nn::layers {
+	/**
+	 * @brief The windows of a pooling over images of (channels, height,
+	 * width), with the batch layout of `Conv2D`: one image per column in
+	 * CHW order. Every channel is pooled on its own, the output is
+	 * (channels * out_height * out_width, b). Pooling has no parameters.
+	 */
+	class Pool2D : public Layer {
+	public:
+		using Layer::Layer;
+
+		// A stride of 0 moves the windows by their size, they don't overlap
+		Pool2D(std::size_t channels, std::size_t height, std::size_t width, std::size_t pool_height,
+		       std::size_t pool_width, std::size_t stride, std::string name = "Pool2D");
+		virtual ~Pool2D(void) = 0;
+
+		std::size_t get_channels(void) const;
+		std::size_t get_height(void) const;
+		std::size_t get_width(void) const;
+		std::size_t get_pool_height(void) const;
+		std::size_t get_pool_width(void) const;
+		std::size_t get_stride(void) const;
+		std::size_t get_out_height(void) const;
+		std::size_t get_out_width(void) const;
+
+		Pool2D &build(const Shape &input_shape, const Shape &output_shape) override;
+		Pool2D &build(std::size_t input_size, std::size_t output_size) override;
+		Pool2D &build(void) override;
+	protected:
+		Mat_conv2d geometry(std::size_t nbatch) const;
+
+		std::size_t channels_;
+		std::size_t height_;
+		std::size_t width_;
+		std::size_t pool_height_;
+		std::size_t pool_width_;
+		std::size_t stride_;
+		std::size_t out_height_;
+		std::size_t out_width_;
+	};
+
+	/**
+	 * @brief The maximum of every window. The forward keeps where every
+	 * maximum was, so the backward is a scatter of dY to them: the tape and
+	 * the compiled plans never read the windows again. The maxima are kept
+	 * per thread like the masks of `Dropout`, the backward of a batch goes
+	 * in the thread of its forward.
+	 */
+	template <typename T>
+	class MaxPool2D : public Pool2D {
+	public:
+		using Pool2D::Pool2D;
+
+		MaxPool2D(std::size_t channels, std::size_t height, std::size_t width, std::size_t pool_size,
+			  std::size_t stride = 0);
+		~MaxPool2D(void) override = default;
+	private:
+		// The maxima of the last forward of a thread, the number of outputs they cover and its input
+		struct Argmax {
+			std::vector<std::size_t> indices;
+			std::size_t size = 0;
+			const T *input = nullptr;
+		};
+
+		MaxPool2D &register_funcs(void) override;
+		// forward_argmax: Y = the pooling of X, the maxima are kept for the backward of this thread
+		void forward_argmax(const Mat<T> &X, Mat<T> &Y);
+		// thread_argmax: the maxima of the forward of this batch, throws if this thread didn't run it
+		const Argmax &thread_argmax(const Mat<T> &X);
+
+		utils::PerThread<Argmax> argmax_;
+	};
+
+	// The mean of every window
+	template <typename T>
+	class AvgPool2D : public Pool2D {
+	public:
+		using Pool2D::Pool2D;
+
+		AvgPool2D(std::size_t channels, std::size_t height, std::size_t width, std::size_t pool_size,
+			  std::size_t stride = 0);
+		~AvgPool2D(void) override = default;
+	protected:
+		AvgPool2D &register_funcs(void) override;
+	};
+
+	// The mean of every channel, (channels, b) for a classifier on top of the convolutions
+	template <typename T>
+	class GlobalAvgPool : public AvgPool2D<T> {
+	public:
+		GlobalAvgPool(std::size_t channels, std::size_t height, std::size_t width);
+		~GlobalAvgPool(void) override = default;
+	};
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef NN_RESIDUAL_INCLUDED
+#define NN_RESIDUAL_INCLUDED
+
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "layer.hpp"
+#include "norm.hpp"
+
+namespace nn::layers {
+	/**
+	 * @brief A skip connection around a block of layers, Y = block(X) + X,
+	 * or with `layer_norm` the post-norm one Y = LayerNorm(block(X) + X).
+	 * The block must keep the size of its input. The sum is done in place
+	 * on the output of the block, with the normalization it is fused into
+	 * the kernel of the `LayerNorm`, which reads X and block(X) once.
+	 *
+	 * The parameters are the ones of the block followed by gamma and beta
+	 * of the normalization, a `Sequential` trains them as its own. The
+	 * block runs through the allocating paths, a compiled plan calls the
+	 * residual as one layer. A thread keeps the trace of its last forward
+	 * (the inputs of the block, the sum and its statistics) for its
+	 * backward, which doesn't run the block again: the dropout masks and
+	 * the batch statistics of the block are the ones of the forward.
+	 */
+	template <typename T>
+	class Residual : public Layer {
+	public:
+		using Layer::Layer;
+
+		Residual(std::initializer_list<std::unique_ptr<Layer>> block, bool layer_norm = false,
+			 T eps = static_cast<T>(1e-5));
+		~Residual(void) override = default;
+
+		const std::vector<std::unique_ptr<Layer>> &get_block(void) const;
+		// add: append a layer to the block, the residual needs to be built again after it
+		Residual &add(std::unique_ptr<Layer> layer);
+		bool has_layer_norm(void) const;
+		LayerNorm<T> &get_layer_norm(void) const;
+
+		Residual &build(const Shape &input_shape, const Shape &output_shape) override;
+		Residual &build(std::size_t input_size, std::size_t output_size) override;
+		Residual &build(void) override;
+		// set_training: the residual and all the layers of its block
+		Residual &set_training(bool training) override;
+	private:
+		// The last forward of a thread, `inputs[i]` is the input of the layer i + 1 of the block
+		struct Trace {
+			std::vector<Mat<T>> inputs;
+			Mat<T> sum;			// block(X) + X, only with the normalization
+			std::vector<T> mean, invstd;
+			std::size_t size = 0;		// samples of the forward
+			const T *input = nullptr;	// the data of X
+		};
+
+		Residual &register_funcs(void) override;
+
+		// forward_trace: Y of X, the trace of this thread is kept for its backward
+		Mat<T> forward_trace(const Mat<T> &X);
+		// thread_trace: the trace of the forward of this batch, throws if this thread didn't run it
+		Trace &thread_trace(const Mat<T> &X);
+
+		std::vector<std::unique_ptr<Layer>> block_;
+		bool layer_norm_;
+		T eps_;
+		std::unique_ptr<LayerNorm<T>> norm_;
+		// Where the parameters of every layer of the block start, the normalization goes last
+		std::vector<std::size_t> param_offsets_;
+		utils::PerThread<Trace> traces_;
+	};
+}
+
+#endif
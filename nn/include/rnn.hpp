@@ -0,0 +1,164 @@
+#ifndef NN_RNN_INCLUDED
+#define NN_RNN_INCLUDED
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "layer.hpp"
+
+namespace nn::layers {
+	/**
+	 * @brief A recurrent layer over sequences of `seq_len` steps of
+	 * `input_size` features. A sample is a column of (seq_len * input_size)
+	 * with the steps one after the other, as `Embedding` gives them, the
+	 * output is the last hidden state (hidden_size, b) or with
+	 * `return_sequences` all of them (seq_len * hidden_size, b).
+	 *
+	 * The input projection W_x * x of every step doesn't depend on the
+	 * recurrence: it is one product of W_x with the whole sequence, then
+	 * every step takes a window of it, adds W_h * h_prev and activates all
+	 * the gates in one kernel of libmat. The forward keeps the activations
+	 * of the gates, the backpropagation through time reads them back and
+	 * ends with one product for dW_x and one for dX over the sequence.
+	 * Every thread keeps the trace of its last forward, the backward of a
+	 * batch runs after its forward in the same thread.
+	 *
+	 * The parameters are W_x (gates * hidden_size, input_size), W_h
+	 * (gates * hidden_size, hidden_size) and the biases, see `LSTM` and
+	 * `GRU` for the order of the gates.
+	 */
+	template <typename T>
+	class Recurrent : public WeightedLayer {
+	public:
+		using WeightedLayer::WeightedLayer;
+
+		virtual ~Recurrent(void) = 0;
+
+		std::size_t get_hidden_size(void) const;
+		std::size_t get_seq_len(void) const;
+		bool returns_sequences(void) const;
+		Mat<T> &get_input_weights(void) const;
+		Mat<T> &get_recurrent_weights(void) const;
+		// get_bias: (gates * hidden_size, 1), added to the input projection
+		Mat<T> &get_bias(void) const;
+
+		Recurrent &build(const Shape &input_shape, const Shape &output_shape) override;
+		Recurrent &build(std::size_t input_size, std::size_t output_size) override;
+		Recurrent &build(void) override;
+	protected:
+		Recurrent(std::size_t input_size, std::size_t hidden_size, std::size_t seq_len, bool return_sequences,
+			  std::size_t ngates, std::size_t nbiases, bool cell_state,
+			  std::shared_ptr<RandInitializer> rand_init, std::string name);
+
+		/*
+		 * cell_forward: one step, Gx is the window of the projection
+		 * (rows `ldx` apart) and Z = W_h * h_prev. h_prev and c_prev
+		 * are null at the first step. `gates` has 4 rows per unit
+		 */
+		virtual void cell_forward(const T *Gx, std::size_t ldx, const T *Z, const T *h_prev, const T *c_prev,
+					  T *gates, T *c, T *h, std::size_t ncols) const = 0;
+		/*
+		 * cell_backward: dZ and the window dG of a step from dh (and dc,
+		 * which goes back one step). Returns whether it wrote a part of
+		 * dh_prev that skips W_h into `dh_skip`
+		 */
+		virtual bool cell_backward(const T *gates, const T *h_prev, const T *c_prev, const T *c, const T *dh,
+					   T *dc, T *dZ, T *dG, std::size_t ldg, T *dh_skip, std::size_t ncols) const = 0;
+		// init_biases: the biases after a build, zeros by default
+		virtual void init_biases(void);
+
+		std::size_t hidden_size_;
+		std::size_t seq_len_;
+		bool return_sequences_;
+		std::size_t ngates_;
+		// W_x, W_h and the biases
+		std::vector<std::unique_ptr<Mat<T>>> params_;
+	private:
+		// The buffers of a pass over a batch of sequences, they only grow
+		struct Trace {
+			std::size_t ncols = 0;		// the capacity of the buffers
+			std::size_t size = 0;		// samples of the last forward
+			const T *input = nullptr;	// the data of its X
+			AlignedBuffer<T> inputs;	// (input_size, seq_len * b), the steps side by side
+			AlignedBuffer<T> projection;	// (gates * hidden_size, seq_len * b)
+			AlignedBuffer<T> states;	// (seq_len * hidden_size, b)
+			AlignedBuffer<T> cells;
+			AlignedBuffer<T> gates;		// (seq_len * 4 * hidden_size, b)
+			AlignedBuffer<T> recurrent;	// (gates * hidden_size, b), Z or dZ of a step
+			AlignedBuffer<T> dprojection;
+			AlignedBuffer<T> dh;
+			AlignedBuffer<T> dc;
+			AlignedBuffer<T> dskip;
+			AlignedBuffer<T> dinputs;
+		};
+
+		Recurrent &register_funcs(void) override;
+		Recurrent &alloc_weights(void);
+		Recurrent &alloc_gradients(void);
+
+		void reserve(Trace &trace, std::size_t ncols) const;
+		// forward_steps: Y of X, the steps are kept in `trace` for `backward_steps`
+		void forward_steps(const Mat<T> &X, Trace &trace, Mat<T> &Y) const;
+		// backward_steps: through time from the `trace` of X, dX and `grads` (added to) are nullable
+		void backward_steps(Trace &trace, const Mat<T> &dY, Mat<T> *dX, Mat<T> *grads) const;
+		// thread_trace: the trace of the forward of this batch, throws if this thread didn't run it
+		Trace &thread_trace(const Mat<T> &X);
+		// gradient_steps: the forward of X then the gradients (added to `grads`) of dY, for `fit` and `accumulate`
+		void gradient_steps(const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads);
+
+		bool cell_state_;
+		std::vector<std::unique_ptr<Mat<T>>> grads_;
+		std::size_t grad_count_ = 0;
+		bool weights_bound_ = false;
+		// The trace of `forward_into` for `backward_into`, a compiled plan runs in one thread
+		mutable Trace trace_;
+		// The trace of `feedforward` for `backward`, the batches of other threads keep their own
+		utils::PerThread<Trace> traces_;
+	};
+
+	/**
+	 * @brief Long short-term memory, the gates are input, forget, the
+	 * candidate and output (4 * hidden_size rows of W_x, W_h and the bias):
+	 * c = f * c_prev + i * g and h = o * tanh(c). The bias of the forget
+	 * gate starts at one, the cell keeps its state early in the training.
+	 */
+	template <typename T>
+	class LSTM : public Recurrent<T> {
+	public:
+		LSTM(std::size_t input_size, std::size_t hidden_size, std::size_t seq_len = 1,
+		     bool return_sequences = false, std::shared_ptr<RandInitializer> rand_init = nullptr);
+		~LSTM(void) override = default;
+	protected:
+		void cell_forward(const T *Gx, std::size_t ldx, const T *Z, const T *h_prev, const T *c_prev,
+				  T *gates, T *c, T *h, std::size_t ncols) const override;
+		bool cell_backward(const T *gates, const T *h_prev, const T *c_prev, const T *c, const T *dh,
+				   T *dc, T *dZ, T *dG, std::size_t ldg, T *dh_skip, std::size_t ncols) const override;
+		void init_biases(void) override;
+	};
+
+	/**
+	 * @brief Gated recurrent unit, the gates are reset, update and the
+	 * candidate (3 * hidden_size rows): n = tanh(W_x n x + b_x n + r *
+	 * (W_h n h_prev + b_h n)) and h = (1 - u) * n + u * h_prev. The reset
+	 * gate scales the recurrent part of the candidate, so W_h keeps its own
+	 * bias, the parameters end with b_x then b_h.
+	 */
+	template <typename T>
+	class GRU : public Recurrent<T> {
+	public:
+		GRU(std::size_t input_size, std::size_t hidden_size, std::size_t seq_len = 1,
+		    bool return_sequences = false, std::shared_ptr<RandInitializer> rand_init = nullptr);
+		~GRU(void) override = default;
+
+		// get_recurrent_bias: (3 * hidden_size, 1), added to W_h * h_prev
+		Mat<T> &get_recurrent_bias(void) const;
+	protected:
+		void cell_forward(const T *Gx, std::size_t ldx, const T *Z, const T *h_prev, const T *c_prev,
+				  T *gates, T *c, T *h, std::size_t ncols) const override;
+		bool cell_backward(const T *gates, const T *h_prev, const T *c_prev, const T *c, const T *dh,
+				   T *dc, T *dZ, T *dG, std::size_t ldg, T *dh_skip, std::size_t ncols) const override;
+	};
+}
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef NN_SERIALIZE_INCLUDED
+#define NN_SERIALIZE_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "nn.hpp"
+
+/**
+ * Binary model format (little endian, version 2):
+ *
+ *   FileHeader
+ *   LayerRecord  x (nlayers + nstate)
+ *   TensorRecord x ntensors
+ *   (padding)
+ *   raw tensors, each one starting at a `model_file_alignment` offset
+ *
+ * The tensors are stored exactly as they live in a `Mat<T>` (row-major), so
+ * a loaded model can point its weights straight into the mapped file.
+ *
+ * Version 2 added the state records (`nstate`, a reserved field in version
+ * 1). Version 1 files still load, their reserved field must be zero.
+ *
+ * Every layer of a `Sequential` has a record, the records of the block of a
+ * `Residual` follow it (`nlayers` counts them). A record stores the
+ * parameters of its layer and its non-trainable state, the running
+ * statistics of a `BatchNorm` or the pattern of a `SparseDense`.
+ */
+namespace nn::io {
+	using namespace mathops;
+	using namespace layers;
+	using namespace models;
+	using namespace optimizers;
+
+	constexpr char model_file_magic[8] = {'N', 'N', 'C', 'P', 'P', 'M', 'D', 'L'};
+	constexpr std::uint32_t model_file_version = 2;
+	constexpr std::uint32_t model_file_min_version = 1;	// the oldest version that still loads
+	constexpr std::size_t model_file_alignment = 64;
+	constexpr std::size_t model_file_name_size = 32;
+
+	enum class ModelKind : std::uint32_t {
+		Dense = 1,
+		Perceptron = 2,
+		Adeline = 3,
+		Sequential = 4,
+	};
+
+	struct FileHeader {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t dtype_size;	// sizeof(T) of the stored tensors
+		std::uint32_t kind;		// ModelKind
+		std::uint32_t nlayers;
+		std::uint32_t ntensors;
+		std::uint32_t nstate;		// training state records after the layers (optimizer), loaders skip them
+		std::uint64_t epoch;		// training epoch of the weights, zero for plain saves
+		std::uint64_t data_offset;
+		std::uint64_t file_size;
+	};
+
+	struct LayerRecord {
+		char name[model_file_name_size];	// class of the layer, e.g. "Dense" or "SigmoidFunc"
+		char activation[model_file_name_size];	// activation of a weighted layer, empty if there is none
+		std::uint64_t input_rows, input_cols;
+		std::uint64_t output_rows, output_cols;
+		std::uint64_t config[8];		// layer specific hyper-parameters, reals as the bits of a double
+		std::uint32_t first_tensor;
+		std::uint32_t ntensors;
+	};
+
+	struct TensorRecord {
+		std::uint64_t offset;	// from the beginning of the file
+		std::uint64_t rows, cols;
+	};
+
+	/**
+	 * @brief In-memory description of a model file.
+	 *
+	 * `tensors` point to the data that is going to be written, it could be
+	 * the live weights of a model or a staging copy of them.
+	 */
+	template <typename T>
+	struct ModelImage {
+		ModelKind kind;
+		std::uint64_t epoch = 0;
+		std::uint32_t nstate = 0;
+		std::vector<LayerRecord> layers;	// the state records go after the layers
+		std::vector<TensorRecord> records;
+		std::vector<const T *> tensors;
+		std::vector<std::unique_ptr<Mat<T>>> owned;	// tensors made for the image, e.g. a sparse pattern
+
+		// add_layer: append a layer record, the tensors are added after it with `add_tensor`
+		LayerRecord &add_layer(const Layer &layer, const std::string &activation = "");
+		// add_state: append the state of an optimizer, it must go after all the layers
+		LayerRecord &add_state(const Optimizer &optimizer);
+		void add_tensor(const Mat<T> &A);
+		std::size_t data_size(void) const;	// bytes of the tensors including the alignment padding
+	};
+
+	/**
+	 * @brief Read-write, copy-on-write memory mapping of a file.
+	 *
+	 * The pages are shared with every other process mapping the same file
+	 * until somebody writes on them (fine-tuning a loaded model for example).
+	 */
+	class MappedFile {
+	public:
+		MappedFile(const std::string &path);
+		~MappedFile(void);
+
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+
+		unsigned char *data(void) const;
+		std::size_t size(void) const;
+		const std::string &get_path(void) const;
+
+	private:
+		std::string path_;
+		unsigned char *data_;
+		std::size_t size_;
+	};
+
+	// Build the image of a model, the tensors point to the live weights
+	template <typename T> ModelImage<T> make_image(const Dense<T> &layer);
+	template <typename T> ModelImage<T> make_image(const Perceptron<T> &model);
+	template <typename T> ModelImage<T> make_image(const Adeline<T> &model);
+	template <typename T> ModelImage<T> make_image(const Sequential<T> &model);
+
+	// write_image: write the file atomically (temporary file + rename), `sync` makes the file and the rename durable
+	template <typename T>
+	void write_image(const std::string &path, const ModelImage<T> &image, bool sync = false);
+
+	template <typename T> void save(const std::string &path, const Dense<T> &layer);
+	template <typename T> void save(const std::string &path, const Perceptron<T> &model);
+	template <typename T> void save(const std::string &path, const Adeline<T> &model);
+	template <typename T> void save(const std::string &path, const Sequential<T> &model);
+
+	// The loaded weights point into a mapping of the file (zero-copy), a null
+	// `optimizer` selects the default optimizer of the model
+	template <typename T>
+	std::shared_ptr<Dense<T>> load_dense(const std::string &path);
+	template <typename T>
+	std::shared_ptr<Perceptron<T>> load_perceptron(const std::string &path, std::shared_ptr<Optimizer> optimizer = nullptr);
+	template <typename T>
+	std::shared_ptr<Adeline<T>> load_adeline(const std::string &path, std::shared_ptr<Optimizer> optimizer = nullptr);
+	template <typename T>
+	std::shared_ptr<Sequential<T>> load_sequential(const std::string &path, std::shared_ptr<Optimizer> optimizer = nullptr);
+
+	// restore: copy the weights and the optimizer state stored in `path` into
+	// an already built model of the same architecture, returns the stored epoch
+	template <typename T>
+	std::uint64_t restore(const std::string &path, Sequential<T> &model);
+
+	// read_header: validate and return the header of a mapped model file
+	template <typename T>
+	const FileHeader &read_header(const MappedFile &file);
+}
+
+#endif
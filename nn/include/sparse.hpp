@@ -0,0 +1,122 @@
+#ifndef NN_SPARSE_INCLUDED
+#define NN_SPARSE_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "layer.hpp"
+
+namespace nn::mathops {
+	// CSR keeps every nonzero with its column, BSR keeps blocks with one column per block
+	enum class SparseFormat { CSR, BSR };
+
+	/**
+	 * @brief A sparse matrix for the weights of pruned layers, only the
+	 * stored values are kept and read by the products of libmat
+	 * (`Mat_bsr`). CSR stores single elements, BSR stores (block_rows,
+	 * block_cols) blocks that divide the shape: fewer indices and dense
+	 * products on the blocks, at the cost of the zeros inside them.
+	 *
+	 * The pattern is fixed once built, the values are a (nnz, 1) `Mat` that
+	 * an optimizer updates like any other parameter.
+	 */
+	template <typename T>
+	class SparseMat {
+	public:
+		/*
+		 * SparseMat: the blocks of A whose sum of squares is above
+		 * `threshold`, every block with a nonzero by default. A negative
+		 * threshold keeps all of them
+		 */
+		SparseMat(const Mat<T> &A, SparseFormat format = SparseFormat::CSR, std::size_t block_rows = 1,
+			  std::size_t block_cols = 1, T threshold = static_cast<T>(0));
+		// SparseMat: the blocks of A with a flag in `keep`, one per block row after row
+		SparseMat(const Mat<T> &A, const std::vector<bool> &keep, SparseFormat format = SparseFormat::CSR,
+			  std::size_t block_rows = 1, std::size_t block_cols = 1);
+
+		const Shape &get_shape(void) const;
+		std::size_t rows(void) const;
+		std::size_t cols(void) const;
+		SparseFormat get_format(void) const;
+		std::size_t get_block_rows(void) const;
+		std::size_t get_block_cols(void) const;
+		// nnz: the stored values, the zeros inside the blocks count
+		std::size_t nnz(void) const;
+		std::size_t nblocks(void) const;
+		// density: nnz over rows * cols
+		double density(void) const;
+		Mat<T> &get_values(void);
+		const Mat<T> &get_values(void) const;
+		const std::vector<std::size_t> &get_row_ptr(void) const;
+		const std::vector<std::uint32_t> &get_col_idx(void) const;
+		// layout: the view of the pattern for the kernels, valid while the matrix lives
+		Mat_bsr layout(void) const;
+
+		Mat<T> to_dense(void) const;
+		Mat<T> dot(const Mat<T> &B) const;			// this . B
+		Mat<T> transpose_dot(const Mat<T> &B) const;		// this^T . B
+		// add_sampled_dot_transposed: G (nnz, 1) += A . B^T at the stored positions
+		const SparseMat<T> &add_sampled_dot_transposed(const Mat<T> &A, const Mat<T> &B, Mat<T> &G) const;
+
+		// block_norms: the sum of squares of every block of A, row after row
+		static std::vector<T> block_norms(const Mat<T> &A, std::size_t block_rows, std::size_t block_cols);
+	private:
+		Shape shape_;
+		SparseFormat format_;
+		std::size_t block_rows_;
+		std::size_t block_cols_;
+		std::vector<std::size_t> row_ptr_;
+		std::vector<std::uint32_t> col_idx_;
+		Mat<T> values_;
+	};
+}
+
+namespace nn::layers {
+	/**
+	 * @brief A `Dense` layer whose weights are a `SparseMat`, the output is
+	 * f(W . X + B) with only the stored weights: the products cost the
+	 * nonzeros and not output_size * input_size. The layer trains the stored
+	 * values and the bias, a pruned weight stays at zero.
+	 *
+	 * The parameters are the values of the weights (nnz, 1) and the bias.
+	 */
+	template <typename T>
+	class SparseDense : public WeightedLayer {
+	public:
+		SparseDense(const SparseMat<T> &weights, std::shared_ptr<Layer> activation_func = nullptr);
+		SparseDense(const SparseMat<T> &weights, const Mat<T> &bias, std::shared_ptr<Layer> activation_func = nullptr);
+		~SparseDense(void) override = default;
+
+		SparseMat<T> &get_weights(void) const;
+		Mat<T> &get_bias(void) const;
+
+		SparseDense &build(const Shape &input_shape, const Shape &output_shape) override;
+		SparseDense &build(std::size_t input_size, std::size_t output_size) override;
+		SparseDense &build(void) override;
+	private:
+		SparseDense &register_funcs(void) override;
+		SparseDense &alloc_gradients(void);
+
+		std::unique_ptr<SparseMat<T>> weights_;
+		std::unique_ptr<Mat<T>> bias_;
+		std::unique_ptr<Mat<T>> grad_values_;
+		std::unique_ptr<Mat<T>> grad_bias_;
+		std::size_t grad_count_ = 0;
+	};
+
+	/*
+	 * prune_dense: magnitude pruning of a built `Dense`, the `sparsity`
+	 * fraction of its weights (of its blocks with BSR, by their sum of
+	 * squares) with the smallest magnitude is dropped and the rest goes to
+	 * a `SparseDense` with the same bias, activation, name and optimizer,
+	 * built and ready to be fine-tuned. The number of blocks dropped is
+	 * rounded down, at least one is kept
+	 */
+	template <typename T>
+	std::unique_ptr<SparseDense<T>> prune_dense(const Dense<T> &dense, double sparsity,
+						    SparseFormat format = SparseFormat::CSR,
+						    std::size_t block_rows = 1, std::size_t block_cols = 1);
+}
+
+#endif
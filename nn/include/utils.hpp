@@ -2,9 +2,15 @@
 #define NN_UTILS_INCLUDED
 
 #include <any>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
+#include <mutex>
+#include <new>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <typeindex>
 #include <vector>
 #include <unordered_map>
@@ -99,6 +105,23 @@ namespace nn::utils {
 			return std::any_cast<std::function<Ret(Args...)>>(it->second);
 		}
 
+		/**
+		 * @brief Check if a function was registered under a given name and type signature.
+		 *
+		 * Useful for optional entries, where the caller has a fallback.
+		 *
+		 * Example:
+		 * @code
+		 * if (has_func<int, int>("square"))
+		 *     get_func<int, int>("square")(4);
+		 * @endcode
+		 */
+		template<typename Ret, typename... Args>
+		bool has_func(const std::string& name) const
+		{
+			return vtable_.find(make_signature<Ret, Args...>(name)) != vtable_.end();
+		}
+
 	protected:
 		/**
 		 * @brief Registers the functions required by the derived class.
@@ -153,6 +176,99 @@ namespace nn::utils {
 		/// The actual vtable storage (maps signature -> function)
 		std::unordered_map<FuncKey, std::any, FuncKeyHash, FuncKeyEqual> vtable_;
 	};
+
+	/**
+	 * @brief An owning, zero initialized array aligned for vector loads.
+	 *
+	 * The memory starts at a multiple of `Alignment` bytes (a cache line by
+	 * default), so kernels that stream over it never split a vector load
+	 * across two lines. Used for the flat state of the optimizers and the
+	 * parameter slabs of the models, `Mat` views are placed over it with
+	 * `Mat<T>(shape, buffer.data() + offset)`.
+	 */
+	template <typename T, std::size_t Alignment = 64>
+	class AlignedBuffer {
+	public:
+		AlignedBuffer(void) : data_(nullptr), size_(0) {}
+		explicit AlignedBuffer(std::size_t size) : AlignedBuffer() { resize(size); }
+		~AlignedBuffer(void) { std::free(data_); }
+
+		AlignedBuffer(const AlignedBuffer &) = delete;
+		AlignedBuffer &operator=(const AlignedBuffer &) = delete;
+
+		AlignedBuffer(AlignedBuffer &&other) noexcept : data_(other.data_), size_(other.size_)
+		{
+			other.data_ = nullptr;
+			other.size_ = 0;
+		}
+
+		AlignedBuffer &operator=(AlignedBuffer &&other) noexcept
+		{
+			if (this != &other) {
+				std::free(data_);
+				data_ = other.data_;
+				size_ = other.size_;
+				other.data_ = nullptr;
+				other.size_ = 0;
+			}
+			return *this;
+		}
+
+		// resize: drop the old contents and hold `size` zeros
+		AlignedBuffer &resize(std::size_t size)
+		{
+			std::free(data_);
+			data_ = nullptr;
+			size_ = 0;
+			if (size == 0)
+				return *this;
+
+			// aligned_alloc wants a multiple of the alignment
+			std::size_t bytes = (size * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+			data_ = static_cast<T *>(std::aligned_alloc(Alignment, bytes));
+			if (data_ == nullptr)
+				throw std::bad_alloc();
+			std::memset(static_cast<void *>(data_), 0, bytes);
+			size_ = size;
+			return *this;
+		}
+
+		// round_up: elements of a segment that keeps the next one aligned
+		static std::size_t round_up(std::size_t n)
+		{
+			constexpr std::size_t step = Alignment / sizeof(T) > 0 ? Alignment / sizeof(T) : 1;
+			return (n + step - 1) / step * step;
+		}
+
+		T *data(void) { return data_; }
+		const T *data(void) const { return data_; }
+		std::size_t size(void) const { return size_; }
+
+	private:
+		T *data_;
+		std::size_t size_;
+	};
+
+	/**
+	 * @brief One value per thread, for what a layer keeps from a forward for
+	 * the backward of the same batch (masks, maxima, traces). The data
+	 * parallel workers run their forward and backward in the same thread,
+	 * so each of them finds its own. The values never move, the reference
+	 * stays valid out of the lock.
+	 */
+	template <typename V>
+	class PerThread {
+	public:
+		V &get(void)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return values_[std::this_thread::get_id()];
+		}
+
+	private:
+		std::mutex mutex_;
+		std::unordered_map<std::thread::id, V> values_;
+	};
 } 
 
 #endif
@@ -3,6 +3,25 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+/* --- Parallel execution hook --- */
+
+/* Mat_range_fn: computes the items [begin, end) of a kernel, `ctx` holds its arguments */
+typedef void (*Mat_range_fn)(void *ctx, size_t begin, size_t end);
+
+/* Mat_parallel_for_fn: runs `body` over [0, n) in chunks of at least `grain` items and waits for all of them */
+typedef void (*Mat_parallel_for_fn)(Mat_range_fn body, void *ctx, size_t n, size_t grain);
+
+/* Mat_set_parallel_for: install the scheduler of the kernels, NULL (the default) runs them serially.
+ * The library never creates threads by itself, the host application decides where the work runs */
+extern void Mat_set_parallel_for(Mat_parallel_for_fn fn);
+
+/* Mat_get_parallel_for: the installed scheduler, NULL if there is none */
+extern Mat_parallel_for_fn Mat_get_parallel_for(void);
+
+/* Mat_parallel_for: run `body` over [0, n) with the installed scheduler, serially if n <= grain */
+extern void Mat_parallel_for(Mat_range_fn body, void *ctx, size_t n, size_t grain);
 
 /* --- Mat 32 bit operations --- */
 
@@ -63,6 +82,291 @@ extern void Matf32_transpose(const float *A, float *B, size_t nrows,
 /* Matf32_equal: Evaluates if A ~ B within epsilon tolerance */
 extern bool Matf32_equal(const float *A, const float *B, size_t nrows, size_t ncols, float eps);
 
+/* Matf32_axpy: B += a * A, both of size nrows x ncols */
+extern void Matf32_axpy(const float *A, float *B, size_t nrows, size_t ncols, float a);
+
+/* Matf32_add_colvec: add the column vector v (nrows x 1) to every column of A (nrows x ncols) */
+extern void Matf32_add_colvec(float *A, const float *v, size_t nrows, size_t ncols);
+
+/* Matf32_add_row_sum: v += the sum of every row of A (nrows x ncols), v is (nrows x 1) */
+extern void Matf32_add_row_sum(const float *A, float *v, size_t nrows, size_t ncols);
+
+/* Matf32_dot_nt_acc: C += A * B^T
+ * A is (nrowsA x ncolsA), B is (nrowsB x ncolsA), C is (nrowsA x nrowsB)
+ */
+extern void Matf32_dot_nt_acc(const float *A, const float *B, float *C, size_t nrowsA,
+			      size_t ncolsA, size_t nrowsB);
+
+/* Matf32_dot_tn: matrix product C = A^T * B
+ * A is (nrowsA x ncolsA), B is (nrowsA x ncolsB), result C is (ncolsA x ncolsB)
+ */
+extern void Matf32_dot_tn(const float *A, const float *B, float *C, size_t nrowsA,
+			  size_t ncolsA, size_t ncolsB);
+
+/* --- Optimizer steps ---
+ * Fused in place updates of a parameter `P` of n elements given its gradient `G`,
+ * one pass over memory and no temporaries. The state buffers are updated in place */
+
+/* Matf32_momentum_step: V = mu * V + G, then P -= lr * V
+ * (nesterov: P -= lr * (G + mu * V)) */
+extern void Matf32_momentum_step(float *P, const float *G, float *V, size_t n,
+				 float lr, float mu, bool nesterov);
+
+/* Matf32_rmsprop_step: S = rho * S + (1 - rho) * G^2, then P -= lr * G / (sqrt(S) + eps) */
+extern void Matf32_rmsprop_step(float *P, const float *G, float *S, size_t n,
+				float lr, float rho, float eps);
+
+/* Matf32_adam_step: M = beta1 * M + (1 - beta1) * G, V = beta2 * V + (1 - beta2) * G^2,
+ * then P -= lr * (M / c1) / (sqrt(V / c2) + eps) + lr * wd * P
+ * c1 = 1 - beta1^t and c2 = 1 - beta2^t are the bias corrections of the step t,
+ * wd is the decoupled weight decay of AdamW (zero for Adam) */
+extern void Matf32_adam_step(float *P, const float *G, float *M, float *V, size_t n,
+			     float lr, float beta1, float beta2, float eps, float wd,
+			     float c1, float c2);
+
+/* --- Losses --- */
+
+/* Matf32_sigmoid_cross_entropy: binary cross-entropy of the logits `Z` against the
+ * targets `Y` (n elements), returns the sum of the losses and, if `G` isn't NULL,
+ * writes dL/dZ = sigmoid(Z) - Y in the same pass. Stable for any logit */
+extern float Matf32_sigmoid_cross_entropy(const float *Z, const float *Y, float *G, size_t n);
+
+/* Matf32_softmax_cols: P = softmax of every column of `Z` (`nrows` classes, `ncols`
+ * samples), the maximum of the column is subtracted before the exponentials.
+ * P can be Z. The softmax kernels don't allocate */
+extern void Matf32_softmax_cols(const float *Z, float *P, size_t nrows, size_t ncols);
+
+/* Matf32_softmax_cross_entropy: categorical cross-entropy of the logits `Z` against
+ * the targets `Y` (one sample per column), returns the sum of the losses and, if
+ * `G` isn't NULL, writes dL/dZ = softmax(Z) - Y in the same pass */
+extern float Matf32_softmax_cross_entropy(const float *Z, const float *Y, float *G,
+					  size_t nrows, size_t ncols);
+
+/* Row sums of the losses of the predictions `P` against the targets `Y` (`nrows`
+ * outputs, `ncols` samples): S[i] += sum_j loss(P[i][j], Y[i][j]) */
+extern void Matf32_abs_error_rows(const float *P, const float *Y, float *S, size_t nrows, size_t ncols);
+extern void Matf32_squared_error_rows(const float *P, const float *Y, float *S, size_t nrows, size_t ncols);
+/* -(y log(p + 1e-8) + (1 - y) log(1 - p + 1e-8)) */
+extern void Matf32_binary_cross_entropy_rows(const float *P, const float *Y, float *S, size_t nrows, size_t ncols);
+/* -y log(p + 1e-8) */
+extern void Matf32_categorical_cross_entropy_rows(const float *P, const float *Y, float *S, size_t nrows, size_t ncols);
+
+/* --- 2D convolutions --- */
+
+/*
+ * Mat_conv2d: geometry of a 2D convolution over `nbatch` images of (channels,
+ * height, width). The batch is stored one image per column, so the element
+ * (c, h, w) of the image j is X[((c * height + h) * width + w) * nbatch + j]
+ * and every pixel holds the whole batch contiguous. The outputs use the same
+ * layout with (filters, out_height, out_width)
+ */
+struct Mat_conv2d {
+	size_t channels;
+	size_t height;
+	size_t width;
+	size_t kernel_h;
+	size_t kernel_w;
+	size_t stride;
+	size_t padding;
+	size_t dilation;
+	size_t out_height;
+	size_t out_width;
+	size_t nbatch;
+};
+
+/* Matf32_im2col: unfold the patches of X into `cols` (channels * kernel_h * kernel_w x
+ * out_height * out_width * nbatch), the padding reads zeros. W (filters x rows of cols)
+ * times `cols` is the convolution, already in the layout of the outputs */
+extern void Matf32_im2col(const float *X, float *cols, const struct Mat_conv2d *conv);
+
+/* Matf32_col2im_acc: X += the patches of `cols` folded back, the adjoint of Matf32_im2col */
+extern void Matf32_col2im_acc(const float *cols, float *X, const struct Mat_conv2d *conv);
+
+/* Matf32_conv2d_direct: Y = W * X of `nfilters` filters (nfilters x channels * kernel_h *
+ * kernel_w) without unfolding X, stride 1 only. Every tap of the kernel adds a shifted row
+ * of X to a row of Y, both contiguous over the output columns and the batch */
+extern void Matf32_conv2d_direct(const float *X, const float *W, float *Y, size_t nfilters,
+				 const struct Mat_conv2d *conv);
+
+/* Matf32_conv2d_direct_backward: dW += dY (x) X and dX = W^T * dY, the backward of
+ * Matf32_conv2d_direct. Any of dW and dX can be NULL to skip it */
+extern void Matf32_conv2d_direct_backward(const float *X, const float *W, const float *dY, float *dX,
+					  float *dW, size_t nfilters, const struct Mat_conv2d *conv);
+
+/* --- 2D pooling, the windows of a `Mat_conv2d` over every channel, filters = channels --- */
+
+/* Matf32_maxpool2d: Y = the maximum of every window. If `argmax` isn't NULL it gets the
+ * index in X of every maximum, one per element of Y, for the backward */
+extern void Matf32_maxpool2d(const float *X, float *Y, size_t *argmax, const struct Mat_conv2d *conv);
+
+/* Matf32_maxpool2d_backward: dX = dY scattered to the maxima of `argmax`, zero elsewhere */
+extern void Matf32_maxpool2d_backward(const float *dY, const size_t *argmax, float *dX,
+				      const struct Mat_conv2d *conv);
+
+/* Matf32_avgpool2d: Y = the mean of every window, the padding counts as zeros */
+extern void Matf32_avgpool2d(const float *X, float *Y, const struct Mat_conv2d *conv);
+
+/* Matf32_avgpool2d_backward: dX = dY spread evenly over the windows */
+extern void Matf32_avgpool2d_backward(const float *dY, float *dX, const struct Mat_conv2d *conv);
+
+/* --- Normalization --- */
+
+/* Matf32_batchnorm_forward: Y = gamma * (X - mean) * invstd + beta of every row of X (nrows
+ * x ncols, one sample per column), gamma and beta are (nrows x 1). With `batch_stats` the
+ * mean and 1 / sqrt(var + eps) of every row over the batch are computed into `mean` and
+ * `invstd` first, otherwise they are read from them. Y can be X */
+extern void Matf32_batchnorm_forward(const float *X, float *Y, const float *gamma, const float *beta,
+				     float *mean, float *invstd, size_t nrows, size_t ncols, float eps,
+				     bool batch_stats);
+
+/* Matf32_batchnorm_backward: dX of Matf32_batchnorm_forward with the same statistics, and
+ * dgamma += sum dY * (X - mean) * invstd, dbeta += sum dY of every row. Without
+ * `batch_stats` the statistics are constants. dX, or dgamma and dbeta, can be NULL */
+extern void Matf32_batchnorm_backward(const float *X, const float *dY, const float *gamma, const float *mean,
+				      const float *invstd, float *dX, float *dgamma, float *dbeta,
+				      size_t nrows, size_t ncols, bool batch_stats);
+
+/* Matf32_layernorm_forward: Y = gamma * (S - mean) * invstd + beta, the statistics of every
+ * column of S (nrows x ncols) over its rows go to `mean` and `invstd` (ncols). With a residual
+ * R the sum S = X + R is made in the same pass, otherwise S is X and can be NULL. S can be X
+ * or R, Y can be S */
+extern void Matf32_layernorm_forward(const float *X, const float *R, float *S, float *Y, const float *gamma,
+				     const float *beta, float *mean, float *invstd, size_t nrows, size_t ncols,
+				     float eps);
+
+/* Matf32_layernorm_backward: dX of Matf32_layernorm_forward from its input S and statistics,
+ * dgamma += sum dY * (S - mean) * invstd and dbeta += sum dY of every row. dX can be dY,
+ * dX or dgamma and dbeta can be NULL */
+extern void Matf32_layernorm_backward(const float *S, const float *dY, const float *gamma, const float *mean,
+				      const float *invstd, float *dX, float *dgamma, float *dbeta,
+				      size_t nrows, size_t ncols);
+
+/* --- Dropout --- */
+
+/* Mat_dropout_mask_words: the words of the packed mask of n elements, one bit per element */
+static inline size_t Mat_dropout_mask_words(size_t n)
+{
+	return (n + 63) / 64;
+}
+
+/* Matf32_dropout_forward: Y = X / (1 - rate) where the mask keeps an element, 0 elsewhere, for
+ * `n` elements. The random numbers come from a counter-based generator: the element i of the
+ * call draws a hash of (seed, counter, i), the same arguments give the same mask, and calls
+ * with counters `n` apart never share a draw. The mask (Mat_dropout_mask_words(n)) can be NULL,
+ * Y can be X */
+extern void Matf32_dropout_forward(const float *X, float *Y, uint64_t *mask, size_t n, float rate,
+				   uint64_t seed, uint64_t counter);
+
+/* Matf32_dropout_backward: dX = dY / (1 - rate) where `mask` kept the element, 0 elsewhere.
+ * dX can be dY */
+extern void Matf32_dropout_backward(const float *dY, const uint64_t *mask, float *dX, size_t n, float rate);
+
+/* --- Recurrent cells --- */
+
+/* Matf32_lstm_cell: one step of an LSTM of `hidden` units over `ncols` samples. The rows of the
+ * pre-activations are the input gate, the forget gate, the candidate and the output gate, hidden
+ * each: Z (4 * hidden x ncols) holds W_h * h_prev, Gx the projection of the input of the step
+ * (4 * hidden rows `ldx` apart, a window of the projection of the whole sequence) and `bias`
+ * (4 * hidden) is added to both. The activations i, f, g, o go to `gates` (4 * hidden x ncols),
+ * c = f * c_prev + i * g and h = o * tanh(c) (hidden x ncols). c_prev can be NULL for zeros */
+extern void Matf32_lstm_cell(const float *Gx, size_t ldx, const float *Z, const float *bias, const float *c_prev,
+			     float *gates, float *c, float *h, size_t hidden, size_t ncols);
+
+/* Matf32_lstm_cell_backward: from the `gates`, c_prev and c of a step and dL/dh of the step, the
+ * gradient of the pre-activations into dZ (4 * hidden x ncols) and, if it isn't NULL, into dG too
+ * (rows `ldg` apart). dc holds dL/dc from the next step and leaves with dL/dc_prev */
+extern void Matf32_lstm_cell_backward(const float *gates, const float *c_prev, const float *c, const float *dh,
+				      float *dc, float *dZ, float *dG, size_t ldg, size_t hidden, size_t ncols);
+
+/* Matf32_gru_cell: one step of a GRU, the rows of the pre-activations are the reset gate r, the
+ * update gate u and the candidate n, Z and Gx as for Matf32_lstm_cell with 3 * hidden rows.
+ * bias_x goes with Gx and bias_h with Z: n = tanh(gx_n + bx_n + r * (z_n + bh_n)) and
+ * h = (1 - u) * n + u * h_prev. `gates` (4 * hidden x ncols) gets r, u, n and z_n + bh_n.
+ * h_prev can be NULL for zeros */
+extern void Matf32_gru_cell(const float *Gx, size_t ldx, const float *Z, const float *bias_x, const float *bias_h,
+			    const float *h_prev, float *gates, float *h, size_t hidden, size_t ncols);
+
+/* Matf32_gru_cell_backward: from the `gates` and h_prev of a step and dL/dh, the gradient of
+ * the input pre-activations into dG (rows `ldg` apart), the one of the recurrent ones into dZ
+ * (3 * hidden x ncols) and the part of dL/dh_prev that skips W_h, dh * u, into dh_prev
+ * (nullable) */
+extern void Matf32_gru_cell_backward(const float *gates, const float *h_prev, const float *dh, float *dZ,
+				     float *dG, size_t ldg, float *dh_prev, size_t hidden, size_t ncols);
+
+/* --- Attention --- */
+
+/*
+ * Mat_attention: geometry of a multi-head attention over `nbatch` sequences
+ * of `seq_len` tokens. Q, K, V and O hold one token per column, the tokens
+ * of a sample next to each other: the element d of the head h of the token
+ * t of the sample j is X[(h * head_dim + d) * ld + j * seq_len + t] with
+ * ld = nbatch * seq_len. The scores are scaled by 1 / sqrt(head_dim), with
+ * `causal` a token only attends to itself and the ones before it
+ */
+struct Mat_attention {
+	size_t seq_len;
+	size_t head_dim;
+	size_t nheads;
+	size_t nbatch;
+	bool causal;
+};
+
+/* Mat_attention_workspace: the floats of the `work` of Matf32_attention_forward and
+ * Matf32_attention_backward, (2 * head_dim * 32 + seq_len) per head of every sample */
+extern size_t Mat_attention_workspace(const struct Mat_attention *att);
+
+/* Matf32_attention_forward: O = V softmax(scale * K^T Q) of every head of every sample. The
+ * scores are taken by tiles of 32 queries and 32 keys with an online softmax (running maximum
+ * and sum per query), the (seq_len x seq_len) matrix is never built and the scratch in `work`
+ * (Mat_attention_workspace floats) doesn't grow with the square of the sequence. If `lse`
+ * isn't NULL it gets the log-sum-exp of the scores of every query (nbatch * nheads * seq_len)
+ * for the backward */
+extern void Matf32_attention_forward(const float *Q, const float *K, const float *V, float *O, float *lse,
+				     float *work, const struct Mat_attention *att);
+
+/* Matf32_attention_backward: dQ, dK and dV of Matf32_attention_forward from its output O, dO
+ * and `lse`. The probabilities are recomputed by tiles from the scores and `lse`, the
+ * scratch is `work` as in the forward */
+extern void Matf32_attention_backward(const float *Q, const float *K, const float *V, const float *O,
+				      const float *dO, const float *lse, float *dQ, float *dK, float *dV,
+				      float *work, const struct Mat_attention *att);
+
+/* --- Sparse matrices --- */
+
+/*
+ * Mat_bsr: pattern of a sparse (nrows x ncols) matrix stored by blocks of
+ * (block_rows x block_cols) that divide it, CSR is the case of 1 x 1 blocks.
+ * The blocks of the block row i are k = row_ptr[i] .. row_ptr[i + 1] - 1,
+ * col_idx[k] is the block column of k and its values are the row major
+ * block at values + k * block_rows * block_cols. Only the stored blocks are
+ * read, a product costs the stored values and not nrows * ncols
+ */
+struct Mat_bsr {
+	size_t nrows;
+	size_t ncols;
+	size_t block_rows;
+	size_t block_cols;
+	const size_t *row_ptr;		/* nrows / block_rows + 1 */
+	const uint32_t *col_idx;	/* row_ptr[nrows / block_rows] */
+};
+
+/* Matf32_bsr_dot: C = A * B, B is (ncols x ncolsB) and C (nrows x ncolsB) with one sample per
+ * column. Parallel over the block rows, a stored value multiplies a whole row of B. With CSR
+ * blocks of 8 samples of C stay in registers over a row, a vector is a gathered dot product */
+extern void Matf32_bsr_dot(const struct Mat_bsr *A, const float *values, const float *B, float *C,
+			   size_t ncolsB);
+
+/* Matf32_bsr_dot_tn: C = A^T * B, B is (nrows x ncolsB) and C (ncols x ncolsB). The blocks
+ * scatter to the rows of C, it is parallel over the columns */
+extern void Matf32_bsr_dot_tn(const struct Mat_bsr *A, const float *values, const float *B, float *C,
+			      size_t ncolsB);
+
+/* Matf32_bsr_sampled_dot_nt_acc: values += X * Y^T only at the stored positions of A, X is
+ * (nrows x ncols) and Y (ncols(A) x ncols): the gradient of the values of A in C = A * Y with
+ * dL/dC = X, without the dense (nrows x ncols(A)) product */
+extern void Matf32_bsr_sampled_dot_nt_acc(const struct Mat_bsr *A, const float *X, const float *Y, float *values,
+					  size_t ncols);
+
 // TODO: Build the implemenations, tests and don't forget sub and div matrices, sub and div scalar, and grand sum
 
 /* --- Mat 64 bit operations --- */
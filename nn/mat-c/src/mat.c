@@ -5,8 +5,21 @@
 #include <math.h>
 #include <stdbool.h>
 
+#include "../include/mat.h"
+
 /* TODO: Implement the optional versions */
 
+/* Element-wise kernels only go parallel over this number of elements */
+#define MAT_ELEMENTWISE_GRAIN ((size_t) 1 << 15)
+
+/* Arguments of the element-wise kernels for `Mat_parallel_for` */
+struct Matf32_binary_args {
+	const float *A;
+	const float *B;
+	float *C;
+	float a;
+};
+
 
 /* Matf32_rand_uniform: fill matrix A (nrows x ncols) with samples from U[min, max) */
 void Matf32_rand_uniform(float *A, size_t nrows, size_t ncols, float min, float max) {
@@ -87,18 +100,32 @@ void Matf32_div_scalar(float *A, size_t nrows, size_t ncols, float a) {
 	}
 }
 
+static void Matf32_add_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_binary_args *args = ctx;
+	for (size_t i = begin; i < end; i++) {
+		args->C[i] = args->A[i] + args->B[i];
+	}
+}
+
 /* Matf32_add: element-wise addition of matrices A and B, result in C (all of size nrows x ncols) */
 void Matf32_add(const float *A, const float *B, float *C, size_t nrows, size_t ncols) {
 	assert(A && "A can't be null");
 	assert(B && "B can't be null");
 	assert(C && "C can't be null");
-	size_t total = nrows * ncols;
-	for (size_t i = 0; i < total; i++) {
-		C[i] = A[i] + B[i];
-	}
+	struct Matf32_binary_args args = {A, B, C, 0.0f};
+	Mat_parallel_for(Matf32_add_range, &args, nrows * ncols, MAT_ELEMENTWISE_GRAIN);
 }
 
 
+static void Matf32_sub_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_binary_args *args = ctx;
+	for (size_t i = begin; i < end; i++) {
+		args->C[i] = args->A[i] - args->B[i];
+	}
+}
+
 /* Matf32_sub: element-wise subtraction of matrices A and B, result in C (all of size nrows x ncols) */
 void Matf32_sub(const float *A, const float *B, float *C, size_t nrows,
 		size_t ncols)
@@ -106,9 +133,15 @@ void Matf32_sub(const float *A, const float *B, float *C, size_t nrows,
 	assert(A && "A can't be null");
 	assert(B && "B can't be null");
 	assert(C && "C can't be null");
-	size_t total = nrows * ncols;
-	for (size_t i = 0; i < total; i++) {
-		C[i] = A[i] - B[i];
+	struct Matf32_binary_args args = {A, B, C, 0.0f};
+	Mat_parallel_for(Matf32_sub_range, &args, nrows * ncols, MAT_ELEMENTWISE_GRAIN);
+}
+
+static void Matf32_mul_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_binary_args *args = ctx;
+	for (size_t i = begin; i < end; i++) {
+		args->C[i] = args->A[i] * args->B[i];
 	}
 }
 
@@ -118,23 +151,27 @@ void Matf32_mul(const float *A, const float *B, float *C, size_t nrows, size_t n
 	assert(A && "A can't be null");
 	assert(B && "B can't be null");
 	assert(C && "C can't be null");
-	size_t total = nrows * ncols;
-	for (size_t i = 0; i < total; i++) {
-		C[i] = A[i] * B[i];
-	}
+	struct Matf32_binary_args args = {A, B, C, 0.0f};
+	Mat_parallel_for(Matf32_mul_range, &args, nrows * ncols, MAT_ELEMENTWISE_GRAIN);
 }
 
 
+static void Matf32_div_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_binary_args *args = ctx;
+	for (size_t i = begin; i < end; i++) {
+		args->C[i] = args->A[i] / args->B[i];
+	}
+}
+
 /* Matf32_div: element-wise (Hadamard) division of matrices A and B, result in C (all of size nrows x ncols) */
 void Matf32_div(const float *A, const float *B, float *C, size_t nrows, size_t ncols)
 {
 	assert(A && "A can't be null");
 	assert(B && "B can't be null");
 	assert(C && "C can't be null");
-	size_t total = nrows * ncols;
-	for (size_t i = 0; i < total; i++) {
-		C[i] = A[i] / B[i];
-	}
+	struct Matf32_binary_args args = {A, B, C, 0.0f};
+	Mat_parallel_for(Matf32_div_range, &args, nrows * ncols, MAT_ELEMENTWISE_GRAIN);
 }
 
 
@@ -196,3 +233,47 @@ bool Matf32_equal(const float *A, const float *B, size_t nrows, size_t ncols, fl
     return true;
 }
 
+
+static void Matf32_axpy_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_binary_args *args = ctx;
+	for (size_t i = begin; i < end; i++) {
+		args->C[i] += args->a * args->A[i];
+	}
+}
+
+/* Matf32_axpy: B += a * A, both of size nrows x ncols */
+void Matf32_axpy(const float *A, float *B, size_t nrows, size_t ncols, float a)
+{
+	assert(A && "A can't be null");
+	assert(B && "B can't be null");
+	struct Matf32_binary_args args = {A, NULL, B, a};
+	Mat_parallel_for(Matf32_axpy_range, &args, nrows * ncols, MAT_ELEMENTWISE_GRAIN);
+}
+
+/* Matf32_add_colvec: add the column vector v (nrows x 1) to every column of A (nrows x ncols) */
+void Matf32_add_colvec(float *A, const float *v, size_t nrows, size_t ncols)
+{
+	assert(A && "A can't be null");
+	assert(v && "v can't be null");
+	for (size_t i = 0; i < nrows; i++) {
+		float vi = v[i];
+		for (size_t j = 0; j < ncols; j++) {
+			A[i * ncols + j] += vi;
+		}
+	}
+}
+
+/* Matf32_add_row_sum: v += the sum of every row of A (nrows x ncols), v is (nrows x 1) */
+void Matf32_add_row_sum(const float *A, float *v, size_t nrows, size_t ncols)
+{
+	assert(A && "A can't be null");
+	assert(v && "v can't be null");
+	for (size_t i = 0; i < nrows; i++) {
+		float sum = 0.0f;
+		for (size_t j = 0; j < ncols; j++) {
+			sum += A[i * ncols + j];
+		}
+		v[i] += sum;
+	}
+}
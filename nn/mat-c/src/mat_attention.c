@@ -0,0 +1,240 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../include/mat.h"
+#include "mat_gemm.h"
+
+/* Queries and keys per block, a tile of scores is MAT_ATTENTION_BLOCK^2 floats */
+#define MAT_ATTENTION_BLOCK ((size_t) 32)
+
+/* Arguments of the attention for `Mat_parallel_for` */
+struct Matf32_attention_args {
+	const float *Q;
+	const float *K;
+	const float *V;
+	const float *O;
+	const float *dO;
+	float *out;
+	float *lse;
+	const float *lse_in;
+	float *work;
+	float *dQ;
+	float *dK;
+	float *dV;
+	const struct Mat_attention *att;
+};
+
+static size_t attention_min(size_t a, size_t b)
+{
+	return a < b ? a : b;
+}
+
+/* The scratch of every (sample, head): dK and dV of a block of keys, then D of every query */
+static size_t attention_scratch(const struct Mat_attention *att)
+{
+	return 2 * att->head_dim * MAT_ATTENTION_BLOCK + att->seq_len;
+}
+
+size_t Mat_attention_workspace(const struct Mat_attention *att)
+{
+	assert(att && "the attention can't be null");
+	return att->nbatch * att->nheads * attention_scratch(att);
+}
+
+/* The column of the first query of the sample j and the first row of the head h */
+static size_t attention_offset(const struct Mat_attention *att, size_t task)
+{
+	size_t j = task / att->nheads, h = task % att->nheads;
+	return h * att->head_dim * att->nbatch * att->seq_len + j * att->seq_len;
+}
+
+/*
+ * S = scale * Q_blk^T K_blk of the queries [q0, q0 + nq) and the keys
+ * [k0, k0 + nk), -inf where a causal key comes after its query
+ */
+static void attention_scores(const struct Mat_attention *att, const float *Qt, const float *Kt, size_t q0,
+			     size_t nq, size_t k0, size_t nk, float *S)
+{
+	size_t ld = att->nbatch * att->seq_len;
+	float scale = 1.0f / sqrtf((float) att->head_dim);
+	for (size_t i = 0; i < nq * MAT_ATTENTION_BLOCK; i++)
+		S[i] = 0.0f;
+	gemm_tn_acc(nq, nk, att->head_dim, Qt + q0, ld, Kt + k0, ld, S, MAT_ATTENTION_BLOCK);
+	for (size_t i = 0; i < nq; i++)
+		for (size_t c = 0; c < nk; c++)
+			S[i * MAT_ATTENTION_BLOCK + c] = att->causal && k0 + c > q0 + i ?
+				-INFINITY : S[i * MAT_ATTENTION_BLOCK + c] * scale;
+}
+
+/*
+ * Every (sample, head) of [begin, end) on its own. A block of queries keeps
+ * a running maximum m and sum l of its exponentials: a new block of keys
+ * rescales the output by exp(m_old - m_new) before adding its own P * V,
+ * and the division by l happens once at the end
+ */
+static void Matf32_attention_forward_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_attention_args *args = ctx;
+	const struct Mat_attention *att = args->att;
+	size_t T = att->seq_len, dh = att->head_dim, ld = att->nbatch * T;
+	float S[MAT_ATTENTION_BLOCK * MAT_ATTENTION_BLOCK], m[MAT_ATTENTION_BLOCK], l[MAT_ATTENTION_BLOCK];
+
+	for (size_t task = begin; task < end; task++) {
+		size_t offset = attention_offset(att, task);
+		const float *Qt = args->Q + offset, *Kt = args->K + offset, *Vt = args->V + offset;
+		float *Ot = args->out + offset;
+		float *acc = args->work + task * attention_scratch(att);
+
+		for (size_t q0 = 0; q0 < T; q0 += MAT_ATTENTION_BLOCK) {
+			size_t nq = attention_min(MAT_ATTENTION_BLOCK, T - q0);
+			for (size_t i = 0; i < nq; i++) {
+				m[i] = -INFINITY;
+				l[i] = 0.0f;
+			}
+			for (size_t i = 0; i < dh * nq; i++)
+				acc[i] = 0.0f;
+
+			size_t kend = att->causal ? q0 + nq : T;
+			for (size_t k0 = 0; k0 < kend; k0 += MAT_ATTENTION_BLOCK) {
+				size_t nk = attention_min(MAT_ATTENTION_BLOCK, kend - k0);
+				attention_scores(att, Qt, Kt, q0, nq, k0, nk, S);
+
+				for (size_t i = 0; i < nq; i++) {
+					float *s = S + i * MAT_ATTENTION_BLOCK;
+					float m_new = m[i];
+					for (size_t c = 0; c < nk; c++)
+						m_new = s[c] > m_new ? s[c] : m_new;
+					float sum = 0.0f;
+					for (size_t c = 0; c < nk; c++) {
+						s[c] = expf(s[c] - m_new);
+						sum += s[c];
+					}
+					float rescale = expf(m[i] - m_new);
+					l[i] = l[i] * rescale + sum;
+					m[i] = m_new;
+					for (size_t d = 0; d < dh; d++)
+						acc[d * nq + i] *= rescale;
+				}
+				/* acc (dh x nq) += V_blk (dh x nk) * P^T */
+				gemm_nt_acc(dh, nq, nk, Vt + k0, ld, S, MAT_ATTENTION_BLOCK, acc, nq);
+			}
+
+			for (size_t d = 0; d < dh; d++)
+				for (size_t i = 0; i < nq; i++)
+					Ot[d * ld + q0 + i] = acc[d * nq + i] / l[i];
+			if (args->lse != NULL)
+				for (size_t i = 0; i < nq; i++)
+					args->lse[task * T + q0 + i] = m[i] + logf(l[i]);
+		}
+	}
+}
+
+/* Matf32_attention_forward: O = V softmax(scale * K^T Q) of every head of every sample, by blocks */
+void Matf32_attention_forward(const float *Q, const float *K, const float *V, float *O, float *lse, float *work,
+			      const struct Mat_attention *att)
+{
+	assert(Q && "Q can't be null");
+	assert(K && "K can't be null");
+	assert(V && "V can't be null");
+	assert(O && "O can't be null");
+	assert(work && "the workspace can't be null");
+	assert(att && "the attention can't be null");
+
+	struct Matf32_attention_args args = {Q, K, V, NULL, NULL, O, lse, NULL, work, NULL, NULL, NULL, att};
+	Mat_parallel_for(Matf32_attention_forward_range, &args, att->nbatch * att->nheads, 1);
+}
+
+/*
+ * A block of keys at a time: its dK and dV stay in the scratch while every
+ * block of queries that sees it goes by, P comes back from the scores and
+ * the log-sum-exp of the forward, dQ is added to in place
+ */
+static void Matf32_attention_backward_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_attention_args *args = ctx;
+	const struct Mat_attention *att = args->att;
+	size_t T = att->seq_len, dh = att->head_dim, ld = att->nbatch * T;
+	float scale = 1.0f / sqrtf((float) dh);
+	float P[MAT_ATTENTION_BLOCK * MAT_ATTENTION_BLOCK], dP[MAT_ATTENTION_BLOCK * MAT_ATTENTION_BLOCK];
+
+	for (size_t task = begin; task < end; task++) {
+		size_t offset = attention_offset(att, task);
+		float *scratch = args->work + task * attention_scratch(att);
+		float *dKt = scratch, *dVt = scratch + dh * MAT_ATTENTION_BLOCK, *D = scratch + 2 * dh * MAT_ATTENTION_BLOCK;
+		const float *Qt = args->Q + offset, *Kt = args->K + offset, *Vt = args->V + offset;
+		const float *Ot = args->O + offset, *dOt = args->dO + offset;
+		const float *lse = args->lse_in + task * T;
+		float *dQt = args->dQ + offset;
+
+		/* D = rowsum(dO * O) of every query, and dQ starts at zero */
+		for (size_t i = 0; i < T; i++)
+			D[i] = 0.0f;
+		for (size_t d = 0; d < dh; d++) {
+			for (size_t i = 0; i < T; i++) {
+				D[i] += dOt[d * ld + i] * Ot[d * ld + i];
+				dQt[d * ld + i] = 0.0f;
+			}
+		}
+
+		for (size_t k0 = 0; k0 < T; k0 += MAT_ATTENTION_BLOCK) {
+			size_t nk = attention_min(MAT_ATTENTION_BLOCK, T - k0);
+			for (size_t i = 0; i < 2 * dh * MAT_ATTENTION_BLOCK; i++)
+				scratch[i] = 0.0f;
+
+			/* With the causal mask the queries before the block don't see it */
+			for (size_t q0 = att->causal ? k0 : 0; q0 < T; q0 += MAT_ATTENTION_BLOCK) {
+				size_t nq = attention_min(MAT_ATTENTION_BLOCK, T - q0);
+				attention_scores(att, Qt, Kt, q0, nq, k0, nk, P);
+				for (size_t i = 0; i < nq; i++)
+					for (size_t c = 0; c < nk; c++)
+						P[i * MAT_ATTENTION_BLOCK + c] = expf(P[i * MAT_ATTENTION_BLOCK + c] - lse[q0 + i]);
+
+				/* dV (dh x nk) += dO_blk (dh x nq) * P, dP = dO_blk^T V_blk */
+				gemm_nn_acc(dh, nk, nq, dOt + q0, ld, P, MAT_ATTENTION_BLOCK, dVt, nk);
+				for (size_t i = 0; i < nq * MAT_ATTENTION_BLOCK; i++)
+					dP[i] = 0.0f;
+				gemm_tn_acc(nq, nk, dh, dOt + q0, ld, Vt + k0, ld, dP, MAT_ATTENTION_BLOCK);
+
+				/* dS = P * (dP - D) * scale, in place of dP */
+				for (size_t i = 0; i < nq; i++)
+					for (size_t c = 0; c < nk; c++)
+						dP[i * MAT_ATTENTION_BLOCK + c] = P[i * MAT_ATTENTION_BLOCK + c] *
+							(dP[i * MAT_ATTENTION_BLOCK + c] - D[q0 + i]) * scale;
+
+				/* dK (dh x nk) += Q_blk (dh x nq) * dS, dQ_blk (dh x nq) += K_blk (dh x nk) * dS^T */
+				gemm_nn_acc(dh, nk, nq, Qt + q0, ld, dP, MAT_ATTENTION_BLOCK, dKt, nk);
+				gemm_nt_acc(dh, nq, nk, Kt + k0, ld, dP, MAT_ATTENTION_BLOCK, dQt + q0, ld);
+			}
+
+			for (size_t d = 0; d < dh; d++) {
+				for (size_t c = 0; c < nk; c++) {
+					args->dK[offset + d * ld + k0 + c] = dKt[d * nk + c];
+					args->dV[offset + d * ld + k0 + c] = dVt[d * nk + c];
+				}
+			}
+		}
+	}
+}
+
+/* Matf32_attention_backward: dQ, dK and dV of Matf32_attention_forward from its O and log-sum-exp */
+void Matf32_attention_backward(const float *Q, const float *K, const float *V, const float *O, const float *dO,
+			       const float *lse, float *dQ, float *dK, float *dV, float *work,
+			       const struct Mat_attention *att)
+{
+	assert(Q && "Q can't be null");
+	assert(K && "K can't be null");
+	assert(V && "V can't be null");
+	assert(O && "O can't be null");
+	assert(dO && "dO can't be null");
+	assert(lse && "lse can't be null");
+	assert(dQ && "dQ can't be null");
+	assert(dK && "dK can't be null");
+	assert(dV && "dV can't be null");
+	assert(work && "the workspace can't be null");
+	assert(att && "the attention can't be null");
+
+	struct Matf32_attention_args args = {Q, K, V, O, dO, NULL, NULL, lse, work, dQ, dK, dV, att};
+	Mat_parallel_for(Matf32_attention_backward_range, &args, att->nbatch * att->nheads, 1);
+}
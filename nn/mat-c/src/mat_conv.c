@@ -0,0 +1,418 @@
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../include/mat.h"
+
+/* The convolutions go parallel over rows of `cols`, filters or channels, a chunk moves at least this many floats */
+#define MAT_CONV_GRAIN_FLOATS ((size_t) 1 << 14)
+
+/* Arguments of the convolutions for `Mat_parallel_for` */
+struct Matf32_conv_args {
+	const float *X;
+	const float *W;
+	const float *dY;
+	float *Y;
+	float *dX;
+	float *dW;
+	size_t nfilters;
+	const struct Mat_conv2d *conv;
+	size_t *argmax;
+};
+
+static size_t conv_grain(size_t work)
+{
+	return work == 0 || work >= MAT_CONV_GRAIN_FLOATS ? 1 : MAT_CONV_GRAIN_FLOATS / work;
+}
+
+/*
+ * Columns [first, last) of the output row `oh` that read inside the image for
+ * the tap (u, v), the row of the input is `ih`. Returns false if the whole row
+ * falls in the padding
+ */
+static bool conv_span(const struct Mat_conv2d *conv, size_t oh, size_t u, size_t v,
+		      size_t *ih, size_t *first, size_t *last)
+{
+	size_t s = conv->stride, p = conv->padding, d = conv->dilation;
+	size_t row = oh * s + u * d;
+	if (row < p || row - p >= conv->height)
+		return false;
+	*ih = row - p;
+
+	/* iw = ow * s + v * d - p in [0, width) */
+	size_t off = v * d;
+	if (conv->width + p <= off)
+		return false;
+	*first = off >= p ? 0 : (p - off + s - 1) / s;
+	*last = (conv->width + p - 1 - off) / s + 1;
+	if (*last > conv->out_width)
+		*last = conv->out_width;
+	return *first < *last;
+}
+
+static void Matf32_im2col_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_conv_args *args = ctx;
+	const struct Mat_conv2d *conv = args->conv;
+	size_t n = conv->nbatch, kk = conv->kernel_h * conv->kernel_w;
+	size_t plane = conv->out_width * n, ncols = conv->out_height * plane;
+	for (size_t r = begin; r < end; r++) {
+		size_t c = r / kk, u = (r % kk) / conv->kernel_w, v = r % conv->kernel_w;
+		float *out = args->Y + r * ncols;
+		for (size_t oh = 0; oh < conv->out_height; oh++) {
+			float *row = out + oh * plane;
+			size_t ih, first, last;
+			if (!conv_span(conv, oh, u, v, &ih, &first, &last)) {
+				memset(row, 0, plane * sizeof(float));
+				continue;
+			}
+			memset(row, 0, first * n * sizeof(float));
+			memset(row + last * n, 0, (conv->out_width - last) * n * sizeof(float));
+			const float *in = args->X + (c * conv->height + ih) * conv->width * n;
+			for (size_t ow = first; ow < last; ow++) {
+				size_t iw = ow * conv->stride + v * conv->dilation - conv->padding;
+				memcpy(row + ow * n, in + iw * n, n * sizeof(float));
+			}
+		}
+	}
+}
+
+/* Matf32_im2col: unfold the patches of X into cols, one row per (channel, tap) */
+void Matf32_im2col(const float *X, float *cols, const struct Mat_conv2d *conv)
+{
+	assert(X && "X can't be null");
+	assert(cols && "cols can't be null");
+	assert(conv && "conv can't be null");
+	struct Matf32_conv_args args = {X, NULL, NULL, cols, NULL, NULL, 0, conv, NULL};
+	size_t nrows = conv->channels * conv->kernel_h * conv->kernel_w;
+	Mat_parallel_for(Matf32_im2col_range, &args, nrows,
+			 conv_grain(conv->out_height * conv->out_width * conv->nbatch));
+}
+
+/* A channel only receives from its own rows of cols, the channels never race */
+static void Matf32_col2im_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_conv_args *args = ctx;
+	const struct Mat_conv2d *conv = args->conv;
+	size_t n = conv->nbatch, kk = conv->kernel_h * conv->kernel_w;
+	size_t plane = conv->out_width * n, ncols = conv->out_height * plane;
+	for (size_t c = begin; c < end; c++) {
+		float *image = args->dX + c * conv->height * conv->width * n;
+		for (size_t k = 0; k < kk; k++) {
+			size_t u = k / conv->kernel_w, v = k % conv->kernel_w;
+			const float *in = args->dY + (c * kk + k) * ncols;
+			for (size_t oh = 0; oh < conv->out_height; oh++) {
+				size_t ih, first, last;
+				if (!conv_span(conv, oh, u, v, &ih, &first, &last))
+					continue;
+				const float *row = in + oh * plane;
+				float *out = image + ih * conv->width * n;
+				for (size_t ow = first; ow < last; ow++) {
+					size_t iw = ow * conv->stride + v * conv->dilation - conv->padding;
+					for (size_t j = 0; j < n; j++)
+						out[iw * n + j] += row[ow * n + j];
+				}
+			}
+		}
+	}
+}
+
+/* Matf32_col2im_acc: X += the patches of cols folded back */
+void Matf32_col2im_acc(const float *cols, float *X, const struct Mat_conv2d *conv)
+{
+	assert(cols && "cols can't be null");
+	assert(X && "X can't be null");
+	assert(conv && "conv can't be null");
+	struct Matf32_conv_args args = {NULL, NULL, cols, NULL, X, NULL, 0, conv, NULL};
+	size_t kk = conv->kernel_h * conv->kernel_w;
+	Mat_parallel_for(Matf32_col2im_range, &args, conv->channels,
+			 conv_grain(kk * conv->out_height * conv->out_width * conv->nbatch));
+}
+
+/* Filters [begin, end) of the direct convolution, with stride 1 a tap shifts whole spans of a row */
+static void Matf32_conv2d_direct_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_conv_args *args = ctx;
+	const struct Mat_conv2d *conv = args->conv;
+	size_t n = conv->nbatch, kk = conv->kernel_h * conv->kernel_w;
+	size_t plane = conv->out_width * n, image = conv->height * conv->width * n;
+	for (size_t f = begin; f < end; f++) {
+		float *out = args->Y + f * conv->out_height * plane;
+		memset(out, 0, conv->out_height * plane * sizeof(float));
+		for (size_t c = 0; c < conv->channels; c++) {
+			for (size_t k = 0; k < kk; k++) {
+				size_t u = k / conv->kernel_w, v = k % conv->kernel_w;
+				float w = args->W[(f * conv->channels + c) * kk + k];
+				for (size_t oh = 0; oh < conv->out_height; oh++) {
+					size_t ih, first, last;
+					if (!conv_span(conv, oh, u, v, &ih, &first, &last))
+						continue;
+					size_t iw = first + v * conv->dilation - conv->padding;
+					float *restrict y = out + oh * plane + first * n;
+					const float *restrict x = args->X + c * image + (ih * conv->width + iw) * n;
+					for (size_t i = 0; i < (last - first) * n; i++)
+						y[i] += w * x[i];
+				}
+			}
+		}
+	}
+}
+
+/* Matf32_conv2d_direct: Y = W * X with stride 1, without unfolding X */
+void Matf32_conv2d_direct(const float *X, const float *W, float *Y, size_t nfilters,
+			  const struct Mat_conv2d *conv)
+{
+	assert(X && "X can't be null");
+	assert(W && "W can't be null");
+	assert(Y && "Y can't be null");
+	assert(conv && conv->stride == 1 && "the direct convolution only has stride 1");
+	struct Matf32_conv_args args = {X, W, NULL, Y, NULL, NULL, nfilters, conv, NULL};
+	size_t work = conv->channels * conv->kernel_h * conv->kernel_w * conv->out_height * conv->out_width * conv->nbatch;
+	Mat_parallel_for(Matf32_conv2d_direct_range, &args, nfilters, conv_grain(work));
+}
+
+/* dW of the filters [begin, end), every tap is a dot product of the same spans of the forward */
+static void Matf32_conv2d_direct_dw_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_conv_args *args = ctx;
+	const struct Mat_conv2d *conv = args->conv;
+	size_t n = conv->nbatch, kk = conv->kernel_h * conv->kernel_w;
+	size_t plane = conv->out_width * n, image = conv->height * conv->width * n;
+	for (size_t f = begin; f < end; f++) {
+		const float *grad = args->dY + f * conv->out_height * plane;
+		for (size_t c = 0; c < conv->channels; c++) {
+			for (size_t k = 0; k < kk; k++) {
+				size_t u = k / conv->kernel_w, v = k % conv->kernel_w;
+				float sum = 0.0f;
+				for (size_t oh = 0; oh < conv->out_height; oh++) {
+					size_t ih, first, last;
+					if (!conv_span(conv, oh, u, v, &ih, &first, &last))
+						continue;
+					size_t iw = first + v * conv->dilation - conv->padding;
+					const float *dy = grad + oh * plane + first * n;
+					const float *x = args->X + c * image + (ih * conv->width + iw) * n;
+					for (size_t i = 0; i < (last - first) * n; i++)
+						sum += dy[i] * x[i];
+				}
+				args->dW[(f * conv->channels + c) * kk + k] += sum;
+			}
+		}
+	}
+}
+
+/* dX of the channels [begin, end), the spans of the forward with the roles swapped */
+static void Matf32_conv2d_direct_dx_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_conv_args *args = ctx;
+	const struct Mat_conv2d *conv = args->conv;
+	size_t n = conv->nbatch, kk = conv->kernel_h * conv->kernel_w;
+	size_t plane = conv->out_width * n, image = conv->height * conv->width * n;
+	for (size_t c = begin; c < end; c++) {
+		float *in = args->dX + c * image;
+		memset(in, 0, image * sizeof(float));
+		for (size_t f = 0; f < args->nfilters; f++) {
+			const float *grad = args->dY + f * conv->out_height * plane;
+			for (size_t k = 0; k < kk; k++) {
+				size_t u = k / conv->kernel_w, v = k % conv->kernel_w;
+				float w = args->W[(f * conv->channels + c) * kk + k];
+				for (size_t oh = 0; oh < conv->out_height; oh++) {
+					size_t ih, first, last;
+					if (!conv_span(conv, oh, u, v, &ih, &first, &last))
+						continue;
+					size_t iw = first + v * conv->dilation - conv->padding;
+					const float *restrict dy = grad + oh * plane + first * n;
+					float *restrict dx = in + (ih * conv->width + iw) * n;
+					for (size_t i = 0; i < (last - first) * n; i++)
+						dx[i] += w * dy[i];
+				}
+			}
+		}
+	}
+}
+
+/* Matf32_conv2d_direct_backward: dW += dY (x) X, dX = W^T * dY, either can be NULL */
+void Matf32_conv2d_direct_backward(const float *X, const float *W, const float *dY, float *dX,
+				   float *dW, size_t nfilters, const struct Mat_conv2d *conv)
+{
+	assert(X && "X can't be null");
+	assert(W && "W can't be null");
+	assert(dY && "dY can't be null");
+	assert(conv && conv->stride == 1 && "the direct convolution only has stride 1");
+	struct Matf32_conv_args args = {X, W, dY, NULL, dX, dW, nfilters, conv, NULL};
+	size_t kk = conv->kernel_h * conv->kernel_w;
+	size_t work = kk * conv->out_height * conv->out_width * conv->nbatch;
+	if (dW != NULL)
+		Mat_parallel_for(Matf32_conv2d_direct_dw_range, &args, nfilters, conv_grain(conv->channels * work));
+	if (dX != NULL)
+		Mat_parallel_for(Matf32_conv2d_direct_dx_range, &args, conv->channels, conv_grain(nfilters * work));
+}
+
+/* Channels [begin, end) of the max pooling, the batch of every pixel is compared at once */
+static void Matf32_maxpool2d_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_conv_args *args = ctx;
+	const struct Mat_conv2d *conv = args->conv;
+	size_t n = conv->nbatch, kk = conv->kernel_h * conv->kernel_w;
+	size_t plane = conv->out_width * n, image = conv->height * conv->width * n;
+	size_t outputs = conv->out_height * plane;
+	for (size_t c = begin; c < end; c++) {
+		float *out = args->Y + c * outputs;
+		size_t *idx = args->argmax == NULL ? NULL : args->argmax + c * outputs;
+		for (size_t i = 0; i < outputs; i++)
+			out[i] = -INFINITY;
+		/* SIZE_MAX until a tap of the window reads inside the image */
+		if (idx != NULL)
+			for (size_t i = 0; i < outputs; i++)
+				idx[i] = SIZE_MAX;
+		for (size_t k = 0; k < kk; k++) {
+			size_t u = k / conv->kernel_w, v = k % conv->kernel_w;
+			for (size_t oh = 0; oh < conv->out_height; oh++) {
+				size_t ih, first, last;
+				if (!conv_span(conv, oh, u, v, &ih, &first, &last))
+					continue;
+				for (size_t ow = first; ow < last; ow++) {
+					size_t iw = ow * conv->stride + v * conv->dilation - conv->padding;
+					size_t at = c * image + (ih * conv->width + iw) * n;
+					const float *x = args->X + at;
+					float *y = out + oh * plane + ow * n;
+					if (idx == NULL) {
+						for (size_t j = 0; j < n; j++)
+							y[j] = x[j] > y[j] ? x[j] : y[j];
+						continue;
+					}
+					size_t *m = idx + oh * plane + ow * n;
+					for (size_t j = 0; j < n; j++) {
+						if (x[j] > y[j] || m[j] == SIZE_MAX) {
+							y[j] = x[j];
+							m[j] = at + j;
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+/* Matf32_maxpool2d: Y = the maximum of every window and, if not NULL, where it was */
+void Matf32_maxpool2d(const float *X, float *Y, size_t *argmax, const struct Mat_conv2d *conv)
+{
+	assert(X && "X can't be null");
+	assert(Y && "Y can't be null");
+	assert(conv && "conv can't be null");
+	struct Matf32_conv_args args = {X, NULL, NULL, Y, NULL, NULL, 0, conv, argmax};
+	size_t work = conv->kernel_h * conv->kernel_w * conv->out_height * conv->out_width * conv->nbatch;
+	Mat_parallel_for(Matf32_maxpool2d_range, &args, conv->channels, conv_grain(work));
+}
+
+/* The maxima of a channel are inside its own image, the channels never race */
+static void Matf32_maxpool2d_backward_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_conv_args *args = ctx;
+	const struct Mat_conv2d *conv = args->conv;
+	size_t image = conv->height * conv->width * conv->nbatch;
+	size_t outputs = conv->out_height * conv->out_width * conv->nbatch;
+	for (size_t c = begin; c < end; c++) {
+		memset(args->dX + c * image, 0, image * sizeof(float));
+		const float *dy = args->dY + c * outputs;
+		const size_t *idx = args->argmax + c * outputs;
+		for (size_t i = 0; i < outputs; i++)
+			if (idx[i] != SIZE_MAX)
+				args->dX[idx[i]] += dy[i];
+	}
+}
+
+/* Matf32_maxpool2d_backward: scatter dY to the maxima, no window is read again */
+void Matf32_maxpool2d_backward(const float *dY, const size_t *argmax, float *dX,
+			       const struct Mat_conv2d *conv)
+{
+	assert(dY && "dY can't be null");
+	assert(argmax && "argmax can't be null");
+	assert(dX && "dX can't be null");
+	assert(conv && "conv can't be null");
+	struct Matf32_conv_args args = {NULL, NULL, dY, NULL, dX, NULL, 0, conv, (size_t *) argmax};
+	Mat_parallel_for(Matf32_maxpool2d_backward_range, &args, conv->channels,
+			 conv_grain(conv->height * conv->width * conv->nbatch));
+}
+
+/* Channels [begin, end) of the average pooling, the same spans of the direct convolution with a constant weight */
+static void Matf32_avgpool2d_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_conv_args *args = ctx;
+	const struct Mat_conv2d *conv = args->conv;
+	size_t n = conv->nbatch, kk = conv->kernel_h * conv->kernel_w;
+	size_t plane = conv->out_width * n, image = conv->height * conv->width * n;
+	size_t outputs = conv->out_height * plane;
+	float w = 1.0f / (float) kk;
+	for (size_t c = begin; c < end; c++) {
+		float *out = args->Y + c * outputs;
+		memset(out, 0, outputs * sizeof(float));
+		for (size_t k = 0; k < kk; k++) {
+			size_t u = k / conv->kernel_w, v = k % conv->kernel_w;
+			for (size_t oh = 0; oh < conv->out_height; oh++) {
+				size_t ih, first, last;
+				if (!conv_span(conv, oh, u, v, &ih, &first, &last))
+					continue;
+				for (size_t ow = first; ow < last; ow++) {
+					size_t iw = ow * conv->stride + v * conv->dilation - conv->padding;
+					float *restrict y = out + oh * plane + ow * n;
+					const float *restrict x = args->X + c * image + (ih * conv->width + iw) * n;
+					for (size_t j = 0; j < n; j++)
+						y[j] += w * x[j];
+				}
+			}
+		}
+	}
+}
+
+/* Matf32_avgpool2d: Y = the mean of every window */
+void Matf32_avgpool2d(const float *X, float *Y, const struct Mat_conv2d *conv)
+{
+	assert(X && "X can't be null");
+	assert(Y && "Y can't be null");
+	assert(conv && "conv can't be null");
+	struct Matf32_conv_args args = {X, NULL, NULL, Y, NULL, NULL, 0, conv, NULL};
+	size_t work = conv->kernel_h * conv->kernel_w * conv->out_height * conv->out_width * conv->nbatch;
+	Mat_parallel_for(Matf32_avgpool2d_range, &args, conv->channels, conv_grain(work));
+}
+
+static void Matf32_avgpool2d_backward_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_conv_args *args = ctx;
+	const struct Mat_conv2d *conv = args->conv;
+	size_t n = conv->nbatch, kk = conv->kernel_h * conv->kernel_w;
+	size_t plane = conv->out_width * n, image = conv->height * conv->width * n;
+	size_t outputs = conv->out_height * plane;
+	float w = 1.0f / (float) kk;
+	for (size_t c = begin; c < end; c++) {
+		float *in = args->dX + c * image;
+		memset(in, 0, image * sizeof(float));
+		for (size_t k = 0; k < kk; k++) {
+			size_t u = k / conv->kernel_w, v = k % conv->kernel_w;
+			for (size_t oh = 0; oh < conv->out_height; oh++) {
+				size_t ih, first, last;
+				if (!conv_span(conv, oh, u, v, &ih, &first, &last))
+					continue;
+				for (size_t ow = first; ow < last; ow++) {
+					size_t iw = ow * conv->stride + v * conv->dilation - conv->padding;
+					const float *restrict dy = args->dY + c * outputs + oh * plane + ow * n;
+					float *restrict dx = in + (ih * conv->width + iw) * n;
+					for (size_t j = 0; j < n; j++)
+						dx[j] += w * dy[j];
+				}
+			}
+		}
+	}
+}
+
+/* Matf32_avgpool2d_backward: dX = dY / window over every window */
+void Matf32_avgpool2d_backward(const float *dY, float *dX, const struct Mat_conv2d *conv)
+{
+	assert(dY && "dY can't be null");
+	assert(dX && "dX can't be null");
+	assert(conv && "conv can't be null");
+	struct Matf32_conv_args args = {NULL, NULL, dY, NULL, dX, NULL, 0, conv, NULL};
+	size_t work = conv->kernel_h * conv->kernel_w * conv->out_height * conv->out_width * conv->nbatch;
+	Mat_parallel_for(Matf32_avgpool2d_backward_range, &args, conv->channels, conv_grain(work));
+}
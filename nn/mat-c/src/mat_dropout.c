@@ -0,0 +1,115 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../include/mat.h"
+
+/* The dropout kernels go parallel over words of the mask, 64 elements each */
+#define MAT_DROPOUT_GRAIN_WORDS ((size_t) 1 << 9)
+
+/* Arguments of the dropout for `Mat_parallel_for` */
+struct Matf32_dropout_args {
+	const float *X;
+	float *Y;
+	uint64_t *mask;
+	const uint64_t *kept;
+	size_t n;
+	uint32_t threshold;
+	uint32_t key_lo;
+	uint32_t key_hi;
+	float scale;
+};
+
+/* A 32 bit integer hash with full avalanche, two multiplies and three shifts */
+static inline uint32_t dropout_mix(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+/* splitmix64, the key of a call from the seed and the counter */
+static uint64_t dropout_key(uint64_t seed, uint64_t counter)
+{
+	uint64_t z = seed + counter * 0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/*
+ * Words [begin, end) of the mask. The random number of an element is a keyed
+ * hash of its index, with no state carried from one element to the next, so
+ * the 64 of a word are drawn by a loop the compiler vectorizes and compared
+ * once for both the bit of the mask and the scale of Y
+ */
+static void Matf32_dropout_forward_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_dropout_args *args = ctx;
+	uint32_t draws[64];
+	for (size_t w = begin; w < end; w++) {
+		size_t i0 = w * 64;
+		size_t nb = args->n - i0 < 64 ? args->n - i0 : 64;
+		for (size_t b = 0; b < nb; b++) {
+			uint64_t i = (uint64_t) (i0 + b);
+			uint32_t h = dropout_mix((uint32_t) i ^ args->key_lo);
+			draws[b] = dropout_mix(h ^ (uint32_t) (i >> 32) ^ args->key_hi);
+		}
+
+		const float *x = args->X + i0;
+		float *y = args->Y + i0;
+		for (size_t b = 0; b < nb; b++)
+			y[b] = draws[b] >= args->threshold ? x[b] * args->scale : 0.0f;
+
+		if (args->mask != NULL) {
+			uint64_t bits = 0;
+			for (size_t b = 0; b < nb; b++)
+				bits |= (uint64_t) (draws[b] >= args->threshold) << b;
+			args->mask[w] = bits;
+		}
+	}
+}
+
+/* Matf32_dropout_forward: Y = X * mask / (1 - rate) with a new mask of `rate` zeros */
+void Matf32_dropout_forward(const float *X, float *Y, uint64_t *mask, size_t n, float rate, uint64_t seed,
+			    uint64_t counter)
+{
+	assert(X && "X can't be null");
+	assert(Y && "Y can't be null");
+	assert(rate >= 0.0f && rate < 1.0f && "the rate goes in [0, 1)");
+	uint64_t key = dropout_key(seed, counter);
+	double threshold = (double) rate * 4294967296.0;
+	struct Matf32_dropout_args args = {X, Y, mask, NULL, n,
+					   threshold >= 4294967295.0 ? UINT32_MAX : (uint32_t) threshold,
+					   (uint32_t) key, (uint32_t) (key >> 32), 1.0f / (1.0f - rate)};
+	Mat_parallel_for(Matf32_dropout_forward_range, &args, Mat_dropout_mask_words(n), MAT_DROPOUT_GRAIN_WORDS);
+}
+
+/* Words [begin, end) of the mask, a bit of it picks the scale or zero */
+static void Matf32_dropout_backward_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_dropout_args *args = ctx;
+	for (size_t w = begin; w < end; w++) {
+		size_t i0 = w * 64;
+		size_t nb = args->n - i0 < 64 ? args->n - i0 : 64;
+		uint64_t bits = args->kept[w];
+		const float *dy = args->X + i0;
+		float *dx = args->Y + i0;
+		for (size_t b = 0; b < nb; b++)
+			dx[b] = (bits >> b) & 1 ? dy[b] * args->scale : 0.0f;
+	}
+}
+
+/* Matf32_dropout_backward: dX = dY * mask / (1 - rate) with the mask of the forward */
+void Matf32_dropout_backward(const float *dY, const uint64_t *mask, float *dX, size_t n, float rate)
+{
+	assert(dY && "dY can't be null");
+	assert(mask && "mask can't be null");
+	assert(dX && "dX can't be null");
+	assert(rate >= 0.0f && rate < 1.0f && "the rate goes in [0, 1)");
+	struct Matf32_dropout_args args = {dY, dX, NULL, mask, n, 0, 0, 0, 1.0f / (1.0f - rate)};
+	Mat_parallel_for(Matf32_dropout_backward_range, &args, Mat_dropout_mask_words(n), MAT_DROPOUT_GRAIN_WORDS);
+}
@@ -0,0 +1,59 @@
+#ifndef MAT_GEMM_H
+#define MAT_GEMM_H
+
+#include <stddef.h>
+
+/*
+ * The inner loops of the matrix products on tiles with leading dimensions,
+ * shared by the products of mat_mul.c and the kernels that multiply blocks
+ * of bigger matrices (the attention). The innermost loop always runs along
+ * a row of C or a row of both operands, so it is contiguous and vectorizes
+ */
+
+/* gemm_nn_acc: C += A * B, A is (m x k), B is (k x n), C is (m x n) */
+static inline void gemm_nn_acc(size_t m, size_t n, size_t k, const float *A, size_t lda,
+			       const float *B, size_t ldb, float *C, size_t ldc)
+{
+	for (size_t i = 0; i < m; i++) {
+		float *c = C + i * ldc;
+		for (size_t p = 0; p < k; p++) {
+			float a = A[i * lda + p];
+			const float *b = B + p * ldb;
+			for (size_t j = 0; j < n; j++)
+				c[j] += a * b[j];
+		}
+	}
+}
+
+/* gemm_nt_acc: C += A * B^T, A is (m x k), B is (n x k), C is (m x n) */
+static inline void gemm_nt_acc(size_t m, size_t n, size_t k, const float *A, size_t lda,
+			       const float *B, size_t ldb, float *C, size_t ldc)
+{
+	for (size_t i = 0; i < m; i++) {
+		const float *a = A + i * lda;
+		for (size_t j = 0; j < n; j++) {
+			const float *b = B + j * ldb;
+			float sum = 0.0f;
+			for (size_t p = 0; p < k; p++)
+				sum += a[p] * b[p];
+			C[i * ldc + j] += sum;
+		}
+	}
+}
+
+/* gemm_tn_acc: C += A^T * B, A is (k x m), B is (k x n), C is (m x n) */
+static inline void gemm_tn_acc(size_t m, size_t n, size_t k, const float *A, size_t lda,
+			       const float *B, size_t ldb, float *C, size_t ldc)
+{
+	for (size_t p = 0; p < k; p++) {
+		const float *b = B + p * ldb;
+		for (size_t i = 0; i < m; i++) {
+			float a = A[p * lda + i];
+			float *c = C + i * ldc;
+			for (size_t j = 0; j < n; j++)
+				c[j] += a * b[j];
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,208 @@
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+
+#include "../include/mat.h"
+#include "mat_math.h"
+
+/*
+ * The binary cross-entropy of `width` <= MAT_LANES logits, returns their sum
+ * and writes dL/dZ to G if it isn't NULL. Called with MAT_LANES the loops
+ * have a constant trip count and vectorize, the tail takes the same path
+ *
+ * L = -(y * log(s(z)) + (1 - y) * log(1 - s(z)))
+ *   = max(z, 0) - z * y + log(1 + exp(-|z|))
+ * exp only sees non-positive numbers and the logs never get a zero, the
+ * loss stays finite for any logit. s(z) reuses the same exponential
+ */
+static inline float sigmoid_cross_entropy_block(const float *Z, const float *Y, float *G, size_t width)
+{
+	float loss[MAT_LANES], grad[MAT_LANES];
+	for (size_t k = 0; k < width; k++) {
+		float z = Z[k];
+		float e = mat_expf(-fabsf(z));
+		loss[k] = fmaxf(z, 0.0f) - z * Y[k] + mat_logf(1.0f + e);
+		grad[k] = (z >= 0.0f ? 1.0f : e) / (1.0f + e) - Y[k];
+	}
+	if (G != NULL)
+		for (size_t k = 0; k < width; k++)
+			G[k] = grad[k];
+
+	float sum = 0.0f;
+	for (size_t k = 0; k < width; k++)
+		sum += loss[k];
+	return sum;
+}
+
+/* Matf32_sigmoid_cross_entropy: sum of the binary cross-entropy of the logits Z, G = s(Z) - Y */
+float Matf32_sigmoid_cross_entropy(const float *Z, const float *Y, float *G, size_t n)
+{
+	assert(Z && "Z can't be null");
+	assert(Y && "Y can't be null");
+
+	float loss = 0.0f;
+	size_t i = 0;
+	for (; i + MAT_LANES <= n; i += MAT_LANES)
+		loss += sigmoid_cross_entropy_block(Z + i, Y + i, G != NULL ? G + i : NULL, MAT_LANES);
+	if (i < n)
+		loss += sigmoid_cross_entropy_block(Z + i, Y + i, G != NULL ? G + i : NULL, n - i);
+
+	return loss;
+}
+
+/*
+ * The softmax kernels sweep a block of `width` <= MAT_LANES columns row after
+ * row, so the statistics of the block live in locals (no scratch memory) and
+ * the loops along the block vectorize when it is a whole one. `ld` is the
+ * stride between the rows of the matrices
+ */
+
+/* Column statistics of a block: the maximum `M` and the sum `S` of exp(z - M) */
+static inline void softmax_block_stats(const float *Z, size_t ld, size_t nrows, size_t width, float *M, float *S)
+{
+	for (size_t k = 0; k < width; k++) {
+		M[k] = Z[k];
+		S[k] = 0.0f;
+	}
+	for (size_t i = 1; i < nrows; i++)
+		for (size_t k = 0; k < width; k++)
+			M[k] = fmaxf(M[k], Z[i * ld + k]);
+	for (size_t i = 0; i < nrows; i++)
+		for (size_t k = 0; k < width; k++)
+			S[k] += mat_expf(Z[i * ld + k] - M[k]);
+}
+
+static inline void softmax_block(const float *Z, float *P, size_t ld, size_t nrows, size_t width)
+{
+	float M[MAT_LANES], S[MAT_LANES];
+	softmax_block_stats(Z, ld, nrows, width, M, S);
+	for (size_t k = 0; k < width; k++)
+		S[k] = 1.0f / S[k];
+	for (size_t i = 0; i < nrows; i++)
+		for (size_t k = 0; k < width; k++)
+			P[i * ld + k] = mat_expf(Z[i * ld + k] - M[k]) * S[k];
+}
+
+/* Matf32_softmax_cols: P = softmax of every column of Z */
+void Matf32_softmax_cols(const float *Z, float *P, size_t nrows, size_t ncols)
+{
+	assert(Z && "Z can't be null");
+	assert(P && "P can't be null");
+	if (nrows == 0)
+		return;
+
+	size_t j = 0;
+	for (; j + MAT_LANES <= ncols; j += MAT_LANES)
+		softmax_block(Z + j, P + j, ncols, nrows, MAT_LANES);
+	if (j < ncols)
+		softmax_block(Z + j, P + j, ncols, nrows, ncols - j);
+}
+
+/*
+ * The cross-entropy of a block, G (if it isn't NULL) gets softmax(Z) - Y.
+ * log p_i = z_i - M - log(S), then L = sum_i y_i * (M + log(S) - z_i).
+ * The log-softmax never takes the log of a rounded probability
+ */
+static inline float softmax_cross_entropy_block(const float *Z, const float *Y, float *G, size_t ld,
+						size_t nrows, size_t width)
+{
+	float M[MAT_LANES], S[MAT_LANES], L[MAT_LANES], loss[MAT_LANES];
+	softmax_block_stats(Z, ld, nrows, width, M, S);
+	for (size_t k = 0; k < width; k++) {
+		L[k] = mat_logf(S[k]);
+		S[k] = 1.0f / S[k];
+		loss[k] = 0.0f;
+	}
+
+	for (size_t i = 0; i < nrows; i++) {
+		const float *z = Z + i * ld, *y = Y + i * ld;
+		for (size_t k = 0; k < width; k++)
+			loss[k] += y[k] * (L[k] - (z[k] - M[k]));
+		if (G != NULL)
+			for (size_t k = 0; k < width; k++)
+				G[i * ld + k] = mat_expf(z[k] - M[k]) * S[k] - y[k];
+	}
+
+	float sum = 0.0f;
+	for (size_t k = 0; k < width; k++)
+		sum += loss[k];
+	return sum;
+}
+
+/* Matf32_softmax_cross_entropy: sum of the categorical cross-entropy of the logits Z, G = softmax(Z) - Y */
+float Matf32_softmax_cross_entropy(const float *Z, const float *Y, float *G, size_t nrows, size_t ncols)
+{
+	assert(Z && "Z can't be null");
+	assert(Y && "Y can't be null");
+	if (nrows == 0)
+		return 0.0f;
+
+	float loss = 0.0f;
+	size_t j = 0;
+	for (; j + MAT_LANES <= ncols; j += MAT_LANES)
+		loss += softmax_cross_entropy_block(Z + j, Y + j, G != NULL ? G + j : NULL, ncols, nrows, MAT_LANES);
+	if (j < ncols)
+		loss += softmax_cross_entropy_block(Z + j, Y + j, G != NULL ? G + j : NULL, ncols, nrows, ncols - j);
+
+	return loss;
+}
+
+/*
+ * Row reductions of the losses: S[i] += sum_j f(P[i][j], Y[i][j]) for the
+ * predictions `P` and the targets `Y` of `ncols` samples. Every row is
+ * contiguous, the inner loops are plain reductions the compiler vectorizes
+ */
+
+/* Matf32_abs_error_rows: S[i] += sum_j |P - Y| */
+void Matf32_abs_error_rows(const float *P, const float *Y, float *S, size_t nrows, size_t ncols)
+{
+	assert(P && Y && S && "The matrices can't be null");
+	for (size_t i = 0; i < nrows; i++) {
+		const float *p = P + i * ncols, *y = Y + i * ncols;
+		float sum = 0.0f;
+		for (size_t j = 0; j < ncols; j++)
+			sum += fabsf(p[j] - y[j]);
+		S[i] += sum;
+	}
+}
+
+/* Matf32_squared_error_rows: S[i] += sum_j (P - Y)^2 */
+void Matf32_squared_error_rows(const float *P, const float *Y, float *S, size_t nrows, size_t ncols)
+{
+	assert(P && Y && S && "The matrices can't be null");
+	for (size_t i = 0; i < nrows; i++) {
+		const float *p = P + i * ncols, *y = Y + i * ncols;
+		float sum = 0.0f;
+		for (size_t j = 0; j < ncols; j++) {
+			float d = p[j] - y[j];
+			sum += d * d;
+		}
+		S[i] += sum;
+	}
+}
+
+/* Matf32_binary_cross_entropy_rows: S[i] += sum_j -(Y log(P + eps) + (1 - Y) log(1 - P + eps)) */
+void Matf32_binary_cross_entropy_rows(const float *P, const float *Y, float *S, size_t nrows, size_t ncols)
+{
+	assert(P && Y && S && "The matrices can't be null");
+	for (size_t i = 0; i < nrows; i++) {
+		const float *p = P + i * ncols, *y = Y + i * ncols;
+		float sum = 0.0f;
+		for (size_t j = 0; j < ncols; j++)
+			sum -= y[j] * logf(p[j] + 1e-8f) + (1.0f - y[j]) * logf(1.0f - p[j] + 1e-8f);
+		S[i] += sum;
+	}
+}
+
+/* Matf32_categorical_cross_entropy_rows: S[i] += sum_j -Y log(P + eps) */
+void Matf32_categorical_cross_entropy_rows(const float *P, const float *Y, float *S, size_t nrows, size_t ncols)
+{
+	assert(P && Y && S && "The matrices can't be null");
+	for (size_t i = 0; i < nrows; i++) {
+		const float *p = P + i * ncols, *y = Y + i * ncols;
+		float sum = 0.0f;
+		for (size_t j = 0; j < ncols; j++)
+			sum -= y[j] * logf(p[j] + 1e-8f);
+		S[i] += sum;
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef MAT_MATH_H
+#define MAT_MATH_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Branch-free exp and log for the loops of the kernels. The ones of libm
+ * are calls, a loop with a call in it never vectorizes. These are the
+ * Cephes polynomials (about 2 ulp) with the range reduction done on the
+ * bits, only multiply-adds, selects and conversions: a loop over a fixed
+ * number of lanes that uses them turns into vector code at -O2
+ */
+
+/* Elements per block of the vectorized loops, a constant trip count is what -O2 vectorizes */
+#define MAT_LANES 8
+
+/* mat_expf: exp(x), zero below -87 and the input is clamped at 88 so the result stays a normal float */
+static inline float mat_expf(float input)
+{
+	float x = fminf(fmaxf(input, -87.0f), 88.0f);
+
+	/* x = n ln(2) + r with |r| <= ln(2) / 2, ln(2) split in two for the precision of r */
+	float t = x * 1.44269504088896341f;
+	int32_t n = (int32_t) (t + copysignf(0.5f, t));
+	float fn = (float) n;
+	float r = x - fn * 0.693359375f + fn * 2.12194440e-4f;
+
+	float z = r * r;
+	float p = (((((1.9875691500e-4f * r + 1.3981999507e-3f) * r + 8.3334519073e-3f) * r
+		     + 4.1665795894e-2f) * r + 1.6666665459e-1f) * r + 5.0000001201e-1f) * z + r + 1.0f;
+
+	/* 2^n straight into the exponent */
+	int32_t bits = (n + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof(scale));
+	return input < -87.0f ? 0.0f : p * scale;
+}
+
+/* mat_logf: log(x) of a positive normal x */
+static inline float mat_logf(float x)
+{
+	int32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	int32_t e = ((bits >> 23) & 0xff) - 127;
+
+	/* x = m 2^e with m in [sqrt(1/2), sqrt(2)), the polynomial only sees |m - 1| < 0.42 */
+	bits = (bits & 0x007fffff) | 0x3f800000;
+	float m;
+	memcpy(&m, &bits, sizeof(m));
+	int32_t big = m > 1.41421356f;
+	m = big ? 0.5f * m : m;
+	e += big;
+
+	float f = m - 1.0f;
+	float z = f * f;
+	float y = f * z * ((((((((7.0376836292e-2f * f - 1.1514610310e-1f) * f + 1.1676998740e-1f) * f
+				 - 1.2420140846e-1f) * f + 1.4249322787e-1f) * f - 1.6668057665e-1f) * f
+			      + 2.0000714765e-1f) * f - 2.4999993993e-1f) * f + 3.3333331174e-1f);
+	float fe = (float) e;
+	y += -2.12194440e-4f * fe - 0.5f * z;
+	return f + y + 0.693359375f * fe;
+}
+
+#endif
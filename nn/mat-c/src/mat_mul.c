@@ -1,6 +1,39 @@
 #include <assert.h>
 #include <stddef.h>
 
+#include "../include/mat.h"
+#include "mat_gemm.h"
+
+/* The products go parallel over the rows of C, a chunk does at least this many multiply-adds */
+#define MAT_GEMM_GRAIN_FLOPS ((size_t) 1 << 16)
+
+/* Arguments of the matrix products for `Mat_parallel_for` */
+struct Matf32_gemm_args {
+	const float *A;
+	const float *B;
+	float *C;
+	size_t nrowsA;
+	size_t ncolsA;
+	size_t ncols;	/* columns of C */
+};
+
+/* Rows of C per chunk so that each one does at least MAT_GEMM_GRAIN_FLOPS */
+static size_t gemm_grain(size_t depth, size_t ncols)
+{
+	size_t work = depth * ncols;
+	return work == 0 || work >= MAT_GEMM_GRAIN_FLOPS ? 1 : MAT_GEMM_GRAIN_FLOPS / work;
+}
+
+static void Matf32_dot_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_gemm_args *args = ctx;
+	size_t ncolsA = args->ncolsA, ncolsB = args->ncols;
+	float *C = args->C + begin * ncolsB;
+	for (size_t i = 0; i < (end - begin) * ncolsB; i++)
+		C[i] = 0.0f;
+	gemm_nn_acc(end - begin, ncolsB, ncolsA, args->A + begin * ncolsA, ncolsA, args->B, ncolsB, C, ncolsB);
+}
+
 /* Matf32_dot: matrix product C = A * B 
  * A is (nrowsA x ncolsA), B is (ncolsA x ncolsB), result C is (nrowsA x ncolsB)
  */
@@ -9,20 +42,53 @@ void Matf32_dot(const float *A, const float *B, float *C,
 	assert(A && "A can't be null");
 	assert(B && "B can't be null");
 	assert(C && "C can't be null");
-	for (size_t i = 0; i < nrowsA; i++) {
-		for (size_t j = 0; j < ncolsB; j++) {
-			float sum = 0.0f;
-			for (size_t k = 0; k < ncolsA; k++) {
-				sum += A[i * ncolsA + k] * B[k * ncolsB + j];
-			}
-			C[i * ncolsB + j] = sum;
-		}
-	}
+	struct Matf32_gemm_args args = {A, B, C, nrowsA, ncolsA, ncolsB};
+	Mat_parallel_for(Matf32_dot_range, &args, nrowsA, gemm_grain(ncolsA, ncolsB));
 }
 
+static void Matf32_dot_nt_acc_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_gemm_args *args = ctx;
+	size_t ncolsA = args->ncolsA, nrowsB = args->ncols;
+	gemm_nt_acc(end - begin, nrowsB, ncolsA, args->A + begin * ncolsA, ncolsA, args->B, ncolsA,
+		    args->C + begin * nrowsB, nrowsB);
+}
 
+/* Matf32_dot_nt_acc: C += A * B^T
+ * A is (nrowsA x ncolsA), B is (nrowsB x ncolsA), C is (nrowsA x nrowsB)
+ *
+ * Both operands are read along their rows, so B^T is never built
+ */
+void Matf32_dot_nt_acc(const float *A, const float *B, float *C,
+		       size_t nrowsA, size_t ncolsA, size_t nrowsB) {
+	assert(A && "A can't be null");
+	assert(B && "B can't be null");
+	assert(C && "C can't be null");
+	struct Matf32_gemm_args args = {A, B, C, nrowsA, ncolsA, nrowsB};
+	Mat_parallel_for(Matf32_dot_nt_acc_range, &args, nrowsA, gemm_grain(ncolsA, nrowsB));
+}
 
+/* Computes the rows [begin, end) of C = A^T * B, a row of C only depends on a column of A */
+static void Matf32_dot_tn_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_gemm_args *args = ctx;
+	size_t nrowsA = args->nrowsA, ncolsA = args->ncolsA, ncolsB = args->ncols;
+	float *C = args->C + begin * ncolsB;
+	for (size_t i = 0; i < (end - begin) * ncolsB; i++)
+		C[i] = 0.0f;
+	gemm_tn_acc(end - begin, ncolsB, nrowsA, args->A + begin, ncolsA, args->B, ncolsB, C, ncolsB);
+}
 
-
-
-
+/* Matf32_dot_tn: matrix product C = A^T * B
+ * A is (nrowsA x ncolsA), B is (nrowsA x ncolsB), result C is (ncolsA x ncolsB)
+ *
+ * Accumulates the outer products of the rows of A and B, every access is sequential
+ */
+void Matf32_dot_tn(const float *A, const float *B, float *C,
+		   size_t nrowsA, size_t ncolsA, size_t ncolsB) {
+	assert(A && "A can't be null");
+	assert(B && "B can't be null");
+	assert(C && "C can't be null");
+	struct Matf32_gemm_args args = {A, B, C, nrowsA, ncolsA, ncolsB};
+	Mat_parallel_for(Matf32_dot_tn_range, &args, ncolsA, gemm_grain(nrowsA, ncolsB));
+}
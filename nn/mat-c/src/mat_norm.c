@@ -0,0 +1,288 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../include/mat.h"
+
+/* The normalizations go parallel over the rows, a chunk reads at least this many floats */
+#define MAT_NORM_GRAIN_FLOATS ((size_t) 1 << 14)
+
+/* Arguments of the batch normalization for `Mat_parallel_for` */
+struct Matf32_batchnorm_args {
+	const float *X;
+	const float *dY;
+	float *Y;
+	float *dX;
+	const float *gamma;
+	const float *beta;
+	float *mean;
+	float *invstd;
+	float *dgamma;
+	float *dbeta;
+	size_t ncols;
+	float eps;
+	bool batch_stats;
+};
+
+static size_t norm_grain(size_t ncols)
+{
+	return ncols == 0 || ncols >= MAT_NORM_GRAIN_FLOATS ? 1 : MAT_NORM_GRAIN_FLOATS / ncols;
+}
+
+/* Rows [begin, end), the statistics of a row are taken while it is in the cache */
+static void Matf32_batchnorm_forward_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_batchnorm_args *args = ctx;
+	size_t n = args->ncols;
+	for (size_t i = begin; i < end; i++) {
+		const float *x = args->X + i * n;
+		float *y = args->Y + i * n;
+		if (args->batch_stats) {
+			/* Two passes, the variance doesn't cancel for large means */
+			float sum = 0.0f;
+			for (size_t j = 0; j < n; j++)
+				sum += x[j];
+			float mu = sum / (float) n;
+			float sq = 0.0f;
+			for (size_t j = 0; j < n; j++)
+				sq += (x[j] - mu) * (x[j] - mu);
+			args->mean[i] = mu;
+			args->invstd[i] = 1.0f / sqrtf(sq / (float) n + args->eps);
+		}
+
+		/* y = a * x + b, the whole row shares the scale and the shift */
+		float a = args->gamma[i] * args->invstd[i];
+		float b = args->beta[i] - a * args->mean[i];
+		for (size_t j = 0; j < n; j++)
+			y[j] = a * x[j] + b;
+	}
+}
+
+/* Matf32_batchnorm_forward: Y = gamma * (X - mean) * invstd + beta of every row */
+void Matf32_batchnorm_forward(const float *X, float *Y, const float *gamma, const float *beta,
+			      float *mean, float *invstd, size_t nrows, size_t ncols, float eps, bool batch_stats)
+{
+	assert(X && "X can't be null");
+	assert(Y && "Y can't be null");
+	assert(gamma && beta && "gamma and beta can't be null");
+	assert(mean && invstd && "mean and invstd can't be null");
+	assert((!batch_stats || ncols > 0) && "the statistics need a batch");
+	struct Matf32_batchnorm_args args = {X, NULL, Y, NULL, gamma, beta, mean, invstd, NULL, NULL,
+					     ncols, eps, batch_stats};
+	Mat_parallel_for(Matf32_batchnorm_forward_range, &args, nrows, norm_grain(ncols));
+}
+
+static void Matf32_batchnorm_backward_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_batchnorm_args *args = ctx;
+	size_t n = args->ncols;
+	for (size_t i = begin; i < end; i++) {
+		const float *x = args->X + i * n;
+		const float *dy = args->dY + i * n;
+		float mu = args->mean[i], s = args->invstd[i];
+
+		/* sum dy and sum dy * xhat, one pass */
+		float sum_dy = 0.0f, sum_dy_xhat = 0.0f;
+		for (size_t j = 0; j < n; j++) {
+			sum_dy += dy[j];
+			sum_dy_xhat += dy[j] * (x[j] - mu) * s;
+		}
+		if (args->dgamma != NULL) {
+			args->dgamma[i] += sum_dy_xhat;
+			args->dbeta[i] += sum_dy;
+		}
+		if (args->dX == NULL)
+			continue;
+
+		float *dx = args->dX + i * n;
+		float a = args->gamma[i] * s;
+		if (!args->batch_stats) {
+			/* Fixed statistics, the normalization is an affine map */
+			for (size_t j = 0; j < n; j++)
+				dx[j] = a * dy[j];
+			continue;
+		}
+
+		/* dx = gamma * invstd * (dy - mean(dy) - xhat * mean(dy * xhat)) */
+		float mean_dy = sum_dy / (float) n, mean_dy_xhat = sum_dy_xhat / (float) n;
+		for (size_t j = 0; j < n; j++)
+			dx[j] = a * (dy[j] - mean_dy - (x[j] - mu) * s * mean_dy_xhat);
+	}
+}
+
+/* Matf32_batchnorm_backward: dX of the forward, dgamma and dbeta accumulated */
+void Matf32_batchnorm_backward(const float *X, const float *dY, const float *gamma, const float *mean,
+			       const float *invstd, float *dX, float *dgamma, float *dbeta,
+			       size_t nrows, size_t ncols, bool batch_stats)
+{
+	assert(X && "X can't be null");
+	assert(dY && "dY can't be null");
+	assert(gamma && mean && invstd && "gamma and the statistics can't be null");
+	assert((dgamma == NULL) == (dbeta == NULL) && "dgamma and dbeta go together");
+	struct Matf32_batchnorm_args args = {X, dY, NULL, dX, gamma, NULL, (float *) mean, (float *) invstd,
+					     dgamma, dbeta, ncols, 0.0f, batch_stats};
+	Mat_parallel_for(Matf32_batchnorm_backward_range, &args, nrows, norm_grain(ncols));
+}
+
+/*
+ * The layer normalization goes over the rows of every column. The columns are
+ * taken in blocks, so the loops over a row of a block run over contiguous
+ * memory, and a block is read again while it is still in the cache
+ */
+#define MAT_NORM_BLOCK ((size_t) 64)
+
+/* Arguments of the layer normalization for `Mat_parallel_for` */
+struct Matf32_layernorm_args {
+	const float *X;
+	const float *R;
+	float *S;
+	float *Y;
+	const float *dY;
+	float *dX;
+	const float *gamma;
+	const float *beta;
+	float *mean;
+	float *invstd;
+	float *dgamma;
+	float *dbeta;
+	size_t nrows;
+	size_t ncols;
+	float eps;
+};
+
+/* Blocks of columns [begin, end), Welford over the rows while the residual is added */
+static void Matf32_layernorm_forward_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_layernorm_args *args = ctx;
+	size_t m = args->nrows, n = args->ncols;
+	for (size_t block = begin; block < end; block++) {
+		size_t j0 = block * MAT_NORM_BLOCK;
+		size_t nb = n - j0 < MAT_NORM_BLOCK ? n - j0 : MAT_NORM_BLOCK;
+		float *restrict mean = args->mean + j0;
+		float *restrict m2 = args->invstd + j0;
+		for (size_t j = 0; j < nb; j++)
+			mean[j] = m2[j] = 0.0f;
+
+		const float *in = args->R == NULL ? args->X : args->S;
+		for (size_t i = 0; i < m; i++) {
+			const float *s = args->X + i * n + j0;
+			if (args->R != NULL) {
+				float *sum = args->S + i * n + j0;
+				const float *r = args->R + i * n + j0;
+				for (size_t j = 0; j < nb; j++)
+					sum[j] = s[j] + r[j];
+				s = sum;
+			}
+			float w = 1.0f / (float) (i + 1);
+			for (size_t j = 0; j < nb; j++) {
+				float delta = s[j] - mean[j];
+				mean[j] += delta * w;
+				m2[j] += delta * (s[j] - mean[j]);
+			}
+		}
+		for (size_t j = 0; j < nb; j++)
+			m2[j] = 1.0f / sqrtf(m2[j] / (float) m + args->eps);
+
+		for (size_t i = 0; i < m; i++) {
+			const float *s = in + i * n + j0;
+			float *y = args->Y + i * n + j0;
+			float g = args->gamma[i], b = args->beta[i];
+			for (size_t j = 0; j < nb; j++)
+				y[j] = g * (s[j] - mean[j]) * m2[j] + b;
+		}
+	}
+}
+
+/* Matf32_layernorm_forward: S = X + R if R isn't NULL, Y = the normalization of every column */
+void Matf32_layernorm_forward(const float *X, const float *R, float *S, float *Y, const float *gamma,
+			      const float *beta, float *mean, float *invstd, size_t nrows, size_t ncols, float eps)
+{
+	assert(X && "X can't be null");
+	assert(Y && "Y can't be null");
+	assert((R == NULL || S != NULL) && "the residual needs S");
+	assert(gamma && beta && "gamma and beta can't be null");
+	assert(mean && invstd && "mean and invstd can't be null");
+	assert(nrows > 0 && "a column needs rows");
+	struct Matf32_layernorm_args args = {X, R, S, Y, NULL, NULL, gamma, beta, mean, invstd, NULL, NULL,
+					     nrows, ncols, eps};
+	size_t nblocks = (ncols + MAT_NORM_BLOCK - 1) / MAT_NORM_BLOCK;
+	Mat_parallel_for(Matf32_layernorm_forward_range, &args, nblocks, norm_grain(nrows * MAT_NORM_BLOCK));
+}
+
+/* Rows [begin, end) of dgamma and dbeta, a row is contiguous and only its own sums are written */
+static void Matf32_layernorm_params_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_layernorm_args *args = ctx;
+	size_t n = args->ncols;
+	for (size_t i = begin; i < end; i++) {
+		const float *s = args->X + i * n;
+		const float *dy = args->dY + i * n;
+		float sum_dy = 0.0f, sum_dy_xhat = 0.0f;
+		for (size_t j = 0; j < n; j++) {
+			sum_dy += dy[j];
+			sum_dy_xhat += dy[j] * (s[j] - args->mean[j]) * args->invstd[j];
+		}
+		args->dgamma[i] += sum_dy_xhat;
+		args->dbeta[i] += sum_dy;
+	}
+}
+
+/* Blocks of columns [begin, end) of dX, dx = invstd * (g - mean(g) - xhat * mean(g * xhat)), g = gamma * dy */
+static void Matf32_layernorm_dx_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_layernorm_args *args = ctx;
+	size_t m = args->nrows, n = args->ncols;
+	float sum_g[MAT_NORM_BLOCK], sum_g_xhat[MAT_NORM_BLOCK];
+	for (size_t block = begin; block < end; block++) {
+		size_t j0 = block * MAT_NORM_BLOCK;
+		size_t nb = n - j0 < MAT_NORM_BLOCK ? n - j0 : MAT_NORM_BLOCK;
+		const float *mean = args->mean + j0, *invstd = args->invstd + j0;
+		for (size_t j = 0; j < nb; j++)
+			sum_g[j] = sum_g_xhat[j] = 0.0f;
+
+		for (size_t i = 0; i < m; i++) {
+			const float *s = args->X + i * n + j0;
+			const float *dy = args->dY + i * n + j0;
+			float gamma = args->gamma[i];
+			for (size_t j = 0; j < nb; j++) {
+				float g = gamma * dy[j];
+				sum_g[j] += g;
+				sum_g_xhat[j] += g * (s[j] - mean[j]) * invstd[j];
+			}
+		}
+		for (size_t j = 0; j < nb; j++) {
+			sum_g[j] /= (float) m;
+			sum_g_xhat[j] /= (float) m;
+		}
+
+		for (size_t i = 0; i < m; i++) {
+			const float *s = args->X + i * n + j0;
+			const float *dy = args->dY + i * n + j0;
+			float *dx = args->dX + i * n + j0;
+			float gamma = args->gamma[i];
+			for (size_t j = 0; j < nb; j++) {
+				float xhat = (s[j] - mean[j]) * invstd[j];
+				dx[j] = invstd[j] * (gamma * dy[j] - sum_g[j] - xhat * sum_g_xhat[j]);
+			}
+		}
+	}
+}
+
+/* Matf32_layernorm_backward: dX of Matf32_layernorm_forward, dgamma and dbeta accumulated */
+void Matf32_layernorm_backward(const float *S, const float *dY, const float *gamma, const float *mean,
+			       const float *invstd, float *dX, float *dgamma, float *dbeta, size_t nrows, size_t ncols)
+{
+	assert(S && "S can't be null");
+	assert(dY && "dY can't be null");
+	assert(gamma && mean && invstd && "gamma and the statistics can't be null");
+	assert((dgamma == NULL) == (dbeta == NULL) && "dgamma and dbeta go together");
+	struct Matf32_layernorm_args args = {S, NULL, NULL, NULL, dY, dX, gamma, NULL, (float *) mean, (float *) invstd,
+					     dgamma, dbeta, nrows, ncols, 0.0f};
+	if (dgamma != NULL)
+		Mat_parallel_for(Matf32_layernorm_params_range, &args, nrows, norm_grain(ncols));
+	if (dX != NULL) {
+		size_t nblocks = (ncols + MAT_NORM_BLOCK - 1) / MAT_NORM_BLOCK;
+		Mat_parallel_for(Matf32_layernorm_dx_range, &args, nblocks, norm_grain(nrows * MAT_NORM_BLOCK));
+	}
+}
@@ -0,0 +1,122 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../include/mat.h"
+
+/* The steps only go parallel over this number of elements */
+#define MAT_OPTIM_GRAIN ((size_t) 1 << 14)
+
+/* Arguments of the optimizer steps for `Mat_parallel_for` */
+struct Matf32_optim_args {
+	float *P;
+	const float *G;
+	float *M;
+	float *V;
+	float lr;
+	float beta1;
+	float beta2;
+	float eps;
+	float wd;
+	float c1;
+	float c2;
+	bool nesterov;
+};
+
+static void Matf32_momentum_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_optim_args *args = ctx;
+	float *restrict P = args->P;
+	const float *restrict G = args->G;
+	float *restrict V = args->M;
+	float lr = args->lr, mu = args->beta1;
+
+	if (args->nesterov) {
+		for (size_t i = begin; i < end; i++) {
+			float v = mu * V[i] + G[i];
+			V[i] = v;
+			P[i] -= lr * (G[i] + mu * v);
+		}
+	} else {
+		for (size_t i = begin; i < end; i++) {
+			float v = mu * V[i] + G[i];
+			V[i] = v;
+			P[i] -= lr * v;
+		}
+	}
+}
+
+/* Matf32_momentum_step: V = mu * V + G, then P -= lr * V (nesterov: P -= lr * (G + mu * V)) */
+void Matf32_momentum_step(float *P, const float *G, float *V, size_t n,
+			  float lr, float mu, bool nesterov)
+{
+	assert(P && "P can't be null");
+	assert(G && "G can't be null");
+	assert(V && "V can't be null");
+	struct Matf32_optim_args args = {P, G, V, NULL, lr, mu, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, nesterov};
+	Mat_parallel_for(Matf32_momentum_range, &args, n, MAT_OPTIM_GRAIN);
+}
+
+static void Matf32_rmsprop_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_optim_args *args = ctx;
+	float *restrict P = args->P;
+	const float *restrict G = args->G;
+	float *restrict S = args->V;
+	float lr = args->lr, rho = args->beta2, eps = args->eps;
+
+	for (size_t i = begin; i < end; i++) {
+		float g = G[i];
+		float s = rho * S[i] + (1.0f - rho) * g * g;
+		S[i] = s;
+		P[i] -= lr * g / (sqrtf(s) + eps);
+	}
+}
+
+/* Matf32_rmsprop_step: S = rho * S + (1 - rho) * G^2, then P -= lr * G / (sqrt(S) + eps) */
+void Matf32_rmsprop_step(float *P, const float *G, float *S, size_t n,
+			 float lr, float rho, float eps)
+{
+	assert(P && "P can't be null");
+	assert(G && "G can't be null");
+	assert(S && "S can't be null");
+	struct Matf32_optim_args args = {P, G, NULL, S, lr, 0.0f, rho, eps, 0.0f, 0.0f, 0.0f, false};
+	Mat_parallel_for(Matf32_rmsprop_range, &args, n, MAT_OPTIM_GRAIN);
+}
+
+static void Matf32_adam_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_optim_args *args = ctx;
+	float *restrict P = args->P;
+	const float *restrict G = args->G;
+	float *restrict M = args->M;
+	float *restrict V = args->V;
+	float lr = args->lr, beta1 = args->beta1, beta2 = args->beta2, eps = args->eps;
+	float decay = args->lr * args->wd;
+	/* The bias corrections fold into the step size and epsilon */
+	float step = lr / args->c1;
+	float inv_c2 = 1.0f / args->c2;
+
+	for (size_t i = begin; i < end; i++) {
+		float g = G[i];
+		float m = beta1 * M[i] + (1.0f - beta1) * g;
+		float v = beta2 * V[i] + (1.0f - beta2) * g * g;
+		M[i] = m;
+		V[i] = v;
+		P[i] -= step * m / (sqrtf(v * inv_c2) + eps) + decay * P[i];
+	}
+}
+
+/* Matf32_adam_step: fused Adam/AdamW step, see mat.h */
+void Matf32_adam_step(float *P, const float *G, float *M, float *V, size_t n,
+		      float lr, float beta1, float beta2, float eps, float wd,
+		      float c1, float c2)
+{
+	assert(P && "P can't be null");
+	assert(G && "G can't be null");
+	assert(M && "M can't be null");
+	assert(V && "V can't be null");
+	struct Matf32_optim_args args = {P, G, M, V, lr, beta1, beta2, eps, wd, c1, c2, false};
+	Mat_parallel_for(Matf32_adam_range, &args, n, MAT_OPTIM_GRAIN);
+}
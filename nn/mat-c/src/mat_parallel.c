@@ -0,0 +1,32 @@
+#include <stddef.h>
+
+#include "../include/mat.h"
+
+static Mat_parallel_for_fn parallel_for_hook = NULL;
+
+/* Mat_set_parallel_for: install the scheduler of the kernels, NULL (the default) runs them serially */
+void Mat_set_parallel_for(Mat_parallel_for_fn fn)
+{
+	parallel_for_hook = fn;
+}
+
+/* Mat_get_parallel_for: the installed scheduler, NULL if there is none */
+Mat_parallel_for_fn Mat_get_parallel_for(void)
+{
+	return parallel_for_hook;
+}
+
+/* Mat_parallel_for: run `body` over [0, n) with the installed scheduler, serially if n <= grain */
+void Mat_parallel_for(Mat_range_fn body, void *ctx, size_t n, size_t grain)
+{
+	if (n == 0)
+		return;
+
+	/* Small kernels are not worth the synchronization */
+	if (parallel_for_hook == NULL || n <= grain) {
+		body(ctx, 0, n);
+		return;
+	}
+
+	parallel_for_hook(body, ctx, n, grain);
+}
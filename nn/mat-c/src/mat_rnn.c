@@ -0,0 +1,247 @@
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+
+#include "../include/mat.h"
+
+/* The cells go parallel over the hidden units, a chunk reads at least this many floats */
+#define MAT_RNN_GRAIN_FLOATS ((size_t) 1 << 13)
+
+/* Arguments of the recurrent cells for `Mat_parallel_for` */
+struct Matf32_rnn_args {
+	const float *Gx;
+	const float *Z;
+	const float *bias_x;
+	const float *bias_h;
+	const float *gates;
+	const float *h_prev;
+	const float *c_prev;
+	const float *c;
+	const float *dh;
+	float *dc;
+	float *dZ;
+	float *dG;
+	float *dh_prev;
+	float *out_gates;
+	float *out_c;
+	float *out_h;
+	size_t ldx;
+	size_t hidden;
+	size_t ncols;
+};
+
+static size_t rnn_grain(size_t ncols)
+{
+	return ncols == 0 || ncols >= MAT_RNN_GRAIN_FLOATS ? 1 : MAT_RNN_GRAIN_FLOATS / ncols;
+}
+
+static inline float rnn_sigmoid(float x)
+{
+	return 1.0f / (1.0f + expf(-x));
+}
+
+/* Units [begin, end), the four gates of a unit are activated in one pass over the batch */
+static void Matf32_lstm_cell_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_rnn_args *args = ctx;
+	size_t n = args->ncols;
+	size_t H = args->hidden;
+	for (size_t k = begin; k < end; k++) {
+		const float *gx[4], *z[4];
+		float *a[4], bias[4];
+		for (size_t q = 0; q < 4; q++) {
+			gx[q] = args->Gx + (q * H + k) * args->ldx;
+			z[q] = args->Z + (q * H + k) * n;
+			a[q] = args->out_gates + (q * H + k) * n;
+			bias[q] = args->bias_x[q * H + k];
+		}
+		const float *c_prev = args->c_prev == NULL ? NULL : args->c_prev + k * n;
+		float *c = args->out_c + k * n;
+		float *h = args->out_h + k * n;
+
+		for (size_t j = 0; j < n; j++) {
+			float i = rnn_sigmoid(gx[0][j] + z[0][j] + bias[0]);
+			float f = rnn_sigmoid(gx[1][j] + z[1][j] + bias[1]);
+			float g = tanhf(gx[2][j] + z[2][j] + bias[2]);
+			float o = rnn_sigmoid(gx[3][j] + z[3][j] + bias[3]);
+			float cj = i * g + (c_prev == NULL ? 0.0f : f * c_prev[j]);
+			a[0][j] = i;
+			a[1][j] = f;
+			a[2][j] = g;
+			a[3][j] = o;
+			c[j] = cj;
+			h[j] = o * tanhf(cj);
+		}
+	}
+}
+
+/* Matf32_lstm_cell: one step of an LSTM, the activations i, f, g, o and c, h of the step */
+void Matf32_lstm_cell(const float *Gx, size_t ldx, const float *Z, const float *bias, const float *c_prev,
+		      float *gates, float *c, float *h, size_t hidden, size_t ncols)
+{
+	assert(Gx && "Gx can't be null");
+	assert(Z && "Z can't be null");
+	assert(bias && "bias can't be null");
+	assert(gates && "gates can't be null");
+	assert(c && "c can't be null");
+	assert(h && "h can't be null");
+	assert(ldx >= ncols && "the rows of Gx hold the batch");
+
+	struct Matf32_rnn_args args = {Gx, Z, bias, NULL, NULL, NULL, c_prev, NULL, NULL, NULL, NULL, NULL,
+				       NULL, gates, c, h, ldx, hidden, ncols};
+	Mat_parallel_for(Matf32_lstm_cell_range, &args, hidden, rnn_grain(4 * ncols));
+}
+
+/* The stored activations give every derivative, no exponential is taken again */
+static void Matf32_lstm_cell_backward_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_rnn_args *args = ctx;
+	size_t n = args->ncols;
+	size_t H = args->hidden;
+	for (size_t k = begin; k < end; k++) {
+		const float *a[4];
+		float *dz[4], *dg[4];
+		for (size_t q = 0; q < 4; q++) {
+			a[q] = args->gates + (q * H + k) * n;
+			dz[q] = args->dZ + (q * H + k) * n;
+			dg[q] = args->dG == NULL ? NULL : args->dG + (q * H + k) * args->ldx;
+		}
+		const float *c_prev = args->c_prev == NULL ? NULL : args->c_prev + k * n;
+		const float *c = args->c + k * n;
+		const float *dh = args->dh + k * n;
+		float *dc = args->dc + k * n;
+
+		for (size_t j = 0; j < n; j++) {
+			float i = a[0][j], f = a[1][j], g = a[2][j], o = a[3][j];
+			float tc = tanhf(c[j]);
+			float dcj = dc[j] + dh[j] * o * (1.0f - tc * tc);
+			dz[0][j] = dcj * g * i * (1.0f - i);
+			dz[1][j] = c_prev == NULL ? 0.0f : dcj * c_prev[j] * f * (1.0f - f);
+			dz[2][j] = dcj * i * (1.0f - g * g);
+			dz[3][j] = dh[j] * tc * o * (1.0f - o);
+			dc[j] = dcj * f;
+		}
+		if (args->dG != NULL)
+			for (size_t q = 0; q < 4; q++)
+				for (size_t j = 0; j < n; j++)
+					dg[q][j] = dz[q][j];
+	}
+}
+
+/* Matf32_lstm_cell_backward: the gradients of the pre-activations of a step, dc goes back one step */
+void Matf32_lstm_cell_backward(const float *gates, const float *c_prev, const float *c, const float *dh,
+			       float *dc, float *dZ, float *dG, size_t ldg, size_t hidden, size_t ncols)
+{
+	assert(gates && "gates can't be null");
+	assert(c && "c can't be null");
+	assert(dh && "dh can't be null");
+	assert(dc && "dc can't be null");
+	assert(dZ && "dZ can't be null");
+	assert((dG == NULL || ldg >= ncols) && "the rows of dG hold the batch");
+
+	struct Matf32_rnn_args args = {NULL, NULL, NULL, NULL, gates, NULL, c_prev, c, dh, dc, dZ, dG,
+				       NULL, NULL, NULL, NULL, ldg, hidden, ncols};
+	Mat_parallel_for(Matf32_lstm_cell_backward_range, &args, hidden, rnn_grain(4 * ncols));
+}
+
+/* Units [begin, end), the candidate needs the reset gate of the same unit only */
+static void Matf32_gru_cell_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_rnn_args *args = ctx;
+	size_t n = args->ncols;
+	size_t H = args->hidden;
+	for (size_t k = begin; k < end; k++) {
+		const float *gx[3], *z[3];
+		float *a[4], bx[3], bh[3];
+		for (size_t q = 0; q < 3; q++) {
+			gx[q] = args->Gx + (q * H + k) * args->ldx;
+			z[q] = args->Z + (q * H + k) * n;
+			bx[q] = args->bias_x[q * H + k];
+			bh[q] = args->bias_h[q * H + k];
+		}
+		for (size_t q = 0; q < 4; q++)
+			a[q] = args->out_gates + (q * H + k) * n;
+		const float *h_prev = args->h_prev == NULL ? NULL : args->h_prev + k * n;
+		float *h = args->out_h + k * n;
+
+		for (size_t j = 0; j < n; j++) {
+			float r = rnn_sigmoid(gx[0][j] + bx[0] + z[0][j] + bh[0]);
+			float u = rnn_sigmoid(gx[1][j] + bx[1] + z[1][j] + bh[1]);
+			float hn = z[2][j] + bh[2];
+			float cand = tanhf(gx[2][j] + bx[2] + r * hn);
+			a[0][j] = r;
+			a[1][j] = u;
+			a[2][j] = cand;
+			a[3][j] = hn;
+			h[j] = (1.0f - u) * cand + (h_prev == NULL ? 0.0f : u * h_prev[j]);
+		}
+	}
+}
+
+/* Matf32_gru_cell: one step of a GRU, the activations r, u, n, the recurrent candidate and h */
+void Matf32_gru_cell(const float *Gx, size_t ldx, const float *Z, const float *bias_x, const float *bias_h,
+		     const float *h_prev, float *gates, float *h, size_t hidden, size_t ncols)
+{
+	assert(Gx && "Gx can't be null");
+	assert(Z && "Z can't be null");
+	assert(bias_x && "bias_x can't be null");
+	assert(bias_h && "bias_h can't be null");
+	assert(gates && "gates can't be null");
+	assert(h && "h can't be null");
+	assert(ldx >= ncols && "the rows of Gx hold the batch");
+
+	struct Matf32_rnn_args args = {Gx, Z, bias_x, bias_h, NULL, h_prev, NULL, NULL, NULL, NULL, NULL, NULL,
+				       NULL, gates, NULL, h, ldx, hidden, ncols};
+	Mat_parallel_for(Matf32_gru_cell_range, &args, hidden, rnn_grain(4 * ncols));
+}
+
+static void Matf32_gru_cell_backward_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_rnn_args *args = ctx;
+	size_t n = args->ncols;
+	size_t H = args->hidden;
+	for (size_t k = begin; k < end; k++) {
+		const float *a[4];
+		float *dz[3], *dg[3];
+		for (size_t q = 0; q < 4; q++)
+			a[q] = args->gates + (q * H + k) * n;
+		for (size_t q = 0; q < 3; q++) {
+			dz[q] = args->dZ + (q * H + k) * n;
+			dg[q] = args->dG + (q * H + k) * args->ldx;
+		}
+		const float *h_prev = args->h_prev == NULL ? NULL : args->h_prev + k * n;
+		const float *dh = args->dh + k * n;
+		float *dh_prev = args->dh_prev == NULL ? NULL : args->dh_prev + k * n;
+
+		for (size_t j = 0; j < n; j++) {
+			float r = a[0][j], u = a[1][j], cand = a[2][j], hn = a[3][j];
+			float hp = h_prev == NULL ? 0.0f : h_prev[j];
+			float dn = dh[j] * (1.0f - u) * (1.0f - cand * cand);
+			float dr = dn * hn * r * (1.0f - r);
+			float du = dh[j] * (hp - cand) * u * (1.0f - u);
+			dg[0][j] = dr;
+			dg[1][j] = du;
+			dg[2][j] = dn;
+			dz[0][j] = dr;
+			dz[1][j] = du;
+			dz[2][j] = dn * r;
+			if (dh_prev != NULL)
+				dh_prev[j] = dh[j] * u;
+		}
+	}
+}
+
+/* Matf32_gru_cell_backward: the gradients of the pre-activations of a step and the direct part of dh_prev */
+void Matf32_gru_cell_backward(const float *gates, const float *h_prev, const float *dh, float *dZ, float *dG,
+			      size_t ldg, float *dh_prev, size_t hidden, size_t ncols)
+{
+	assert(gates && "gates can't be null");
+	assert(dh && "dh can't be null");
+	assert(dZ && "dZ can't be null");
+	assert(dG && "dG can't be null");
+	assert(ldg >= ncols && "the rows of dG hold the batch");
+
+	struct Matf32_rnn_args args = {NULL, NULL, NULL, NULL, gates, h_prev, NULL, NULL, dh, NULL, dZ, dG,
+				       dh_prev, NULL, NULL, NULL, ldg, hidden, ncols};
+	Mat_parallel_for(Matf32_gru_cell_backward_range, &args, hidden, rnn_grain(4 * ncols));
+}
@@ -0,0 +1,184 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../include/mat.h"
+#include "mat_gemm.h"
+#include "mat_math.h"
+
+/* A chunk of block rows does at least this many multiply-adds */
+#define MAT_SPARSE_GRAIN_FLOPS ((size_t) 1 << 16)
+
+/* Columns of C per task of the transposed product */
+#define MAT_SPARSE_TN_COLS ((size_t) 64)
+
+/* Arguments of the sparse products for `Mat_parallel_for`, the sampled product
+ * reads X from `values` and Y from `B` and adds to the values in `C` */
+struct Matf32_bsr_args {
+	const struct Mat_bsr *A;
+	const float *values;
+	const float *B;
+	float *C;
+	size_t ncols;	/* columns of B and C */
+};
+
+/* Block rows per chunk so that each one does at least MAT_SPARSE_GRAIN_FLOPS on average */
+static size_t bsr_grain(const struct Mat_bsr *A, size_t ncols)
+{
+	size_t nbrows = A->nrows / A->block_rows;
+	size_t work = nbrows == 0 ? 0 : A->row_ptr[nbrows] * A->block_rows * A->block_cols * ncols / nbrows;
+	return work == 0 || work >= MAT_SPARSE_GRAIN_FLOPS ? 1 : MAT_SPARSE_GRAIN_FLOPS / work;
+}
+
+/*
+ * A row of a CSR matrix times a vector: MAT_LANES independent partial sums
+ * over the nonzeros, the loads of x are gathered. Every whole block of
+ * nonzeros is one multiply-add of vectors at -O2
+ */
+static inline float csr_row_dot(const float *values, const uint32_t *cols, size_t count, const float *x)
+{
+	float acc[MAT_LANES] = {0.0f};
+	size_t k = 0;
+	for (; k + MAT_LANES <= count; k += MAT_LANES)
+		for (size_t l = 0; l < MAT_LANES; l++)
+			acc[l] += values[k + l] * x[cols[k + l]];
+	for (; k < count; k++)
+		acc[0] += values[k] * x[cols[k]];
+
+	float sum = 0.0f;
+	for (size_t l = 0; l < MAT_LANES; l++)
+		sum += acc[l];
+	return sum;
+}
+
+/*
+ * `width` <= MAT_LANES columns of a row of C = A * B through CSR: the block
+ * of C stays in locals over all the nonzeros of the row, every nonzero is a
+ * broadcast times a contiguous block of its row of B. Called with MAT_LANES
+ * the loops are vector code
+ */
+static inline void csr_row_block(const float *values, const uint32_t *cols, size_t count, const float *B,
+				 size_t ldb, float *c, size_t width)
+{
+	float acc[MAT_LANES] = {0.0f};
+	for (size_t k = 0; k < count; k++) {
+		const float *b = B + (size_t) cols[k] * ldb;
+		for (size_t l = 0; l < width; l++)
+			acc[l] += values[k] * b[l];
+	}
+	for (size_t l = 0; l < width; l++)
+		c[l] = acc[l];
+}
+
+static void Matf32_bsr_dot_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_bsr_args *args = ctx;
+	const struct Mat_bsr *A = args->A;
+	size_t br = A->block_rows, bc = A->block_cols, bsize = br * bc, n = args->ncols;
+
+	for (size_t ib = begin; ib < end; ib++) {
+		float *c = args->C + ib * br * n;
+		size_t first = A->row_ptr[ib], last = A->row_ptr[ib + 1];
+
+		/* CSR: a row of C along the batch, MAT_LANES samples at a time */
+		if (bsize == 1) {
+			const float *values = args->values + first;
+			const uint32_t *cols = A->col_idx + first;
+			if (n == 1) {
+				c[0] = csr_row_dot(values, cols, last - first, args->B);
+				continue;
+			}
+			size_t j = 0;
+			for (; j + MAT_LANES <= n; j += MAT_LANES)
+				csr_row_block(values, cols, last - first, args->B + j, n, c + j, MAT_LANES);
+			if (j < n)
+				csr_row_block(values, cols, last - first, args->B + j, n, c + j, n - j);
+			continue;
+		}
+
+		/* A row of C gets the rows of B at the columns of its nonzeros, along the batch */
+		for (size_t i = 0; i < br * n; i++)
+			c[i] = 0.0f;
+		for (size_t k = first; k < last; k++)
+			gemm_nn_acc(br, n, bc, args->values + k * bsize, bc, args->B + (size_t) A->col_idx[k] * bc * n,
+				    n, c, n);
+	}
+}
+
+/* Matf32_bsr_dot: C = A * B, B is (ncols(A) x ncolsB), C is (nrows(A) x ncolsB) */
+void Matf32_bsr_dot(const struct Mat_bsr *A, const float *values, const float *B, float *C, size_t ncolsB)
+{
+	assert(A && "A can't be null");
+	assert(values && "the values can't be null");
+	assert(B && "B can't be null");
+	assert(C && "C can't be null");
+
+	struct Matf32_bsr_args args = {A, values, B, C, ncolsB};
+	Mat_parallel_for(Matf32_bsr_dot_range, &args, A->nrows / A->block_rows, bsr_grain(A, ncolsB));
+}
+
+/*
+ * The columns [j0, j1) of C = A^T * B for the tasks [begin, end). Every
+ * block scatters to the rows of its block column, so the tasks split the
+ * batch and not the rows: two of them never write the same element
+ */
+static void Matf32_bsr_dot_tn_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_bsr_args *args = ctx;
+	const struct Mat_bsr *A = args->A;
+	size_t br = A->block_rows, bc = A->block_cols, bsize = br * bc, n = args->ncols;
+	size_t nbrows = A->nrows / br;
+
+	for (size_t task = begin; task < end; task++) {
+		size_t j0 = task * MAT_SPARSE_TN_COLS;
+		size_t width = n - j0 < MAT_SPARSE_TN_COLS ? n - j0 : MAT_SPARSE_TN_COLS;
+		for (size_t i = 0; i < A->ncols; i++)
+			for (size_t j = 0; j < width; j++)
+				args->C[i * n + j0 + j] = 0.0f;
+
+		for (size_t ib = 0; ib < nbrows; ib++)
+			for (size_t k = A->row_ptr[ib]; k < A->row_ptr[ib + 1]; k++)
+				gemm_tn_acc(bc, width, br, args->values + k * bsize, bc, args->B + ib * br * n + j0, n,
+					    args->C + (size_t) A->col_idx[k] * bc * n + j0, n);
+	}
+}
+
+/* Matf32_bsr_dot_tn: C = A^T * B, B is (nrows(A) x ncolsB), C is (ncols(A) x ncolsB) */
+void Matf32_bsr_dot_tn(const struct Mat_bsr *A, const float *values, const float *B, float *C, size_t ncolsB)
+{
+	assert(A && "A can't be null");
+	assert(values && "the values can't be null");
+	assert(B && "B can't be null");
+	assert(C && "C can't be null");
+
+	struct Matf32_bsr_args args = {A, values, B, C, ncolsB};
+	Mat_parallel_for(Matf32_bsr_dot_tn_range, &args, (ncolsB + MAT_SPARSE_TN_COLS - 1) / MAT_SPARSE_TN_COLS, 1);
+}
+
+/* The blocks of the block rows [begin, end), a block is the product of a window of rows of X and Y */
+static void Matf32_bsr_sampled_dot_nt_acc_range(void *ctx, size_t begin, size_t end)
+{
+	const struct Matf32_bsr_args *args = ctx;
+	const struct Mat_bsr *A = args->A;
+	size_t br = A->block_rows, bc = A->block_cols, bsize = br * bc, n = args->ncols;
+	float *values = args->C;
+
+	for (size_t ib = begin; ib < end; ib++)
+		for (size_t k = A->row_ptr[ib]; k < A->row_ptr[ib + 1]; k++)
+			gemm_nt_acc(br, bc, n, args->values + ib * br * n, n, args->B + (size_t) A->col_idx[k] * bc * n,
+				    n, values + k * bsize, bc);
+}
+
+/* Matf32_bsr_sampled_dot_nt_acc: the stored values of A (laid out as `values`) += X * Y^T at
+ * their positions, X is (nrows(A) x ncols), Y is (ncols(A) x ncols) */
+void Matf32_bsr_sampled_dot_nt_acc(const struct Mat_bsr *A, const float *X, const float *Y, float *values,
+				   size_t ncols)
+{
+	assert(A && "A can't be null");
+	assert(X && "X can't be null");
+	assert(Y && "Y can't be null");
+	assert(values && "the values can't be null");
+
+	struct Matf32_bsr_args args = {A, X, Y, values, ncols};
+	Mat_parallel_for(Matf32_bsr_sampled_dot_nt_acc_range, &args, A->nrows / A->block_rows, bsr_grain(A, ncols));
+}
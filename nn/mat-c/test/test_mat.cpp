@@ -2,6 +2,7 @@
 #include <gtest/gtest.h>
 #include <algorithm> // for std::copy
 #include <cstring>   // for std::memcmp
+#include <vector>
 
 extern "C" {
 #include "../include/mat.h"
@@ -353,3 +354,432 @@ TEST(Matf32Test, SumSquareMatrix) {
 	float sum = Matf32_grand_sum(A, 2, 2);
 	EXPECT_FLOAT_EQ(sum, 10.0f);
 }
+
+TEST(Matf32Test, AxpyBasic) {
+	float A[4] = {1.0f, 2.0f, 3.0f, 4.0f};
+	float B[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+	Matf32_axpy(A, B, 2, 2, -0.5f);
+
+	float expected[4] = {0.5f, 0.0f, -0.5f, -1.0f};
+	expect_array_eq(expected, B, 4);
+}
+
+TEST(Matf32Test, AddColvecAndRowSum) {
+	float A[6] = {1, 2, 3,
+		      4, 5, 6}; // 2x3 matrix
+	float v[2] = {10, 20};
+
+	Matf32_add_colvec(A, v, 2, 3);
+	float expected[6] = {11, 12, 13,
+			     24, 25, 26};
+	expect_array_eq(expected, A, 6);
+
+	float sums[2] = {1, 1};
+	Matf32_add_row_sum(A, sums, 2, 3);
+	float expected_sums[2] = {37, 76};
+	expect_array_eq(expected_sums, sums, 2);
+}
+
+TEST(Matf32Test, DotTransposedVariants) {
+	float A[6] = {1, 2, 3,
+		      4, 5, 6}; // 2x3 matrix
+	float B[4] = {1, 0,
+		      2, 1};    // 2x2 matrix
+
+	// A^T . B ~ (3x2)
+	float C[6];
+	Matf32_dot_tn(A, B, C, 2, 3, 2);
+	float expected_tn[6] = {9, 4,
+				12, 5,
+				15, 6};
+	expect_array_eq(expected_tn, C, 6);
+
+	// A . A^T ~ (2x2), accumulated on top of ones
+	float D[4] = {1, 1, 1, 1};
+	Matf32_dot_nt_acc(A, A, D, 2, 3, 2);
+	float expected_nt[4] = {15, 33,
+				33, 78};
+	expect_array_eq(expected_nt, D, 4);
+}
+
+/* Runs the chunks of at most `grain` items in reverse order, like an out of order scheduler */
+static size_t hook_calls = 0;
+static void reverse_chunks(Mat_range_fn body, void *ctx, size_t n, size_t grain) {
+	hook_calls++;
+	size_t nchunks = (n + grain - 1) / grain;
+	for (size_t c = nchunks; c-- > 0;) {
+		size_t begin = c * grain;
+		body(ctx, begin, std::min(n, begin + grain));
+	}
+}
+
+TEST(Matf32Test, ParallelHookKeepsTheResults) {
+	const size_t n = 96, m = 1024;
+	std::vector<float> A(n * m), B(m * n), serial(n * n), chunked(n * n);
+	Matf32_rand_uniform(A.data(), n, m, -1.0f, 1.0f);
+	Matf32_rand_uniform(B.data(), m, n, -1.0f, 1.0f);
+
+	ASSERT_EQ(Mat_get_parallel_for(), nullptr);
+	Matf32_dot(A.data(), B.data(), serial.data(), n, m, n);
+	Mat_set_parallel_for(reverse_chunks);
+	Matf32_dot(A.data(), B.data(), chunked.data(), n, m, n);
+	EXPECT_GT(hook_calls, 0u);
+	expect_array_eq(serial.data(), chunked.data(), n * n);
+
+	// A . A^T and B^T . B, both (n x n)
+	std::fill(serial.begin(), serial.end(), 0.0f);
+	std::fill(chunked.begin(), chunked.end(), 0.0f);
+	Mat_set_parallel_for(NULL);
+	Matf32_dot_nt_acc(A.data(), A.data(), serial.data(), n, m, n);
+	Mat_set_parallel_for(reverse_chunks);
+	Matf32_dot_nt_acc(A.data(), A.data(), chunked.data(), n, m, n);
+	expect_array_eq(serial.data(), chunked.data(), n * n);
+
+	Mat_set_parallel_for(NULL);
+	Matf32_dot_tn(B.data(), B.data(), serial.data(), m, n, n);
+	Mat_set_parallel_for(reverse_chunks);
+	Matf32_dot_tn(B.data(), B.data(), chunked.data(), m, n, n);
+	expect_array_eq(serial.data(), chunked.data(), n * n);
+
+	// The element-wise kernels
+	std::vector<float> sum_serial(n * m), sum_chunked(n * m);
+	Mat_set_parallel_for(NULL);
+	Matf32_add(A.data(), B.data(), sum_serial.data(), n, m);
+	Matf32_axpy(A.data(), sum_serial.data(), n, m, 0.5f);
+	Mat_set_parallel_for(reverse_chunks);
+	Matf32_add(A.data(), B.data(), sum_chunked.data(), n, m);
+	Matf32_axpy(A.data(), sum_chunked.data(), n, m, 0.5f);
+	expect_array_eq(sum_serial.data(), sum_chunked.data(), n * m);
+
+	Mat_set_parallel_for(NULL);
+}
+
+TEST(Matf32Test, FusedOptimizerSteps) {
+	float P[2] = {1.0f, -1.0f};
+	float G[2] = {0.5f, 2.0f};
+	float V[2] = {1.0f, 0.0f};
+
+	// V = 0.5 V + G, P -= 0.1 V
+	Matf32_momentum_step(P, G, V, 2, 0.1f, 0.5f, false);
+	float expected_v[2] = {1.0f, 2.0f};
+	float expected_p[2] = {0.9f, -1.2f};
+	expect_array_eq(expected_v, V, 2);
+	expect_array_eq(expected_p, P, 2);
+
+	// S = 0.5 * 4 = 2, P -= 1 * 2 / sqrt(2)
+	float Q[1] = {0.0f}, H[1] = {2.0f}, S[1] = {0.0f};
+	Matf32_rmsprop_step(Q, H, S, 1, 1.0f, 0.5f, 0.0f);
+	EXPECT_FLOAT_EQ(S[0], 2.0f);
+	EXPECT_FLOAT_EQ(Q[0], -std::sqrt(2.0f));
+
+	// First Adam step with bias correction moves by lr, plus the decay
+	float W[1] = {1.0f}, D[1] = {-4.0f}, M[1] = {0.0f}, U[1] = {0.0f};
+	Matf32_adam_step(W, D, M, U, 1, 0.1f, 0.9f, 0.999f, 0.0f, 0.5f, 0.1f, 0.001f);
+	EXPECT_FLOAT_EQ(M[0], -0.4f);
+	EXPECT_NEAR(U[0], 0.016f, 1e-6);
+	EXPECT_NEAR(W[0], 1.0f + 0.1f - 0.1f * 0.5f, 1e-6);
+}
+
+TEST(Matf32Test, SigmoidCrossEntropy) {
+	float Z[3] = {0.0f, 50.0f, -50.0f};
+	float Y[3] = {1.0f, 1.0f, 1.0f};
+	float G[3];
+
+	// log(2) for a zero logit, ~0 when it is right and ~50 when it is wrong
+	float loss = Matf32_sigmoid_cross_entropy(Z, Y, G, 3);
+	EXPECT_NEAR(loss, std::log(2.0f) + 50.0f, 1e-4);
+	EXPECT_FLOAT_EQ(G[0], -0.5f);
+	EXPECT_NEAR(G[1], 0.0f, 1e-6);
+	EXPECT_FLOAT_EQ(G[2], -1.0f);
+
+	// The gradient is optional
+	EXPECT_FLOAT_EQ(Matf32_sigmoid_cross_entropy(Z, Y, NULL, 1), std::log(2.0f));
+}
+
+TEST(Matf32Test, SigmoidCrossEntropyMatchesLibm) {
+	// Whole blocks of lanes and a tail, logits of every magnitude
+	const std::size_t n = 37;
+	std::vector<float> Z(n), Y(n), G(n);
+	for (std::size_t i = 0; i < n; i++) {
+		Z[i] = -40.0f + 80.0f * static_cast<float>(i) / (n - 1) + 0.01f * static_cast<float>(i % 3);
+		Y[i] = static_cast<float>(i % 2);
+	}
+
+	double expected = 0.0;
+	for (std::size_t i = 0; i < n; i++) {
+		double z = Z[i];
+		expected += std::max(z, 0.0) - z * Y[i] + std::log1p(std::exp(-std::fabs(z)));
+	}
+	float loss = Matf32_sigmoid_cross_entropy(Z.data(), Y.data(), G.data(), n);
+	EXPECT_NEAR(loss, expected, 1e-5 * expected);
+	for (std::size_t i = 0; i < n; i++)
+		EXPECT_NEAR(G[i], 1.0 / (1.0 + std::exp(-static_cast<double>(Z[i]))) - Y[i], 1e-6);
+}
+
+TEST(Matf32Test, SoftmaxCrossEntropy) {
+	// Three classes (rows) of two samples (columns)
+	float Z[6] = {0.0f, 100.0f,
+		      0.0f, 0.0f,
+		      0.0f, 0.0f};
+	float Y[6] = {1.0f, 0.0f,
+		      0.0f, 1.0f,
+		      0.0f, 0.0f};
+	float G[6], P[6];
+
+	Matf32_softmax_cols(Z, P, 3, 2);
+	EXPECT_FLOAT_EQ(P[0], 1.0f / 3.0f);
+	EXPECT_FLOAT_EQ(P[1], 1.0f);
+	EXPECT_NEAR(P[3], 0.0f, 1e-30);
+
+	// log(3) for the uniform sample, the margin for the wrong one
+	float loss = Matf32_softmax_cross_entropy(Z, Y, G, 3, 2);
+	EXPECT_NEAR(loss, std::log(3.0f) + 100.0f, 1e-4);
+	EXPECT_FLOAT_EQ(G[0], 1.0f / 3.0f - 1.0f);
+	EXPECT_FLOAT_EQ(G[2], 1.0f / 3.0f);
+	EXPECT_FLOAT_EQ(G[1], 1.0f);
+	EXPECT_FLOAT_EQ(G[3], -1.0f);
+}
+
+TEST(Matf32Test, SoftmaxMatchesLibm) {
+	// Whole blocks of columns and a tail
+	const std::size_t nrows = 5, ncols = 19;
+	std::vector<float> Z(nrows * ncols), Y(nrows * ncols, 0.0f), P(nrows * ncols), G(nrows * ncols);
+	for (std::size_t i = 0; i < nrows * ncols; i++)
+		Z[i] = 0.37f * static_cast<float>(static_cast<int>((i * 7) % 23) - 11);
+	for (std::size_t j = 0; j < ncols; j++)
+		Y[(j % nrows) * ncols + j] = 1.0f;
+
+	Matf32_softmax_cols(Z.data(), P.data(), nrows, ncols);
+	float loss = Matf32_softmax_cross_entropy(Z.data(), Y.data(), G.data(), nrows, ncols);
+
+	double expected = 0.0;
+	for (std::size_t j = 0; j < ncols; j++) {
+		double sum = 0.0;
+		for (std::size_t i = 0; i < nrows; i++)
+			sum += std::exp(static_cast<double>(Z[i * ncols + j]));
+		for (std::size_t i = 0; i < nrows; i++) {
+			double p = std::exp(static_cast<double>(Z[i * ncols + j])) / sum;
+			EXPECT_NEAR(P[i * ncols + j], p, 1e-6);
+			EXPECT_NEAR(G[i * ncols + j], p - Y[i * ncols + j], 1e-6);
+			expected -= Y[i * ncols + j] * std::log(p);
+		}
+	}
+	EXPECT_NEAR(loss, expected, 1e-5 * expected);
+}
+
+TEST(Matf32Test, LossRowSums) {
+	// Two outputs (rows) of three samples (columns)
+	float P[6] = {0.5f, 2.0f, -1.0f,
+		      0.9f, 0.1f, 0.5f};
+	float Y[6] = {1.0f, 1.0f, 1.0f,
+		      1.0f, 0.0f, 0.0f};
+
+	// The sums are accumulated, not overwritten
+	float S[2] = {1.0f, 0.0f};
+	Matf32_abs_error_rows(P, Y, S, 2, 3);
+	EXPECT_FLOAT_EQ(S[0], 1.0f + 0.5f + 1.0f + 2.0f);
+	EXPECT_FLOAT_EQ(S[1], 0.1f + 0.1f + 0.5f);
+
+	S[0] = S[1] = 0.0f;
+	Matf32_squared_error_rows(P, Y, S, 2, 3);
+	EXPECT_FLOAT_EQ(S[0], 0.25f + 1.0f + 4.0f);
+	EXPECT_NEAR(S[1], 0.01f + 0.01f + 0.25f, 1e-6);
+
+	float expected = 0.0f;
+	for (std::size_t j = 3; j < 6; j++)
+		expected -= Y[j] * std::log(P[j] + 1e-8f) + (1.0f - Y[j]) * std::log(1.0f - P[j] + 1e-8f);
+	S[1] = 0.0f;
+	Matf32_binary_cross_entropy_rows(P + 3, Y + 3, S + 1, 1, 3);
+	EXPECT_NEAR(S[1], expected, 1e-5);
+
+	S[1] = 0.0f;
+	Matf32_categorical_cross_entropy_rows(P + 3, Y + 3, S + 1, 1, 3);
+	EXPECT_NEAR(S[1], -std::log(0.9f + 1e-8f), 1e-6);
+}
+
+TEST(Matf32Test, Conv2dDirectMatchesIm2col) {
+	// 2 channels of 4x5, two images, 3 filters of 3x3 with padding 1
+	struct Mat_conv2d conv = {2, 4, 5, 3, 3, 1, 1, 1, 4, 5, 2};
+	const size_t nfilters = 3, patch = 2 * 9, npixels = 4 * 5 * 2;
+	std::vector<float> X(2 * 4 * 5 * 2), W(nfilters * patch), dY(nfilters * npixels);
+	for (size_t i = 0; i < X.size(); i++)
+		X[i] = static_cast<float>(i % 7) - 3.0f;
+	for (size_t i = 0; i < W.size(); i++)
+		W[i] = 0.1f * static_cast<float>(i % 5) - 0.2f;
+	for (size_t i = 0; i < dY.size(); i++)
+		dY[i] = 0.05f * static_cast<float>(i % 9);
+
+	std::vector<float> cols(patch * npixels), Y(nfilters * npixels), Y_direct(nfilters * npixels);
+	Matf32_im2col(X.data(), cols.data(), &conv);
+	Matf32_dot(W.data(), cols.data(), Y.data(), nfilters, patch, npixels);
+	Matf32_conv2d_direct(X.data(), W.data(), Y_direct.data(), nfilters, &conv);
+	for (size_t i = 0; i < Y.size(); i++)
+		EXPECT_NEAR(Y_direct[i], Y[i], 1e-5);
+
+	// The backward of im2col is col2im: dX = col2im(W^T . dY), dW = dY . cols^T
+	std::vector<float> dcols(patch * npixels), dX(X.size(), 0.0f), dW(W.size(), 0.0f);
+	Matf32_dot_tn(W.data(), dY.data(), dcols.data(), nfilters, patch, npixels);
+	Matf32_col2im_acc(dcols.data(), dX.data(), &conv);
+	Matf32_dot_nt_acc(dY.data(), cols.data(), dW.data(), nfilters, npixels, patch);
+
+	std::vector<float> dX_direct(X.size(), 1.0f), dW_direct(W.size(), 0.0f);
+	Matf32_conv2d_direct_backward(X.data(), W.data(), dY.data(), dX_direct.data(), dW_direct.data(), nfilters, &conv);
+	for (size_t i = 0; i < dX.size(); i++)
+		EXPECT_NEAR(dX_direct[i], dX[i], 1e-4);
+	for (size_t i = 0; i < dW.size(); i++)
+		EXPECT_NEAR(dW_direct[i], dW[i], 1e-4);
+}
+
+TEST(MatTest, DropoutMaskMatchesTheOutput) {
+	// Not a multiple of the 64 elements of a word
+	const size_t n = 1000;
+	std::vector<float> X(n), Y(n), Y_again(n), dX(n);
+	for (size_t i = 0; i < n; i++)
+		X[i] = 1.0f + static_cast<float>(i % 13);
+	std::vector<uint64_t> mask(Mat_dropout_mask_words(n));
+
+	Matf32_dropout_forward(X.data(), Y.data(), mask.data(), n, 0.5f, 7, 0);
+	size_t kept = 0;
+	for (size_t i = 0; i < n; i++) {
+		bool bit = (mask[i / 64] >> (i % 64)) & 1;
+		EXPECT_FLOAT_EQ(Y[i], bit ? 2.0f * X[i] : 0.0f);
+		kept += bit;
+	}
+	EXPECT_NEAR(static_cast<double>(kept) / n, 0.5, 0.05);
+
+	// The same counter draws the same mask, another one a different mask
+	Matf32_dropout_forward(X.data(), Y_again.data(), NULL, n, 0.5f, 7, 0);
+	EXPECT_EQ(Y_again, Y);
+	Matf32_dropout_forward(X.data(), Y_again.data(), NULL, n, 0.5f, 7, n);
+	EXPECT_NE(Y_again, Y);
+
+	Matf32_dropout_backward(X.data(), mask.data(), dX.data(), n, 0.5f);
+	EXPECT_EQ(dX, Y);
+}
+
+TEST(MatTest, LstmCellReadsAWindowOfTheProjection) {
+	// 2 units, 3 samples, the projection holds 2 steps side by side
+	const size_t H = 2, n = 3, ld = 2 * n;
+	std::vector<float> G(4 * H * ld), Z(4 * H * n), bias(4 * H), c_prev(H * n);
+	for (size_t i = 0; i < G.size(); i++)
+		G[i] = 0.1f * static_cast<float>(static_cast<int>(i % 7) - 3);
+	for (size_t i = 0; i < Z.size(); i++)
+		Z[i] = 0.05f * static_cast<float>(static_cast<int>(i % 5) - 2);
+	for (size_t i = 0; i < bias.size(); i++)
+		bias[i] = 0.2f * static_cast<float>(i % 3);
+	for (size_t i = 0; i < c_prev.size(); i++)
+		c_prev[i] = 0.3f * static_cast<float>(i) - 0.5f;
+	std::vector<float> gates(4 * H * n), c(H * n), h(H * n);
+
+	Matf32_lstm_cell(G.data() + n, ld, Z.data(), bias.data(), c_prev.data(), gates.data(), c.data(), h.data(), H, n);
+	auto sigmoid = [](float x) { return 1.0f / (1.0f + std::exp(-x)); };
+	for (size_t k = 0; k < H; k++) {
+		for (size_t j = 0; j < n; j++) {
+			float a[4];
+			for (size_t q = 0; q < 4; q++)
+				a[q] = G[(q * H + k) * ld + n + j] + Z[(q * H + k) * n + j] + bias[q * H + k];
+			float cj = sigmoid(a[1]) * c_prev[k * n + j] + sigmoid(a[0]) * std::tanh(a[2]);
+			EXPECT_NEAR(c[k * n + j], cj, 1e-6);
+			EXPECT_NEAR(h[k * n + j], sigmoid(a[3]) * std::tanh(cj), 1e-6);
+			EXPECT_NEAR(gates[(H + k) * n + j], sigmoid(a[1]), 1e-6);
+		}
+	}
+
+	// The backward leaves the same gradient in both outputs, dc goes back through f
+	std::vector<float> dh(H * n, 1.0f), dc(H * n, 0.0f), dZ(4 * H * n), dG(4 * H * ld, 0.0f);
+	Matf32_lstm_cell_backward(gates.data(), c_prev.data(), c.data(), dh.data(), dc.data(), dZ.data(),
+				  dG.data() + n, ld, H, n);
+	for (size_t r = 0; r < 4 * H; r++) {
+		for (size_t j = 0; j < n; j++) {
+			EXPECT_FLOAT_EQ(dG[r * ld + n + j], dZ[r * n + j]);
+			EXPECT_FLOAT_EQ(dG[r * ld + j], 0.0f);
+		}
+	}
+	float tc = std::tanh(c[0]);
+	EXPECT_NEAR(dc[0], gates[3 * H * n] * (1.0f - tc * tc) * gates[H * n], 1e-6);
+}
+
+TEST(MatTest, AttentionOfALongSequenceMatchesTheSoftmax) {
+	// The scores of the sequence would be 16 MB, the kernel only keeps tiles of them
+	struct Mat_attention att = {2048, 4, 1, 1, true};
+	const size_t T = att.seq_len, dh = att.head_dim;
+	std::vector<float> Q(dh * T), K(dh * T), V(dh * T), O(dh * T), lse(T), work(Mat_attention_workspace(&att));
+	for (size_t i = 0; i < dh * T; i++) {
+		Q[i] = 0.3f * static_cast<float>(static_cast<int>(i % 7) - 3);
+		K[i] = 0.2f * static_cast<float>(static_cast<int>(i % 5) - 2);
+		V[i] = 0.1f * static_cast<float>(static_cast<int>(i % 11) - 5);
+	}
+	Matf32_attention_forward(Q.data(), K.data(), V.data(), O.data(), lse.data(), work.data(), &att);
+
+	for (size_t q : {size_t(0), size_t(31), size_t(32), size_t(1000), T - 1}) {
+		std::vector<double> p(q + 1);
+		double maximum = -INFINITY, sum = 0.0;
+		for (size_t k = 0; k <= q; k++) {
+			double s = 0.0;
+			for (size_t d = 0; d < dh; d++)
+				s += Q[d * T + q] * K[d * T + k];
+			p[k] = s / std::sqrt(static_cast<double>(dh));
+			maximum = std::max(maximum, p[k]);
+		}
+		for (size_t k = 0; k <= q; k++)
+			sum += p[k] = std::exp(p[k] - maximum);
+		EXPECT_NEAR(lse[q], maximum + std::log(sum), 1e-4);
+		for (size_t d = 0; d < dh; d++) {
+			double o = 0.0;
+			for (size_t k = 0; k <= q; k++)
+				o += p[k] / sum * V[d * T + k];
+			EXPECT_NEAR(O[d * T + q], o, 1e-5);
+		}
+	}
+}
+
+TEST(MatTest, BsrProductsMatchTheDenseProducts) {
+	// 4 x 6 by 2 x 3 blocks, the blocks (0, 1) and (1, 0) are stored, 70 columns are two tasks of A^T * B
+	const size_t m = 4, k = 6, n = 70;
+	const size_t row_ptr[] = {0, 1, 2};
+	const uint32_t col_idx[] = {1, 0};
+	struct Mat_bsr A = {m, k, 2, 3, row_ptr, col_idx};
+	std::vector<float> values(12), dense(m * k, 0.0f);
+	for (size_t i = 0; i < values.size(); i++)
+		values[i] = 0.5f * static_cast<float>(static_cast<int>(i % 5) - 2);
+	for (size_t r = 0; r < 2; r++) {
+		for (size_t c = 0; c < 3; c++) {
+			dense[r * k + 3 + c] = values[r * 3 + c];
+			dense[(2 + r) * k + c] = values[6 + r * 3 + c];
+		}
+	}
+
+	std::vector<float> B(k * n), C(m * n), expected(m * n), Bt(m * n), Ct(k * n), expected_t(k * n);
+	for (size_t i = 0; i < B.size(); i++)
+		B[i] = 0.1f * static_cast<float>(static_cast<int>(i % 7) - 3);
+	for (size_t i = 0; i < Bt.size(); i++)
+		Bt[i] = 0.2f * static_cast<float>(static_cast<int>(i % 3) - 1);
+	Matf32_bsr_dot(&A, values.data(), B.data(), C.data(), n);
+	Matf32_dot(dense.data(), B.data(), expected.data(), m, k, n);
+	expect_array_near(expected.data(), C.data(), m * n);
+	Matf32_bsr_dot_tn(&A, values.data(), Bt.data(), Ct.data(), n);
+	Matf32_dot_tn(dense.data(), Bt.data(), expected_t.data(), m, k, n);
+	expect_array_near(expected_t.data(), Ct.data(), k * n);
+
+	// The sampled product is the dense one at the stored positions only
+	std::vector<float> grad(12, 1.0f), full(m * k, 0.0f);
+	Matf32_bsr_sampled_dot_nt_acc(&A, Bt.data(), B.data(), grad.data(), n);
+	Matf32_dot_nt_acc(Bt.data(), B.data(), full.data(), m, n, k);
+	for (size_t r = 0; r < 2; r++) {
+		for (size_t c = 0; c < 3; c++) {
+			EXPECT_NEAR(grad[r * 3 + c], 1.0f + full[r * k + 3 + c], 1e-5);
+			EXPECT_NEAR(grad[6 + r * 3 + c], 1.0f + full[(2 + r) * k + c], 1e-5);
+		}
+	}
+
+	// CSR is the case of 1 x 1 blocks, a single column takes the gathered dot product
+	const size_t csr_ptr[] = {0, 2, 2, 3, 4};
+	const uint32_t csr_idx[] = {0, 5, 2, 4};
+	const float csr_values[] = {1.0f, -2.0f, 0.5f, 3.0f};
+	struct Mat_bsr csr = {m, k, 1, 1, csr_ptr, csr_idx};
+	float x[] = {1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f}, y[4];
+	Matf32_bsr_dot(&csr, csr_values, x, y, 1);
+	const float expected_y[] = {-11.0f, 0.0f, 1.5f, 15.0f};
+	expect_array_eq(expected_y, y, 4);
+}
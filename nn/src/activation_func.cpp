@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <cstddef>
 #include "../include/activation_func.hpp"
@@ -80,6 +81,32 @@ StepFunc<T> &nn::activation_funcs::StepFunc<T>::register_funcs(void)
 			return Mat<T>(X.rows(), X.rows()).fill(0.0f);
 		});
 	
+	// The derivative is element-wise, then dL/dX = f'(X) * dL/dY also for a batch
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			((void) grads);
+			Mat<T> dX = this->gradient(X);
+			dX *= dY;
+			return dX;
+		});
+
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [](const Mat<T> &X, Mat<T> &Y) -> void {
+			const T *x = X.get_mat_raw();
+			T *y = Y.get_mat_raw();
+			for (std::size_t i = 0; i < X.rows() * X.cols(); i++)
+				y[i] = x[i] >= 0 ? static_cast<T>(1) : static_cast<T>(0);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			((void) X);
+			((void) Y);
+			((void) dY);
+			((void) grads);
+			dX.fill(static_cast<T>(0));
+		});
+
 	return *this;
 }
 
@@ -165,6 +192,41 @@ SigmoidFunc<T> &nn::activation_funcs::SigmoidFunc<T>::register_funcs(void)
 			return C;
 		});
 	
+	// The derivative is element-wise, then dL/dX = f'(X) * dL/dY also for a batch
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			((void) grads);
+			Mat<T> dX = this->gradient(X);
+			dX *= dY;
+			return dX;
+		});
+
+	register_func<autodiff::Var, autodiff::Tape<T> &, autodiff::Var, Mat<T> *>
+		("record", [](autodiff::Tape<T> &tape, autodiff::Var X, Mat<T> *grads) -> autodiff::Var {
+			((void) grads);
+			return tape.sigmoid(X);
+		});
+
+	// In place, the derivative comes from the output: s'(x) = s(x) * (1 - s(x))
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [](const Mat<T> &X, Mat<T> &Y) -> void {
+			const T *x = X.get_mat_raw();
+			T *y = Y.get_mat_raw();
+			for (std::size_t i = 0; i < X.rows() * X.cols(); i++)
+				y[i] = 1.0 / (1.0 + std::exp(-x[i])) + 1e-8;
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			((void) X);
+			((void) grads);
+			const T *y = Y.get_mat_raw();
+			const T *dy = dY.get_mat_raw();
+			T *dx = dX.get_mat_raw();
+			for (std::size_t i = 0; i < Y.rows() * Y.cols(); i++)
+				dx[i] = y[i] * (1 - y[i]) * dy[i];
+		});
+
 	return *this;
 }
 
@@ -246,6 +308,41 @@ TanhFunc<T> &nn::activation_funcs::TanhFunc<T>::register_funcs(void)
 		return C;
 	});
 
+	// The derivative is element-wise, then dL/dX = f'(X) * dL/dY also for a batch
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			((void) grads);
+			Mat<T> dX = this->gradient(X);
+			dX *= dY;
+			return dX;
+		});
+
+	register_func<autodiff::Var, autodiff::Tape<T> &, autodiff::Var, Mat<T> *>
+		("record", [](autodiff::Tape<T> &tape, autodiff::Var X, Mat<T> *grads) -> autodiff::Var {
+			((void) grads);
+			return tape.tanh(X);
+		});
+
+	// In place, the derivative comes from the output: tanh'(x) = 1 - tanh^2(x)
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [](const Mat<T> &X, Mat<T> &Y) -> void {
+			const T *x = X.get_mat_raw();
+			T *y = Y.get_mat_raw();
+			for (std::size_t i = 0; i < X.rows() * X.cols(); i++)
+				y[i] = std::tanh(x[i]);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			((void) X);
+			((void) grads);
+			const T *y = Y.get_mat_raw();
+			const T *dy = dY.get_mat_raw();
+			T *dx = dX.get_mat_raw();
+			for (std::size_t i = 0; i < Y.rows() * Y.cols(); i++)
+				dx[i] = (1 - y[i] * y[i]) * dy[i];
+		});
+
 	return *this;
 }
 
@@ -326,6 +423,41 @@ ReluFunc<T> &nn::activation_funcs::ReluFunc<T>::register_funcs(void)
 		return C;
 	});
 
+	// The derivative is element-wise, then dL/dX = f'(X) * dL/dY also for a batch
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			((void) grads);
+			Mat<T> dX = this->gradient(X);
+			dX *= dY;
+			return dX;
+		});
+
+	register_func<autodiff::Var, autodiff::Tape<T> &, autodiff::Var, Mat<T> *>
+		("record", [](autodiff::Tape<T> &tape, autodiff::Var X, Mat<T> *grads) -> autodiff::Var {
+			((void) grads);
+			return tape.relu(X);
+		});
+
+	// In place, the output is positive exactly where the input is
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [](const Mat<T> &X, Mat<T> &Y) -> void {
+			const T *x = X.get_mat_raw();
+			T *y = Y.get_mat_raw();
+			for (std::size_t i = 0; i < X.rows() * X.cols(); i++)
+				y[i] = std::max(static_cast<T>(0), x[i]);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			((void) X);
+			((void) grads);
+			const T *y = Y.get_mat_raw();
+			const T *dy = dY.get_mat_raw();
+			T *dx = dX.get_mat_raw();
+			for (std::size_t i = 0; i < Y.rows() * Y.cols(); i++)
+				dx[i] = y[i] > 0 ? dy[i] : static_cast<T>(0);
+		});
+
 	return *this;
 }
 
@@ -333,3 +465,128 @@ ReluFunc<T> &nn::activation_funcs::ReluFunc<T>::register_funcs(void)
 template class nn::activation_funcs::ReluFunc<float>;
 // template class nn::activation_funcs::ReluFunc<double>;
 
+
+
+
+template <typename T>
+nn::activation_funcs::SoftmaxFunc<T>::SoftmaxFunc(void)
+	: ActivationFunc("SoftmaxFunc")
+{
+}
+
+template <typename T>
+SoftmaxFunc<T> &nn::activation_funcs::SoftmaxFunc<T>::build(const Shape &input_shape, const Shape &output_shape)
+{
+	((void) input_shape);
+	((void) output_shape);
+
+	register_funcs();
+	return *this;
+}
+
+template <typename T>
+SoftmaxFunc<T> &nn::activation_funcs::SoftmaxFunc<T>::build(std::size_t input_size, std::size_t output_size)
+{
+	((void) input_size);
+	((void) output_size);
+
+	register_funcs();
+	return *this;
+}
+
+template <typename T>
+SoftmaxFunc<T> &nn::activation_funcs::SoftmaxFunc<T>::build(void)
+{
+	register_funcs();
+	return *this;
+}
+
+template <typename T>
+SoftmaxFunc<T> &nn::activation_funcs::SoftmaxFunc<T>::register_funcs(void)
+{
+	register_func<Mat<T>, const Mat<T> &>("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+		// p_i = e^{x_i - max(x)} / sum_j e^{x_j - max(x)}, column by column
+		Mat<T> P(X.get_shape());
+		MatDispatchOps::Mat_softmax_cols(X.get_mat_raw(), P.get_mat_raw(), X.get_shape());
+		return P;
+	});
+
+	register_func<Mat<T>, const Mat<T> &>("gradient", [this](const Mat<T> &X) -> Mat<T> {
+		// Diagonal of the Jacobian: dp_i/dx_i = p_i * (1 - p_i)
+		Mat<T> P = (*this)(X);
+		return P * (P * (-1) + 1);
+	});
+
+	register_func<Mat<T>, const Mat<T> &>("jacobian", [this](const Mat<T> &X) -> Mat<T> {
+		// Supposing that X ~ (n, 1) -> jacobian -> (n, n)
+		// dp_i/dx_j = p_i * (delta_ij - p_j)
+		Mat<T> P = (*this)(X);
+		Mat<T> C(X.rows(), X.rows());
+		for (std::size_t i = 0; i < C.rows(); i++)
+			for (std::size_t j = 0; j < C.cols(); j++)
+				C(i, j) = P(i, 0) * ((i == j ? 1 : 0) - P(j, 0));
+		return C;
+	});
+
+	// dL/dx = J^T . dL/dp = p * (dL/dp - <p, dL/dp>), never builds J
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			((void) grads);
+			Mat<T> P = (*this)(X);
+			Mat<T> dX = P * dY;
+			Mat<T> dots = Mat<T>(Shape{1, X.rows()}).fill(static_cast<T>(1)).dot(dX);
+			for (std::size_t i = 0; i < dX.rows(); i++)
+				for (std::size_t j = 0; j < dX.cols(); j++)
+					dX(i, j) -= P(i, j) * dots(0, j);
+			return dX;
+		});
+
+	register_func<autodiff::Var, autodiff::Tape<T> &, autodiff::Var, Mat<T> *>
+		("record", [](autodiff::Tape<T> &tape, autodiff::Var X, Mat<T> *grads) -> autodiff::Var {
+			((void) grads);
+			return tape.softmax(X);
+		});
+
+	// In place, column by column without the scratch of the libmat kernel
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [](const Mat<T> &X, Mat<T> &Y) -> void {
+			std::size_t nrows = X.rows(), ncols = X.cols();
+			const T *x = X.get_mat_raw();
+			T *y = Y.get_mat_raw();
+			for (std::size_t j = 0; j < ncols; j++) {
+				T max = x[j];
+				for (std::size_t i = 1; i < nrows; i++)
+					max = std::max(max, x[i * ncols + j]);
+				T sum = 0;
+				for (std::size_t i = 0; i < nrows; i++) {
+					y[i * ncols + j] = std::exp(x[i * ncols + j] - max);
+					sum += y[i * ncols + j];
+				}
+				for (std::size_t i = 0; i < nrows; i++)
+					y[i * ncols + j] /= sum;
+			}
+		});
+
+	// dL/dx = p * (dL/dp - <p, dL/dp>) from the output p
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			((void) X);
+			((void) grads);
+			std::size_t nrows = Y.rows(), ncols = Y.cols();
+			const T *p = Y.get_mat_raw();
+			const T *dy = dY.get_mat_raw();
+			T *dx = dX.get_mat_raw();
+			for (std::size_t j = 0; j < ncols; j++) {
+				T dot = 0;
+				for (std::size_t i = 0; i < nrows; i++)
+					dot += p[i * ncols + j] * dy[i * ncols + j];
+				for (std::size_t i = 0; i < nrows; i++)
+					dx[i * ncols + j] = p[i * ncols + j] * (dy[i * ncols + j] - dot);
+			}
+		});
+
+	return *this;
+}
+
+template class nn::activation_funcs::SoftmaxFunc<float>;
+// template class nn::activation_funcs::SoftmaxFunc<double>;
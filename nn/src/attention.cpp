@@ -0,0 +1,362 @@
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "../include/attention.hpp"
+
+using namespace nn::mathops;
+using namespace nn::layers;
+
+// pack_tokens: X (seq_len * dim, b) to one token per column (dim, b * seq_len), the tokens of a sample together
+template <typename T>
+static void pack_tokens(const T *X, T *Xp, std::size_t dim, std::size_t seq_len, std::size_t b)
+{
+	std::size_t ld = b * seq_len;
+	for (std::size_t t = 0; t < seq_len; t++)
+		for (std::size_t i = 0; i < dim; i++)
+			for (std::size_t j = 0; j < b; j++)
+				Xp[i * ld + j * seq_len + t] = X[(t * dim + i) * b + j];
+}
+
+// unpack_tokens: the inverse of pack_tokens
+template <typename T>
+static void unpack_tokens(const T *Xp, T *X, std::size_t dim, std::size_t seq_len, std::size_t b)
+{
+	std::size_t ld = b * seq_len;
+	for (std::size_t t = 0; t < seq_len; t++)
+		for (std::size_t i = 0; i < dim; i++)
+			for (std::size_t j = 0; j < b; j++)
+				X[(t * dim + i) * b + j] = Xp[i * ld + j * seq_len + t];
+}
+
+template <typename T>
+nn::layers::MultiHeadAttention<T>::MultiHeadAttention(std::size_t dim, std::size_t nheads, std::size_t seq_len,
+						      bool causal, std::shared_ptr<RandInitializer> rand_init)
+	: WeightedLayer(Shape{seq_len * dim, 1}, Shape{seq_len * dim, 1}, "MultiHeadAttention", nullptr, rand_init),
+	  dim_(dim), nheads_(nheads), seq_len_(seq_len), causal_(causal), params_(4)
+{
+	if (dim == 0 || nheads == 0 || seq_len == 0)
+		throw std::invalid_argument("invalid argument: an attention needs features, heads and tokens");
+	if (dim % nheads != 0)
+		throw std::invalid_argument("invalid argument: the heads must split the features evenly");
+}
+
+template <typename T>
+std::size_t nn::layers::MultiHeadAttention<T>::get_dim(void) const
+{
+	return dim_;
+}
+
+template <typename T>
+std::size_t nn::layers::MultiHeadAttention<T>::get_nheads(void) const
+{
+	return nheads_;
+}
+
+template <typename T>
+std::size_t nn::layers::MultiHeadAttention<T>::get_seq_len(void) const
+{
+	return seq_len_;
+}
+
+template <typename T>
+bool nn::layers::MultiHeadAttention<T>::is_causal(void) const
+{
+	return causal_;
+}
+
+template <typename T>
+Mat<T> &nn::layers::MultiHeadAttention<T>::get_qkv_weights(void) const
+{
+	if (params_[0] == nullptr)
+		throw std::invalid_argument("MultiHeadAttention layer not built yet");
+	return *params_[0];
+}
+
+template <typename T>
+Mat<T> &nn::layers::MultiHeadAttention<T>::get_qkv_bias(void) const
+{
+	if (params_[1] == nullptr)
+		throw std::invalid_argument("MultiHeadAttention layer not built yet");
+	return *params_[1];
+}
+
+template <typename T>
+Mat<T> &nn::layers::MultiHeadAttention<T>::get_output_weights(void) const
+{
+	if (params_[2] == nullptr)
+		throw std::invalid_argument("MultiHeadAttention layer not built yet");
+	return *params_[2];
+}
+
+template <typename T>
+Mat<T> &nn::layers::MultiHeadAttention<T>::get_output_bias(void) const
+{
+	if (params_[3] == nullptr)
+		throw std::invalid_argument("MultiHeadAttention layer not built yet");
+	return *params_[3];
+}
+
+template <typename T>
+MultiHeadAttention<T> &nn::layers::MultiHeadAttention<T>::build(const Shape &input_shape, const Shape &output_shape)
+{
+	if (input_shape != input_shape_ || output_shape != output_shape_)
+		throw std::invalid_argument("Invalid shapes for the features of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+MultiHeadAttention<T> &nn::layers::MultiHeadAttention<T>::build(std::size_t input_size, std::size_t output_size)
+{
+	if (input_size != input_shape_.rows || output_size != output_shape_.rows)
+		throw std::invalid_argument("Invalid sizes for the features of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+MultiHeadAttention<T> &nn::layers::MultiHeadAttention<T>::build(void)
+{
+	alloc_weights();
+	register_funcs();
+	built_ = true;
+	return *this;
+}
+
+template <typename T>
+MultiHeadAttention<T> &nn::layers::MultiHeadAttention<T>::alloc_weights(void)
+{
+	grads_.clear();
+	grad_count_ = 0;
+
+	// Weights moved to external memory by `bind_parameters` are kept
+	if (weights_bound_)
+		return *this;
+
+	params_[0] = add_weights<T>(Shape{3 * dim_, dim_}, rand_init_);
+	params_[1] = add_weights<T>(3 * dim_);
+	params_[2] = add_weights<T>(Shape{dim_, dim_}, rand_init_);
+	params_[3] = add_weights<T>(dim_);
+	return *this;
+}
+
+template <typename T>
+MultiHeadAttention<T> &nn::layers::MultiHeadAttention<T>::alloc_gradients(void)
+{
+	if (!grads_.empty())
+		return *this;
+
+	for (auto &param : params_)
+		grads_.push_back(std::make_unique<Mat<T>>(param->get_shape()));
+	for (auto &grad : grads_)
+		grad->fill(static_cast<T>(0));
+	grad_count_ = 0;
+	return *this;
+}
+
+template <typename T>
+Mat_attention nn::layers::MultiHeadAttention<T>::geometry(std::size_t nbatch) const
+{
+	return Mat_attention{seq_len_, dim_ / nheads_, nheads_, nbatch, causal_};
+}
+
+template <typename T>
+void nn::layers::MultiHeadAttention<T>::reserve(Trace &trace, std::size_t ncols) const
+{
+	if (trace.ncols >= ncols)
+		return;
+
+	std::size_t tokens = seq_len_ * ncols;
+	trace.inputs.resize(dim_ * tokens);
+	trace.qkv.resize(3 * dim_ * tokens);
+	trace.heads.resize(dim_ * tokens);
+	trace.lse.resize(nheads_ * tokens);
+	Mat_attention att = geometry(ncols);
+	trace.work.resize(Mat_attention_workspace(&att));
+	trace.outputs.resize(dim_ * tokens);
+	trace.dheads.resize(dim_ * tokens);
+	trace.dqkv.resize(3 * dim_ * tokens);
+	trace.ncols = ncols;
+}
+
+template <typename T>
+void nn::layers::MultiHeadAttention<T>::forward_tokens(const Mat<T> &X, Trace &trace, Mat<T> &Y) const
+{
+	if (X.rows() != input_shape_.rows)
+		throw std::invalid_argument("invalid argument: the features don't match the layer: " + name_);
+
+	std::size_t b = X.cols();
+	std::size_t ld = seq_len_ * b;
+	reserve(trace, b);
+	trace.size = b;
+	trace.input = X.get_mat_raw();
+
+	// Every token of the batch is a column, each projection is one product
+	pack_tokens(X.get_mat_raw(), trace.inputs.data(), dim_, seq_len_, b);
+	T *qkv = trace.qkv.data();
+	MatDispatchOps::Mat_dot(params_[0]->get_mat_raw(), trace.inputs.data(), qkv, params_[0]->get_shape(), ld);
+	MatDispatchOps::Mat_add_colvec(qkv, params_[1]->get_mat_raw(), Shape{3 * dim_, ld});
+
+	MatDispatchOps::Mat_attention_forward(qkv, qkv + dim_ * ld, qkv + 2 * dim_ * ld, trace.heads.data(),
+					      trace.lse.data(), trace.work.data(), geometry(b));
+
+	MatDispatchOps::Mat_dot(params_[2]->get_mat_raw(), trace.heads.data(), trace.outputs.data(),
+				params_[2]->get_shape(), ld);
+	MatDispatchOps::Mat_add_colvec(trace.outputs.data(), params_[3]->get_mat_raw(), Shape{dim_, ld});
+	unpack_tokens(trace.outputs.data(), Y.get_mat_raw(), dim_, seq_len_, b);
+}
+
+template <typename T>
+void nn::layers::MultiHeadAttention<T>::backward_tokens(Trace &trace, const Mat<T> &dY, Mat<T> *dX, Mat<T> *grads) const
+{
+	std::size_t b = dY.cols();
+	std::size_t ld = seq_len_ * b;
+	Shape token_shape{dim_, ld};
+	Shape qkv_shape{3 * dim_, ld};
+
+	// dY takes the place of Y, dX the one of the heads once they are done
+	T *dout = trace.outputs.data();
+	pack_tokens(dY.get_mat_raw(), dout, dim_, seq_len_, b);
+	if (grads != nullptr) {
+		MatDispatchOps::Mat_dot_nt_acc(dout, trace.heads.data(), grads[2].get_mat_raw(), token_shape, dim_);
+		MatDispatchOps::Mat_add_row_sum(dout, grads[3].get_mat_raw(), token_shape);
+	}
+	MatDispatchOps::Mat_dot_tn(params_[2]->get_mat_raw(), dout, trace.dheads.data(), params_[2]->get_shape(), ld);
+
+	const T *qkv = trace.qkv.data();
+	T *dqkv = trace.dqkv.data();
+	MatDispatchOps::Mat_attention_backward(qkv, qkv + dim_ * ld, qkv + 2 * dim_ * ld, trace.heads.data(),
+					       trace.dheads.data(), trace.lse.data(), dqkv, dqkv + dim_ * ld,
+					       dqkv + 2 * dim_ * ld, trace.work.data(), geometry(b));
+
+	if (grads != nullptr) {
+		MatDispatchOps::Mat_dot_nt_acc(dqkv, trace.inputs.data(), grads[0].get_mat_raw(), qkv_shape, dim_);
+		MatDispatchOps::Mat_add_row_sum(dqkv, grads[1].get_mat_raw(), qkv_shape);
+	}
+	if (dX == nullptr)
+		return;
+
+	MatDispatchOps::Mat_dot_tn(params_[0]->get_mat_raw(), dqkv, trace.dheads.data(), params_[0]->get_shape(), ld);
+	unpack_tokens(trace.dheads.data(), dX->get_mat_raw(), dim_, seq_len_, b);
+}
+
+template <typename T>
+typename MultiHeadAttention<T>::Trace &nn::layers::MultiHeadAttention<T>::thread_trace(const Mat<T> &X)
+{
+	Trace &trace = traces_.get();
+	if (trace.size != X.cols() || trace.input != X.get_mat_raw())
+		throw std::logic_error("logic error: the backward of a MultiHeadAttention needs the forward of its batch in the same thread: " + name_);
+	return trace;
+}
+
+template <typename T>
+void nn::layers::MultiHeadAttention<T>::gradient_tokens(const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads)
+{
+	Trace &trace = traces_.get();
+	Mat<T> Y(X.get_shape());
+	forward_tokens(X, trace, Y);
+	backward_tokens(trace, dY, nullptr, grads);
+}
+
+template <typename T>
+MultiHeadAttention<T> &nn::layers::MultiHeadAttention<T>::register_funcs(void)
+{
+	register_func<Mat<T>, const Mat<T> &>
+		("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+			Mat<T> Y(X.get_shape());
+			forward_tokens(X, traces_.get(), Y);
+			return Y;
+		});
+
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			Mat<T> dX(X.get_shape());
+			backward_tokens(thread_trace(X), dY, &dX, grads);
+			return dX;
+		});
+
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [this](const Mat<T> &X, Mat<T> &Y) -> void {
+			forward_tokens(X, trace_, Y);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [this](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			((void) X);
+			((void) Y);
+			backward_tokens(trace_, dY, &dX, grads);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("fit", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			std::vector<Mat<T>> grads;
+			for (auto &param : params_)
+				grads.emplace_back(Mat<T>(param->get_shape()).fill(static_cast<T>(0)));
+			gradient_tokens(input, signal_update, grads.data());
+			for (std::size_t k = 0; k < params_.size(); k++)
+				optimizer_->apply(*params_[k], grads[k]);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("accumulate", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			alloc_gradients();
+			std::vector<Mat<T>> grads;
+			for (auto &grad : grads_)
+				grads.emplace_back(Mat<T>(grad->get_shape(), grad->get_mat_raw()));
+			gradient_tokens(input, signal_update, grads.data());
+			grad_count_ += input.cols();
+		});
+
+	register_func<void>
+		("step", [this]() -> void {
+			if (grad_count_ == 0)
+				return;
+
+			T scale = static_cast<T>(1) / static_cast<T>(grad_count_);
+			for (std::size_t k = 0; k < params_.size(); k++) {
+				*grads_[k] *= scale;
+				optimizer_->apply(*params_[k], *grads_[k]);
+				grads_[k]->fill(static_cast<T>(0));
+			}
+			grad_count_ = 0;
+		});
+
+	register_func<void>
+		("zero_grad", [this]() -> void {
+			for (auto &grad : grads_)
+				grad->fill(static_cast<T>(0));
+			grad_count_ = 0;
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("gradients", [this]() -> std::vector<Mat<T> *> {
+			alloc_gradients();
+			std::vector<Mat<T> *> grads;
+			for (auto &grad : grads_)
+				grads.push_back(grad.get());
+			return grads;
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("parameters", [this]() -> std::vector<Mat<T> *> {
+			std::vector<Mat<T> *> params;
+			for (auto &param : params_)
+				params.push_back(param.get());
+			return params;
+		});
+
+	register_func<void, const std::vector<T *> &>
+		("bind_parameters", [this](const std::vector<T *> &memory) -> void {
+			if (memory.size() != params_.size())
+				throw std::invalid_argument("invalid argument: a MultiHeadAttention layer binds four matrices");
+			// The matrices are replaced in place, pointers to them (optimizer state) stay valid
+			for (std::size_t k = 0; k < params_.size(); k++)
+				*params_[k] = Mat<T>(params_[k]->get_shape(), memory[k]);
+			weights_bound_ = true;
+		});
+
+	return *this;
+}
+
+template class nn::layers::MultiHeadAttention<float>;
+// template class nn::layers::MultiHeadAttention<double>;
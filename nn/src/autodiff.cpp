@@ -0,0 +1,447 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#include "../include/autodiff.hpp"
+
+using namespace nn::autodiff;
+
+template <typename T>
+nn::autodiff::Tape<T>::Tape(void)
+	: live_(0), peak_(0), done_(false)
+{
+}
+
+template <typename T>
+nn::autodiff::Tape<T>::Node::Node(Kind kind, Mat<T> value, bool requires_grad, Mat<T> *param_grad)
+	: kind(kind), shape(value.get_shape()), vjp(nullptr), requires_grad(requires_grad), release(never),
+	  value(std::move(value)), has_value(true), has_grad(false), param_grad(param_grad)
+{
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::constant(const Mat<T> &value)
+{
+	return push(Node(Kind::Constant, value, false));
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::input(const Mat<T> &value)
+{
+	return push(Node(Kind::Input, value, true));
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::parameter(Mat<T> &value, Mat<T> &grad)
+{
+	if (value.get_shape() != grad.get_shape())
+		throw std::invalid_argument("invalid argument: the gradient of a parameter needs its shape");
+
+	// A view, the parameter is never copied nor released by the tape
+	return push(Node(Kind::Parameter, Mat<T>(value.get_shape(), value.get_mat_raw()), true, &grad));
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::dot(Var A, Var B)
+{
+	bool grad_A = requires_grad(A), grad_B = requires_grad(B);
+	Var C = custom(value(A).dot(value(B)), {A, B}, [A, B, grad_A, grad_B](Tape &tape, const Mat<T> &g) {
+		// dA = g . B^T, dB = A^T . g
+		if (grad_A) {
+			const Mat<T> &b = tape.value(B);
+			Mat<T> dA = Mat<T>(g.rows(), b.rows()).fill(static_cast<T>(0));
+			tape.accumulate(A, dA.add_dot_transposed(g, b));
+		}
+		if (grad_B)
+			tape.accumulate(B, tape.value(A).transpose_dot(g));
+	});
+
+	if (grad_A)
+		read(C.id, B.id);
+	if (grad_B)
+		read(C.id, A.id);
+	return C;
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::add(Var A, Var B)
+{
+	return custom(value(A) + value(B), {A, B}, [A, B](Tape &tape, const Mat<T> &g) {
+		tape.accumulate(A, g);
+		tape.accumulate(B, g);
+	});
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::sub(Var A, Var B)
+{
+	return custom(value(A) - value(B), {A, B}, [A, B](Tape &tape, const Mat<T> &g) {
+		tape.accumulate(A, g);
+		if (tape.requires_grad(B))
+			tape.accumulate(B, g * static_cast<T>(-1));
+	});
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::mul(Var A, Var B)
+{
+	bool grad_A = requires_grad(A), grad_B = requires_grad(B);
+	Var C = custom(value(A) * value(B), {A, B}, [A, B, grad_A, grad_B](Tape &tape, const Mat<T> &g) {
+		if (grad_A)
+			tape.accumulate(A, g * tape.value(B));
+		if (grad_B)
+			tape.accumulate(B, g * tape.value(A));
+	});
+
+	if (grad_A)
+		read(C.id, B.id);
+	if (grad_B)
+		read(C.id, A.id);
+	return C;
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::scale(Var A, T a)
+{
+	return custom(value(A) * a, {A}, [A, a](Tape &tape, const Mat<T> &g) {
+		tape.accumulate(A, g * a);
+	});
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::add_colvec(Var A, Var v)
+{
+	Mat<T> C = value(A);
+	C.add_colvec(value(v));
+	Shape shape = value(v).get_shape();
+	return custom(std::move(C), {A, v}, [A, v, shape](Tape &tape, const Mat<T> &g) {
+		tape.accumulate(A, g);
+		if (tape.requires_grad(v))
+			tape.accumulate(v, Mat<T>(shape).fill(static_cast<T>(0)).add_row_sum(g));
+	});
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::sigmoid(Var A)
+{
+	Mat<T> Y(value(A).get_shape());
+	const T *a = value(A).get_mat_raw();
+	T *y = Y.get_mat_raw();
+	for (std::size_t i = 0; i < Y.rows() * Y.cols(); i++)
+		y[i] = static_cast<T>(1) / (static_cast<T>(1) + std::exp(-a[i]));
+
+	std::size_t self = nodes_.size();
+	return custom(std::move(Y), {A}, [A, self](Tape &tape, const Mat<T> &g) {
+		// s' = s (1 - s)
+		const Mat<T> &s = tape.value(Var{self});
+		Mat<T> dA(g.get_shape());
+		for (std::size_t i = 0; i < g.rows() * g.cols(); i++) {
+			T si = s.get_mat_raw()[i];
+			dA.get_mat_raw()[i] = g.get_mat_raw()[i] * si * (static_cast<T>(1) - si);
+		}
+		tape.accumulate(A, dA);
+	}, {}, true);
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::tanh(Var A)
+{
+	Mat<T> Y(value(A).get_shape());
+	const T *a = value(A).get_mat_raw();
+	T *y = Y.get_mat_raw();
+	for (std::size_t i = 0; i < Y.rows() * Y.cols(); i++)
+		y[i] = std::tanh(a[i]);
+
+	std::size_t self = nodes_.size();
+	return custom(std::move(Y), {A}, [A, self](Tape &tape, const Mat<T> &g) {
+		// tanh' = 1 - tanh^2
+		const Mat<T> &t = tape.value(Var{self});
+		Mat<T> dA(g.get_shape());
+		for (std::size_t i = 0; i < g.rows() * g.cols(); i++) {
+			T ti = t.get_mat_raw()[i];
+			dA.get_mat_raw()[i] = g.get_mat_raw()[i] * (static_cast<T>(1) - ti * ti);
+		}
+		tape.accumulate(A, dA);
+	}, {}, true);
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::relu(Var A)
+{
+	Mat<T> Y(value(A).get_shape());
+	const T *a = value(A).get_mat_raw();
+	T *y = Y.get_mat_raw();
+	for (std::size_t i = 0; i < Y.rows() * Y.cols(); i++)
+		y[i] = std::max(a[i], static_cast<T>(0));
+
+	std::size_t self = nodes_.size();
+	return custom(std::move(Y), {A}, [A, self](Tape &tape, const Mat<T> &g) {
+		const Mat<T> &r = tape.value(Var{self});
+		Mat<T> dA(g.get_shape());
+		for (std::size_t i = 0; i < g.rows() * g.cols(); i++)
+			dA.get_mat_raw()[i] = r.get_mat_raw()[i] > static_cast<T>(0) ? g.get_mat_raw()[i] : static_cast<T>(0);
+		tape.accumulate(A, dA);
+	}, {}, true);
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::softmax(Var A)
+{
+	Mat<T> P(value(A).get_shape());
+	MatDispatchOps::Mat_softmax_cols(value(A).get_mat_raw(), P.get_mat_raw(), P.get_shape());
+
+	std::size_t self = nodes_.size();
+	return custom(std::move(P), {A}, [A, self](Tape &tape, const Mat<T> &g) {
+		// dz = p * (g - sum_k p_k g_k) for every column
+		const Mat<T> &p = tape.value(Var{self});
+		Mat<T> dA(g.get_shape());
+		for (std::size_t j = 0; j < g.cols(); j++) {
+			T dot = 0;
+			for (std::size_t i = 0; i < g.rows(); i++)
+				dot += p(i, j) * g(i, j);
+			for (std::size_t i = 0; i < g.rows(); i++)
+				dA(i, j) = p(i, j) * (g(i, j) - dot);
+		}
+		tape.accumulate(A, dA);
+	}, {}, true);
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::sum(Var A)
+{
+	Shape shape = value(A).get_shape();
+	Mat<T> S = {{value(A).grand_sum()}};
+	return custom(std::move(S), {A}, [A, shape](Tape &tape, const Mat<T> &g) {
+		tape.accumulate(A, Mat<T>(shape).fill(g(0, 0)));
+	});
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::sigmoid_cross_entropy(Var Z, const Mat<T> &Y)
+{
+	const Mat<T> &z = value(Z);
+	if (z.get_shape() != Y.get_shape())
+		throw std::invalid_argument("invalid argument: logits and targets are not of the same shape");
+
+	// The gradient comes with the loss, it is kept by the VJP until it runs
+	Mat<T> G(z.get_shape());
+	Mat<T> L = {{MatDispatchOps::Mat_sigmoid_cross_entropy(z.get_mat_raw(), Y.get_mat_raw(), G.get_mat_raw(),
+								z.rows() * z.cols())}};
+	return custom(std::move(L), {Z}, [Z, G = std::move(G)](Tape &tape, const Mat<T> &g) {
+		tape.accumulate(Z, G * g(0, 0));
+	});
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::softmax_cross_entropy(Var Z, const Mat<T> &Y)
+{
+	const Mat<T> &z = value(Z);
+	if (z.get_shape() != Y.get_shape())
+		throw std::invalid_argument("invalid argument: logits and targets are not of the same shape");
+
+	Mat<T> G(z.get_shape());
+	Mat<T> L = {{MatDispatchOps::Mat_softmax_cross_entropy(z.get_mat_raw(), Y.get_mat_raw(), G.get_mat_raw(),
+								z.get_shape())}};
+	return custom(std::move(L), {Z}, [Z, G = std::move(G)](Tape &tape, const Mat<T> &g) {
+		tape.accumulate(Z, G * g(0, 0));
+	});
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::custom(Mat<T> value, const std::vector<Var> &inputs, Vjp vjp,
+				 const std::vector<Var> &reads, bool reads_output)
+{
+	Node node(Kind::Operation, std::move(value), false);
+	for (Var input : inputs) {
+		node_of(input);
+		node.inputs.push_back(input.id);
+		node.requires_grad = node.requires_grad || nodes_[input.id].requires_grad;
+	}
+
+	// Without gradients to propagate the VJP never runs, nor reads anything
+	if (node.requires_grad)
+		node.vjp = std::move(vjp);
+	Var out = push(std::move(node));
+
+	if (nodes_[out.id].requires_grad) {
+		for (Var input : reads)
+			read(out.id, input.id);
+		if (reads_output)
+			read(out.id, out.id);
+	}
+	return out;
+}
+
+template <typename T>
+Tape<T> &nn::autodiff::Tape<T>::backward(Var out)
+{
+	if (node_of(out).shape != Shape(1, 1))
+		throw std::invalid_argument("invalid argument: only a (1, 1) output can be backpropagated without a seed");
+	return backward(out, Mat<T>(1, 1).fill(static_cast<T>(1)));
+}
+
+template <typename T>
+Tape<T> &nn::autodiff::Tape<T>::backward(Var out, const Mat<T> &seed)
+{
+	const Node &last = node_of(out);
+	if (done_)
+		throw std::logic_error("logic error: the tape was already backpropagated, clear it first");
+	if (last.shape != seed.get_shape())
+		throw std::invalid_argument("invalid argument: the seed needs the shape of the output");
+	done_ = true;
+
+	// The value of a node goes after the VJP of its last reader, the output is kept
+	std::vector<std::vector<std::size_t>> releases(out.id + 1);
+	for (std::size_t i = 0; i < nodes_.size(); i++) {
+		if (i == out.id)
+			continue;
+		if (nodes_[i].release == never || nodes_[i].release > out.id)
+			drop_value(nodes_[i]);
+		else
+			releases[nodes_[i].release].push_back(i);
+	}
+
+	accumulate(out, seed);
+	for (std::size_t i = out.id + 1; i-- > 0;) {
+		Node &node = nodes_[i];
+		// The gradient of a node is complete, all its consumers come after it
+		if (node.has_grad && node.vjp != nullptr) {
+			node.vjp(*this, node.grad);
+			node.vjp = nullptr;
+		}
+		if (node.kind != Kind::Input)
+			drop_grad(node);
+		for (std::size_t id : releases[i])
+			drop_value(nodes_[id]);
+	}
+
+	return *this;
+}
+
+template <typename T>
+Tape<T> &nn::autodiff::Tape<T>::accumulate(Var var, const Mat<T> &grad)
+{
+	const Node &checked = node_of(var);
+	if (!checked.requires_grad)
+		return *this;
+	if (checked.shape != grad.get_shape())
+		throw std::invalid_argument("invalid argument: the gradient needs the shape of the node");
+
+	Node &node = nodes_[var.id];
+	if (node.kind == Kind::Parameter) {
+		*node.param_grad += grad;
+	} else if (node.has_grad) {
+		node.grad += grad;
+	} else {
+		node.grad = grad;
+		node.has_grad = true;
+		peak_ = std::max(peak_, ++live_);
+	}
+
+	return *this;
+}
+
+template <typename T>
+Tape<T> &nn::autodiff::Tape<T>::clear(void)
+{
+	nodes_.clear();
+	live_ = peak_ = 0;
+	done_ = false;
+	return *this;
+}
+
+template <typename T>
+const Mat<T> &nn::autodiff::Tape<T>::value(Var var) const
+{
+	const Node &node = node_of(var);
+	if (!node.has_value)
+		throw std::logic_error("logic error: the value of the node was already released");
+	return node.value;
+}
+
+template <typename T>
+const Mat<T> &nn::autodiff::Tape<T>::grad(Var var) const
+{
+	const Node &node = node_of(var);
+	if (node.kind != Kind::Input)
+		throw std::logic_error("logic error: only the gradients of the inputs are kept");
+	if (!node.has_grad)
+		throw std::logic_error("logic error: the input has no gradient, run the backward first");
+	return node.grad;
+}
+
+template <typename T>
+bool nn::autodiff::Tape<T>::requires_grad(Var var) const
+{
+	return node_of(var).requires_grad;
+}
+
+template <typename T>
+std::size_t nn::autodiff::Tape<T>::size(void) const
+{
+	return nodes_.size();
+}
+
+template <typename T>
+std::size_t nn::autodiff::Tape<T>::live_buffers(void) const
+{
+	return live_;
+}
+
+template <typename T>
+std::size_t nn::autodiff::Tape<T>::peak_buffers(void) const
+{
+	return peak_;
+}
+
+template <typename T>
+Var nn::autodiff::Tape<T>::push(Node node)
+{
+	if (done_)
+		throw std::logic_error("logic error: the tape was already backpropagated, clear it first");
+
+	if (node.kind != Kind::Parameter)
+		peak_ = std::max(peak_, ++live_);
+	nodes_.push_back(std::move(node));
+	return Var{nodes_.size() - 1};
+}
+
+template <typename T>
+void nn::autodiff::Tape<T>::read(std::size_t reader, std::size_t id)
+{
+	// The backward goes down, the reader with the smallest index is the last one
+	nodes_[id].release = std::min(nodes_[id].release, reader);
+}
+
+template <typename T>
+void nn::autodiff::Tape<T>::drop_value(Node &node)
+{
+	if (!node.has_value)
+		return;
+	node.value = Mat<T>();
+	node.has_value = false;
+	if (node.kind != Kind::Parameter)
+		live_--;
+}
+
+template <typename T>
+void nn::autodiff::Tape<T>::drop_grad(Node &node)
+{
+	if (!node.has_grad)
+		return;
+	node.grad = Mat<T>();
+	node.has_grad = false;
+	live_--;
+}
+
+template <typename T>
+const typename Tape<T>::Node &nn::autodiff::Tape<T>::node_of(Var var) const
+{
+	if (var.id >= nodes_.size())
+		throw std::invalid_argument("invalid argument: the variable doesn't belong to the tape");
+	return nodes_[var.id];
+}
+
+template class nn::autodiff::Tape<float>;
+// template class nn::autodiff::Tape<double>;
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <utility>
+
+#include "../include/checkpoint.hpp"
+
+using namespace nn::io;
+
+namespace fs = std::filesystem;
+
+static constexpr const char *checkpoint_extension = ".nnm";
+
+/* Epoch of a checkpoint file name, false if the name doesn't belong to this prefix */
+static bool parse_epoch(const std::string &filename, const std::string &prefix, std::uint64_t &epoch)
+{
+	std::string head = prefix + "-";
+	std::string tail = checkpoint_extension;
+	if (filename.size() <= head.size() + tail.size()
+	    || filename.compare(0, head.size(), head) != 0
+	    || filename.compare(filename.size() - tail.size(), tail.size(), tail) != 0)
+		return false;
+
+	std::string digits = filename.substr(head.size(), filename.size() - head.size() - tail.size());
+	if (!std::all_of(digits.begin(), digits.end(), [](char c) { return c >= '0' && c <= '9'; }))
+		return false;
+
+	epoch = std::stoull(digits);
+	return true;
+}
+
+template <typename T>
+nn::io::Checkpointer<T>::Checkpointer(const std::string &directory, std::size_t interval, std::size_t keep_last,
+				      const std::string &prefix)
+	: directory_(directory), prefix_(prefix), interval_(interval), keep_last_(keep_last), resume_(true),
+	  pending_(false), stopped_(false)
+{
+	if (directory_.empty())
+		throw std::invalid_argument("invalid argument: the checkpoint directory cannot be empty");
+	if (interval_ == 0)
+		throw std::invalid_argument("invalid argument: the checkpoint interval must be at least one epoch");
+	if (prefix_.empty() || prefix_.find('/') != std::string::npos)
+		throw std::invalid_argument("invalid argument: invalid checkpoint prefix: " + prefix_);
+
+	fs::create_directories(directory_);
+	writer_ = std::thread(&Checkpointer<T>::write_loop, this);
+}
+
+template <typename T>
+nn::io::Checkpointer<T>::~Checkpointer(void)
+{
+	// The queued checkpoint is still written, only then the writer stops
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopped_ = true;
+	}
+	cv_.notify_all();
+
+	if (writer_.joinable())
+		writer_.join();
+}
+
+template <typename T>
+bool nn::io::Checkpointer<T>::on_epoch_end(const Sequential<T> &model, std::uint64_t epoch)
+{
+	if (epoch == 0 || epoch % interval_ != 0)
+		return false;
+
+	snapshot(model, epoch);
+	return true;
+}
+
+template <typename T>
+Checkpointer<T> &nn::io::Checkpointer<T>::snapshot(const Sequential<T> &model, std::uint64_t epoch)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	cv_.wait(lock, [&] { return !pending_; });
+	if (error_ != nullptr)
+		std::rethrow_exception(std::exchange(error_, nullptr));
+
+	// The image points to the live weights, then they are moved to the staging buffer
+	image_ = make_image(model);
+	image_.epoch = epoch;
+
+	std::shared_ptr<Optimizer> optimizer = model.get_optimizer();
+	if (optimizer != nullptr) {
+		image_.add_state(*optimizer);
+		for (Mat<T> *state : optimizer->template get_state<T>())
+			image_.add_tensor(*state);
+	}
+
+	std::size_t nelements = 0;
+	for (const auto &record : image_.records)
+		nelements += record.rows * record.cols;
+	// Only grows, after the first checkpoint the snapshots don't allocate tensor memory
+	// The weights of a flat model are copied with a single memcpy of the
+	// slab (its padding included), their tensors are rebased into the copy
+	const T *slab = nullptr;
+	std::size_t slab_size = 0;
+	if (model.has_flat_parameters()) {
+		slab = model.get_flat_parameters().get_mat_raw();
+		slab_size = model.get_flat_parameters().cols();
+		nelements += slab_size;
+	}
+	if (staging_.size() < nelements)
+		staging_.resize(nelements);
+
+	T *dst = staging_.data();
+	if (slab != nullptr) {
+		std::memcpy(dst, slab, slab_size * sizeof(T));
+		dst += slab_size;
+	}
+	for (std::size_t i = 0; i < image_.records.size(); i++) {
+		std::size_t n = image_.records[i].rows * image_.records[i].cols;
+		if (slab != nullptr && image_.tensors[i] >= slab && image_.tensors[i] + n <= slab + slab_size) {
+			image_.tensors[i] = staging_.data() + (image_.tensors[i] - slab);
+			continue;
+		}
+		std::memcpy(dst, image_.tensors[i], n * sizeof(T));
+		image_.tensors[i] = dst;
+		dst += n;
+	}
+
+	pending_ = true;
+	lock.unlock();
+	cv_.notify_all();
+
+	return *this;
+}
+
+template <typename T>
+Checkpointer<T> &nn::io::Checkpointer<T>::flush(void)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	cv_.wait(lock, [&] { return !pending_; });
+	if (error_ != nullptr)
+		std::rethrow_exception(std::exchange(error_, nullptr));
+
+	return *this;
+}
+
+template <typename T>
+std::uint64_t nn::io::Checkpointer<T>::resume(Sequential<T> &model)
+{
+	if (!resume_)
+		return 0;
+
+	std::string path = latest();
+	if (path.empty())
+		return 0;
+
+	return restore(path, model);
+}
+
+template <typename T>
+std::vector<std::string> nn::io::Checkpointer<T>::list(void) const
+{
+	std::vector<std::pair<std::uint64_t, std::string>> found;
+	if (fs::is_directory(directory_)) {
+		for (const auto &entry : fs::directory_iterator(directory_)) {
+			std::uint64_t epoch;
+			if (entry.is_regular_file() && parse_epoch(entry.path().filename().string(), prefix_, epoch))
+				found.emplace_back(epoch, entry.path().string());
+		}
+	}
+	std::sort(found.begin(), found.end());
+
+	std::vector<std::string> paths;
+	for (auto &file : found)
+		paths.push_back(std::move(file.second));
+	return paths;
+}
+
+template <typename T>
+std::string nn::io::Checkpointer<T>::latest(void) const
+{
+	std::vector<std::string> paths = list();
+	return paths.empty() ? "" : paths.back();
+}
+
+template <typename T>
+std::string nn::io::Checkpointer<T>::path_of(std::uint64_t epoch) const
+{
+	// Zero padded, then the names also sort by epoch
+	char number[21];
+	std::snprintf(number, sizeof(number), "%08llu", static_cast<unsigned long long>(epoch));
+	return (fs::path(directory_) / (prefix_ + "-" + number + checkpoint_extension)).string();
+}
+
+template <typename T>
+Checkpointer<T> &nn::io::Checkpointer<T>::set_resume(bool resume)
+{
+	resume_ = resume;
+	return *this;
+}
+
+template <typename T>
+bool nn::io::Checkpointer<T>::get_resume(void) const
+{
+	return resume_;
+}
+
+template <typename T>
+const std::string &nn::io::Checkpointer<T>::get_directory(void) const
+{
+	return directory_;
+}
+
+template <typename T>
+std::size_t nn::io::Checkpointer<T>::get_interval(void) const
+{
+	return interval_;
+}
+
+template <typename T>
+std::size_t nn::io::Checkpointer<T>::get_keep_last(void) const
+{
+	return keep_last_;
+}
+
+template <typename T>
+void nn::io::Checkpointer<T>::write_loop(void)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		cv_.wait(lock, [&] { return pending_ || stopped_; });
+		if (!pending_)
+			return;
+
+		// Nobody touches `image_` nor `staging_` while the write is pending
+		lock.unlock();
+		std::exception_ptr error;
+		try {
+			write_image(path_of(image_.epoch), image_, true);
+			prune();
+		} catch (...) {
+			error = std::current_exception();
+		}
+		lock.lock();
+
+		if (error != nullptr)
+			error_ = error;
+		pending_ = false;
+		cv_.notify_all();
+	}
+}
+
+template <typename T>
+void nn::io::Checkpointer<T>::prune(void) const
+{
+	if (keep_last_ == 0)
+		return;
+
+	std::vector<std::string> paths = list();
+	for (std::size_t i = 0; i + keep_last_ < paths.size(); i++)
+		fs::remove(paths[i]);
+}
+
+template class nn::io::Checkpointer<float>;
+// template class nn::io::Checkpointer<double>;
@@ -0,0 +1,403 @@
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+
+#include "../include/conv.hpp"
+
+using namespace nn::mathops;
+using namespace nn::layers;
+
+// Output size of one dimension, zero if the kernel doesn't fit
+static std::size_t conv_output_size(std::size_t size, std::size_t kernel, std::size_t stride,
+				    std::size_t padding, std::size_t dilation)
+{
+	std::size_t span = dilation * (kernel - 1) + 1;
+	if (size + 2 * padding < span)
+		return 0;
+	return (size + 2 * padding - span) / stride + 1;
+}
+
+template <typename T>
+nn::layers::Conv2D<T>::Conv2D(std::size_t channels, std::size_t height, std::size_t width, std::size_t filters,
+			      std::size_t kernel_size, std::size_t stride, std::size_t padding, std::size_t dilation,
+			      std::shared_ptr<Layer> activation_func, std::shared_ptr<RandInitializer> rand_init)
+	: WeightedLayer(channels * height * width, 0, "Conv2D", activation_func, rand_init),
+	  channels_(channels), height_(height), width_(width), filters_(filters), kernel_size_(kernel_size),
+	  stride_(stride), padding_(padding), dilation_(dilation)
+{
+	if (channels == 0 || height == 0 || width == 0 || filters == 0)
+		throw std::invalid_argument("invalid argument: a convolution needs images and filters");
+	if (kernel_size == 0 || stride == 0 || dilation == 0)
+		throw std::invalid_argument("invalid argument: the kernel, stride and dilation must be positive");
+
+	out_height_ = conv_output_size(height, kernel_size, stride, padding, dilation);
+	out_width_ = conv_output_size(width, kernel_size, stride, padding, dilation);
+	if (out_height_ == 0 || out_width_ == 0)
+		throw std::invalid_argument("invalid argument: the kernel doesn't fit in the padded image");
+
+	output_shape_ = Shape{filters_ * out_height_ * out_width_, 1};
+}
+
+template <typename T>
+Mat<T> &nn::layers::Conv2D<T>::get_weights(void) const
+{
+	if (weights_ == nullptr)
+		throw std::invalid_argument("Conv2D layer not built yet");
+	return *weights_;
+}
+
+template <typename T>
+Mat<T> &nn::layers::Conv2D<T>::get_bias(void) const
+{
+	if (bias_ == nullptr)
+		throw std::invalid_argument("Conv2D layer not built yet");
+	return *bias_;
+}
+
+template <typename T>
+std::size_t nn::layers::Conv2D<T>::get_channels(void) const
+{
+	return channels_;
+}
+
+template <typename T>
+std::size_t nn::layers::Conv2D<T>::get_height(void) const
+{
+	return height_;
+}
+
+template <typename T>
+std::size_t nn::layers::Conv2D<T>::get_width(void) const
+{
+	return width_;
+}
+
+template <typename T>
+std::size_t nn::layers::Conv2D<T>::get_filters(void) const
+{
+	return filters_;
+}
+
+template <typename T>
+std::size_t nn::layers::Conv2D<T>::get_kernel_size(void) const
+{
+	return kernel_size_;
+}
+
+template <typename T>
+std::size_t nn::layers::Conv2D<T>::get_stride(void) const
+{
+	return stride_;
+}
+
+template <typename T>
+std::size_t nn::layers::Conv2D<T>::get_padding(void) const
+{
+	return padding_;
+}
+
+template <typename T>
+std::size_t nn::layers::Conv2D<T>::get_dilation(void) const
+{
+	return dilation_;
+}
+
+template <typename T>
+std::size_t nn::layers::Conv2D<T>::get_out_height(void) const
+{
+	return out_height_;
+}
+
+template <typename T>
+std::size_t nn::layers::Conv2D<T>::get_out_width(void) const
+{
+	return out_width_;
+}
+
+template <typename T>
+Conv2D<T> &nn::layers::Conv2D<T>::set_algorithm(ConvAlgorithm algorithm)
+{
+	if (algorithm == ConvAlgorithm::Direct && stride_ != 1)
+		throw std::invalid_argument("invalid argument: the direct convolution only has stride 1");
+	algorithm_ = algorithm;
+	return *this;
+}
+
+template <typename T>
+ConvAlgorithm nn::layers::Conv2D<T>::get_algorithm(void) const
+{
+	return algorithm_;
+}
+
+template <typename T>
+Conv2D<T> &nn::layers::Conv2D<T>::build(const Shape &input_shape, const Shape &output_shape)
+{
+	if (input_shape != input_shape_ || output_shape != output_shape_)
+		throw std::invalid_argument("Invalid shapes for the geometry of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+Conv2D<T> &nn::layers::Conv2D<T>::build(std::size_t input_size, std::size_t output_size)
+{
+	if (input_size != input_shape_.rows || output_size != output_shape_.rows)
+		throw std::invalid_argument("Invalid sizes for the geometry of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+Conv2D<T> &nn::layers::Conv2D<T>::build(void)
+{
+	alloc_weights();
+
+	if (activation_func_ != nullptr)
+		activation_func_->build(output_shape_, output_shape_);
+
+	// After the activation, its in place functions are captured
+	register_funcs();
+
+	built_ = true;
+	return *this;
+}
+
+template <typename T>
+Conv2D<T> &nn::layers::Conv2D<T>::alloc_weights(void)
+{
+	grad_weights_ = nullptr;
+	grad_bias_ = nullptr;
+	grad_count_ = 0;
+
+	// Weights moved to external memory by `bind_parameters` are kept
+	if (weights_bound_)
+		return *this;
+
+	weights_ = add_weights<T>(Shape{filters_, channels_ * kernel_size_ * kernel_size_}, rand_init_);
+	bias_ = add_weights<T>(filters_, rand_init_);
+	return *this;
+}
+
+template <typename T>
+Conv2D<T> &nn::layers::Conv2D<T>::alloc_gradients(void)
+{
+	if (grad_weights_ != nullptr)
+		return *this;
+
+	grad_weights_ = std::make_unique<Mat<T>>(weights_->get_shape());
+	grad_bias_ = std::make_unique<Mat<T>>(bias_->get_shape());
+	grad_weights_->fill(static_cast<T>(0));
+	grad_bias_->fill(static_cast<T>(0));
+	grad_count_ = 0;
+	return *this;
+}
+
+template <typename T>
+Mat_conv2d nn::layers::Conv2D<T>::geometry(std::size_t nbatch) const
+{
+	return Mat_conv2d{channels_, height_, width_, kernel_size_, kernel_size_,
+			  stride_, padding_, dilation_, out_height_, out_width_, nbatch};
+}
+
+template <typename T>
+bool nn::layers::Conv2D<T>::direct(void) const
+{
+	return algorithm_ == ConvAlgorithm::Direct
+		|| (algorithm_ == ConvAlgorithm::Auto && kernel_size_ == 3 && stride_ == 1);
+}
+
+template <typename T>
+std::size_t nn::layers::Conv2D<T>::workspace_size(std::size_t nbatch) const
+{
+	if (direct())
+		return 0;
+	return 2 * AlignedBuffer<T>::round_up(channels_ * kernel_size_ * kernel_size_ * out_height_ * out_width_ * nbatch);
+}
+
+template <typename T>
+void nn::layers::Conv2D<T>::convolve(const Mat<T> &X, Mat<T> &Z, T *workspace) const
+{
+	Mat_conv2d conv = geometry(X.cols());
+	std::size_t npixels = out_height_ * out_width_ * X.cols();
+	if (direct()) {
+		MatDispatchOps::Mat_conv2d_direct(X.get_mat_raw(), weights_->get_mat_raw(), Z.get_mat_raw(), filters_, conv);
+	} else {
+		// W (filters, patch) . cols (patch, pixels) is Z (filters * pixels of a sample, batch)
+		MatDispatchOps::Mat_im2col(X.get_mat_raw(), workspace, conv);
+		MatDispatchOps::Mat_dot(weights_->get_mat_raw(), workspace, Z.get_mat_raw(), weights_->get_shape(), npixels);
+	}
+
+	// Z as (filters, pixels), the bias of a filter goes to all of its pixels
+	MatDispatchOps::Mat_add_colvec(Z.get_mat_raw(), bias_->get_mat_raw(), Shape{filters_, npixels});
+}
+
+template <typename T>
+void nn::layers::Conv2D<T>::convolve_backward(const Mat<T> &X, const Mat<T> &dZ, Mat<T> *dX, Mat<T> *grads, T *workspace) const
+{
+	Mat_conv2d conv = geometry(X.cols());
+	std::size_t npixels = out_height_ * out_width_ * X.cols();
+	Shape pixels{filters_, npixels};
+	if (direct()) {
+		MatDispatchOps::Mat_conv2d_direct_backward(X.get_mat_raw(), weights_->get_mat_raw(), dZ.get_mat_raw(),
+							   dX == nullptr ? nullptr : dX->get_mat_raw(),
+							   grads == nullptr ? nullptr : grads[0].get_mat_raw(), filters_, conv);
+	} else {
+		// dW += dZ . cols^T, dcols = W^T . dZ folded back into dX
+		std::size_t patch = weights_->cols();
+		T *cols = workspace;
+		T *dcols = workspace + AlignedBuffer<T>::round_up(patch * npixels);
+		if (grads != nullptr) {
+			MatDispatchOps::Mat_im2col(X.get_mat_raw(), cols, conv);
+			MatDispatchOps::Mat_dot_nt_acc(dZ.get_mat_raw(), cols, grads[0].get_mat_raw(), pixels, patch);
+		}
+		if (dX != nullptr) {
+			MatDispatchOps::Mat_dot_tn(weights_->get_mat_raw(), dZ.get_mat_raw(), dcols, weights_->get_shape(), npixels);
+			dX->fill(static_cast<T>(0));
+			MatDispatchOps::Mat_col2im_acc(dcols, dX->get_mat_raw(), conv);
+		}
+	}
+
+	if (grads != nullptr)
+		MatDispatchOps::Mat_add_row_sum(dZ.get_mat_raw(), grads[1].get_mat_raw(), pixels);
+}
+
+template <typename T>
+Conv2D<T> &nn::layers::Conv2D<T>::register_funcs(void)
+{
+	register_func<Mat<T>, const Mat<T> &>
+		("logits", [this](const Mat<T> &X) -> Mat<T> {
+			if (X.rows() != input_shape_.rows)
+				throw std::invalid_argument("invalid argument: the images don't match the layer: " + name_);
+			Mat<T> Z(Shape{output_shape_.rows, X.cols()});
+			AlignedBuffer<T> workspace(workspace_size(X.cols()) / 2);
+			convolve(X, Z, workspace.data());
+			return Z;
+		});
+
+	register_func<Mat<T>, const Mat<T> &>
+		("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+			Mat<T> Z = logits<T>(X);
+			if (activation_func_ != nullptr)
+				return (*activation_func_)(Z);
+			return Z;
+		});
+
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward_logits", [this](const Mat<T> &X, const Mat<T> &dZ, Mat<T> *grads) -> Mat<T> {
+			Mat<T> dX(X.get_shape());
+			AlignedBuffer<T> workspace(workspace_size(X.cols()));
+			convolve_backward(X, dZ, &dX, grads, workspace.data());
+			return dX;
+		});
+
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			if (activation_func_ == nullptr)
+				return backward_logits<T>(X, dY, grads);
+			Mat<T> dZ = activation_func_->backward(logits<T>(X), dY, static_cast<Mat<T> *>(nullptr));
+			return backward_logits<T>(X, dZ, grads);
+		});
+
+	// The in place functions of the activation are looked up once, not on every call
+	ForwardInto<T> activation_forward;
+	BackwardInto<T> activation_backward;
+	if (activation_func_ != nullptr && activation_func_->can_run_into<T>()) {
+		activation_forward = activation_func_->get_forward_into<T>();
+		activation_backward = activation_func_->get_backward_into<T>();
+	}
+
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [this, activation_forward](const Mat<T> &X, Mat<T> &Y) -> void {
+			// The scratch only grows, the steady state doesn't allocate
+			if (workspace_.size() < workspace_size(X.cols()))
+				workspace_.resize(workspace_size(X.cols()));
+			convolve(X, Y, workspace_.data());
+			if (activation_forward)
+				activation_forward(Y, Y);
+			else if (activation_func_ != nullptr)
+				Y = (*activation_func_)(Y);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [this, activation_backward](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			// dL/dZ over dY, the activation differentiates from its output
+			if (activation_backward)
+				activation_backward(Y, Y, dY, dY, nullptr);
+			else if (activation_func_ != nullptr)
+				dY = activation_func_->backward(logits<T>(X), dY, static_cast<Mat<T> *>(nullptr));
+
+			if (workspace_.size() < workspace_size(X.cols()))
+				workspace_.resize(workspace_size(X.cols()));
+			convolve_backward(X, dY, &dX, grads, workspace_.data());
+		});
+
+	// One gradient step with dL/dZ of the batch, like `Dense`
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("fit", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			Mat<T> grads[2] = {Mat<T>(weights_->get_shape()).fill(static_cast<T>(0)),
+					   Mat<T>(bias_->get_shape()).fill(static_cast<T>(0))};
+			AlignedBuffer<T> workspace(workspace_size(input.cols()));
+			convolve_backward(input, signal_update, nullptr, grads, workspace.data());
+			optimizer_->apply(*weights_, grads[0]);
+			optimizer_->apply(*bias_, grads[1]);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("accumulate", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			alloc_gradients();
+			Mat<T> grads[2] = {Mat<T>(grad_weights_->get_shape(), grad_weights_->get_mat_raw()),
+					   Mat<T>(grad_bias_->get_shape(), grad_bias_->get_mat_raw())};
+			AlignedBuffer<T> workspace(workspace_size(input.cols()));
+			convolve_backward(input, signal_update, nullptr, grads, workspace.data());
+			grad_count_ += input.cols();
+		});
+
+	register_func<void>
+		("step", [this]() -> void {
+			if (grad_count_ == 0)
+				return;
+
+			T scale = static_cast<T>(1) / static_cast<T>(grad_count_);
+			*grad_weights_ *= scale;
+			*grad_bias_ *= scale;
+			optimizer_->apply(*weights_, *grad_weights_);
+			optimizer_->apply(*bias_, *grad_bias_);
+
+			grad_weights_->fill(static_cast<T>(0));
+			grad_bias_->fill(static_cast<T>(0));
+			grad_count_ = 0;
+		});
+
+	register_func<void>
+		("zero_grad", [this]() -> void {
+			if (grad_weights_ == nullptr)
+				return;
+			grad_weights_->fill(static_cast<T>(0));
+			grad_bias_->fill(static_cast<T>(0));
+			grad_count_ = 0;
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("gradients", [this]() -> std::vector<Mat<T> *> {
+			alloc_gradients();
+			return {grad_weights_.get(), grad_bias_.get()};
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("parameters", [this]() -> std::vector<Mat<T> *> {
+			return {weights_.get(), bias_.get()};
+		});
+
+	register_func<void, const std::vector<T *> &>
+		("bind_parameters", [this](const std::vector<T *> &memory) -> void {
+			if (memory.size() != 2)
+				throw std::invalid_argument("invalid argument: a Conv2D layer binds two matrices");
+			// The matrices are replaced in place, pointers to them (optimizer state) stay valid
+			*weights_ = Mat<T>(weights_->get_shape(), memory[0]);
+			*bias_ = Mat<T>(bias_->get_shape(), memory[1]);
+			weights_bound_ = true;
+		});
+
+	return *this;
+}
+
+template class nn::layers::Conv2D<float>;
+// template class nn::layers::Conv2D<double>;
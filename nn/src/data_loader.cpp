@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "../include/data_loader.hpp"
+
+using namespace nn::data;
+
+template <typename T>
+nn::data::Batch<T>::Batch(const Shape &input_shape, const Shape &output_shape, std::size_t capacity)
+	: X(input_shape.rows * input_shape.cols, capacity),
+	  Y(output_shape.rows * output_shape.cols, capacity),
+	  size(0), epoch(0), index(0)
+{
+}
+
+template <typename T>
+void nn::data::Batch<T>::get_sample(std::size_t j, Mat<T> &x, Mat<T> &y) const
+{
+	if (j >= size)
+		throw std::out_of_range("out of range: sample index bigger than the batch size");
+
+	// X is (n, size) in row-major, then the sample `j` is a strided column
+	const T *src_x = X.get_mat_raw();
+	T *dst_x = x.get_mat_raw();
+	for (std::size_t i = 0; i < X.rows(); i++)
+		dst_x[i] = src_x[i * size + j];
+
+	const T *src_y = Y.get_mat_raw();
+	T *dst_y = y.get_mat_raw();
+	for (std::size_t i = 0; i < Y.rows(); i++)
+		dst_y[i] = src_y[i * size + j];
+}
+
+template class nn::data::Batch<float>;
+// template class nn::data::Batch<double>;
+
+
+template <typename T>
+void nn::data::pack_columns(const std::vector<Mat<T>> &src, std::size_t first, std::size_t count, Mat<T> &dst)
+{
+	T *out = dst.get_mat_raw();
+	std::size_t rows = dst.rows();
+	for (std::size_t j = 0; j < count; j++) {
+		const T *col = src[first + j].get_mat_raw();
+		for (std::size_t i = 0; i < rows; i++)
+			out[i * count + j] = col[i];
+	}
+}
+
+template void nn::data::pack_columns(const std::vector<Mat<float>> &src, std::size_t first, std::size_t count,
+				     Mat<float> &dst);
+
+
+template <typename T>
+nn::data::DataLoader<T>::DataLoader(std::shared_ptr<std::vector<Mat<T>>> X, std::shared_ptr<std::vector<Mat<T>>> Y,
+				    std::size_t batch_size, bool shuffle, std::size_t nbuffers, unsigned int seed)
+	: X_(X), Y_(Y), batch_size_(batch_size), shuffle_(shuffle), rng_(seed),
+	  produced_(0), consumed_(0), total_(0), holding_(false), stopped_(false)
+{
+	if (X_ == nullptr || Y_ == nullptr || X_->empty())
+		throw std::invalid_argument("invalid argument: Inputs and outputs cannot be empty.");
+	if (X_->size() != Y_->size())
+		throw std::invalid_argument("invalid argument: Inputs and outputs are not of the same size");
+	if (batch_size_ == 0)
+		throw std::invalid_argument("invalid argument: batch size must be at least one");
+	if (nbuffers == 0)
+		throw std::invalid_argument("invalid argument: at least one buffer is needed");
+
+	batch_size_ = std::min(batch_size_, X_->size());
+
+	indices_.resize(X_->size());
+	for (std::size_t i = 0; i < indices_.size(); i++)
+		indices_[i] = i;
+
+	// Preallocate the ring, after this point the loader doesn't allocate batches anymore
+	for (std::size_t i = 0; i < nbuffers; i++) {
+		slots_.push_back(std::make_unique<Batch<T>>((*X_)[0].get_shape(), (*Y_)[0].get_shape(), batch_size_));
+		slot_indices_.emplace_back();
+		slot_indices_.back().reserve(batch_size_);
+	}
+	ready_.assign(nbuffers, false);
+}
+
+template <typename T>
+nn::data::DataLoader<T>::~DataLoader(void)
+{
+	stop();
+}
+
+template <typename T>
+DataLoader<T> &nn::data::DataLoader<T>::start(std::size_t nepochs)
+{
+	stop();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	ready_.assign(slots_.size(), false);
+	produced_ = 0;
+	consumed_ = 0;
+	total_ = nepochs * get_nbatches();
+	holding_ = false;
+	stopped_ = false;
+	error_ = nullptr;
+	schedule();
+
+	return *this;
+}
+
+template <typename T>
+const Batch<T> *nn::data::DataLoader<T>::next(void)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+
+	// Give back the slot that the consumer was using, its next batch can start
+	if (holding_) {
+		holding_ = false;
+		schedule();
+	}
+
+	std::size_t slot = consumed_ % slots_.size();
+	auto done = [&] { return ready_[slot] || error_ != nullptr || stopped_ || consumed_ >= total_; };
+	if (!done()) {
+		// Help the pool instead of sleeping, the batch could be queued behind other work
+		lock.unlock();
+		parallel::ThreadPool::global().help_until([&] {
+			std::lock_guard<std::mutex> guard(mutex_);
+			return done();
+		});
+		lock.lock();
+	}
+
+	if (error_ != nullptr)
+		std::rethrow_exception(error_);
+	// A stopped loader doesn't hand out the batches that were already prefetched
+	if (stopped_ || !ready_[slot])
+		return nullptr;
+
+	ready_[slot] = false;
+	holding_ = true;
+	consumed_++;
+
+	return slots_[slot].get();
+}
+
+template <typename T>
+DataLoader<T> &nn::data::DataLoader<T>::stop(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopped_ = true;
+	}
+	parallel::ThreadPool::global().notify_waiters();
+
+	// The assembly tasks don't throw, they leave their errors for `next`
+	tasks_.wait();
+
+	return *this;
+}
+
+template <typename T>
+std::size_t nn::data::DataLoader<T>::get_batch_size(void) const
+{
+	return batch_size_;
+}
+
+template <typename T>
+std::size_t nn::data::DataLoader<T>::get_nbatches(void) const
+{
+	return (indices_.size() + batch_size_ - 1) / batch_size_;
+}
+
+template <typename T>
+std::size_t nn::data::DataLoader<T>::get_nbuffers(void) const
+{
+	return slots_.size();
+}
+
+template <typename T>
+std::vector<std::size_t> nn::data::DataLoader<T>::get_indices(void) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return indices_;
+}
+
+template <typename T>
+void nn::data::DataLoader<T>::schedule(void)
+{
+	std::size_t n = indices_.size();
+	std::size_t nbatches = get_nbatches();
+
+	// The batches in flight plus the one held by the consumer never exceed the ring
+	while (!stopped_ && produced_ < total_ && produced_ - consumed_ + (holding_ ? 1 : 0) < slots_.size()) {
+		std::size_t slot = produced_ % slots_.size();
+		std::size_t epoch = produced_ / nbatches;
+		std::size_t index = produced_ % nbatches;
+
+		// Only the indices are permuted, the samples never move. The batches
+		// of the previous epoch already took their copy of the indices
+		if (index == 0 && shuffle_)
+			std::shuffle(indices_.begin(), indices_.end(), rng_);
+
+		std::size_t first = index * batch_size_;
+		std::size_t count = std::min(batch_size_, n - first);
+		slot_indices_[slot].assign(indices_.begin() + first, indices_.begin() + first + count);
+		produced_++;
+
+		// The slot is free, nobody else touches it until it is marked as ready
+		tasks_.run([this, slot, epoch, index] {
+			Batch<T> &batch = *slots_[slot];
+			std::exception_ptr error;
+			try {
+				assemble(batch, slot_indices_[slot]);
+				batch.epoch = epoch;
+				batch.index = index;
+			} catch (...) {
+				error = std::current_exception();
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (error != nullptr) {
+					if (error_ == nullptr)
+						error_ = error;
+				} else {
+					ready_[slot] = true;
+				}
+			}
+			parallel::ThreadPool::global().notify_waiters();
+		});
+	}
+}
+
+template <typename T>
+void nn::data::DataLoader<T>::assemble(Batch<T> &batch, const std::vector<std::size_t> &indices)
+{
+	std::size_t nx = batch.X.rows();
+	std::size_t ny = batch.Y.rows();
+	std::size_t count = indices.size();
+
+	// The buffers were allocated for `batch_size_` columns, a smaller last
+	// batch just uses a tighter stride over the same memory
+	batch.size = count;
+	batch.X.set_shape(Shape{nx, count});
+	batch.Y.set_shape(Shape{ny, count});
+
+	T *dst_x = batch.X.get_mat_raw();
+	T *dst_y = batch.Y.get_mat_raw();
+	for (std::size_t j = 0; j < count; j++) {
+		const Mat<T> &x = (*X_)[indices[j]];
+		const Mat<T> &y = (*Y_)[indices[j]];
+		if (x.rows() * x.cols() != nx || y.rows() * y.cols() != ny)
+			throw std::invalid_argument("invalid argument: all the samples must have the same shape");
+
+		const T *src_x = x.get_mat_raw();
+		for (std::size_t i = 0; i < nx; i++)
+			dst_x[i * count + j] = src_x[i];
+
+		const T *src_y = y.get_mat_raw();
+		for (std::size_t i = 0; i < ny; i++)
+			dst_y[i * count + j] = src_y[i];
+	}
+}
+
+template class nn::data::DataLoader<float>;
+// template class nn::data::DataLoader<double>;
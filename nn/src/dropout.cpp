@@ -0,0 +1,150 @@
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+
+#include "../include/dropout.hpp"
+
+using namespace nn::mathops;
+using namespace nn::layers;
+
+template <typename T>
+nn::layers::Dropout<T>::Dropout(std::size_t size, T rate, std::uint64_t seed)
+	: Layer(size, size, false, "Dropout"), rate_(rate), seed_(seed)
+{
+	if (size == 0)
+		throw std::invalid_argument("invalid argument: a dropout needs features");
+	if (rate < 0 || rate >= 1)
+		throw std::invalid_argument("invalid argument: the rate of a dropout goes in [0, 1)");
+
+	if (seed_ == 0) {
+		std::random_device device;
+		seed_ = (static_cast<std::uint64_t>(device()) << 32) | device();
+	}
+}
+
+template <typename T>
+T nn::layers::Dropout<T>::get_rate(void) const
+{
+	return rate_;
+}
+
+template <typename T>
+std::uint64_t nn::layers::Dropout<T>::get_seed(void) const
+{
+	return seed_;
+}
+
+template <typename T>
+Dropout<T> &nn::layers::Dropout<T>::build(const Shape &input_shape, const Shape &output_shape)
+{
+	if (input_shape != input_shape_ || output_shape != output_shape_)
+		throw std::invalid_argument("Invalid shapes for the features of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+Dropout<T> &nn::layers::Dropout<T>::build(std::size_t input_size, std::size_t output_size)
+{
+	if (input_size != input_shape_.rows || output_size != output_shape_.rows)
+		throw std::invalid_argument("Invalid sizes for the features of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+Dropout<T> &nn::layers::Dropout<T>::build(void)
+{
+	register_funcs();
+	built_ = true;
+	return *this;
+}
+
+template <typename T>
+bool nn::layers::Dropout<T>::is_identity(void) const
+{
+	return !training_ || rate_ == 0;
+}
+
+template <typename T>
+const typename Dropout<T>::Mask &nn::layers::Dropout<T>::thread_mask(const Mat<T> &X)
+{
+	const Mask &mask = masks_.get();
+	if (mask.size != X.rows() * X.cols() || mask.input != X.get_mat_raw())
+		throw std::logic_error("logic error: the backward of a Dropout needs the forward of its batch in the same thread: " + name_);
+	return mask;
+}
+
+template <typename T>
+void nn::layers::Dropout<T>::forward_mask(const Mat<T> &X, Mat<T> &Y)
+{
+	if (X.rows() != input_shape_.rows)
+		throw std::invalid_argument("invalid argument: the features don't match the layer: " + name_);
+
+	// The bits only grow, the steady state doesn't allocate
+	std::size_t n = X.rows() * X.cols();
+	Mask &mask = masks_.get();
+	if (mask.bits.size() < Mat_dropout_mask_words(n))
+		mask.bits.resize(Mat_dropout_mask_words(n));
+	mask.size = n;
+	mask.input = X.get_mat_raw();
+
+	// Every forward draws from its own range of the stream
+	std::uint64_t counter = counter_.fetch_add(n, std::memory_order_relaxed);
+	MatDispatchOps::Mat_dropout_forward(X.get_mat_raw(), Y.get_mat_raw(), mask.bits.data(), X.get_shape(),
+					    rate_, seed_, counter);
+}
+
+template <typename T>
+Dropout<T> &nn::layers::Dropout<T>::register_funcs(void)
+{
+	register_func<Mat<T>, const Mat<T> &>
+		("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+			if (is_identity())
+				return X;
+			Mat<T> Y(X.get_shape());
+			forward_mask(X, Y);
+			return Y;
+		});
+
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			((void) grads);
+			if (is_identity())
+				return dY;
+
+			const Mask &mask = thread_mask(X);
+			Mat<T> dX(dY.get_shape());
+			MatDispatchOps::Mat_dropout_backward(dY.get_mat_raw(), mask.bits.data(), dX.get_mat_raw(),
+							     dY.get_shape(), rate_);
+			return dX;
+		});
+
+	// Y can be X, then the identity doesn't touch it
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [this](const Mat<T> &X, Mat<T> &Y) -> void {
+			if (!is_identity())
+				forward_mask(X, Y);
+			else if (Y.get_mat_raw() != X.get_mat_raw())
+				MatDispatchOps::Mat_copy(X.get_mat_raw(), Y.get_mat_raw(), X.get_shape());
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [this](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			((void) Y);
+			((void) grads);
+			if (is_identity()) {
+				if (dX.get_mat_raw() != dY.get_mat_raw())
+					MatDispatchOps::Mat_copy(dY.get_mat_raw(), dX.get_mat_raw(), dY.get_shape());
+				return;
+			}
+
+			const Mask &mask = thread_mask(X);
+			MatDispatchOps::Mat_dropout_backward(dY.get_mat_raw(), mask.bits.data(), dX.get_mat_raw(),
+							     dY.get_shape(), rate_);
+		});
+
+	return *this;
+}
+
+template class nn::layers::Dropout<float>;
+// template class nn::layers::Dropout<double>;
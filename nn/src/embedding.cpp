@@ -0,0 +1,278 @@
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+#include "../include/embedding.hpp"
+#include "../include/parallel.hpp"
+
+using namespace nn::mathops;
+using namespace nn::layers;
+
+template <typename T>
+nn::layers::Embedding<T>::Embedding(std::size_t vocab_size, std::size_t dim, std::size_t seq_len,
+				    std::shared_ptr<RandInitializer> rand_init)
+	: WeightedLayer(Shape{seq_len, 1}, Shape{seq_len * dim, 1}, "Embedding", nullptr, rand_init),
+	  vocab_size_(vocab_size), dim_(dim)
+{
+	if (vocab_size == 0 || dim == 0 || seq_len == 0)
+		throw std::invalid_argument("invalid argument: an embedding needs a vocabulary, values and IDs");
+}
+
+template <typename T>
+Mat<T> &nn::layers::Embedding<T>::get_table(void) const
+{
+	if (table_ == nullptr)
+		throw std::invalid_argument("Embedding layer not built yet");
+	return *table_;
+}
+
+template <typename T>
+std::size_t nn::layers::Embedding<T>::get_vocab_size(void) const
+{
+	return vocab_size_;
+}
+
+template <typename T>
+std::size_t nn::layers::Embedding<T>::get_dim(void) const
+{
+	return dim_;
+}
+
+template <typename T>
+std::vector<std::size_t> nn::layers::Embedding<T>::touched_rows(void)
+{
+	std::lock_guard<std::mutex> lock(grads_mutex_);
+	std::vector<std::size_t> rows;
+	std::unordered_set<std::size_t> seen;
+	for (auto &grad : grads_) {
+		std::lock_guard<std::mutex> grad_lock(grad->mutex);
+		for (std::size_t row : grad->rows)
+			if (seen.insert(row).second)
+				rows.push_back(row);
+	}
+	return rows;
+}
+
+template <typename T>
+Embedding<T> &nn::layers::Embedding<T>::build(const Shape &input_shape, const Shape &output_shape)
+{
+	if (input_shape != input_shape_ || output_shape != output_shape_)
+		throw std::invalid_argument("Invalid shapes for the IDs of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+Embedding<T> &nn::layers::Embedding<T>::build(std::size_t input_size, std::size_t output_size)
+{
+	if (input_size != input_shape_.rows || output_size != output_shape_.rows)
+		throw std::invalid_argument("Invalid sizes for the IDs of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+Embedding<T> &nn::layers::Embedding<T>::build(void)
+{
+	table_ = add_weights<T>(Shape{vocab_size_, dim_}, rand_init_);
+	{
+		std::lock_guard<std::mutex> lock(grads_mutex_);
+		grads_.clear();
+	}
+
+	register_funcs();
+	built_ = true;
+	return *this;
+}
+
+template <typename T>
+bool nn::layers::Embedding<T>::has_sparse_gradients(void) const
+{
+	return true;
+}
+
+template <typename T>
+std::size_t nn::layers::Embedding<T>::id(const Mat<T> &X, std::size_t t, std::size_t j) const
+{
+	T value = X.get_mat_raw()[t * X.cols() + j];
+	if (!(value >= 0) || value >= static_cast<T>(vocab_size_) || std::floor(value) != value)
+		throw std::invalid_argument("invalid argument: an ID out of the vocabulary of the layer: " + name_);
+	return static_cast<std::size_t>(value);
+}
+
+template <typename T>
+void nn::layers::Embedding<T>::gather(const Mat<T> &X, Mat<T> &Y) const
+{
+	if (X.rows() != input_shape_.rows)
+		throw std::invalid_argument("invalid argument: the IDs don't match the layer: " + name_);
+
+	// One sample per column: the values of a row go down a column of Y
+	std::size_t b = X.cols();
+	const T *table = table_->get_mat_raw();
+	T *y = Y.get_mat_raw();
+	for (std::size_t t = 0; t < X.rows(); t++) {
+		for (std::size_t j = 0; j < b; j++) {
+			const T *row = table + id(X, t, j) * dim_;
+			T *column = y + t * dim_ * b + j;
+			for (std::size_t d = 0; d < dim_; d++)
+				column[d * b] = row[d];
+		}
+	}
+}
+
+template <typename T>
+T *nn::layers::Embedding<T>::SparseGradient::row(std::size_t id, std::size_t dim)
+{
+	auto [slot, added] = slots.try_emplace(id, rows.size());
+	if (added) {
+		rows.push_back(id);
+		values.resize(values.size() + dim, static_cast<T>(0));
+	}
+	return values.data() + slot->second * dim;
+}
+
+template <typename T>
+void nn::layers::Embedding<T>::SparseGradient::clear(void)
+{
+	rows.clear();
+	slots.clear();
+	values.clear();
+	count = 0;
+}
+
+template <typename T>
+typename Embedding<T>::SparseGradient &nn::layers::Embedding<T>::accumulator(std::size_t w)
+{
+	if (w == parallel::WorkerGroup::npos)
+		w = 0;
+	std::lock_guard<std::mutex> lock(grads_mutex_);
+	while (grads_.size() <= w)
+		grads_.push_back(std::make_unique<SparseGradient>());
+	return *grads_[w];
+}
+
+template <typename T>
+void nn::layers::Embedding<T>::scatter(const Mat<T> &X, const Mat<T> &dY)
+{
+	std::size_t b = X.cols();
+	const T *dy = dY.get_mat_raw();
+	SparseGradient &grad = accumulator(parallel::WorkerGroup::current());
+	std::lock_guard<std::mutex> lock(grad.mutex);
+	for (std::size_t t = 0; t < X.rows(); t++) {
+		for (std::size_t j = 0; j < b; j++) {
+			T *row = grad.row(id(X, t, j), dim_);
+			const T *column = dy + t * dim_ * b + j;
+			for (std::size_t d = 0; d < dim_; d++)
+				row[d] += column[d * b];
+		}
+	}
+	grad.count += b;
+}
+
+template <typename T>
+void nn::layers::Embedding<T>::step_rows(SparseGradient &grad)
+{
+	if (grad.count == 0)
+		return;
+
+	Mat<T> grads(Shape{grad.rows.size(), dim_}, grad.values.data());
+	grads *= static_cast<T>(1) / static_cast<T>(grad.count);
+	optimizer_->apply_rows(*table_, grads, grad.rows);
+	grad.clear();
+}
+
+template <typename T>
+Embedding<T> &nn::layers::Embedding<T>::register_funcs(void)
+{
+	register_func<Mat<T>, const Mat<T> &>
+		("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+			Mat<T> Y(Shape{output_shape_.rows, X.cols()});
+			gather(X, Y);
+			return Y;
+		});
+
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			((void) grads);
+			scatter(X, dY);
+			return Mat<T>(X.get_shape()).fill(static_cast<T>(0));
+		});
+
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [this](const Mat<T> &X, Mat<T> &Y) -> void {
+			gather(X, Y);
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("sparse_parameters", [this]() -> std::vector<Mat<T> *> {
+			return {table_.get()};
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [this](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			((void) Y);
+			((void) grads);
+			scatter(X, dY);
+			dX.fill(static_cast<T>(0));
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("fit", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			scatter(input, signal_update);
+			step();
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("accumulate", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			scatter(input, signal_update);
+		});
+
+	// Only the rows used get a step, the accumulators keep their memory for the next one
+	register_func<void>
+		("step", [this]() -> void {
+			// A Hogwild worker steps alone, with the rows it saw
+			std::size_t w = parallel::WorkerGroup::current();
+			if (w != parallel::WorkerGroup::npos) {
+				SparseGradient &grad = accumulator(w);
+				std::lock_guard<std::mutex> lock(grad.mutex);
+				step_rows(grad);
+				return;
+			}
+
+			// The other workers are added to the worker zero one after the other
+			std::lock_guard<std::mutex> lock(grads_mutex_);
+			if (grads_.empty())
+				return;
+			SparseGradient &total = *grads_[0];
+			std::lock_guard<std::mutex> total_lock(total.mutex);
+			for (std::size_t r = 1; r < grads_.size(); r++) {
+				SparseGradient &grad = *grads_[r];
+				std::lock_guard<std::mutex> grad_lock(grad.mutex);
+				for (std::size_t k = 0; k < grad.rows.size(); k++) {
+					T *row = total.row(grad.rows[k], dim_);
+					const T *values = grad.values.data() + k * dim_;
+					for (std::size_t d = 0; d < dim_; d++)
+						row[d] += values[d];
+				}
+				total.count += grad.count;
+				grad.clear();
+			}
+			step_rows(total);
+		});
+
+	register_func<void>
+		("zero_grad", [this]() -> void {
+			std::lock_guard<std::mutex> lock(grads_mutex_);
+			for (auto &grad : grads_) {
+				std::lock_guard<std::mutex> grad_lock(grad->mutex);
+				grad->clear();
+			}
+		});
+
+	return *this;
+}
+
+template class nn::layers::Embedding<float>;
+// template class nn::layers::Embedding<double>;
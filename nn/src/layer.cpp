@@ -37,6 +37,27 @@ bool nn::layers::Layer::is_built(void)
 	return built_;
 }
 
+Layer &nn::layers::Layer::set_training(bool training)
+{
+	training_ = training;
+	return *this;
+}
+
+bool nn::layers::Layer::is_training(void) const
+{
+	return training_;
+}
+
+bool nn::layers::Layer::is_identity(void) const
+{
+	return false;
+}
+
+bool nn::layers::Layer::has_sparse_gradients(void) const
+{
+	return false;
+}
+
 Layer &nn::layers::Layer::set_input_shape(const Shape &input_shape)
 {
 	input_shape_ = input_shape;
@@ -221,6 +242,75 @@ Mat<T> &nn::layers::Dense<T>::get_bias(void) const
 
 
 
+template <typename T>
+Dense<T> &nn::layers::Dense<T>::bind_weights(T *weights, T *bias, std::shared_ptr<void> storage)
+{
+	if (weights == nullptr || bias == nullptr)
+		throw std::invalid_argument("invalid argument: Can't bind null weights to the layer: " + name_);
+	if (input_shape_.rows == 0 || output_shape_.rows == 0)
+		throw std::invalid_argument("Invalid shape to bind the weights of the layer: " + name_);
+
+	// Shared memory mode of the matrices, they never free this memory. The
+	// matrices are replaced in place, pointers to them (optimizer state) stay valid
+	Mat<T> w(Shape{output_shape_.rows, input_shape_.rows}, weights);
+	Mat<T> b(Shape{output_shape_.rows, 1}, bias);
+	if (weights_ == nullptr || bias_ == nullptr) {
+		weights_ = std::make_unique<Mat<T>>(std::move(w));
+		bias_ = std::make_unique<Mat<T>>(std::move(b));
+	} else {
+		*weights_ = std::move(w);
+		*bias_ = std::move(b);
+	}
+	storage_ = storage;
+	weights_bound_ = true;
+
+	return *this;
+}
+
+template <typename T>
+bool nn::layers::Dense<T>::has_bound_weights(void) const
+{
+	return weights_bound_
+		&& weights_->get_shape() == Shape(output_shape_.rows, input_shape_.rows)
+		&& bias_->get_shape() == Shape(output_shape_.rows, 1);
+}
+
+template <typename T>
+Dense<T> &nn::layers::Dense<T>::alloc_weights(void)
+{
+	// The shapes could have changed, the accumulators are allocated again when used
+	grad_weights_ = nullptr;
+	grad_bias_ = nullptr;
+	grad_count_ = 0;
+
+	// Weights bound with `bind_weights` before building are kept as they are
+	if (has_bound_weights())
+		return *this;
+
+	// TODO: free the previous memory of the weights
+	weights_ = add_weights<T>(Shape{output_shape_.rows, input_shape_.rows}, rand_init_);
+	bias_ = add_weights<T>(output_shape_.rows, rand_init_);
+	storage_ = nullptr;
+	weights_bound_ = false;
+
+	return *this;
+}
+
+template <typename T>
+Dense<T> &nn::layers::Dense<T>::alloc_gradients(void)
+{
+	if (grad_weights_ != nullptr)
+		return *this;
+
+	grad_weights_ = std::make_unique<Mat<T>>(weights_->get_shape());
+	grad_bias_ = std::make_unique<Mat<T>>(bias_->get_shape());
+	grad_weights_->fill(static_cast<T>(0));
+	grad_bias_->fill(static_cast<T>(0));
+	grad_count_ = 0;
+
+	return *this;
+}
+
 template <typename T>
 Dense<T> &nn::layers::Dense<T>::build(const Shape &input_shape, const Shape &output_shape)
 {
@@ -235,18 +325,16 @@ Dense<T> &nn::layers::Dense<T>::build(const Shape &input_shape, const Shape &out
 	input_shape_ = input_shape;
 	output_shape_ = output_shape;
 
-	// TODO: free the previous memory of the weights
-	weights_ = add_weights<T>(Shape{output_shape.rows, input_shape.rows}, rand_init_);
-	bias_ = add_weights<T>(output_shape.rows, rand_init_);
-
-	register_funcs();
+	alloc_weights();
 
-	
 	if (activation_func_ != nullptr) {
 		// TODO: This needs to be verify 
 		activation_func_.get()->build(output_shape, output_shape);
 	}
 
+	// After the activation, its in place functions are captured
+	register_funcs();
+
 	built_ = true;
 	return *this;
 }
@@ -265,17 +353,16 @@ Dense<T> &nn::layers::Dense<T>::build(std::size_t input_size, std::size_t output
 	input_shape_ = Shape{input_size, 1};
 	output_shape_ = Shape{output_size, 1};
 
-	// TODO: free the previous memory of the weights
-	weights_ = add_weights<T>(Shape{output_size, input_size}, rand_init_);
-	bias_ = add_weights<T>(output_size, rand_init_);
+	alloc_weights();
 
-	register_funcs();
-	
 	if (activation_func_ != nullptr) {
 		// TODO: This needs to be verify 
 		activation_func_.get()->build(output_size, output_size);
 	}
 
+	// After the activation, its in place functions are captured
+	register_funcs();
+
 	built_ = true;
 	return *this;
 }
@@ -291,18 +378,16 @@ Dense<T> &nn::layers::Dense<T>::build(void)
 		throw std::invalid_argument("Invalid output shape of the layer: " + name_);
 	}
 
-	// TODO: free the previous memory of the weights
-	weights_ = add_weights<T>(Shape{output_shape_.rows, input_shape_.rows}, rand_init_);
-	bias_ = add_weights<T>(output_shape_.rows, rand_init_);
-
-	register_funcs();
-
+	alloc_weights();
 
 	if (activation_func_ != nullptr) {
 		// TODO: This needs to be verify 
 		activation_func_.get()->build();
 	}
 
+	// After the activation, its in place functions are captured
+	register_funcs();
+
 	built_ = true;
 	return *this;
 }
@@ -313,14 +398,15 @@ Dense<T> &nn::layers::Dense<T>::register_funcs(void)
 	// Register the functions
 	register_func<Mat<T>, const Mat<T> &>
 		("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+			// W . X + B, the bias is added to every column of a batch
+			Mat<T> Z = weights_->dot(X);
+			Z.add_colvec(*bias_);
 			if (activation_func_ != nullptr) {
 				// f(W . X + B), where 'f' is an activation function
-				Mat<T> Z = weights_->dot(X) + *bias_;
 				return (*activation_func_)(Z);
 			}
 			
-			// W . X + B
-			return weights_->dot(X) + *bias_;
+			return Z;
 		});
 
 	register_func<Mat<T>, const Mat<T> &>
@@ -365,6 +451,147 @@ Dense<T> &nn::layers::Dense<T>::register_funcs(void)
 			optimizer_.get()->update(*weights_, signal_update, input);
 			optimizer_.get()->update(*bias_, signal_update);
 		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("accumulate", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			alloc_gradients();
+			grad_weights_->add_dot_transposed(signal_update, input);
+			grad_bias_->add_row_sum(signal_update);
+			grad_count_ += input.cols();
+		});
+
+	register_func<void>
+		("step", [this]() -> void {
+			if (grad_count_ == 0)
+				return;
+
+			T scale = static_cast<T>(1) / static_cast<T>(grad_count_);
+			*grad_weights_ *= scale;
+			*grad_bias_ *= scale;
+			optimizer_->apply(*weights_, *grad_weights_);
+			optimizer_->apply(*bias_, *grad_bias_);
+
+			grad_weights_->fill(static_cast<T>(0));
+			grad_bias_->fill(static_cast<T>(0));
+			grad_count_ = 0;
+		});
+
+	register_func<void>
+		("zero_grad", [this]() -> void {
+			if (grad_weights_ == nullptr)
+				return;
+			grad_weights_->fill(static_cast<T>(0));
+			grad_bias_->fill(static_cast<T>(0));
+			grad_count_ = 0;
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("gradients", [this]() -> std::vector<Mat<T> *> {
+			alloc_gradients();
+			return {grad_weights_.get(), grad_bias_.get()};
+		});
+
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			// X ~ (n, b), dY ~ (m, b)
+			// dL/dZ = f'(Z) * dL/dY
+			// dL/dW += dL/dZ . X^T	~ (m, n)
+			// dL/dB += dL/dZ . 1_b	~ (m, 1)
+			// dL/dX = W^T . dL/dZ	~ (n, b)
+			if (activation_func_ != nullptr) {
+				Mat<T> Z = weights_->dot(X);
+				Z.add_colvec(*bias_);
+				Mat<T> dZ = activation_func_->backward(Z, dY, static_cast<Mat<T> *>(nullptr));
+				return backward_logits<T>(X, dZ, grads);
+			}
+
+			return backward_logits<T>(X, dY, grads);
+		});
+
+	register_func<Mat<T>, const Mat<T> &>
+		("logits", [this](const Mat<T> &X) -> Mat<T> {
+			// Z = W . X + B, one sample per column
+			Mat<T> Z = weights_->dot(X);
+			Z.add_colvec(*bias_);
+			return Z;
+		});
+
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward_logits", [this](const Mat<T> &X, const Mat<T> &dZ, Mat<T> *grads) -> Mat<T> {
+			grads[0].add_dot_transposed(dZ, X);
+			grads[1].add_row_sum(dZ);
+			return weights_->transpose_dot(dZ);
+		});
+
+	// The in place functions of the activation are looked up once, not on every call
+	ForwardInto<T> activation_forward;
+	BackwardInto<T> activation_backward;
+	if (activation_func_ != nullptr && activation_func_->can_run_into<T>()) {
+		activation_forward = activation_func_->get_forward_into<T>();
+		activation_backward = activation_func_->get_backward_into<T>();
+	}
+
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [this, activation_forward](const Mat<T> &X, Mat<T> &Y) -> void {
+			// Z = W . X + B straight into Y, then the activation over it
+			MatDispatchOps::Mat_dot(weights_->get_mat_raw(), X.get_mat_raw(), Y.get_mat_raw(),
+						weights_->get_shape(), X.cols());
+			MatDispatchOps::Mat_add_colvec(Y.get_mat_raw(), bias_->get_mat_raw(), Y.get_shape());
+			if (activation_forward)
+				activation_forward(Y, Y);
+			else if (activation_func_ != nullptr)
+				Y = (*activation_func_)(Y);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [this, activation_backward](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			// dL/dZ over dY, Z isn't kept and the activation differentiates from its output
+			if (activation_backward) {
+				activation_backward(Y, Y, dY, dY, nullptr);
+			} else if (activation_func_ != nullptr) {
+				Mat<T> Z = weights_->dot(X);
+				Z.add_colvec(*bias_);
+				dY = activation_func_->backward(Z, dY, static_cast<Mat<T> *>(nullptr));
+			}
+
+			if (grads != nullptr) {
+				MatDispatchOps::Mat_dot_nt_acc(dY.get_mat_raw(), X.get_mat_raw(), grads[0].get_mat_raw(),
+							       dY.get_shape(), X.rows());
+				MatDispatchOps::Mat_add_row_sum(dY.get_mat_raw(), grads[1].get_mat_raw(), dY.get_shape());
+			}
+			MatDispatchOps::Mat_dot_tn(weights_->get_mat_raw(), dY.get_mat_raw(), dX.get_mat_raw(),
+						   weights_->get_shape(), dY.cols());
+		});
+
+	register_func<autodiff::Var, autodiff::Tape<T> &, autodiff::Var, Mat<T> *>
+		("record", [this](autodiff::Tape<T> &tape, autodiff::Var X, Mat<T> *grads) -> autodiff::Var {
+			// Z = W . X + B
+			autodiff::Var Z = tape.add_colvec(tape.dot(tape.parameter(*weights_, grads[0]), X),
+							  tape.parameter(*bias_, grads[1]));
+			if (activation_func_ == nullptr)
+				return Z;
+			if (activation_func_->can_record<T>())
+				return activation_func_->record<T>(tape, Z, nullptr);
+
+			// Any other activation goes through its own backward
+			std::shared_ptr<Layer> activation = activation_func_;
+			return tape.custom((*activation)(tape.value(Z)), {Z},
+					   [activation, Z](autodiff::Tape<T> &tape, const Mat<T> &g) {
+						   tape.accumulate(Z, activation->backward<T>(tape.value(Z), g, nullptr));
+					   }, {Z});
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("parameters", [this]() -> std::vector<Mat<T> *> {
+			return {weights_.get(), bias_.get()};
+		});
+
+	register_func<void, const std::vector<T *> &>
+		("bind_parameters", [this](const std::vector<T *> &memory) -> void {
+			if (memory.size() != 2)
+				throw std::invalid_argument("invalid argument: a Dense layer binds two matrices");
+			bind_weights(memory[0], memory[1]);
+		});
 	
 	return *this;
 }
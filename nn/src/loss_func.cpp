@@ -1,4 +1,5 @@
 #include "../include/loss_func.hpp"
+#include "../include/data_loader.hpp"
 #include <cstddef>
 #include <stdexcept>
 #include <algorithm>
@@ -16,7 +17,9 @@ Loss<T>::Loss(std::shared_ptr<std::vector<Mat<T>>> inputs,
 	: inputs_(inputs),
 	  outputs_(outputs),
 	  model_(),  // Default construct weak_ptr (empty state)
-	  name_(std::move(name))
+	  name_(std::move(name)),
+	  keep_predictions_(true),
+	  batch_size_(256)
 {
 	if (inputs_ != nullptr && outputs_ != nullptr) {
 		if (inputs_->size() != outputs_->size())
@@ -66,6 +69,24 @@ Loss<T> &Loss<T>::set_outputs(std::shared_ptr<std::vector<Mat<T>>> outputs)
 	return *this;
 }
 
+template <typename T>
+Loss<T> &Loss<T>::set_keep_predictions(bool keep)
+{
+	keep_predictions_ = keep;
+	if (!keep_predictions_)
+		predictions_ = std::vector<Mat<T>>();
+	return *this;
+}
+
+template <typename T>
+Loss<T> &Loss<T>::set_batch_size(std::size_t batch_size)
+{
+	if (batch_size == 0)
+		throw std::invalid_argument("invalid argument: the evaluation batch size must be at least one");
+	batch_size_ = batch_size;
+	return *this;
+}
+
 // --------------------- GETTERS ---------------------
 
 template <typename T>
@@ -92,6 +113,18 @@ const std::string &Loss<T>::get_name(void) const
 	return name_;
 }
 
+template <typename T>
+bool Loss<T>::get_keep_predictions(void) const
+{
+	return keep_predictions_;
+}
+
+template <typename T>
+std::size_t Loss<T>::get_batch_size(void) const
+{
+	return batch_size_;
+}
+
 template <typename T>
 const Shape &Loss<T>::get_input_shape(void) const
 {
@@ -160,6 +193,88 @@ Mat<T> Loss<T>::gradient(void)
 	return grad;
 }
 
+template <typename T>
+const Mat<T> &Loss<T>::evaluate(void)
+{
+	auto model_ptr = this->model_.lock();
+	if (!model_ptr)
+		throw std::runtime_error("Model pointer not set in Loss function.");
+	if (!inputs_ || !outputs_)
+		throw std::runtime_error("Not set input and output");
+
+	std::size_t nsamples = inputs_->size();
+	predictions_.clear();
+	if (keep_predictions_)
+		predictions_.reserve(nsamples);
+	last_loss_.resize(output_shape_).fill(static_cast<T>(0.0));
+
+	// Matrix samples can't be stacked, they run one by one as flat columns
+	if (input_shape_.cols != 1 || output_shape_.cols != 1) {
+		std::size_t size = output_shape_.rows * output_shape_.cols;
+		Mat<T> sums(Shape(size, 1), last_loss_.get_mat_raw());
+		for (std::size_t i = 0; i < nsamples; i++) {
+			Mat<T> y_pred = (*model_ptr)((*inputs_)[i]);
+			accumulate_loss(Mat<T>(Shape(size, 1), y_pred.get_mat_raw()),
+					Mat<T>(Shape(size, 1), (*outputs_)[i].get_mat_raw()), sums);
+			if (keep_predictions_)
+				predictions_.push_back(std::move(y_pred));
+		}
+		return last_loss_;
+	}
+
+	std::size_t batch = std::min(batch_size_, nsamples);
+	Mat<T> X(input_shape_.rows, batch);
+	Mat<T> Y(output_shape_.rows, batch);
+	for (std::size_t first = 0; first < nsamples; first += batch) {
+		std::size_t count = std::min(batch, nsamples - first);
+		// Only the last batch can be smaller
+		if (count != X.cols()) {
+			X = Mat<T>(input_shape_.rows, count);
+			Y = Mat<T>(output_shape_.rows, count);
+		}
+		data::pack_columns(*inputs_, first, count, X);
+		data::pack_columns(*outputs_, first, count, Y);
+
+		Mat<T> y_pred = (*model_ptr)(X);
+		accumulate_loss(y_pred, Y, last_loss_);
+
+		if (keep_predictions_) {
+			for (std::size_t j = 0; j < count; j++) {
+				Mat<T> p(y_pred.rows(), 1);
+				for (std::size_t i = 0; i < y_pred.rows(); i++)
+					p(i, 0) = y_pred(i, j);
+				predictions_.push_back(std::move(p));
+			}
+		}
+	}
+
+	return last_loss_;
+}
+
+template <typename T>
+void Loss<T>::accumulate_loss(const Mat<T> &y_pred, const Mat<T> &y_true, Mat<T> &sums) const
+{
+	((void) y_pred);
+	((void) y_true);
+	((void) sums);
+	throw std::logic_error("The loss can't be evaluated in batches: " + name_);
+}
+
+template <typename T>
+std::string Loss<T>::fused_activation(void) const
+{
+	return "";
+}
+
+template <typename T>
+Mat<T> Loss<T>::gradient_logits(const Mat<T> &Z, const Mat<T> &y_true, T *loss) const
+{
+	((void) Z);
+	((void) y_true);
+	((void) loss);
+	throw std::logic_error("The loss can't be fused with an activation: " + name_);
+}
+
 // Explicit template instantiation for Loss
 template class nn::loss_funcs::Loss<float>;
 // template class Loss<double>;
@@ -179,27 +294,19 @@ MeanAbsoluteError<T>::MeanAbsoluteError(std::shared_ptr<std::vector<Mat<T>>> inp
 template <typename T>
 Mat<T> MeanAbsoluteError<T>::operator()(void)
 {
-	auto model_ptr = this->model_.lock();
-	if (!model_ptr)
-		throw std::runtime_error("Model pointer not set in Loss function.");
-	
-	this->predictions_.clear();
-	this->last_loss_.resize(this->output_shape_).fill(static_cast<T>(0.0));
-
-	for (std::size_t i = 0; i < this->inputs_->size(); ++i) {
-		Mat<T> y_pred = (*model_ptr)((*this->inputs_)[i]);
-		this->predictions_.push_back(y_pred);
-
-		Mat<T> diff = y_pred - (*this->outputs_)[i];
-		for (std::size_t r = 0; r < y_pred.rows(); ++r)
-			for (std::size_t c = 0; c < y_pred.cols(); ++c)
-				this->last_loss_(r, c) += std::abs(diff(r, c));
-	}
-
+	this->evaluate();
 	this->last_loss_ /= static_cast<T>(this->inputs_->size());
 	return this->last_loss_;
 }
 
+template <typename T>
+void MeanAbsoluteError<T>::accumulate_loss(const Mat<T> &y_pred, const Mat<T> &y_true, Mat<T> &sums) const
+{
+	if (y_pred.get_shape() != y_true.get_shape())
+		throw std::invalid_argument("Predictions and outputs are not of the same shape");
+	MatDispatchOps::Mat_abs_error_rows(y_pred.get_mat_raw(), y_true.get_mat_raw(), sums.get_mat_raw(), y_pred.get_shape());
+}
+
 // Evaluate MAE on a batch
 template <typename T>
 Mat<T> MeanAbsoluteError<T>::operator()(const std::vector<std::pair<Mat<T>, Mat<T>>> &batch)
@@ -270,6 +377,21 @@ Mat<T> MeanAbsoluteError<T>::gradient(const std::pair<Mat<T>, Mat<T>> &example)
 	return grad;
 }
 
+template <typename T>
+Mat<T> MeanAbsoluteError<T>::gradient(const Mat<T> &y_pred, const Mat<T> &y_true) const
+{
+	if (y_pred.get_shape() != y_true.get_shape())
+		throw std::invalid_argument("Predictions and outputs are not of the same shape");
+
+	Mat<T> grad(y_pred.get_shape());
+	for (std::size_t r = 0; r < y_pred.rows(); ++r)
+		for (std::size_t c = 0; c < y_pred.cols(); ++c) {
+			T val = y_pred(r, c) - y_true(r, c);
+			grad(r, c) = (val > 0) ? 1 : ((val < 0) ? -1 : 0);
+		}
+
+	return grad;
+}
 
 // jacobian
 template <typename T>
@@ -316,33 +438,15 @@ CrossEntropy<T>::CrossEntropy(std::shared_ptr<std::vector<Mat<T>>> inputs,
 template <typename T>
 Mat<T> CrossEntropy<T>::operator()(void)
 {
-	auto model_ptr = this->model_.lock();
-	if (!model_ptr)
-		throw std::runtime_error("Model pointer not set in Loss function.");
-		
-	this->predictions_.clear();
-	this->last_loss_.resize(this->output_shape_).fill(static_cast<T>(0.0));
-
-	// sum_{i = 1}^n - [y_i * log(s(x_i^T * \theta)) + (1 - y_i) * log(1 - s(1 - s(x_i^T * \theta)))]
-	for (std::size_t i = 0; i < this->inputs_->size(); i++) {
-		Mat<T> y_pred = (*model_ptr)((*this->inputs_)[i]);
-		this->predictions_.push_back(y_pred);
-
-		// Compute the log
-		Mat<T> term1(y_pred.rows(), 1);
-		Mat<T> term2(y_pred.rows(), 1);
-		
-		for (std::size_t i = 0; i < y_pred.rows(); i++) {
-			term1(i, 0) = std::log(y_pred(i, 0) + 1e-8);
-			term2(i, 0) = std::log(1 - y_pred(i, 0) + 1e-8);
-		}
-
-		// Create ones 
-		Mat<T> ones = Mat<T>(y_pred.rows(), 1).fill(static_cast<T>(1.0));
-		this->last_loss_ += ((*this->outputs_)[i] * term1 + ((*this->outputs_)[i] * (-1) + ones) * term2) * (-1);
-	}
+	return this->evaluate();
+}
 
-	return this->last_loss_;
+template <typename T>
+void CrossEntropy<T>::accumulate_loss(const Mat<T> &y_pred, const Mat<T> &y_true, Mat<T> &sums) const
+{
+	if (y_pred.get_shape() != y_true.get_shape())
+		throw std::invalid_argument("Predictions and outputs are not of the same shape");
+	MatDispatchOps::Mat_binary_cross_entropy_rows(y_pred.get_mat_raw(), y_true.get_mat_raw(), sums.get_mat_raw(), y_pred.get_shape());
 }
 
 
@@ -431,6 +535,21 @@ Mat<T> CrossEntropy<T>::gradient(const std::pair<Mat<T>, Mat<T>> &example)
 }
 
 
+template <typename T>
+Mat<T> CrossEntropy<T>::gradient(const Mat<T> &y_pred, const Mat<T> &y_true) const
+{
+	if (y_pred.get_shape() != y_true.get_shape())
+		throw std::invalid_argument("Predictions and outputs are not of the same shape");
+
+	// dL/da = (a - y)/(a * (1 - a))
+	Mat<T> grad(y_pred.get_shape());
+	for (std::size_t r = 0; r < y_pred.rows(); ++r)
+		for (std::size_t c = 0; c < y_pred.cols(); ++c)
+			grad(r, c) = (y_pred(r, c) - y_true(r, c)) / ((y_pred(r, c) + 1e-8) * (1 - y_pred(r, c) + 1e-8));
+
+	return grad;
+}
+
 template <typename T>
 Mat<T> CrossEntropy<T>::jacobian(const std::pair<Mat<T>, Mat<T>> &example)
 {
@@ -456,18 +575,78 @@ template class nn::loss_funcs::CrossEntropy<float>;
 // template class nn::loss_funcs::CrossEntropy<double>;
 
 
-// ===================== MEAN SQUARED ERROR IMPLEMENTATION =====================
+// ===================== Sigmoid Cross Entropy IMPLEMENTATION =====================
 
 template <typename T>
-MeanSquaredError<T>::MeanSquaredError(std::shared_ptr<std::vector<Mat<T>>> inputs,
-                                      std::shared_ptr<std::vector<Mat<T>>> outputs)
-    : Loss<T>(inputs, outputs, "MeanSquaredError")
+SigmoidCrossEntropy<T>::SigmoidCrossEntropy(std::shared_ptr<std::vector<Mat<T>>> inputs,
+					    std::shared_ptr<std::vector<Mat<T>>> outputs)
+	: CrossEntropy<T>(inputs, outputs)
 {
+	this->set_name("SigmoidCrossEntropy");
 }
 
-// Evaluate MSE on all stored inputs/outputs
 template <typename T>
-Mat<T> MeanSquaredError<T>::operator()(void)
+std::string SigmoidCrossEntropy<T>::fused_activation(void) const
+{
+	return "SigmoidFunc";
+}
+
+template <typename T>
+Mat<T> SigmoidCrossEntropy<T>::gradient_logits(const Mat<T> &Z, const Mat<T> &y_true, T *loss) const
+{
+	if (Z.get_shape() != y_true.get_shape())
+		throw std::invalid_argument("Logits and outputs are not of the same shape");
+
+	// dL/dz = s(z) - y, the loss comes from the same pass
+	Mat<T> grad(Z.get_shape());
+	T sum = MatDispatchOps::Mat_sigmoid_cross_entropy(Z.get_mat_raw(), y_true.get_mat_raw(), grad.get_mat_raw(),
+							  Z.rows() * Z.cols());
+	if (loss != nullptr)
+		*loss = sum;
+
+	return grad;
+}
+
+template class nn::loss_funcs::SigmoidCrossEntropy<float>;
+// template class nn::loss_funcs::SigmoidCrossEntropy<double>;
+
+
+// ===================== Softmax Cross Entropy IMPLEMENTATION =====================
+
+template <typename T>
+SoftmaxCrossEntropy<T>::SoftmaxCrossEntropy(std::shared_ptr<std::vector<Mat<T>>> inputs,
+					    std::shared_ptr<std::vector<Mat<T>>> outputs)
+	: Loss<T>(inputs, outputs, "SoftmaxCrossEntropy")
+{
+}
+
+/* -y * log(p) of every class, the loss of one prediction */
+template <typename T>
+static Mat<T> categorical_cross_entropy(const Mat<T> &y_pred, const Mat<T> &y_true)
+{
+	Mat<T> loss(y_pred.get_shape());
+	for (std::size_t r = 0; r < y_pred.rows(); ++r)
+		for (std::size_t c = 0; c < y_pred.cols(); ++c)
+			loss(r, c) = -y_true(r, c) * std::log(y_pred(r, c) + 1e-8);
+	return loss;
+}
+
+template <typename T>
+Mat<T> SoftmaxCrossEntropy<T>::operator()(void)
+{
+	return this->evaluate();
+}
+
+template <typename T>
+void SoftmaxCrossEntropy<T>::accumulate_loss(const Mat<T> &y_pred, const Mat<T> &y_true, Mat<T> &sums) const
+{
+	if (y_pred.get_shape() != y_true.get_shape())
+		throw std::invalid_argument("Predictions and outputs are not of the same shape");
+	MatDispatchOps::Mat_categorical_cross_entropy_rows(y_pred.get_mat_raw(), y_true.get_mat_raw(), sums.get_mat_raw(), y_pred.get_shape());
+}
+
+template <typename T>
+Mat<T> SoftmaxCrossEntropy<T>::operator()(const std::vector<std::pair<Mat<T>, Mat<T>>> &batch)
 {
 	auto model_ptr = this->model_.lock();
 	if (!model_ptr)
@@ -475,21 +654,127 @@ Mat<T> MeanSquaredError<T>::operator()(void)
 
 	this->predictions_.clear();
 	this->last_loss_.resize(this->output_shape_).fill(static_cast<T>(0.0));
-
-	for (std::size_t i = 0; i < this->inputs_->size(); ++i) {
-		Mat<T> y_pred = (*model_ptr)((*this->inputs_)[i]);
+	for (const auto &ex : batch) {
+		const auto &[x, y_true] = ex;
+		Mat<T> y_pred = (*model_ptr)(x);
 		this->predictions_.push_back(y_pred);
-
-		Mat<T> diff = y_pred - (*this->outputs_)[i];
-		for (std::size_t r = 0; r < y_pred.rows(); ++r)
-			for (std::size_t c = 0; c < y_pred.cols(); ++c)
-				this->last_loss_(r, c) += diff(r, c) * diff(r, c);
+		this->last_loss_ += categorical_cross_entropy(y_pred, y_true);
 	}
 
+	return this->last_loss_;
+}
+
+template <typename T>
+Mat<T> SoftmaxCrossEntropy<T>::operator()(const std::pair<Mat<T>, Mat<T>> &example)
+{
+	auto model_ptr = this->model_.lock();
+	if (!model_ptr)
+		throw std::runtime_error("Model pointer not set in Loss function.");
+
+	const auto &[x, y_true] = example;
+	Mat<T> y_pred = (*model_ptr)(x);
+	this->predictions_.clear();
+	this->predictions_.push_back(y_pred);
+	this->last_loss_ = categorical_cross_entropy(y_pred, y_true);
+
+	return this->last_loss_;
+}
+
+template <typename T>
+Mat<T> SoftmaxCrossEntropy<T>::gradient(const std::pair<Mat<T>, Mat<T>> &example)
+{
+	auto model_ptr = this->model_.lock();
+	if (!model_ptr)
+		throw std::runtime_error("Model pointer not set in Loss function.");
+
+	const auto &[x, y_true] = example;
+	return gradient((*model_ptr)(x), y_true);
+}
+
+template <typename T>
+Mat<T> SoftmaxCrossEntropy<T>::gradient(const Mat<T> &y_pred, const Mat<T> &y_true) const
+{
+	if (y_pred.get_shape() != y_true.get_shape())
+		throw std::invalid_argument("Predictions and outputs are not of the same shape");
+
+	// dL/dp = -y / p, only used when the softmax isn't fused
+	Mat<T> grad(y_pred.get_shape());
+	for (std::size_t r = 0; r < y_pred.rows(); ++r)
+		for (std::size_t c = 0; c < y_pred.cols(); ++c)
+			grad(r, c) = -y_true(r, c) / (y_pred(r, c) + 1e-8);
+
+	return grad;
+}
+
+template <typename T>
+Mat<T> SoftmaxCrossEntropy<T>::jacobian(const std::pair<Mat<T>, Mat<T>> &example)
+{
+	auto model_ptr = this->model_.lock();
+	if (!model_ptr)
+		throw std::runtime_error("Model pointer not set in Loss function.");
+
+	const auto &[x, y_true] = example;
+	Mat<T> y_pred = (*model_ptr)(x);
+
+	Mat<T> jaco(this->output_shape_.rows, this->input_shape_.rows);
+	jaco.fill(static_cast<T>(0.0));
+	for (std::size_t i = 0; i < this->output_shape_.rows; i++)
+		jaco(i, i) = -y_true(i, 0) / (y_pred(i, 0) + 1e-8);
+	return jaco;
+}
+
+template <typename T>
+std::string SoftmaxCrossEntropy<T>::fused_activation(void) const
+{
+	return "SoftmaxFunc";
+}
+
+template <typename T>
+Mat<T> SoftmaxCrossEntropy<T>::gradient_logits(const Mat<T> &Z, const Mat<T> &y_true, T *loss) const
+{
+	if (Z.get_shape() != y_true.get_shape())
+		throw std::invalid_argument("Logits and outputs are not of the same shape");
+
+	// dL/dz = softmax(z) - y, the log-softmax loss comes from the same pass
+	Mat<T> grad(Z.get_shape());
+	T sum = MatDispatchOps::Mat_softmax_cross_entropy(Z.get_mat_raw(), y_true.get_mat_raw(), grad.get_mat_raw(),
+							  Z.get_shape());
+	if (loss != nullptr)
+		*loss = sum;
+
+	return grad;
+}
+
+template class nn::loss_funcs::SoftmaxCrossEntropy<float>;
+// template class nn::loss_funcs::SoftmaxCrossEntropy<double>;
+
+
+// ===================== MEAN SQUARED ERROR IMPLEMENTATION =====================
+
+template <typename T>
+MeanSquaredError<T>::MeanSquaredError(std::shared_ptr<std::vector<Mat<T>>> inputs,
+                                      std::shared_ptr<std::vector<Mat<T>>> outputs)
+    : Loss<T>(inputs, outputs, "MeanSquaredError")
+{
+}
+
+// Evaluate MSE on all stored inputs/outputs
+template <typename T>
+Mat<T> MeanSquaredError<T>::operator()(void)
+{
+	this->evaluate();
 	this->last_loss_ /= static_cast<T>(this->inputs_->size());
 	return this->last_loss_;
 }
 
+template <typename T>
+void MeanSquaredError<T>::accumulate_loss(const Mat<T> &y_pred, const Mat<T> &y_true, Mat<T> &sums) const
+{
+	if (y_pred.get_shape() != y_true.get_shape())
+		throw std::invalid_argument("Predictions and outputs are not of the same shape");
+	MatDispatchOps::Mat_squared_error_rows(y_pred.get_mat_raw(), y_true.get_mat_raw(), sums.get_mat_raw(), y_pred.get_shape());
+}
+
 // Evaluate MSE on a batch
 template <typename T>
 Mat<T> MeanSquaredError<T>::operator()(const std::vector<std::pair<Mat<T>, Mat<T>>> &batch)
@@ -560,6 +845,20 @@ Mat<T> MeanSquaredError<T>::gradient(const std::pair<Mat<T>, Mat<T>> &example)
 	return grad;
 }
 
+template <typename T>
+Mat<T> MeanSquaredError<T>::gradient(const Mat<T> &y_pred, const Mat<T> &y_true) const
+{
+	if (y_pred.get_shape() != y_true.get_shape())
+		throw std::invalid_argument("Predictions and outputs are not of the same shape");
+
+	Mat<T> grad(y_pred.get_shape());
+	for (std::size_t r = 0; r < y_pred.rows(); ++r)
+		for (std::size_t c = 0; c < y_pred.cols(); ++c)
+			grad(r, c) = 2 * (y_pred(r, c) - y_true(r, c));
+
+	return grad;
+}
+
 // Jacobian of MSE (diagonal)
 template <typename T>
 Mat<T> MeanSquaredError<T>::jacobian(const std::pair<Mat<T>, Mat<T>> &example)
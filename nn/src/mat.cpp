@@ -163,9 +163,20 @@ void nn::mathops::Mat<T>::operator=(const Mat<T> &A)
 
 	if (!mat_shared_mem_) delete[] mat_;
 	mat_ = new_mat;
+	mat_shared_mem_ = false;
 	shape_ = A.shape_;
 }
 
+template<typename T>
+Mat<T> &nn::mathops::Mat<T>::assign(const Mat<T> &A)
+{
+	if (shape_ != A.shape_)
+		throw std::invalid_argument("invalid argument: Matrices of different shapes");
+	if (this != &A)
+		Mat_copy(A.mat_, mat_, shape_);
+	return *this;
+}
+
 template <typename T>
 Mat<T> nn::mathops::Mat<T>::dot(const Mat<T> &A) const
 {
@@ -317,6 +328,75 @@ Mat<T> &nn::mathops::Mat<T>::operator/=(const Mat<T> &A)
 	return *this;
 }
 
+template <typename T>
+Mat<T> &nn::mathops::Mat<T>::axpy(T a, const Mat<T> &A)
+{
+	if (mat_ == NULL)
+		throw std::invalid_argument("invalid argument: Empty Matrix `this`");
+	if (A.get_mat_raw() == NULL)
+		throw std::invalid_argument("invalid argument: Empty Matrix `A`");
+	if (A.get_shape() != shape_)
+		throw std::invalid_argument("invalid argument: invalid structure `this.shape` != `A.shape`");
+	Mat_axpy(A.get_mat_raw(), mat_, shape_, a);
+	return *this;
+}
+
+template <typename T>
+Mat<T> &nn::mathops::Mat<T>::add_colvec(const Mat<T> &v)
+{
+	if (mat_ == NULL)
+		throw std::invalid_argument("invalid argument: Empty Matrix `this`");
+	if (v.get_mat_raw() == NULL)
+		throw std::invalid_argument("invalid argument: Empty Matrix `v`");
+	if (v.get_shape() != Shape(shape_.rows, 1))
+		throw std::invalid_argument("invalid argument: `v` must be a column vector of rows(this)");
+	Mat_add_colvec(mat_, v.get_mat_raw(), shape_);
+	return *this;
+}
+
+template <typename T>
+Mat<T> &nn::mathops::Mat<T>::add_row_sum(const Mat<T> &A)
+{
+	if (mat_ == NULL)
+		throw std::invalid_argument("invalid argument: Empty Matrix `this`");
+	if (A.get_mat_raw() == NULL)
+		throw std::invalid_argument("invalid argument: Empty Matrix `A`");
+	if (shape_ != Shape(A.rows(), 1))
+		throw std::invalid_argument("invalid argument: `this` must be a column vector of rows(A)");
+	Mat_add_row_sum(A.get_mat_raw(), mat_, A.get_shape());
+	return *this;
+}
+
+template <typename T>
+Mat<T> &nn::mathops::Mat<T>::add_dot_transposed(const Mat<T> &A, const Mat<T> &B)
+{
+	if (mat_ == NULL)
+		throw std::invalid_argument("invalid argument: Empty Matrix `this`");
+	if (A.get_mat_raw() == NULL || B.get_mat_raw() == NULL)
+		throw std::invalid_argument("invalid argument: Empty Matrix `A` or `B`");
+	if (A.cols() != B.cols())
+		throw std::invalid_argument("invalid argument: cols(A) != cols(B)");
+	if (shape_ != Shape(A.rows(), B.rows()))
+		throw std::invalid_argument("invalid argument: invalid structure `this.shape` != (rows(A), rows(B))");
+	Mat_dot_nt_acc(A.get_mat_raw(), B.get_mat_raw(), mat_, A.get_shape(), B.rows());
+	return *this;
+}
+
+template <typename T>
+Mat<T> nn::mathops::Mat<T>::transpose_dot(const Mat<T> &A) const
+{
+	if (mat_ == NULL)
+		throw std::invalid_argument("invalid argument: Empty Matrix `this`");
+	if (A.get_mat_raw() == NULL)
+		throw std::invalid_argument("invalid argument: Empty Matrix `A`");
+	if (shape_.rows != A.rows())
+		throw std::invalid_argument("invalid argument: rows(this) != rows(A)");
+
+	Mat<T> C(shape_.cols, A.cols());
+	Mat_dot_tn(mat_, A.get_mat_raw(), C.get_mat_raw(), shape_, A.cols());
+	return C;
+}
+
 template <typename T>
 bool nn::mathops::Mat<T>::operator==(const Mat<T> &A) const
 {
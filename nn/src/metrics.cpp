@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "../include/metrics.hpp"
+
+using namespace nn::metrics;
+
+template <typename T>
+nn::metrics::Metrics<T>::Metrics(T threshold, std::size_t nbins)
+	: threshold_(threshold), nbins_(nbins), nclasses_(0), nsamples_(0), correct_(0), loss_(0.0)
+{
+	if (nbins_ == 0)
+		throw std::invalid_argument("invalid argument: the AUC needs at least one bin");
+}
+
+template <typename T>
+Metrics<T> &nn::metrics::Metrics<T>::update(const Mat<T> &y_pred, const Mat<T> &y_true, T loss)
+{
+	if (y_pred.get_shape() != y_true.get_shape())
+		throw std::invalid_argument("invalid argument: predictions and targets are not of the same shape");
+	if (nclasses_ != 0 && y_pred.rows() != nclasses_)
+		throw std::invalid_argument("invalid argument: the batch has a different number of outputs");
+
+	if (nclasses_ == 0) {
+		nclasses_ = y_pred.rows();
+		true_positives_.assign(nclasses_, 0);
+		false_positives_.assign(nclasses_, 0);
+		false_negatives_.assign(nclasses_, 0);
+		positives_.assign(nclasses_ * nbins_, 0);
+		negatives_.assign(nclasses_ * nbins_, 0);
+	}
+
+	std::size_t ncols = y_pred.cols();
+	const T *P = y_pred.get_mat_raw();
+	const T *Y = y_true.get_mat_raw();
+	for (std::size_t j = 0; j < ncols; j++) {
+		std::size_t predicted, expected;
+		if (nclasses_ == 1) {
+			predicted = P[j] > threshold_ ? 0 : 1;
+			expected = Y[j] > static_cast<T>(0.5) ? 0 : 1;
+		} else {
+			predicted = expected = 0;
+			for (std::size_t i = 1; i < nclasses_; i++) {
+				if (P[i * ncols + j] > P[predicted * ncols + j])
+					predicted = i;
+				if (Y[i * ncols + j] > Y[expected * ncols + j])
+					expected = i;
+			}
+		}
+
+		// With one output the class 1 is the implicit negative one, it has no counters
+		correct_ += predicted == expected;
+		if (predicted == expected && predicted < nclasses_) {
+			true_positives_[predicted]++;
+		} else {
+			if (predicted < nclasses_)
+				false_positives_[predicted]++;
+			if (expected < nclasses_)
+				false_negatives_[expected]++;
+		}
+
+		for (std::size_t c = 0; c < nclasses_; c++) {
+			std::size_t b = c * nbins_ + bin(P[c * ncols + j]);
+			if (c == expected)
+				positives_[b]++;
+			else
+				negatives_[b]++;
+		}
+	}
+
+	nsamples_ += ncols;
+	loss_ += loss;
+	return *this;
+}
+
+template <typename T>
+Metrics<T> &nn::metrics::Metrics<T>::merge(const Metrics &other)
+{
+	if (threshold_ != other.threshold_ || nbins_ != other.nbins_)
+		throw std::invalid_argument("invalid argument: metrics with different thresholds or bins can't be merged");
+	if (other.nclasses_ == 0)
+		return *this;
+	if (nclasses_ == 0) {
+		*this = other;
+		return *this;
+	}
+	if (nclasses_ != other.nclasses_)
+		throw std::invalid_argument("invalid argument: metrics of a different number of outputs can't be merged");
+
+	auto add = [](std::vector<std::uint64_t> &a, const std::vector<std::uint64_t> &b) {
+		for (std::size_t i = 0; i < a.size(); i++)
+			a[i] += b[i];
+	};
+	add(true_positives_, other.true_positives_);
+	add(false_positives_, other.false_positives_);
+	add(false_negatives_, other.false_negatives_);
+	add(positives_, other.positives_);
+	add(negatives_, other.negatives_);
+
+	nsamples_ += other.nsamples_;
+	correct_ += other.correct_;
+	loss_ += other.loss_;
+	return *this;
+}
+
+template <typename T>
+Metrics<T> &nn::metrics::Metrics<T>::reset(void)
+{
+	*this = Metrics<T>(threshold_, nbins_);
+	return *this;
+}
+
+template <typename T>
+std::size_t nn::metrics::Metrics<T>::get_nsamples(void) const
+{
+	return nsamples_;
+}
+
+template <typename T>
+std::size_t nn::metrics::Metrics<T>::get_nclasses(void) const
+{
+	return nclasses_;
+}
+
+template <typename T>
+T nn::metrics::Metrics<T>::loss(void) const
+{
+	return nsamples_ == 0 ? static_cast<T>(0) : static_cast<T>(loss_ / nsamples_);
+}
+
+template <typename T>
+T nn::metrics::Metrics<T>::accuracy(void) const
+{
+	return nsamples_ == 0 ? static_cast<T>(0) : static_cast<T>(correct_) / static_cast<T>(nsamples_);
+}
+
+template <typename T>
+T nn::metrics::Metrics<T>::precision(void) const
+{
+	T sum = 0;
+	for (std::size_t c = 0; c < nclasses_; c++)
+		sum += precision(c);
+	return nclasses_ == 0 ? sum : sum / static_cast<T>(nclasses_);
+}
+
+template <typename T>
+T nn::metrics::Metrics<T>::recall(void) const
+{
+	T sum = 0;
+	for (std::size_t c = 0; c < nclasses_; c++)
+		sum += recall(c);
+	return nclasses_ == 0 ? sum : sum / static_cast<T>(nclasses_);
+}
+
+template <typename T>
+T nn::metrics::Metrics<T>::auc(void) const
+{
+	T sum = 0;
+	for (std::size_t c = 0; c < nclasses_; c++)
+		sum += auc(c);
+	return nclasses_ == 0 ? sum : sum / static_cast<T>(nclasses_);
+}
+
+template <typename T>
+T nn::metrics::Metrics<T>::precision(std::size_t c) const
+{
+	std::uint64_t predicted = true_positives_[c] + false_positives_[c];
+	return predicted == 0 ? static_cast<T>(0) : static_cast<T>(true_positives_[c]) / static_cast<T>(predicted);
+}
+
+template <typename T>
+T nn::metrics::Metrics<T>::recall(std::size_t c) const
+{
+	std::uint64_t expected = true_positives_[c] + false_negatives_[c];
+	return expected == 0 ? static_cast<T>(0) : static_cast<T>(true_positives_[c]) / static_cast<T>(expected);
+}
+
+template <typename T>
+T nn::metrics::Metrics<T>::auc(std::size_t c) const
+{
+	// Probability that a positive scores above a negative, from the lowest bin up
+	const std::uint64_t *pos = positives_.data() + c * nbins_;
+	const std::uint64_t *neg = negatives_.data() + c * nbins_;
+	double npos = 0.0, nneg = 0.0, area = 0.0;
+	for (std::size_t b = 0; b < nbins_; b++) {
+		area += pos[b] * (nneg + 0.5 * neg[b]);
+		npos += pos[b];
+		nneg += neg[b];
+	}
+
+	return npos == 0.0 || nneg == 0.0 ? static_cast<T>(0) : static_cast<T>(area / (npos * nneg));
+}
+
+template <typename T>
+std::size_t nn::metrics::Metrics<T>::bin(T score) const
+{
+	if (!(score > static_cast<T>(0)))
+		return 0;
+	return std::min(static_cast<std::size_t>(score * static_cast<T>(nbins_)), nbins_ - 1);
+}
+
+template class nn::metrics::Metrics<float>;
+// template class nn::metrics::Metrics<double>;
@@ -1,9 +1,15 @@
 #include "../include/nn.hpp"
 #include "../include/activation_func.hpp"
+#include "../include/checkpoint.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <numeric>
+#include <random>
 
 using namespace nn::activation_funcs;
 using namespace nn::models;
@@ -23,6 +29,66 @@ Mat<T> WeightedModel<T>::test(const std::shared_ptr<std::vector<Mat<T>>> X_test,
 	return (*loss_)();
 }
 
+template <typename T>
+Metrics<T> WeightedModel<T>::evaluate(const std::vector<Mat<T>> &X, const std::vector<Mat<T>> &Y,
+				      std::size_t nshards, std::size_t batch_size, const Metrics<T> &metrics) const
+{
+	if (X.size() != Y.size())
+		throw std::invalid_argument("invalid argument: inputs and outputs must have the same number of examples");
+	if (batch_size == 0)
+		throw std::invalid_argument("invalid argument: the evaluation batch size must be at least one");
+
+	Metrics<T> total(metrics);
+	total.reset();
+	if (X.empty())
+		return total;
+
+	Shape input_shape = X[0].get_shape();
+	Shape output_shape = Y[0].get_shape();
+	if (input_shape.cols != 1 || output_shape.cols != 1)
+		throw std::invalid_argument("invalid argument: the evaluation expects one column per sample");
+
+	if (nshards == 0)
+		nshards = parallel::ThreadPool::global().size();
+	// No shard smaller than a batch
+	nshards = std::max<std::size_t>(1, std::min(nshards, (X.size() + batch_size - 1) / batch_size));
+
+	// The forward doesn't change the model, the shards share it
+	auto &model = const_cast<WeightedModel<T> &>(*this);
+	std::vector<Metrics<T>> shards(nshards, total);
+	parallel::WorkerGroup(nshards).run([&](std::size_t id) {
+		std::size_t first = X.size() * id / nshards;
+		std::size_t last = X.size() * (id + 1) / nshards;
+		std::size_t batch = std::min(batch_size, last - first);
+
+		Mat<T> Xb(input_shape.rows, batch);
+		Mat<T> Yb(output_shape.rows, batch);
+		Mat<T> sums(output_shape.rows, 1);
+		for (std::size_t begin = first; begin < last; begin += batch) {
+			std::size_t count = std::min(batch, last - begin);
+			if (count != Xb.cols()) {
+				Xb = Mat<T>(input_shape.rows, count);
+				Yb = Mat<T>(output_shape.rows, count);
+			}
+			pack_columns(X, begin, count, Xb);
+			pack_columns(Y, begin, count, Yb);
+
+			Mat<T> y_pred = model(Xb);
+			T loss = static_cast<T>(0);
+			if (loss_ != nullptr) {
+				sums.fill(static_cast<T>(0));
+				loss_->accumulate_loss(y_pred, Yb, sums);
+				loss = sums.grand_sum();
+			}
+			shards[id].update(y_pred, Yb, loss);
+		}
+	});
+
+	for (const auto &shard : shards)
+		total.merge(shard);
+	return total;
+}
+
 template <typename T>
 WeightedModel<T> &WeightedModel<T>::set_loss(std::shared_ptr<Loss<T>> loss)
 {
@@ -87,6 +153,15 @@ Mat<T> &Perceptron<T>::get_bias(void) const
 	return dense_->get_bias();
 }
 
+template <typename T>
+Perceptron<T> &Perceptron<T>::bind_weights(T *weights, T *bias, std::shared_ptr<void> storage)
+{
+	dense_->set_input_shape(Layer::input_shape_);
+	dense_->set_output_shape(Layer::output_shape_);
+	dense_->bind_weights(weights, bias, storage);
+	return *this;
+}
+
 template <typename T>
 Perceptron<T> &Perceptron<T>::build(const Shape &input_shape, const Shape &output_shape)
 {
@@ -283,6 +358,15 @@ Mat<T> &Adeline<T>::get_bias(void) const
 	return dense_->get_bias();
 }
 
+template <typename T>
+Adeline<T> &Adeline<T>::bind_weights(T *weights, T *bias, std::shared_ptr<void> storage)
+{
+	dense_->set_input_shape(Layer::input_shape_);
+	dense_->set_output_shape(Layer::output_shape_);
+	dense_->bind_weights(weights, bias, storage);
+	return *this;
+}
+
 template <typename T>
 Adeline<T> &Adeline<T>::build(const Shape &input_shape, const Shape &output_shape)
 {
@@ -485,6 +569,10 @@ Sequential<T> &Sequential<T>::build(void)
 		throw std::invalid_argument("Not set an optimizer");
 	}
 
+	if (layers_.empty()) {
+		throw std::invalid_argument("Sequential model without layers");
+	}
+
 	for (auto &layer_ptr : layers_) {
 		layer_ptr->build();
 		if (layer_ptr->is_trainable()) {
@@ -492,23 +580,69 @@ Sequential<T> &Sequential<T>::build(void)
 		}
 	}
 
-	this->set_input_shape(layers_[0]->get_input_shape());
-	this->set_output_shape(layers_.back()->get_output_shape());
+	collect_parameters();
 	
 	this->register_funcs();
+	Layer::built_ = true;
 
 	
 	return *this;
 }
 
 
+template <typename T>
+void Sequential<T>::collect_parameters(void)
+{
+	this->set_input_shape(layers_[0]->get_input_shape());
+	this->set_output_shape(layers_.back()->get_output_shape());
+
+	// The weights were (re)allocated, collect them again
+	params_.clear();
+	param_offsets_.clear();
+	sparse_layers_.clear();
+	for (auto &layer_ptr : layers_) {
+		param_offsets_.push_back(params_.size());
+		for (Mat<T> *param : layer_ptr->template parameters<T>())
+			params_.push_back(param);
+		if (layer_ptr->has_sparse_gradients())
+			sparse_layers_.push_back(static_cast<WeightedLayer *>(layer_ptr.get()));
+	}
+
+	// The layout of the slab, the gradients use it even if the parameters don't
+	slab_offsets_.clear();
+	slab_size_ = 0;
+	for (Mat<T> *param : params_) {
+		slab_offsets_.push_back(slab_size_);
+		slab_size_ += AlignedBuffer<T>::round_up(param->rows() * param->cols());
+	}
+
+	flat_params_ = Mat<T>();
+	if (flat_parameters_)
+		bind_slab();
+	alloc_gradients(grads_);
+	// The shapes could have changed
+	plan_ = Plan();
+}
+
+template <typename T>
+void Sequential<T>::replace_parameters(const std::vector<Mat<T> *> &replaced)
+{
+	if (WeightedLayer::optimizer_ != nullptr) {
+		for (Mat<T> *param : replaced)
+			WeightedLayer::optimizer_->forget(*param);
+		WeightedLayer::optimizer_->forget(flat_params_);
+	}
+
+	collect_parameters();
+	this->register_funcs();
+	Layer::built_ = true;
+}
+
 template <typename T>
 Sequential<T> &Sequential<T>::fit(const std::shared_ptr<std::vector<Mat<T>>> X_train,
                                   const std::shared_ptr<std::vector<Mat<T>>> Y_train,
                                   std::size_t nepochs, std::size_t batch_size)
 {
-    ((void) batch_size);
-
     if (Layer::input_shape_.rows == 0 || Layer::input_shape_.cols == 0)
         throw std::invalid_argument("Invalid input shape of the layer: " + Layer::name_);
 
@@ -532,47 +666,664 @@ Sequential<T> &Sequential<T>::fit(const std::shared_ptr<std::vector<Mat<T>>> X_t
     this->loss_->set_outputs(Y_train);
     this->loss_->set_model(this->shared_from_this());
 
-    while (nepochs-- > 0) {
-        std::size_t n = X_train->size();
-
-        for (std::size_t i = 0; i < n; i++) {
-            const Mat<T> &x = (*X_train)[i];
+    // The optimizer state exists before the resume restores it and before any worker steps
+    WeightedLayer::optimizer_->prepare(optimizer_parameters());
+    zero_gradients(grads_);
+
+    // The layers train as such (batch statistics, dropout) until `fit` returns
+    struct TrainingMode {
+        Sequential &model;
+        bool previous;
+        ~TrainingMode(void) { model.set_training(previous); }
+    } training_mode{*this, Layer::is_training()};
+    set_training(true);
+
+    // Continue from the newest checkpoint, `nepochs` counts the epochs already trained
+    std::size_t first_epoch = 0;
+    if (checkpointer_ != nullptr)
+        first_epoch = checkpointer_->resume(*this);
+    if (first_epoch >= nepochs)
+        return *this;
+
+    // Every Hogwild worker reads its own stream of samples, there is no shared loader
+    if (fit_mode_ == FitMode::Hogwild) {
+        hogwild_epochs(*X_train, *Y_train, first_epoch, nepochs, batch_size);
+        if (checkpointer_ != nullptr)
+            checkpointer_->flush();
+        return *this;
+    }
 
+    // The loader assembles shuffled batches on the thread pool, here we only consume ready ones
+    DataLoader<T> loader(X_train, Y_train, batch_size, shuffle_, prefetch_, seed_);
+    bool statistics = batch_statistics();
+    std::size_t last_size = X_train->size() - (loader.get_nbatches() - 1) * loader.get_batch_size();
+    if (statistics && last_size < 2)
+        throw std::invalid_argument("invalid argument: the batches of a model with BatchNorm need two samples or more, the last one too");
+    loader.start(nepochs - first_epoch);
+
+    // Every worker of the data parallel mode gets its shard and gradient buffers once
+    std::unique_ptr<parallel::WorkerGroup> workers;
+    std::vector<Replica> replicas;
+    if (fit_mode_ == FitMode::DataParallel) {
+        workers = std::make_unique<parallel::WorkerGroup>(nthreads_);
+        std::size_t shard = (loader.get_batch_size() + nthreads_ - 1) / nthreads_;
+        // Shards of two samples or more in a small batch have at most three
+        if (statistics)
+            shard = std::max<std::size_t>(shard, 3);
+        replicas.resize(nthreads_);
+        for (auto &replica : replicas) {
+            replica.X = Mat<T>(Layer::input_shape_.rows * Layer::input_shape_.cols, shard);
+            replica.Y = Mat<T>(Layer::output_shape_.rows * Layer::output_shape_.cols, shard);
+            alloc_gradients(replica.grads);
+        }
+    }
 
-            // Hardcodeamos la parte de CrossEntropy + Sigmoid
-	    // simplificado: dL/dz = (a - y)
-	    // const Mat<T> &y_true = (*Y_train)[i];
-            // Mat<T> y_pred = (*this)(x);
-            // Mat<T> grad(y_pred.get_shape());
-            // for (std::size_t r = 0; r < y_pred.rows(); ++r)
-	    // 	    for (std::size_t c = 0; c < y_pred.cols(); ++c)
-	    // 		    grad(r, c) = y_pred(r, c) - y_true(r, c);
+    Mat<T> x((*X_train)[0].get_shape());
+    Mat<T> y((*Y_train)[0].get_shape());
+    while (const Batch<T> *batch = loader.next()) {
+        bool last = batch->index + 1 == loader.get_nbatches();
+        if (fit_mode_ == FitMode::DataParallel)
+            data_parallel_step(*batch, replicas, *workers, last);
+
+        // A BatchNorm needs the statistics of the whole batch, the micro-batch is the batch
+        if (fit_mode_ == FitMode::Serial && statistics) {
+            accumulate_gradients(batch->X, batch->Y, grads_.views.data());
+            grads_.nsamples += batch->size;
+            if (++grads_.nmicro == accumulation_steps_ || last)
+                step_gradients(grads_);
+        }
 
-	    Mat<T> grad = this->loss_->gradient(std::make_pair((*X_train)[i], (*Y_train)[i]));
-	    // std::cout << "epoch: " << nepochs << " grad: " << grad(0, 0) << std::endl;
-            this->WeightedLayer::fit(grad, x);
+        // One step every `accumulation_steps_` samples, all the parameters at once
+        for (std::size_t j = 0; fit_mode_ == FitMode::Serial && !statistics && j < batch->size; j++) {
+            batch->get_sample(j, x, y);
+            accumulate_gradients(x, y, grads_.views.data());
+            grads_.nsamples++;
+            if (++grads_.nmicro == accumulation_steps_ || (last && j + 1 == batch->size))
+                step_gradients(grads_);
         }
+
+        // The snapshot is a copy, the file is written while the next epoch trains
+        if (checkpointer_ != nullptr && last)
+            checkpointer_->on_epoch_end(*this, first_epoch + batch->epoch + 1);
     }
 
+    if (checkpointer_ != nullptr)
+        checkpointer_->flush();
+
     return *this;
 }
 
 
 
 
+/* Copy the columns [first, first + count) of a batch into `dst` */
+template <typename T>
+static void copy_columns(const Mat<T> &src, std::size_t first, std::size_t count, Mat<T> &dst)
+{
+	dst.set_shape(Shape{src.rows(), count});
+	for (std::size_t i = 0; i < src.rows(); i++)
+		std::memcpy(dst.get_mat_raw() + i * count, src.get_mat_raw() + i * src.cols() + first, count * sizeof(T));
+}
+
+template <typename T>
+void Sequential<T>::data_parallel_step(const Batch<T> &batch, std::vector<Replica> &replicas,
+					parallel::WorkerGroup &workers, bool last)
+{
+	std::size_t nworkers = replicas.size();
+
+	// With batch statistics a shard needs two samples, a small batch goes to fewer workers
+	std::size_t nshards = nworkers;
+	if (batch_statistics())
+		nshards = std::max<std::size_t>(std::min(nworkers, batch.size / 2), 1);
+
+	// Every worker computes the gradients of a contiguous shard of the batch,
+	// the shards only depend on the batch size and the number of workers. The
+	// worker zero keeps accumulating the micro-batches until the step
+	workers.run([&](std::size_t w) {
+		Replica &replica = replicas[w];
+		if (w > 0)
+			zero_gradients(replica.grads);
+
+		std::size_t first = batch.size * std::min(w, nshards) / nshards;
+		std::size_t last = batch.size * std::min(w + 1, nshards) / nshards;
+		if (first == last)
+			return;
+
+		copy_columns(batch.X, first, last - first, replica.X);
+		copy_columns(batch.Y, first, last - first, replica.Y);
+		accumulate_gradients(replica.X, replica.Y, replica.grads.views.data());
+	});
+
+	// Reduce-scatter: the worker `w` owns the slice `w` of the flat gradients
+	// and sums it over the workers always in the same order, then the result
+	// is bitwise reproducible for a fixed number of workers
+	Gradients &grads = replicas[0].grads;
+	bool step = ++grads.nmicro == accumulation_steps_ || last;
+	grads.nsamples += batch.size;
+	T scale = static_cast<T>(1) / static_cast<T>(grads.nsamples);
+	workers.run([&](std::size_t w) {
+		std::size_t lo = slab_size_ * w / nworkers;
+		std::size_t hi = slab_size_ * (w + 1) / nworkers;
+		if (lo == hi)
+			return;
+
+		T *dst = grads.memory.data() + lo;
+		for (std::size_t r = 1; r < nworkers; r++)
+			MatDispatchOps::Mat_add(dst, replicas[r].grads.memory.data() + lo, dst, Shape{1, hi - lo});
+		if (step)
+			MatDispatchOps::Mat_mul_scalar(dst, Shape{1, hi - lo}, scale);
+	});
+
+	// One step with the mean gradient of the accumulated micro-batches
+	if (step) {
+		apply_gradients(grads);
+		zero_gradients(grads);
+	}
+}
+
+/* A BatchNorm among the layers or in the block of one of their residuals */
+template <typename T>
+static bool has_batchnorm(const std::vector<std::unique_ptr<Layer>> &layers)
+{
+	for (const auto &layer : layers) {
+		if (dynamic_cast<const BatchNorm<T> *>(layer.get()) != nullptr)
+			return true;
+		auto *residual = dynamic_cast<const Residual<T> *>(layer.get());
+		if (residual != nullptr && has_batchnorm<T>(residual->get_block()))
+			return true;
+	}
+	return false;
+}
+
+template <typename T>
+bool Sequential<T>::batch_statistics(void) const
+{
+	return has_batchnorm<T>(layers_);
+}
+
+template <typename T>
+void Sequential<T>::hogwild_epochs(const std::vector<Mat<T>> &X, const std::vector<Mat<T>> &Y,
+				   std::size_t first_epoch, std::size_t nepochs, std::size_t batch_size)
+{
+	std::size_t nsamples = X.size();
+	batch_size = std::min(std::max<std::size_t>(batch_size, 1), nsamples);
+	parallel::WorkerGroup workers(nthreads_);
+
+	// Every worker owns an interleaved subset of the samples and visits it in its own order
+	std::vector<std::vector<std::size_t>> streams(nthreads_);
+	for (std::size_t i = 0; i < nsamples; i++)
+		streams[i % nthreads_].push_back(i);
+
+	std::vector<std::mt19937> rngs;
+	std::vector<Replica> replicas(nthreads_);
+	for (auto &replica : replicas) {
+		rngs.emplace_back(seed_ + rngs.size());
+		replica.X = Mat<T>(Layer::input_shape_.rows * Layer::input_shape_.cols, batch_size);
+		replica.Y = Mat<T>(Layer::output_shape_.rows * Layer::output_shape_.cols, batch_size);
+		alloc_gradients(replica.grads);
+	}
+
+	for (std::size_t epoch = first_epoch; epoch < nepochs; epoch++) {
+		workers.run([&](std::size_t w) {
+			std::vector<std::size_t> &stream = streams[w];
+			Replica &replica = replicas[w];
+			if (shuffle_)
+				std::shuffle(stream.begin(), stream.end(), rngs[w]);
+
+			for (std::size_t first = 0; first < stream.size(); first += batch_size) {
+				std::size_t count = std::min(batch_size, stream.size() - first);
+				std::size_t nx = replica.X.rows(), ny = replica.Y.rows();
+				replica.X.set_shape(Shape{nx, count});
+				replica.Y.set_shape(Shape{ny, count});
+				for (std::size_t j = 0; j < count; j++) {
+					const T *x = X[stream[first + j]].get_mat_raw();
+					const T *y = Y[stream[first + j]].get_mat_raw();
+					for (std::size_t i = 0; i < nx; i++)
+						replica.X.get_mat_raw()[i * count + j] = x[i];
+					for (std::size_t i = 0; i < ny; i++)
+						replica.Y.get_mat_raw()[i * count + j] = y[i];
+				}
+
+				accumulate_gradients(replica.X, replica.Y, replica.grads.views.data());
+				replica.grads.nsamples += count;
+
+				// No locks: the other workers read and write the same weights at
+				// the same time, a lost or stale update is the accepted cost
+				if (++replica.grads.nmicro == accumulation_steps_ || first + count == stream.size())
+					step_gradients(replica.grads);
+			}
+		});
+
+		if (checkpointer_ != nullptr)
+			checkpointer_->on_epoch_end(*this, epoch + 1);
+	}
+}
+
+template <typename T>
+void Sequential<T>::bind_slab(void)
+{
+	if (slab_size_ == 0)
+		return;
+
+	// Every layer with parameters must accept external memory, otherwise they stay where they are
+	for (std::size_t i = 0; i < layers_.size(); i++) {
+		std::size_t first = param_offsets_[i];
+		std::size_t last = i + 1 < layers_.size() ? param_offsets_[i + 1] : params_.size();
+		if (first != last && !layers_[i]->template can_bind_parameters<T>())
+			return;
+	}
+
+	// The layers could live in the previous slab, it is released after the copy
+	AlignedBuffer<T> slab(slab_size_);
+	for (std::size_t k = 0; k < params_.size(); k++)
+		std::memcpy(slab.data() + slab_offsets_[k], params_[k]->get_mat_raw(),
+			    params_[k]->rows() * params_[k]->cols() * sizeof(T));
+
+	for (std::size_t i = 0; i < layers_.size(); i++) {
+		std::size_t first = param_offsets_[i];
+		std::size_t last = i + 1 < layers_.size() ? param_offsets_[i + 1] : params_.size();
+		if (first == last)
+			continue;
+
+		std::vector<T *> memory;
+		for (std::size_t k = first; k < last; k++)
+			memory.push_back(slab.data() + slab_offsets_[k]);
+		layers_[i]->template bind_parameters<T>(memory);
+	}
+
+	slab_ = std::move(slab);
+	flat_params_ = Mat<T>(Shape{1, slab_size_}, slab_.data());
+
+	// Binding could have replaced the matrices of the layers
+	params_.clear();
+	for (auto &layer_ptr : layers_)
+		for (Mat<T> *param : layer_ptr->template parameters<T>())
+			params_.push_back(param);
+}
+
+template <typename T>
+void Sequential<T>::alloc_gradients(Gradients &grads) const
+{
+	grads.memory.resize(slab_size_);
+	grads.views.clear();
+	grads.flat = Mat<T>();
+	zero_gradients(grads);
+	if (slab_size_ == 0)
+		return;
+
+	// Mat isn't nothrow movable, without the reserve a reallocation would copy the views
+	grads.views.reserve(params_.size());
+	for (std::size_t k = 0; k < params_.size(); k++)
+		grads.views.emplace_back(params_[k]->get_shape(), grads.memory.data() + slab_offsets_[k]);
+	grads.flat = Mat<T>(Shape{1, slab_size_}, grads.memory.data());
+}
+
+template <typename T>
+void Sequential<T>::apply_gradients(Gradients &grads)
+{
+	// A single fused pass over the slab, the padding has zero gradients
+	if (has_flat_parameters()) {
+		WeightedLayer::optimizer_->apply(flat_params_, grads.flat);
+	} else {
+		for (std::size_t k = 0; k < params_.size(); k++)
+			WeightedLayer::optimizer_->apply(*params_[k], grads.views[k]);
+	}
+
+	// The sparse gradients live in their layers, each steps the rows it used.
+	// They go last like in `optimizer_parameters`, a lazily allocated state keeps its order
+	for (WeightedLayer *layer : sparse_layers_)
+		layer->step();
+}
+
+template <typename T>
+void Sequential<T>::step_gradients(Gradients &grads)
+{
+	if (grads.nsamples == 0)
+		return;
+
+	MatDispatchOps::Mat_mul_scalar(grads.memory.data(), Shape{1, grads.memory.size()},
+				       static_cast<T>(1) / static_cast<T>(grads.nsamples));
+	apply_gradients(grads);
+	zero_gradients(grads);
+}
+
+template <typename T>
+void Sequential<T>::zero_gradients(Gradients &grads) const
+{
+	std::fill_n(grads.memory.data(), grads.memory.size(), static_cast<T>(0));
+	grads.nsamples = 0;
+	grads.nmicro = 0;
+}
+
+template <typename T>
+Mat<T> Sequential<T>::forward_cached(const Mat<T> &X, std::vector<Mat<T>> &inputs, bool logits)
+{
+	// The layers with a trace know their input by its data, no reallocation may copy it
+	inputs.clear();
+	inputs.reserve(layers_.size() + 1);
+	inputs.push_back(X);
+	for (std::size_t i = 0; i + 1 < layers_.size(); i++)
+		inputs.push_back((*layers_[i])(inputs.back()));
+	if (logits)
+		inputs.push_back(layers_.back()->template logits<T>(inputs.back()));
+	else
+		inputs.push_back((*layers_.back())(inputs.back()));
+
+	// The last one is the output of the network, not an input
+	Mat<T> output = std::move(inputs.back());
+	inputs.pop_back();
+	return output;
+}
+
+template <typename T>
+Mat<T> Sequential<T>::backward_cached(const std::vector<Mat<T>> &inputs, const Mat<T> &dY, Mat<T> *grads, bool logits)
+{
+	std::size_t last = layers_.size() - 1;
+	Mat<T> dA = logits ? layers_[last]->backward_logits(inputs[last], dY, grads + param_offsets_[last])
+			   : layers_[last]->backward(inputs[last], dY, grads + param_offsets_[last]);
+	for (std::size_t i = last; i-- > 0;)
+		dA = layers_[i]->backward(inputs[i], dA, grads + param_offsets_[i]);
+	return dA;
+}
+
+template <typename T>
+nn::autodiff::Var Sequential<T>::record_layers(autodiff::Tape<T> &tape, autodiff::Var X, Mat<T> *grads)
+{
+	autodiff::Var A = X;
+	for (std::size_t i = 0; i < layers_.size(); i++) {
+		Layer &layer = *layers_[i];
+		Mat<T> *layer_grads = grads + param_offsets_[i];
+		if (layer.can_record<T>()) {
+			A = layer.record<T>(tape, A, layer_grads);
+			continue;
+		}
+
+		autodiff::Var input = A;
+		A = tape.custom(layer(tape.value(input)), {input},
+				[&layer, input, layer_grads](autodiff::Tape<T> &tape, const Mat<T> &g) {
+					tape.accumulate(input, layer.backward<T>(tape.value(input), g, layer_grads));
+				}, {input});
+	}
+	return A;
+}
+
+template <typename T>
+bool Sequential<T>::fused_output(void) const
+{
+	if (this->loss_ == nullptr || layers_.empty() || !layers_.back()->is_trainable()
+	    || !layers_.back()->template has_logits<T>())
+		return false;
+
+	std::string activation = this->loss_->fused_activation();
+	auto *last = static_cast<const WeightedLayer *>(layers_.back().get());
+	return !activation.empty() && last->has_activation_func()
+		&& last->get_activation_func()->get_name() == activation;
+}
+
+template <typename T>
+Sequential<T> &Sequential<T>::accumulate_gradients(const Mat<T> &X, const Mat<T> &Y, Mat<T> *grads)
+{
+	if (this->loss_ == nullptr)
+		throw std::invalid_argument("Not set a loss function");
+
+	// dL/dZ straight from the logits of the last layer, its activation is in the loss
+	std::vector<Mat<T>> inputs;
+	if (fused_output()) {
+		Mat<T> Z = forward_cached(X, inputs, true);
+		backward_cached(inputs, this->loss_->gradient_logits(Z, Y), grads, true);
+		return *this;
+	}
+
+	Mat<T> Y_pred = forward_cached(X, inputs);
+	backward_cached(inputs, this->loss_->gradient(Y_pred, Y), grads);
+
+	return *this;
+}
+
+template <typename T>
+Sequential<T> &Sequential<T>::accumulate_batch(const Mat<T> &X, const Mat<T> &Y)
+{
+	accumulate_gradients(X, Y, grads_.views.data());
+	grads_.nsamples += X.cols();
+	grads_.nmicro++;
+	return *this;
+}
+
+template <typename T>
+Sequential<T> &Sequential<T>::set_accumulation_steps(std::size_t nsteps)
+{
+	if (nsteps == 0)
+		throw std::invalid_argument("invalid argument: at least one micro-batch per step");
+	accumulation_steps_ = nsteps;
+	return *this;
+}
+
+template <typename T>
+std::size_t Sequential<T>::get_accumulation_steps(void) const
+{
+	return accumulation_steps_;
+}
+
+template <typename T>
+Sequential<T> &Sequential<T>::compile(std::size_t batch_size, bool training)
+{
+	if (!Layer::built_)
+		throw std::logic_error("logic error: the model must be built before compiling it");
+	if (batch_size == 0)
+		throw std::invalid_argument("invalid argument: a compiled model needs at least one column per batch");
+	if (this->get_input_shape().cols != 1)
+		throw std::invalid_argument("invalid argument: a compiled model expects one column per sample");
+
+	/*
+	 * The forward of the layer k is the step k and its backward the step
+	 * 2L - 1 - k. The output of a layer lives from its forward to the next
+	 * forward, or to its own backward (it is the Y of `backward_into`) when
+	 * training. The gradient of the output of the layer k is written by
+	 * the backward of k + 1 and read by the backward of k, the one of the
+	 * output (dL/dY, copied in) and the one of the input only live in
+	 * their step. Both ends of a lifetime are inclusive
+	 */
+	struct Value {
+		std::size_t size;
+		std::size_t first;
+		std::size_t last;
+		std::size_t buffer;
+	};
+	std::size_t L = layers_.size();
+	std::vector<Value> values;
+	for (std::size_t k = 0; k < L; k++) {
+		std::size_t last = training ? 2 * L - 1 - k : std::min(k + 1, L - 1);
+		values.push_back({layers_[k]->get_output_size() * batch_size, k, last, 0});
+	}
+	/*
+	 * A layer skipped as the identity hands its input on, that lives as
+	 * long as its output. Without a backward its output shares the buffer
+	 * of its input, the identities are element-wise and run in place if
+	 * they stop being so
+	 */
+	std::vector<bool> skip(L), shared(L);
+	for (std::size_t k = L; k-- > 0;) {
+		skip[k] = layers_[k]->is_identity();
+		shared[k] = skip[k] && k > 0 && !training;
+		if (skip[k] && k > 0)
+			values[k - 1].last = std::max(values[k - 1].last, values[k].last);
+	}
+	if (training) {
+		for (std::size_t k = 0; k <= L; k++) {
+			std::size_t rows = k == 0 ? layers_[0]->get_input_size() : layers_[k - 1]->get_output_size();
+			std::size_t first = k == L ? L : 2 * L - 1 - k;
+			std::size_t last = k == 0 || k == L ? first : first + 1;
+			values.push_back({rows * batch_size, first, last, 0});
+		}
+	}
+
+	/*
+	 * Greedy over the values by their first step: a buffer is free if its
+	 * last value is dead, the smallest free one that fits is reused, else
+	 * the largest free one grows, else a new buffer. The intervals form an
+	 * interval graph, then the buffers are as many as the most values alive
+	 * in one step
+	 */
+	std::vector<std::size_t> order(values.size());
+	for (std::size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&values](std::size_t a, std::size_t b) {
+		return values[a].first < values[b].first;
+	});
+
+	std::vector<std::size_t> capacity, busy_until;
+	for (std::size_t i : order) {
+		if (i < L && shared[i])
+			continue;
+		Value &value = values[i];
+		std::size_t best = capacity.size();
+		for (std::size_t b = 0; b < capacity.size(); b++) {
+			if (busy_until[b] >= value.first)
+				continue;
+			if (best == capacity.size()) {
+				best = b;
+				continue;
+			}
+			bool fits = capacity[b] >= value.size, best_fits = capacity[best] >= value.size;
+			if ((fits && (!best_fits || capacity[b] < capacity[best])) || (!fits && !best_fits && capacity[b] > capacity[best]))
+				best = b;
+		}
+		if (best == capacity.size()) {
+			capacity.push_back(0);
+			busy_until.push_back(0);
+		}
+		capacity[best] = std::max(capacity[best], value.size);
+		busy_until[best] = value.last;
+		value.buffer = best;
+	}
+	for (std::size_t k = 0; k < L; k++) {
+		if (!shared[k])
+			continue;
+		values[k].buffer = values[k - 1].buffer;
+		capacity[values[k].buffer] = std::max(capacity[values[k].buffer], values[k].size);
+	}
+
+	std::vector<std::size_t> offsets;
+	std::size_t total = 0;
+	for (std::size_t size : capacity) {
+		offsets.push_back(total);
+		total += AlignedBuffer<T>::round_up(size);
+	}
+
+	Plan plan;
+	plan.batch_size = batch_size;
+	plan.training = training;
+	plan.arena.resize(total);
+	plan.nbuffers = capacity.size();
+	// Mat isn't nothrow movable, without the reserve a reallocation would copy the views
+	plan.activations.reserve(L);
+	for (std::size_t k = 0; k < L; k++)
+		plan.activations.emplace_back(Shape{layers_[k]->get_output_size(), batch_size},
+					      plan.arena.data() + offsets[values[k].buffer]);
+	if (training) {
+		plan.gradients.reserve(L + 1);
+		for (std::size_t k = 0; k <= L; k++) {
+			std::size_t rows = k == 0 ? layers_[0]->get_input_size() : layers_[k - 1]->get_output_size();
+			plan.gradients.emplace_back(Shape{rows, batch_size}, plan.arena.data() + offsets[values[L + k].buffer]);
+		}
+	}
+
+	for (auto &layer : layers_) {
+		bool into = layer->template can_run_into<T>();
+		plan.forward.push_back(into ? layer->template get_forward_into<T>() : Layer::ForwardInto<T>());
+		plan.backward.push_back(into ? layer->template get_backward_into<T>() : Layer::BackwardInto<T>());
+	}
+	plan.skip = std::move(skip);
+	for (auto &activation : plan.activations)
+		plan.outputs.push_back(&activation);
+
+	plan_ = std::move(plan);
+	return *this;
+}
+
+template <typename T>
+bool Sequential<T>::is_compiled(void) const
+{
+	return plan_.batch_size != 0;
+}
+
+template <typename T>
+std::size_t Sequential<T>::get_plan_buffers(void) const
+{
+	return plan_.nbuffers;
+}
+
+template <typename T>
+std::size_t Sequential<T>::get_plan_size(void) const
+{
+	return plan_.arena.size();
+}
+
+template <typename T>
+const Mat<T> &Sequential<T>::forward_compiled(const Mat<T> &X)
+{
+	if (!is_compiled())
+		throw std::logic_error("logic error: the model isn't compiled");
+	if (X.get_shape() != Shape{this->get_input_size(), plan_.batch_size})
+		throw std::invalid_argument("invalid argument: the batch doesn't match the compiled shape");
+
+	// The output of a skipped layer is its input, nullptr for X
+	const Mat<T> *A = nullptr;
+	for (std::size_t k = 0; k < layers_.size(); k++) {
+		if (plan_.skip[k] && layers_[k]->is_identity()) {
+			plan_.outputs[k] = A;
+			continue;
+		}
+		Mat<T> &Y = plan_.activations[k];
+		if (plan_.forward[k])
+			plan_.forward[k](A == nullptr ? X : *A, Y);
+		else
+			Y.assign((*layers_[k])(A == nullptr ? X : *A));
+		A = plan_.outputs[k] = &Y;
+	}
+	return A == nullptr ? X : *A;
+}
+
+template <typename T>
+const Mat<T> &Sequential<T>::backward_compiled(const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads)
+{
+	if (!is_compiled() || !plan_.training)
+		throw std::logic_error("logic error: the model isn't compiled for training");
+	if (X.get_shape() != Shape{this->get_input_size(), plan_.batch_size})
+		throw std::invalid_argument("invalid argument: the batch doesn't match the compiled shape");
+	if (dY.get_shape() != plan_.activations.back().get_shape())
+		throw std::invalid_argument("invalid argument: dY doesn't match the compiled output");
+
+	// The layers use the gradient of their output as scratch, dY is copied in.
+	// The gradients are views of the arena, `assign` writes into them
+	std::size_t L = layers_.size();
+	plan_.gradients[L].assign(dY);
+	for (std::size_t k = L; k-- > 0;) {
+		const Mat<T> &A = k == 0 || plan_.outputs[k - 1] == nullptr ? X : *plan_.outputs[k - 1];
+		Mat<T> *layer_grads = grads == nullptr ? nullptr : grads + param_offsets_[k];
+		if (plan_.outputs[k] != &plan_.activations[k])
+			plan_.gradients[k].assign(plan_.gradients[k + 1]);
+		else if (plan_.backward[k])
+			plan_.backward[k](A, plan_.activations[k], plan_.gradients[k + 1], plan_.gradients[k], layer_grads);
+		else
+			plan_.gradients[k].assign(layers_[k]->template backward<T>(A, plan_.gradients[k + 1], layer_grads));
+	}
+	return plan_.gradients[0];
+}
+
 template <typename T>
 Sequential<T> &Sequential<T>::register_funcs(void)
 {
 	GenericVTable::register_func<Mat<T>, const Mat<T> &>
 		("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+			// The identities (dropout out of training) aren't even copied
 			Mat<T> A_prev = X;
-			Mat<T> A_next;
 			for (auto &layer_ptr : this->layers_) {
-				A_next = (*layer_ptr)(A_prev);
-				A_prev = A_next;
+				if (!layer_ptr->is_identity())
+					A_prev = (*layer_ptr)(A_prev);
 			}
 
-			return A_next;
+			return A_prev;
 		});
 
 
@@ -593,39 +1344,60 @@ Sequential<T> &Sequential<T>::register_funcs(void)
 
 	GenericVTable::register_func<void, const Mat<T> &, const Mat<T> &>
 		("fit", [this](const Mat<T> &dE_dY, const Mat<T> &X) -> void {
+			// The gradients of any stack of layers come from the tape, then
+			// one optimizer step with them (and anything accumulated before)
+			autodiff::Tape<T> tape;
+			tape.backward(record_layers(tape, tape.constant(X), grads_.views.data()), dE_dY);
+			grads_.nsamples += X.cols();
+			grads_.nmicro++;
+			step_gradients(grads_);
+		});
+
+	GenericVTable::register_func<autodiff::Var, autodiff::Tape<T> &, autodiff::Var, Mat<T> *>
+		("record", [this](autodiff::Tape<T> &tape, autodiff::Var X, Mat<T> *grads) -> autodiff::Var {
+			return record_layers(tape, X, grads);
+		});
+
+	GenericVTable::register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
 			std::vector<Mat<T>> inputs;
-			inputs.push_back(X);
+			forward_cached(X, inputs);
+			return backward_cached(inputs, dY, grads);
+		});
 
-			// Get each input from the layers
-			for (auto &layer_ptr : this->layers_) {
-				inputs.push_back((*layer_ptr)(inputs.back()));
-			}
-			// Remove the output from the network
-			inputs.pop_back();
-
-			// Iterate by reverse
-			// Here we are supposing that the `dE_dY` in R^{m, 1}
-			Mat<T> dL_dA_prev = dE_dY;
-			for (int i = layers_.size() - 1; i >= 0; i--) {
-				if (layers_[i].get()->is_trainable()) {
-					// Commeted out because we are already getting the epxression of a - y from above
-					if (static_cast<WeightedLayer *>(layers_[i].get())->has_activation_func()
-					    // && i < layers_.size() - 1
-					    ) {
-						// (m, n) . (n, 1) + (m, 1) = (m, 1)
-						Mat<T> Z = static_cast<Dense<T> *>(layers_[i].get())->get_weights().dot(inputs[i])
-							+ static_cast<Dense<T> *>(layers_[i].get())->get_bias();
-						// (m, 1) . (m, 1) = (m, 1)
-						Mat<T> dL_dZ = static_cast<WeightedLayer *>(layers_[i].get())->get_activation_func()->gradient(Z) * dL_dA_prev;
-						// std::cout << "dL_dZ: " << dL_dZ << std::endl;
-						static_cast<WeightedLayer *>(layers_[i].get())->fit(dL_dZ, inputs[i]);
-					} else {
-						static_cast<WeightedLayer *>(layers_[i].get())->fit(dL_dA_prev, inputs[i]);
-					}
-				}
-				Mat<T> dL_dA = layers_[i].get()->jacobian(inputs[i]).dot(dL_dA_prev);
-				dL_dA_prev = dL_dA;
-			}
+	GenericVTable::register_func<std::vector<Mat<T> *>>
+		("parameters", [this]() -> std::vector<Mat<T> *> {
+			return params_;
+		});
+
+	// The accumulators of the model are the views of `grads_`, not the ones of the layers
+	GenericVTable::register_func<void, const Mat<T> &, const Mat<T> &>
+		("accumulate", [this](const Mat<T> &dE_dY, const Mat<T> &X) -> void {
+			std::vector<Mat<T>> inputs;
+			forward_cached(X, inputs);
+			backward_cached(inputs, dE_dY, grads_.views.data());
+			grads_.nsamples += X.cols();
+			grads_.nmicro++;
+		});
+
+	GenericVTable::register_func<void>
+		("step", [this]() -> void {
+			step_gradients(grads_);
+		});
+
+	GenericVTable::register_func<void>
+		("zero_grad", [this]() -> void {
+			zero_gradients(grads_);
+			for (WeightedLayer *layer : sparse_layers_)
+				layer->zero_grad();
+		});
+
+	GenericVTable::register_func<std::vector<Mat<T> *>>
+		("gradients", [this]() -> std::vector<Mat<T> *> {
+			std::vector<Mat<T> *> grads;
+			for (auto &view : grads_.views)
+				grads.push_back(&view);
+			return grads;
 		});
 	
 	return *this;
@@ -638,6 +1410,396 @@ const std::vector<std::unique_ptr<Layer>> &nn::models::Sequential<T>::get_layers
 	return layers_;
 }
 
+template <typename T>
+Sequential<T> &nn::models::Sequential<T>::add(std::unique_ptr<Layer> layer)
+{
+	if (layer == nullptr)
+		throw std::invalid_argument("invalid argument: Can't add an empty layer");
+	layers_.push_back(std::move(layer));
+	Layer::built_ = false;
+	plan_ = Plan();
+	return *this;
+}
+
+template <typename T>
+Sequential<T> &nn::models::Sequential<T>::set_training(bool training)
+{
+	Layer::set_training(training);
+	for (auto &layer_ptr : layers_)
+		layer_ptr->set_training(training);
+	return *this;
+}
+
+template <typename T>
+std::size_t nn::models::Sequential<T>::fold_batchnorm(void)
+{
+	if (!Layer::built_)
+		throw std::logic_error("logic error: the model must be built to fold its BatchNorm layers");
+
+	std::vector<Mat<T> *> replaced;
+	std::size_t nfolds = 0;
+	for (std::size_t i = 0; i + 1 < layers_.size(); i++) {
+		auto *dense = dynamic_cast<Dense<T> *>(layers_[i].get());
+		auto *norm = dynamic_cast<BatchNorm<T> *>(layers_[i + 1].get());
+		if (dense == nullptr || norm == nullptr || dense->has_activation_func())
+			continue;
+
+		// y = gamma * (W . x + B - mean) / sqrt(var + eps) + beta = W' . x + B'
+		const Mat<T> &W = dense->get_weights();
+		const Mat<T> &B = dense->get_bias();
+		auto folded = std::make_unique<Dense<T>>(W.cols(), W.rows(), norm->get_activation_func());
+		folded->set_name(dense->get_name());
+		folded->build();
+		folded->set_optimizer(WeightedLayer::optimizer_);
+		Mat<T> &W_folded = folded->get_weights();
+		Mat<T> &B_folded = folded->get_bias();
+		for (std::size_t r = 0; r < W.rows(); r++) {
+			T scale = norm->get_gamma()(r, 0) / std::sqrt(norm->get_running_var()(r, 0) + norm->get_eps());
+			for (std::size_t c = 0; c < W.cols(); c++)
+				W_folded(r, c) = scale * W(r, c);
+			B_folded(r, 0) = scale * (B(r, 0) - norm->get_running_mean()(r, 0)) + norm->get_beta()(r, 0);
+		}
+
+		for (auto *layer : {layers_[i].get(), layers_[i + 1].get()})
+			for (Mat<T> *param : layer->template parameters<T>())
+				replaced.push_back(param);
+		layers_[i] = std::move(folded);
+		layers_.erase(layers_.begin() + i + 1);
+		nfolds++;
+	}
+
+	// Only the folded layers are new, the others keep their weights
+	if (nfolds > 0)
+		replace_parameters(replaced);
+	return nfolds;
+}
+
+template <typename T>
+std::size_t nn::models::Sequential<T>::prune_weights(double sparsity, SparseFormat format, std::size_t block_rows,
+						      std::size_t block_cols)
+{
+	if (!Layer::built_)
+		throw std::logic_error("logic error: the model must be built to prune its weights");
+
+	std::vector<Mat<T> *> replaced;
+	std::size_t npruned = 0;
+	for (auto &layer_ptr : layers_) {
+		auto *dense = dynamic_cast<Dense<T> *>(layer_ptr.get());
+		if (dense == nullptr)
+			continue;
+		auto pruned = prune_dense(*dense, sparsity, format, block_rows, block_cols);
+		for (Mat<T> *param : dense->template parameters<T>())
+			replaced.push_back(param);
+		layer_ptr = std::move(pruned);
+		npruned++;
+	}
+
+	// Only the pruned layers are new, the others keep their weights
+	if (npruned > 0)
+		replace_parameters(replaced);
+	return npruned;
+}
+
+template <typename T>
+std::size_t nn::models::Sequential<T>::prune_neurons(double fraction)
+{
+	return prune_neurons_by(fraction, nullptr);
+}
+
+template <typename T>
+std::size_t nn::models::Sequential<T>::prune_neurons(double fraction, const Mat<T> &X)
+{
+	return prune_neurons_by(fraction, &X);
+}
+
+template <typename T>
+std::size_t nn::models::Sequential<T>::prune_neurons_by(double fraction, const Mat<T> *X)
+{
+	if (!Layer::built_)
+		throw std::logic_error("logic error: the model must be built to prune its neurons");
+	if (!(fraction >= 0.0 && fraction < 1.0))
+		throw std::invalid_argument("invalid argument: the fraction of neurons to prune must be in [0, 1)");
+
+	// The layers that map every neuron on its own, they can go between the pruned pair
+	auto elementwise = [](const Layer &layer) {
+		return dynamic_cast<const BatchNorm<T> *>(&layer) != nullptr || dynamic_cast<const Dropout<T> *>(&layer) != nullptr;
+	};
+
+	// The input of the layer i, through the layers before it already pruned
+	Mat<T> A = X != nullptr ? *X : Mat<T>(1, 1);
+	std::vector<Mat<T> *> replaced;
+	std::size_t nremoved = 0;
+	for (std::size_t i = 0; i < layers_.size(); i++) {
+		auto *dense = dynamic_cast<Dense<T> *>(layers_[i].get());
+		std::size_t j = i + 1;
+		while (dense != nullptr && j < layers_.size() && elementwise(*layers_[j]))
+			j++;
+		auto *next = dense != nullptr && j < layers_.size() ? dynamic_cast<Dense<T> *>(layers_[j].get()) : nullptr;
+		if (next == nullptr) {
+			if (X != nullptr)
+				A = (*layers_[i])(A);
+			continue;
+		}
+
+		const Mat<T> &W = dense->get_weights();
+		const Mat<T> &B = dense->get_bias();
+		const Mat<T> &W_next = next->get_weights();
+		std::size_t m = W.rows();
+		std::vector<T> out_norms(m, static_cast<T>(0)), scores(m, static_cast<T>(0)), means(m, static_cast<T>(0));
+		for (std::size_t r = 0; r < W_next.rows(); r++)
+			for (std::size_t c = 0; c < m; c++)
+				out_norms[c] += W_next(r, c) * W_next(r, c);
+
+		if (X == nullptr) {
+			for (std::size_t r = 0; r < m; r++)
+				for (std::size_t c = 0; c < W.cols(); c++)
+					scores[r] += W(r, c) * W(r, c);
+
+			// The output of a neuron without its inputs, act(B) through the layers in between as in inference
+			Mat<T> V = dense->has_activation_func() ? (*dense->get_activation_func())(B) : B;
+			for (std::size_t k = i + 1; k < j; k++) {
+				auto *norm = dynamic_cast<BatchNorm<T> *>(layers_[k].get());
+				if (norm == nullptr)
+					continue;
+				for (std::size_t r = 0; r < m; r++) {
+					T scale = norm->get_gamma()(r, 0) / std::sqrt(norm->get_running_var()(r, 0) + norm->get_eps());
+					V(r, 0) = scale * (V(r, 0) - norm->get_running_mean()(r, 0)) + norm->get_beta()(r, 0);
+					scores[r] *= scale * scale;
+				}
+				if (norm->has_activation_func())
+					V = (*norm->get_activation_func())(V);
+			}
+			for (std::size_t r = 0; r < m; r++)
+				means[r] = V(r, 0);
+		} else {
+			// The variance of every activation over the batch, at the input of the next Dense
+			A = (*dense)(A);
+			for (std::size_t k = i + 1; k < j; k++)
+				A = (*layers_[k])(A);
+			T nsamples = static_cast<T>(A.cols());
+			for (std::size_t r = 0; r < m; r++) {
+				for (std::size_t c = 0; c < A.cols(); c++)
+					means[r] += A(r, c);
+				means[r] /= nsamples;
+				for (std::size_t c = 0; c < A.cols(); c++)
+					scores[r] += (A(r, c) - means[r]) * (A(r, c) - means[r]);
+				scores[r] /= nsamples;
+			}
+		}
+		for (std::size_t r = 0; r < m; r++)
+			scores[r] = std::sqrt(scores[r] * out_norms[r]);
+		// The next Dense is scored against the activations of its own input
+		std::size_t first = i;
+		i = j - 1;
+
+		// The lowest scores go, the first ones on ties
+		std::vector<std::size_t> order(m);
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&scores](std::size_t a, std::size_t b) {
+			return scores[a] < scores[b];
+		});
+		std::size_t ndropped = std::min(static_cast<std::size_t>(std::floor(fraction * static_cast<double>(m))), m - 1);
+		if (ndropped == 0)
+			continue;
+		std::vector<bool> dropped(m, false);
+		for (std::size_t k = 0; k < ndropped; k++)
+			dropped[order[k]] = true;
+		std::vector<std::size_t> kept;
+		for (std::size_t r = 0; r < m; r++)
+			if (!dropped[r])
+				kept.push_back(r);
+
+		auto shrunk = std::make_unique<Dense<T>>(W.cols(), kept.size(), dense->get_activation_func());
+		auto shrunk_next = std::make_unique<Dense<T>>(kept.size(), W_next.rows(), next->get_activation_func());
+		for (auto *layer : {shrunk.get(), shrunk_next.get()}) {
+			layer->build();
+			layer->set_optimizer(WeightedLayer::optimizer_);
+		}
+		shrunk->set_name(dense->get_name());
+		shrunk_next->set_name(next->get_name());
+
+		Mat<T> &W_shrunk = shrunk->get_weights();
+		Mat<T> &W_next_shrunk = shrunk_next->get_weights();
+		Mat<T> &B_next_shrunk = shrunk_next->get_bias();
+		B_next_shrunk = next->get_bias();
+		// A dropped neuron leaves its mean activation, or its output without inputs, to the next bias
+		for (std::size_t r = 0; r < m; r++)
+			if (dropped[r])
+				for (std::size_t o = 0; o < W_next.rows(); o++)
+					B_next_shrunk(o, 0) += W_next(o, r) * means[r];
+		for (std::size_t k = 0; k < kept.size(); k++) {
+			for (std::size_t c = 0; c < W.cols(); c++)
+				W_shrunk(k, c) = W(kept[k], c);
+			shrunk->get_bias()(k, 0) = B(kept[k], 0);
+			for (std::size_t o = 0; o < W_next.rows(); o++)
+				W_next_shrunk(o, k) = W_next(o, kept[k]);
+		}
+
+		// The layers in between keep the rows of the kept neurons
+		for (std::size_t k = first + 1; k < j; k++) {
+			std::unique_ptr<Layer> between;
+			if (auto *norm = dynamic_cast<BatchNorm<T> *>(layers_[k].get())) {
+				auto shrunk_norm = std::make_unique<BatchNorm<T>>(kept.size(), norm->get_activation_func(),
+										  norm->get_momentum(), norm->get_eps());
+				shrunk_norm->build();
+				shrunk_norm->set_optimizer(WeightedLayer::optimizer_);
+				for (std::size_t r = 0; r < kept.size(); r++) {
+					shrunk_norm->get_gamma()(r, 0) = norm->get_gamma()(kept[r], 0);
+					shrunk_norm->get_beta()(r, 0) = norm->get_beta()(kept[r], 0);
+					shrunk_norm->get_running_mean()(r, 0) = norm->get_running_mean()(kept[r], 0);
+					shrunk_norm->get_running_var()(r, 0) = norm->get_running_var()(kept[r], 0);
+				}
+				between = std::move(shrunk_norm);
+			} else {
+				auto *dropout = static_cast<Dropout<T> *>(layers_[k].get());
+				between = std::make_unique<Dropout<T>>(kept.size(), dropout->get_rate(), dropout->get_seed());
+				between->build();
+			}
+			between->set_name(layers_[k]->get_name());
+			between->set_training(layers_[k]->is_training());
+			for (Mat<T> *param : layers_[k]->template parameters<T>())
+				replaced.push_back(param);
+			layers_[k] = std::move(between);
+		}
+
+		// The activations of the kept neurons, for the next layer to score
+		if (X != nullptr) {
+			Mat<T> kept_rows(kept.size(), A.cols());
+			for (std::size_t k = 0; k < kept.size(); k++)
+				std::copy(&A(kept[k], 0), &A(kept[k], 0) + A.cols(), &kept_rows(k, 0));
+			A = std::move(kept_rows);
+		}
+
+		for (auto *layer : {dense, next})
+			for (Mat<T> *param : layer->template parameters<T>())
+				replaced.push_back(param);
+		shrunk->set_training(dense->is_training());
+		shrunk_next->set_training(next->is_training());
+		layers_[first] = std::move(shrunk);
+		layers_[j] = std::move(shrunk_next);
+		nremoved += ndropped;
+	}
+
+	// Only the shrunk layers are new, the others keep their weights
+	if (nremoved > 0)
+		replace_parameters(replaced);
+	return nremoved;
+}
+
+template <typename T>
+Sequential<T> &nn::models::Sequential<T>::set_shuffle(bool shuffle)
+{
+	shuffle_ = shuffle;
+	return *this;
+}
+
+template <typename T>
+Sequential<T> &nn::models::Sequential<T>::set_seed(unsigned int seed)
+{
+	seed_ = seed;
+	return *this;
+}
+
+template <typename T>
+Sequential<T> &nn::models::Sequential<T>::set_prefetch(std::size_t nbuffers)
+{
+	if (nbuffers == 0)
+		throw std::invalid_argument("invalid argument: at least one prefetch buffer is needed");
+	prefetch_ = nbuffers;
+	return *this;
+}
+
+template <typename T>
+bool nn::models::Sequential<T>::get_shuffle(void) const
+{
+	return shuffle_;
+}
+
+template <typename T>
+unsigned int nn::models::Sequential<T>::get_seed(void) const
+{
+	return seed_;
+}
+
+template <typename T>
+std::size_t nn::models::Sequential<T>::get_prefetch(void) const
+{
+	return prefetch_;
+}
+
+template <typename T>
+Sequential<T> &nn::models::Sequential<T>::set_fit_mode(FitMode mode, std::size_t nthreads)
+{
+	fit_mode_ = mode;
+	nthreads_ = nthreads == 0 ? parallel::hardware_threads() : nthreads;
+	return *this;
+}
+
+template <typename T>
+FitMode nn::models::Sequential<T>::get_fit_mode(void) const
+{
+	return fit_mode_;
+}
+
+template <typename T>
+std::size_t nn::models::Sequential<T>::get_nthreads(void) const
+{
+	return nthreads_;
+}
+
+template <typename T>
+Sequential<T> &nn::models::Sequential<T>::set_checkpointer(std::shared_ptr<io::Checkpointer<T>> checkpointer)
+{
+	checkpointer_ = checkpointer;
+	return *this;
+}
+
+template <typename T>
+Sequential<T> &nn::models::Sequential<T>::set_flat_parameters(bool flat)
+{
+	flat_parameters_ = flat;
+	return *this;
+}
+
+template <typename T>
+bool nn::models::Sequential<T>::has_flat_parameters(void) const
+{
+	return flat_params_.get_mat_raw() != nullptr;
+}
+
+template <typename T>
+Mat<T> &nn::models::Sequential<T>::get_flat_parameters(void)
+{
+	if (!has_flat_parameters())
+		throw std::logic_error("The parameters of the model are not in a flat slab: " + Layer::name_);
+	return flat_params_;
+}
+
+template <typename T>
+const Mat<T> &nn::models::Sequential<T>::get_flat_parameters(void) const
+{
+	if (!has_flat_parameters())
+		throw std::logic_error("The parameters of the model are not in a flat slab: " + Layer::name_);
+	return flat_params_;
+}
+
+template <typename T>
+std::vector<Mat<T> *> nn::models::Sequential<T>::optimizer_parameters(void)
+{
+	std::vector<Mat<T> *> params = has_flat_parameters() ? std::vector<Mat<T> *>{&flat_params_} : params_;
+	// The tables go last, `prepare` allocates their state in this order
+	for (WeightedLayer *layer : sparse_layers_)
+		for (Mat<T> *param : layer->template sparse_parameters<T>())
+			params.push_back(param);
+	return params;
+}
+
+template <typename T>
+std::shared_ptr<nn::io::Checkpointer<T>> nn::models::Sequential<T>::get_checkpointer(void) const
+{
+	return checkpointer_;
+}
+
 template class nn::models::Sequential<float>;
 
 
@@ -0,0 +1,547 @@
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "../include/norm.hpp"
+
+using namespace nn::mathops;
+using namespace nn::layers;
+
+template <typename T>
+nn::layers::BatchNorm<T>::BatchNorm(std::size_t size, std::shared_ptr<Layer> activation_func, T momentum, T eps)
+	: WeightedLayer(size, size, "BatchNorm", activation_func), momentum_(momentum), eps_(eps)
+{
+	if (size == 0)
+		throw std::invalid_argument("invalid argument: a batch normalization needs features");
+	if (momentum < 0 || momentum > 1 || eps <= 0)
+		throw std::invalid_argument("invalid argument: the momentum goes in [0, 1] and eps is positive");
+}
+
+template <typename T>
+Mat<T> &nn::layers::BatchNorm<T>::get_gamma(void) const
+{
+	if (gamma_ == nullptr)
+		throw std::invalid_argument("BatchNorm layer not built yet");
+	return *gamma_;
+}
+
+template <typename T>
+Mat<T> &nn::layers::BatchNorm<T>::get_beta(void) const
+{
+	if (beta_ == nullptr)
+		throw std::invalid_argument("BatchNorm layer not built yet");
+	return *beta_;
+}
+
+template <typename T>
+Mat<T> &nn::layers::BatchNorm<T>::get_running_mean(void) const
+{
+	if (running_mean_ == nullptr)
+		throw std::invalid_argument("BatchNorm layer not built yet");
+	return *running_mean_;
+}
+
+template <typename T>
+Mat<T> &nn::layers::BatchNorm<T>::get_running_var(void) const
+{
+	if (running_var_ == nullptr)
+		throw std::invalid_argument("BatchNorm layer not built yet");
+	return *running_var_;
+}
+
+template <typename T>
+T nn::layers::BatchNorm<T>::get_momentum(void) const
+{
+	return momentum_;
+}
+
+template <typename T>
+T nn::layers::BatchNorm<T>::get_eps(void) const
+{
+	return eps_;
+}
+
+template <typename T>
+BatchNorm<T> &nn::layers::BatchNorm<T>::build(const Shape &input_shape, const Shape &output_shape)
+{
+	if (input_shape != input_shape_ || output_shape != output_shape_)
+		throw std::invalid_argument("Invalid shapes for the features of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+BatchNorm<T> &nn::layers::BatchNorm<T>::build(std::size_t input_size, std::size_t output_size)
+{
+	if (input_size != input_shape_.rows || output_size != output_shape_.rows)
+		throw std::invalid_argument("Invalid sizes for the features of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+BatchNorm<T> &nn::layers::BatchNorm<T>::build(void)
+{
+	alloc_weights();
+	mean_.resize(input_shape_.rows);
+	invstd_.resize(input_shape_.rows);
+
+	if (activation_func_ != nullptr)
+		activation_func_->build(output_shape_, output_shape_);
+
+	// After the activation, its in place functions are captured
+	register_funcs();
+
+	built_ = true;
+	return *this;
+}
+
+template <typename T>
+BatchNorm<T> &nn::layers::BatchNorm<T>::alloc_weights(void)
+{
+	grad_gamma_ = nullptr;
+	grad_beta_ = nullptr;
+	grad_count_ = 0;
+
+	// The statistics start as the identity
+	running_mean_ = std::make_unique<Mat<T>>(Shape{input_shape_.rows, 1});
+	running_var_ = std::make_unique<Mat<T>>(Shape{input_shape_.rows, 1});
+	running_mean_->fill(static_cast<T>(0));
+	running_var_->fill(static_cast<T>(1));
+
+	// Weights moved to external memory by `bind_parameters` are kept
+	if (weights_bound_)
+		return *this;
+
+	gamma_ = std::make_unique<Mat<T>>(Shape{input_shape_.rows, 1});
+	beta_ = std::make_unique<Mat<T>>(Shape{input_shape_.rows, 1});
+	gamma_->fill(static_cast<T>(1));
+	beta_->fill(static_cast<T>(0));
+	return *this;
+}
+
+template <typename T>
+BatchNorm<T> &nn::layers::BatchNorm<T>::alloc_gradients(void)
+{
+	if (grad_gamma_ != nullptr)
+		return *this;
+
+	grad_gamma_ = std::make_unique<Mat<T>>(gamma_->get_shape());
+	grad_beta_ = std::make_unique<Mat<T>>(beta_->get_shape());
+	grad_gamma_->fill(static_cast<T>(0));
+	grad_beta_->fill(static_cast<T>(0));
+	grad_count_ = 0;
+	return *this;
+}
+
+template <typename T>
+void nn::layers::BatchNorm<T>::normalize(const Mat<T> &X, Mat<T> &Z, T *mean, T *invstd, bool update)
+{
+	std::size_t n = input_shape_.rows;
+	if (X.rows() != n)
+		throw std::invalid_argument("invalid argument: the features don't match the layer: " + name_);
+
+	if (!training_) {
+		const T *running_mean = running_mean_->get_mat_raw();
+		const T *running_var = running_var_->get_mat_raw();
+		for (std::size_t i = 0; i < n; i++) {
+			mean[i] = running_mean[i];
+			invstd[i] = static_cast<T>(1) / std::sqrt(running_var[i] + eps_);
+		}
+		MatDispatchOps::Mat_batchnorm_forward(X.get_mat_raw(), Z.get_mat_raw(), gamma_->get_mat_raw(),
+						      beta_->get_mat_raw(), mean, invstd, X.get_shape(), eps_, false);
+		return;
+	}
+
+	if (X.cols() < 2)
+		throw std::invalid_argument("invalid argument: the statistics of a batch need two samples or more: " + name_);
+	MatDispatchOps::Mat_batchnorm_forward(X.get_mat_raw(), Z.get_mat_raw(), gamma_->get_mat_raw(),
+					      beta_->get_mat_raw(), mean, invstd, X.get_shape(), eps_, true);
+	if (!update)
+		return;
+
+	// The running variance is the unbiased one
+	std::lock_guard<std::mutex> lock(stats_mutex_);
+	T *running_mean = running_mean_->get_mat_raw();
+	T *running_var = running_var_->get_mat_raw();
+	T unbiased = static_cast<T>(X.cols()) / static_cast<T>(X.cols() - 1);
+	for (std::size_t i = 0; i < n; i++) {
+		T var = static_cast<T>(1) / (invstd[i] * invstd[i]) - eps_;
+		running_mean[i] += momentum_ * (mean[i] - running_mean[i]);
+		running_var[i] += momentum_ * (var * unbiased - running_var[i]);
+	}
+}
+
+template <typename T>
+void nn::layers::BatchNorm<T>::normalize_backward(const Mat<T> &X, const Mat<T> &dZ, const T *mean, const T *invstd,
+						  Mat<T> *dX, Mat<T> *grads) const
+{
+	MatDispatchOps::Mat_batchnorm_backward(X.get_mat_raw(), dZ.get_mat_raw(), gamma_->get_mat_raw(), mean, invstd,
+					       dX == nullptr ? nullptr : dX->get_mat_raw(),
+					       grads == nullptr ? nullptr : grads[0].get_mat_raw(),
+					       grads == nullptr ? nullptr : grads[1].get_mat_raw(),
+					       X.get_shape(), training_);
+}
+
+template <typename T>
+BatchNorm<T> &nn::layers::BatchNorm<T>::register_funcs(void)
+{
+	register_func<Mat<T>, const Mat<T> &>
+		("logits", [this](const Mat<T> &X) -> Mat<T> {
+			std::vector<T> mean(input_shape_.rows), invstd(input_shape_.rows);
+			Mat<T> Z(X.get_shape());
+			normalize(X, Z, mean.data(), invstd.data(), true);
+			return Z;
+		});
+
+	register_func<Mat<T>, const Mat<T> &>
+		("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+			Mat<T> Z = logits<T>(X);
+			if (activation_func_ != nullptr)
+				return (*activation_func_)(Z);
+			return Z;
+		});
+
+	// The statistics of X are taken again, the forward already moved the running ones
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward_logits", [this](const Mat<T> &X, const Mat<T> &dZ, Mat<T> *grads) -> Mat<T> {
+			std::vector<T> mean(input_shape_.rows), invstd(input_shape_.rows);
+			Mat<T> dX(X.get_shape());
+			normalize(X, dX, mean.data(), invstd.data(), false);
+			normalize_backward(X, dZ, mean.data(), invstd.data(), &dX, grads);
+			return dX;
+		});
+
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			std::vector<T> mean(input_shape_.rows), invstd(input_shape_.rows);
+			Mat<T> Z(X.get_shape());
+			normalize(X, Z, mean.data(), invstd.data(), false);
+			if (activation_func_ == nullptr) {
+				normalize_backward(X, dY, mean.data(), invstd.data(), &Z, grads);
+				return Z;
+			}
+
+			Mat<T> dZ = activation_func_->backward(Z, dY, static_cast<Mat<T> *>(nullptr));
+			normalize_backward(X, dZ, mean.data(), invstd.data(), &Z, grads);
+			return Z;
+		});
+
+	// The in place functions of the activation are looked up once, not on every call
+	ForwardInto<T> activation_forward;
+	BackwardInto<T> activation_backward;
+	if (activation_func_ != nullptr && activation_func_->can_run_into<T>()) {
+		activation_forward = activation_func_->get_forward_into<T>();
+		activation_backward = activation_func_->get_backward_into<T>();
+	}
+
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [this, activation_forward](const Mat<T> &X, Mat<T> &Y) -> void {
+			normalize(X, Y, mean_.data(), invstd_.data(), true);
+			if (activation_forward)
+				activation_forward(Y, Y);
+			else if (activation_func_ != nullptr)
+				Y = (*activation_func_)(Y);
+		});
+
+	// The statistics of the forward are reused, X is only read once more
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [this, activation_backward](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			if (activation_backward) {
+				activation_backward(Y, Y, dY, dY, nullptr);
+			} else if (activation_func_ != nullptr) {
+				Mat<T> Z(X.get_shape());
+				MatDispatchOps::Mat_batchnorm_forward(X.get_mat_raw(), Z.get_mat_raw(), gamma_->get_mat_raw(),
+								      beta_->get_mat_raw(), mean_.data(), invstd_.data(),
+								      X.get_shape(), eps_, false);
+				dY = activation_func_->backward(Z, dY, static_cast<Mat<T> *>(nullptr));
+			}
+			normalize_backward(X, dY, mean_.data(), invstd_.data(), &dX, grads);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("fit", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			std::vector<T> mean(input_shape_.rows), invstd(input_shape_.rows);
+			Mat<T> Z(input.get_shape());
+			normalize(input, Z, mean.data(), invstd.data(), false);
+			Mat<T> grads[2] = {Mat<T>(gamma_->get_shape()).fill(static_cast<T>(0)),
+					   Mat<T>(beta_->get_shape()).fill(static_cast<T>(0))};
+			normalize_backward(input, signal_update, mean.data(), invstd.data(), nullptr, grads);
+			optimizer_->apply(*gamma_, grads[0]);
+			optimizer_->apply(*beta_, grads[1]);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("accumulate", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			alloc_gradients();
+			std::vector<T> mean(input_shape_.rows), invstd(input_shape_.rows);
+			Mat<T> Z(input.get_shape());
+			normalize(input, Z, mean.data(), invstd.data(), false);
+			Mat<T> grads[2] = {Mat<T>(grad_gamma_->get_shape(), grad_gamma_->get_mat_raw()),
+					   Mat<T>(grad_beta_->get_shape(), grad_beta_->get_mat_raw())};
+			normalize_backward(input, signal_update, mean.data(), invstd.data(), nullptr, grads);
+			grad_count_ += input.cols();
+		});
+
+	register_func<void>
+		("step", [this]() -> void {
+			if (grad_count_ == 0)
+				return;
+
+			T scale = static_cast<T>(1) / static_cast<T>(grad_count_);
+			*grad_gamma_ *= scale;
+			*grad_beta_ *= scale;
+			optimizer_->apply(*gamma_, *grad_gamma_);
+			optimizer_->apply(*beta_, *grad_beta_);
+
+			grad_gamma_->fill(static_cast<T>(0));
+			grad_beta_->fill(static_cast<T>(0));
+			grad_count_ = 0;
+		});
+
+	register_func<void>
+		("zero_grad", [this]() -> void {
+			if (grad_gamma_ == nullptr)
+				return;
+			grad_gamma_->fill(static_cast<T>(0));
+			grad_beta_->fill(static_cast<T>(0));
+			grad_count_ = 0;
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("gradients", [this]() -> std::vector<Mat<T> *> {
+			alloc_gradients();
+			return {grad_gamma_.get(), grad_beta_.get()};
+		});
+
+	// The running statistics aren't trained, they aren't parameters
+	register_func<std::vector<Mat<T> *>>
+		("parameters", [this]() -> std::vector<Mat<T> *> {
+			return {gamma_.get(), beta_.get()};
+		});
+
+	register_func<void, const std::vector<T *> &>
+		("bind_parameters", [this](const std::vector<T *> &memory) -> void {
+			if (memory.size() != 2)
+				throw std::invalid_argument("invalid argument: a BatchNorm layer binds two matrices");
+			// The matrices are replaced in place, pointers to them (optimizer state) stay valid
+			*gamma_ = Mat<T>(gamma_->get_shape(), memory[0]);
+			*beta_ = Mat<T>(beta_->get_shape(), memory[1]);
+			weights_bound_ = true;
+		});
+
+	return *this;
+}
+
+template <typename T>
+nn::layers::LayerNorm<T>::LayerNorm(std::size_t size, T eps)
+	: WeightedLayer(size, size, "LayerNorm"), eps_(eps)
+{
+	if (size == 0)
+		throw std::invalid_argument("invalid argument: a layer normalization needs features");
+	if (eps <= 0)
+		throw std::invalid_argument("invalid argument: eps must be positive");
+}
+
+template <typename T>
+Mat<T> &nn::layers::LayerNorm<T>::get_gamma(void) const
+{
+	if (gamma_ == nullptr)
+		throw std::invalid_argument("LayerNorm layer not built yet");
+	return *gamma_;
+}
+
+template <typename T>
+Mat<T> &nn::layers::LayerNorm<T>::get_beta(void) const
+{
+	if (beta_ == nullptr)
+		throw std::invalid_argument("LayerNorm layer not built yet");
+	return *beta_;
+}
+
+template <typename T>
+T nn::layers::LayerNorm<T>::get_eps(void) const
+{
+	return eps_;
+}
+
+template <typename T>
+LayerNorm<T> &nn::layers::LayerNorm<T>::build(const Shape &input_shape, const Shape &output_shape)
+{
+	if (input_shape != input_shape_ || output_shape != output_shape_)
+		throw std::invalid_argument("Invalid shapes for the features of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+LayerNorm<T> &nn::layers::LayerNorm<T>::build(std::size_t input_size, std::size_t output_size)
+{
+	if (input_size != input_shape_.rows || output_size != output_shape_.rows)
+		throw std::invalid_argument("Invalid sizes for the features of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+LayerNorm<T> &nn::layers::LayerNorm<T>::build(void)
+{
+	alloc_weights();
+	register_funcs();
+	built_ = true;
+	return *this;
+}
+
+template <typename T>
+LayerNorm<T> &nn::layers::LayerNorm<T>::alloc_weights(void)
+{
+	grad_gamma_ = nullptr;
+	grad_beta_ = nullptr;
+	grad_count_ = 0;
+
+	// Weights moved to external memory by `bind_parameters` are kept
+	if (weights_bound_)
+		return *this;
+
+	gamma_ = std::make_unique<Mat<T>>(Shape{input_shape_.rows, 1});
+	beta_ = std::make_unique<Mat<T>>(Shape{input_shape_.rows, 1});
+	gamma_->fill(static_cast<T>(1));
+	beta_->fill(static_cast<T>(0));
+	return *this;
+}
+
+template <typename T>
+LayerNorm<T> &nn::layers::LayerNorm<T>::alloc_gradients(void)
+{
+	if (grad_gamma_ != nullptr)
+		return *this;
+
+	grad_gamma_ = std::make_unique<Mat<T>>(gamma_->get_shape());
+	grad_beta_ = std::make_unique<Mat<T>>(beta_->get_shape());
+	grad_gamma_->fill(static_cast<T>(0));
+	grad_beta_->fill(static_cast<T>(0));
+	grad_count_ = 0;
+	return *this;
+}
+
+template <typename T>
+LayerNorm<T> &nn::layers::LayerNorm<T>::register_funcs(void)
+{
+	register_func<Mat<T>, const Mat<T> &>
+		("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+			if (X.rows() != input_shape_.rows)
+				throw std::invalid_argument("invalid argument: the features don't match the layer: " + name_);
+			std::vector<T> mean(X.cols()), invstd(X.cols());
+			Mat<T> Y(X.get_shape());
+			MatDispatchOps::Mat_layernorm_forward(X.get_mat_raw(), nullptr, nullptr, Y.get_mat_raw(),
+							      gamma_->get_mat_raw(), beta_->get_mat_raw(), mean.data(),
+							      invstd.data(), X.get_shape(), eps_);
+			return Y;
+		});
+
+	// The statistics of X are taken again into dX, then it is overwritten
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			std::vector<T> mean(X.cols()), invstd(X.cols());
+			Mat<T> dX(X.get_shape());
+			MatDispatchOps::Mat_layernorm_forward(X.get_mat_raw(), nullptr, nullptr, dX.get_mat_raw(),
+							      gamma_->get_mat_raw(), beta_->get_mat_raw(), mean.data(),
+							      invstd.data(), X.get_shape(), eps_);
+			MatDispatchOps::Mat_layernorm_backward(X.get_mat_raw(), dY.get_mat_raw(), gamma_->get_mat_raw(),
+							       mean.data(), invstd.data(), dX.get_mat_raw(),
+							       grads == nullptr ? nullptr : grads[0].get_mat_raw(),
+							       grads == nullptr ? nullptr : grads[1].get_mat_raw(), X.get_shape());
+			return dX;
+		});
+
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [this](const Mat<T> &X, Mat<T> &Y) -> void {
+			// The statistics only grow, the steady state doesn't allocate
+			if (mean_.size() < X.cols()) {
+				mean_.resize(X.cols());
+				invstd_.resize(X.cols());
+			}
+			MatDispatchOps::Mat_layernorm_forward(X.get_mat_raw(), nullptr, nullptr, Y.get_mat_raw(),
+							      gamma_->get_mat_raw(), beta_->get_mat_raw(), mean_.data(),
+							      invstd_.data(), X.get_shape(), eps_);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [this](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			((void) Y);
+			MatDispatchOps::Mat_layernorm_backward(X.get_mat_raw(), dY.get_mat_raw(), gamma_->get_mat_raw(),
+							       mean_.data(), invstd_.data(), dX.get_mat_raw(),
+							       grads == nullptr ? nullptr : grads[0].get_mat_raw(),
+							       grads == nullptr ? nullptr : grads[1].get_mat_raw(), X.get_shape());
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("fit", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			Mat<T> grads[2] = {Mat<T>(gamma_->get_shape()).fill(static_cast<T>(0)),
+					   Mat<T>(beta_->get_shape()).fill(static_cast<T>(0))};
+			backward<T>(input, signal_update, grads);
+			optimizer_->apply(*gamma_, grads[0]);
+			optimizer_->apply(*beta_, grads[1]);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("accumulate", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			alloc_gradients();
+			Mat<T> grads[2] = {Mat<T>(grad_gamma_->get_shape(), grad_gamma_->get_mat_raw()),
+					   Mat<T>(grad_beta_->get_shape(), grad_beta_->get_mat_raw())};
+			backward<T>(input, signal_update, grads);
+			grad_count_ += input.cols();
+		});
+
+	register_func<void>
+		("step", [this]() -> void {
+			if (grad_count_ == 0)
+				return;
+
+			T scale = static_cast<T>(1) / static_cast<T>(grad_count_);
+			*grad_gamma_ *= scale;
+			*grad_beta_ *= scale;
+			optimizer_->apply(*gamma_, *grad_gamma_);
+			optimizer_->apply(*beta_, *grad_beta_);
+
+			grad_gamma_->fill(static_cast<T>(0));
+			grad_beta_->fill(static_cast<T>(0));
+			grad_count_ = 0;
+		});
+
+	register_func<void>
+		("zero_grad", [this]() -> void {
+			if (grad_gamma_ == nullptr)
+				return;
+			grad_gamma_->fill(static_cast<T>(0));
+			grad_beta_->fill(static_cast<T>(0));
+			grad_count_ = 0;
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("gradients", [this]() -> std::vector<Mat<T> *> {
+			alloc_gradients();
+			return {grad_gamma_.get(), grad_beta_.get()};
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("parameters", [this]() -> std::vector<Mat<T> *> {
+			return {gamma_.get(), beta_.get()};
+		});
+
+	register_func<void, const std::vector<T *> &>
+		("bind_parameters", [this](const std::vector<T *> &memory) -> void {
+			if (memory.size() != 2)
+				throw std::invalid_argument("invalid argument: a LayerNorm layer binds two matrices");
+			// The matrices are replaced in place, pointers to them (optimizer state) stay valid
+			*gamma_ = Mat<T>(gamma_->get_shape(), memory[0]);
+			*beta_ = Mat<T>(beta_->get_shape(), memory[1]);
+			weights_bound_ = true;
+		});
+
+	return *this;
+}
+
+template class nn::layers::BatchNorm<float>;
+// template class nn::layers::BatchNorm<double>;
+template class nn::layers::LayerNorm<float>;
+// template class nn::layers::LayerNorm<double>;
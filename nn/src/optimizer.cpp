@@ -2,10 +2,43 @@
 // data based in the model
 
 #include "../include/optimizer.hpp"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <mutex>
+#include <stdexcept>
 
 using namespace nn::optimizers;
 
+// check_rows: the shapes of a sparse step, `grad` has a row per entry of `rows`
+template <typename T>
+static void check_rows(const Mat<T> &param, const Mat<T> &grad, const std::vector<std::size_t> &rows)
+{
+	if (grad.rows() != rows.size() || (!rows.empty() && grad.cols() != param.cols()))
+		throw std::invalid_argument("invalid argument: the gradient doesn't have one row per row to step");
+	for (std::size_t row : rows)
+		if (row >= param.rows())
+			throw std::invalid_argument("invalid argument: a row to step is out of the parameter");
+}
+
+/*
+ * for_each_block: the contiguous blocks of a step as (offset in the
+ * parameter and its state, offset in the gradient, length). All of it at
+ * once, or with `rows` the row rows[k] against the row k of the gradient
+ */
+template <typename T, typename Block>
+static void for_each_block(const Mat<T> &param, const std::vector<std::size_t> *rows, Block block)
+{
+	if (rows == nullptr) {
+		block(0, 0, param.rows() * param.cols());
+		return;
+	}
+
+	std::size_t n = param.cols();
+	for (std::size_t k = 0; k < rows->size(); k++)
+		block((*rows)[k] * n, k * n, n);
+}
+
 nn::optimizers::Optimizer::Optimizer(std::string name, double learning_rate)
 	: name_(name), learning_rate_(learning_rate)
 {
@@ -125,6 +158,23 @@ GradientDescentOptimizer<T> &nn::optimizers::GradientDescentOptimizer<T>::regist
 			bias -= grad * static_cast<T>(learning_rate_);
 		});
 
+	register_func<void, Mat<T> &, const Mat<T> &>(
+		"apply",
+		[this](Mat<T> &param, const Mat<T> &grad) -> void {
+			// θ_{k + 1} = θ_{k} - η * dL/dθ, in place
+			param.axpy(-static_cast<T>(learning_rate_), grad);
+		});
+
+	register_func<void, Mat<T> &, const Mat<T> &, const std::vector<std::size_t> &>(
+		"apply_rows",
+		[this](Mat<T> &param, const Mat<T> &grad, const std::vector<std::size_t> &rows) -> void {
+			check_rows(param, grad, rows);
+			for_each_block(param, &rows, [&](std::size_t p, std::size_t g, std::size_t n) {
+				MatDispatchOps::Mat_axpy(grad.get_mat_raw() + g, param.get_mat_raw() + p, Shape{1, n},
+							 -static_cast<T>(learning_rate_));
+			});
+		});
+
 	return *this;
 }
 
@@ -132,3 +182,335 @@ GradientDescentOptimizer<T> &nn::optimizers::GradientDescentOptimizer<T>::regist
 
 template class nn::optimizers::GradientDescentOptimizer<float>;
 // template class nn::optimizers::GradientDescentOptimizer<float>;
+
+
+template <typename T>
+nn::optimizers::OptimizerState<T>::OptimizerState(std::size_t nmoments, bool counter)
+	: nmoments_(nmoments), counter_(counter)
+{
+}
+
+template <typename T>
+typename OptimizerState<T>::Slot &nn::optimizers::OptimizerState<T>::get(const Mat<T> &param)
+{
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex_);
+		auto it = index_.find(&param);
+		if (it != index_.end() && it->second->shape == param.get_shape())
+			return *it->second;
+	}
+
+	return allocate(param);
+}
+
+template <typename T>
+OptimizerState<T> &nn::optimizers::OptimizerState<T>::prepare(const std::vector<Mat<T> *> &params)
+{
+	for (Mat<T> *param : params)
+		get(*param);
+	return *this;
+}
+
+template <typename T>
+OptimizerState<T> &nn::optimizers::OptimizerState<T>::forget(const Mat<T> &param)
+{
+	std::unique_lock<std::shared_mutex> lock(mutex_);
+	auto it = index_.find(&param);
+	if (it == index_.end())
+		return *this;
+
+	erase(it);
+	return *this;
+}
+
+template <typename T>
+std::vector<Mat<T> *> nn::optimizers::OptimizerState<T>::tensors(void)
+{
+	std::shared_lock<std::shared_mutex> lock(mutex_);
+	std::vector<Mat<T> *> tensors;
+	for (auto &slot : slots_)
+		for (auto &tensor : slot->tensors)
+			tensors.push_back(&tensor);
+	return tensors;
+}
+
+template <typename T>
+std::size_t nn::optimizers::OptimizerState<T>::size(void) const
+{
+	std::shared_lock<std::shared_mutex> lock(mutex_);
+	return slots_.size();
+}
+
+template <typename T>
+typename OptimizerState<T>::Slot &nn::optimizers::OptimizerState<T>::allocate(const Mat<T> &param)
+{
+	std::unique_lock<std::shared_mutex> lock(mutex_);
+	auto it = index_.find(&param);
+	if (it != index_.end()) {
+		if (it->second->shape == param.get_shape())
+			return *it->second;
+
+		// The model was rebuilt (e.g. a new slab), the old moments mean nothing for it
+		erase(it);
+	}
+
+	// One block: [moment 0 | ... | moment n - 1 | counter], every segment aligned
+	const Shape shape = param.get_shape();
+	std::size_t segment = AlignedBuffer<T>::round_up(shape.rows * shape.cols);
+	std::size_t counter = counter_ ? AlignedBuffer<T>::round_up(1) : 0;
+
+	auto slot = std::make_unique<Slot>();
+	slot->shape = shape;
+	slot->memory.resize(segment * nmoments_ + counter);
+	T *memory = slot->memory.data();
+	// Mat isn't nothrow movable, a reallocation would copy the views into owned memory
+	slot->tensors.reserve(nmoments_ + 1);
+	for (std::size_t i = 0; i < nmoments_; i++)
+		slot->tensors.emplace_back(shape, memory + i * segment);
+	if (counter_)
+		slot->tensors.emplace_back(Shape{1, 1}, memory + nmoments_ * segment);
+
+	Slot &ref = *slot;
+	index_.emplace(&param, slot.get());
+	slots_.push_back(std::move(slot));
+	return ref;
+}
+
+template <typename T>
+void nn::optimizers::OptimizerState<T>::erase(typename std::unordered_map<const Mat<T> *, Slot *>::iterator it)
+{
+	Slot *old = it->second;
+	index_.erase(it);
+	slots_.erase(std::find_if(slots_.begin(), slots_.end(),
+				  [old](const std::unique_ptr<Slot> &slot) { return slot.get() == old; }));
+}
+
+template class nn::optimizers::OptimizerState<float>;
+// template class nn::optimizers::OptimizerState<double>;
+
+
+/*
+ * The entries shared by the stateful optimizers, `step(param, grad, slot,
+ * rows)` is their fused update, over all of `param` if `rows` is nullptr or
+ * else over those rows (see `for_each_block`). The per sample `update`
+ * builds dL/dW = dL/dZ . X^T in the scratch of the slot (allocated on its
+ * first use) and then takes the same step
+ */
+template <typename T, typename Step>
+static void register_stateful(Optimizer &optimizer, OptimizerState<T> &state, Step step)
+{
+	optimizer.register_func<void, Mat<T> &, const Mat<T> &, const Mat<T> &>(
+		"update",
+		[&state, step](Mat<T> &weights, const Mat<T> &grad, const Mat<T> &input) -> void {
+			auto &slot = state.get(weights);
+			// Only this path has a scratch, the slots of the batched training never get one
+			std::call_once(slot.scratch_once, [&slot] { slot.scratch = Mat<T>(slot.shape); });
+			slot.scratch.fill(static_cast<T>(0));
+			slot.scratch.add_dot_transposed(grad, input);
+			step(weights, slot.scratch, slot, nullptr);
+		});
+
+	optimizer.register_func<void, Mat<T> &, const Mat<T> &>(
+		"update_bias",
+		[&state, step](Mat<T> &bias, const Mat<T> &grad) -> void {
+			step(bias, grad, state.get(bias), nullptr);
+		});
+
+	optimizer.register_func<void, Mat<T> &, const Mat<T> &>(
+		"apply",
+		[&state, step](Mat<T> &param, const Mat<T> &grad) -> void {
+			if (grad.get_shape() != param.get_shape())
+				throw std::invalid_argument("invalid argument: the gradient and the parameter have different shapes");
+			step(param, grad, state.get(param), nullptr);
+		});
+
+	optimizer.register_func<void, Mat<T> &, const Mat<T> &, const std::vector<std::size_t> &>(
+		"apply_rows",
+		[&state, step](Mat<T> &param, const Mat<T> &grad, const std::vector<std::size_t> &rows) -> void {
+			check_rows(param, grad, rows);
+			step(param, grad, state.get(param), &rows);
+		});
+
+	optimizer.register_func<std::vector<Mat<T> *>>(
+		"state",
+		[&state]() -> std::vector<Mat<T> *> {
+			return state.tensors();
+		});
+
+	optimizer.register_func<void, const std::vector<Mat<T> *> &>(
+		"prepare",
+		[&state](const std::vector<Mat<T> *> &params) -> void {
+			state.prepare(params);
+		});
+
+	optimizer.register_func<void, const Mat<T> &>(
+		"forget",
+		[&state](const Mat<T> &param) -> void {
+			state.forget(param);
+		});
+}
+
+
+template <typename T>
+nn::optimizers::MomentumOptimizer<T>::MomentumOptimizer(T learning_rate, T momentum, bool nesterov)
+	: Optimizer(nesterov ? "NesterovOptimizer" : "MomentumOptimizer", learning_rate),
+	  momentum_(momentum), nesterov_(nesterov), state_(1, false)
+{
+	if (momentum_ < static_cast<T>(0) || momentum_ >= static_cast<T>(1))
+		throw std::invalid_argument("invalid argument: the momentum must be in [0, 1)");
+	register_funcs();
+}
+
+template <typename T>
+T nn::optimizers::MomentumOptimizer<T>::get_momentum(void) const
+{
+	return momentum_;
+}
+
+template <typename T>
+bool nn::optimizers::MomentumOptimizer<T>::is_nesterov(void) const
+{
+	return nesterov_;
+}
+
+template <typename T>
+MomentumOptimizer<T> &nn::optimizers::MomentumOptimizer<T>::register_funcs(void)
+{
+	register_stateful<T>(*this, state_, [this](Mat<T> &param, const Mat<T> &grad, typename OptimizerState<T>::Slot &slot,
+						   const std::vector<std::size_t> *rows) {
+		for_each_block(param, rows, [&](std::size_t p, std::size_t g, std::size_t n) {
+			MatDispatchOps::Mat_momentum_step(param.get_mat_raw() + p, grad.get_mat_raw() + g,
+							  slot.tensors[0].get_mat_raw() + p, n,
+							  static_cast<T>(learning_rate_), momentum_, nesterov_);
+		});
+	});
+
+	return *this;
+}
+
+template class nn::optimizers::MomentumOptimizer<float>;
+// template class nn::optimizers::MomentumOptimizer<double>;
+
+
+template <typename T>
+nn::optimizers::RMSPropOptimizer<T>::RMSPropOptimizer(T learning_rate, T rho, T epsilon)
+	: Optimizer("RMSPropOptimizer", learning_rate), rho_(rho), epsilon_(epsilon), state_(1, false)
+{
+	if (rho_ < static_cast<T>(0) || rho_ >= static_cast<T>(1))
+		throw std::invalid_argument("invalid argument: rho must be in [0, 1)");
+	if (epsilon_ <= static_cast<T>(0))
+		throw std::invalid_argument("invalid argument: epsilon must be positive");
+	register_funcs();
+}
+
+template <typename T>
+T nn::optimizers::RMSPropOptimizer<T>::get_rho(void) const
+{
+	return rho_;
+}
+
+template <typename T>
+T nn::optimizers::RMSPropOptimizer<T>::get_epsilon(void) const
+{
+	return epsilon_;
+}
+
+template <typename T>
+RMSPropOptimizer<T> &nn::optimizers::RMSPropOptimizer<T>::register_funcs(void)
+{
+	register_stateful<T>(*this, state_, [this](Mat<T> &param, const Mat<T> &grad, typename OptimizerState<T>::Slot &slot,
+						   const std::vector<std::size_t> *rows) {
+		for_each_block(param, rows, [&](std::size_t p, std::size_t g, std::size_t n) {
+			MatDispatchOps::Mat_rmsprop_step(param.get_mat_raw() + p, grad.get_mat_raw() + g,
+							 slot.tensors[0].get_mat_raw() + p, n,
+							 static_cast<T>(learning_rate_), rho_, epsilon_);
+		});
+	});
+
+	return *this;
+}
+
+template class nn::optimizers::RMSPropOptimizer<float>;
+// template class nn::optimizers::RMSPropOptimizer<double>;
+
+
+template <typename T>
+nn::optimizers::AdamOptimizer<T>::AdamOptimizer(T learning_rate, T beta1, T beta2, T epsilon)
+	: AdamOptimizer("AdamOptimizer", learning_rate, beta1, beta2, epsilon, static_cast<T>(0))
+{
+}
+
+template <typename T>
+nn::optimizers::AdamOptimizer<T>::AdamOptimizer(std::string name, T learning_rate, T beta1, T beta2, T epsilon,
+						T weight_decay)
+	: Optimizer(name, learning_rate), beta1_(beta1), beta2_(beta2), epsilon_(epsilon),
+	  weight_decay_(weight_decay), state_(2, true)
+{
+	if (beta1_ < static_cast<T>(0) || beta1_ >= static_cast<T>(1) || beta2_ < static_cast<T>(0) || beta2_ >= static_cast<T>(1))
+		throw std::invalid_argument("invalid argument: the betas must be in [0, 1)");
+	if (epsilon_ <= static_cast<T>(0))
+		throw std::invalid_argument("invalid argument: epsilon must be positive");
+	if (weight_decay_ < static_cast<T>(0))
+		throw std::invalid_argument("invalid argument: the weight decay cannot be negative");
+	register_funcs();
+}
+
+template <typename T>
+T nn::optimizers::AdamOptimizer<T>::get_beta1(void) const
+{
+	return beta1_;
+}
+
+template <typename T>
+T nn::optimizers::AdamOptimizer<T>::get_beta2(void) const
+{
+	return beta2_;
+}
+
+template <typename T>
+T nn::optimizers::AdamOptimizer<T>::get_epsilon(void) const
+{
+	return epsilon_;
+}
+
+template <typename T>
+T nn::optimizers::AdamOptimizer<T>::get_weight_decay(void) const
+{
+	return weight_decay_;
+}
+
+template <typename T>
+AdamOptimizer<T> &nn::optimizers::AdamOptimizer<T>::register_funcs(void)
+{
+	register_stateful<T>(*this, state_, [this](Mat<T> &param, const Mat<T> &grad, typename OptimizerState<T>::Slot &slot,
+						   const std::vector<std::size_t> *rows) {
+		// tensors = {m, v, t}, the step counter travels with the checkpoints. A
+		// sparse step counts as one step of the whole parameter (lazy Adam)
+		T &t = slot.tensors[2](0, 0);
+		t += static_cast<T>(1);
+		double c1 = 1.0 - std::pow(static_cast<double>(beta1_), static_cast<double>(t));
+		double c2 = 1.0 - std::pow(static_cast<double>(beta2_), static_cast<double>(t));
+
+		for_each_block(param, rows, [&](std::size_t p, std::size_t g, std::size_t n) {
+			MatDispatchOps::Mat_adam_step(param.get_mat_raw() + p, grad.get_mat_raw() + g,
+						      slot.tensors[0].get_mat_raw() + p, slot.tensors[1].get_mat_raw() + p, n,
+						      static_cast<T>(learning_rate_), beta1_, beta2_, epsilon_, weight_decay_,
+						      static_cast<T>(c1), static_cast<T>(c2));
+		});
+	});
+
+	return *this;
+}
+
+template class nn::optimizers::AdamOptimizer<float>;
+// template class nn::optimizers::AdamOptimizer<double>;
+
+
+template <typename T>
+nn::optimizers::AdamWOptimizer<T>::AdamWOptimizer(T learning_rate, T weight_decay, T beta1, T beta2, T epsilon)
+	: AdamOptimizer<T>("AdamWOptimizer", learning_rate, beta1, beta2, epsilon, weight_decay)
+{
+}
+
+template class nn::optimizers::AdamWOptimizer<float>;
+// template class nn::optimizers::AdamWOptimizer<double>;
@@ -0,0 +1,511 @@
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "../include/parallel.hpp"
+#include "../include/mat.hpp"
+
+using namespace nn::parallel;
+
+// The pool and the index of the worker that runs in the current thread
+static thread_local const ThreadPool *current_pool = nullptr;
+static thread_local std::size_t current_index = 0;
+// The worker of the innermost `WorkerGroup::run` of the current thread
+static thread_local std::size_t current_worker = WorkerGroup::npos;
+
+std::size_t nn::parallel::hardware_threads(void)
+{
+	std::size_t n = std::thread::hardware_concurrency();
+	return n == 0 ? 1 : n;
+}
+
+nn::parallel::ThreadPool::ThreadPool(std::size_t nworkers, bool pin)
+	: pinned_(pin), queued_(0), stopped_(false), open_jobs_(0), waiters_(0), notifications_(0)
+{
+	if (nworkers == 0)
+		throw std::invalid_argument("invalid argument: a thread pool needs at least one worker");
+
+	// All the deques exist before any worker can try to steal from them
+	for (std::size_t id = 0; id < nworkers; id++)
+		workers_.push_back(std::make_unique<Worker>());
+	for (std::size_t id = 0; id < nworkers; id++)
+		workers_[id]->thread = std::thread(&ThreadPool::loop, this, id);
+}
+
+nn::parallel::ThreadPool::~ThreadPool(void)
+{
+	// The workers drain the queues before they leave
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+		stopped_ = true;
+	}
+	sleep_cv_.notify_all();
+
+	for (auto &worker : workers_)
+		worker->thread.join();
+}
+
+// The mutex only guards the creation and the configuration, the pool is read through `global_instance`
+static std::mutex global_mutex;
+static std::unique_ptr<ThreadPool> global_pool;
+static std::atomic<ThreadPool *> global_instance{nullptr};
+static std::size_t global_nworkers = 0;
+static bool global_pin = false;
+
+ThreadPool &nn::parallel::ThreadPool::global(void)
+{
+	// Every dispatch of libmat gets here, once created the pool is a single load
+	ThreadPool *pool = global_instance.load(std::memory_order_acquire);
+	if (pool != nullptr)
+		return *pool;
+
+	std::lock_guard<std::mutex> lock(global_mutex);
+	if (global_pool == nullptr) {
+		std::size_t nworkers = global_nworkers;
+		if (nworkers == 0) {
+			const char *env = std::getenv("NN_NUM_THREADS");
+			if (env != nullptr)
+				nworkers = std::strtoul(env, nullptr, 10);
+		}
+		if (nworkers == 0)
+			nworkers = hardware_threads();
+		global_pool = std::make_unique<ThreadPool>(nworkers, global_pin);
+		global_instance.store(global_pool.get(), std::memory_order_release);
+	}
+	return *global_pool;
+}
+
+void nn::parallel::ThreadPool::configure(std::size_t nworkers, bool pin)
+{
+	std::lock_guard<std::mutex> lock(global_mutex);
+	if (global_pool != nullptr)
+		throw std::logic_error("logic error: the global thread pool is already running");
+
+	global_nworkers = nworkers;
+	global_pin = pin;
+}
+
+void nn::parallel::ThreadPool::submit(Task task)
+{
+	std::size_t self = worker_index();
+	if (self < workers_.size()) {
+		std::lock_guard<std::mutex> lock(workers_[self]->mutex);
+		workers_[self]->tasks.push_back(std::move(task));
+	} else {
+		std::lock_guard<std::mutex> lock(injected_mutex_);
+		injected_.push_back(std::move(task));
+	}
+	queued_++;
+
+	// Taking the lock orders the wake up after the check of a worker that is going to sleep
+	bool waiting;
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+		waiting = waiters_ > 0;
+	}
+	sleep_cv_.notify_one();
+	if (waiting)
+		waiters_cv_.notify_all();
+}
+
+bool nn::parallel::ThreadPool::try_run_one(void)
+{
+	std::size_t self = worker_index();
+	if (run_chunk(self))
+		return true;
+
+	Task task;
+	if (!pop(self, task))
+		return false;
+
+	run_task(self, task);
+	return true;
+}
+
+void nn::parallel::ThreadPool::help_until(const std::function<bool(void)> &done, bool tasks)
+{
+	std::size_t self = worker_index();
+	while (true) {
+		// Read before the condition, a notification after the check changes it
+		std::uint64_t seen = notifications_;
+		if (done())
+			return;
+
+		if (run_chunk(self))
+			continue;
+		Task task;
+		if (tasks && pop(self, task)) {
+			run_task(self, task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex_);
+		waiters_++;
+		waiters_cv_.wait(lock, [&] { return (tasks && queued_ > 0) || open_jobs_ > 0 || notifications_ != seen; });
+		waiters_--;
+	}
+}
+
+void nn::parallel::ThreadPool::notify_waiters(void)
+{
+	bool waiting;
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+		notifications_++;
+		waiting = waiters_ > 0;
+	}
+	if (waiting)
+		waiters_cv_.notify_all();
+}
+
+void nn::parallel::ThreadPool::parallel_for(std::size_t n, std::size_t grain,
+					    const std::function<void(std::size_t, std::size_t)> &body)
+{
+	if (n == 0)
+		return;
+	grain = std::max<std::size_t>(grain, 1);
+
+	// A few chunks per thread, so the threads that come first can balance uneven chunks
+	std::size_t nchunks = std::min((n + grain - 1) / grain, 4 * (workers_.size() + 1));
+	if (nchunks <= 1) {
+		body(0, n);
+		return;
+	}
+
+	JobSlot *slot = nullptr;
+	for (JobSlot &candidate : jobs_) {
+		if (!candidate.taken.load() && !candidate.taken.exchange(true)) {
+			slot = &candidate;
+			break;
+		}
+	}
+	// Nested deeper than the slots, nobody is idle anyway
+	if (slot == nullptr) {
+		body(0, n);
+		return;
+	}
+
+	Job job;
+	job.body = &body;
+	job.n = n;
+	job.nchunks = nchunks;
+	job.remaining = nchunks;
+	open_jobs_++;
+	slot->job = &job;
+
+	bool waiting;
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+		waiting = waiters_ > 0;
+	}
+	for (std::size_t i = 0; i < std::min(nchunks - 1, workers_.size()); i++)
+		sleep_cv_.notify_one();
+	if (waiting)
+		waiters_cv_.notify_all();
+
+	while (claim_chunk(job)) {
+	}
+	// The chunks that were claimed by others could still be running
+	help_until([&job] { return job.remaining == 0; }, false);
+
+	// Retire the job, once `users` is zero nobody can reach it anymore
+	slot->job = nullptr;
+	while (slot->users != 0)
+		std::this_thread::yield();
+	slot->taken = false;
+
+	if (job.error != nullptr)
+		std::rethrow_exception(job.error);
+}
+
+std::size_t nn::parallel::ThreadPool::size(void) const
+{
+	return workers_.size();
+}
+
+bool nn::parallel::ThreadPool::is_pinned(void) const
+{
+	return pinned_;
+}
+
+std::size_t nn::parallel::ThreadPool::worker_index(void) const
+{
+	return current_pool == this ? current_index : workers_.size();
+}
+
+std::vector<ThreadPool::WorkerStats> nn::parallel::ThreadPool::stats(void) const
+{
+	std::vector<WorkerStats> stats;
+	for (const auto &worker : workers_)
+		stats.push_back({worker->executed.load(), worker->steals.load(),
+				 worker->failed_steals.load(), worker->idles.load()});
+	return stats;
+}
+
+ThreadPool &nn::parallel::ThreadPool::reset_stats(void)
+{
+	for (auto &worker : workers_) {
+		worker->executed = 0;
+		worker->steals = 0;
+		worker->failed_steals = 0;
+		worker->idles = 0;
+	}
+	return *this;
+}
+
+void nn::parallel::ThreadPool::loop(std::size_t id)
+{
+	current_pool = this;
+	current_index = id;
+
+#ifdef __linux__
+	if (pinned_) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(id % hardware_threads(), &cpus);
+		// Pinning is a hint, the worker just runs unpinned if it fails
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+#endif
+
+	Worker &worker = *workers_[id];
+	while (true) {
+		if (run_chunk(id))
+			continue;
+		Task task;
+		if (pop(id, task)) {
+			run_task(id, task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex_);
+		if (queued_ == 0 && stopped_)
+			return;
+		worker.idles++;
+		sleep_cv_.wait(lock, [&] { return queued_ > 0 || open_jobs_ > 0 || stopped_; });
+	}
+}
+
+bool nn::parallel::ThreadPool::pop(std::size_t self, Task &task)
+{
+	if (queued_ == 0)
+		return false;
+
+	std::size_t nworkers = workers_.size();
+	if (self < nworkers) {
+		Worker &own = *workers_[self];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			queued_--;
+			return true;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(injected_mutex_);
+		if (!injected_.empty()) {
+			task = std::move(injected_.front());
+			injected_.pop_front();
+			queued_--;
+			return true;
+		}
+	}
+
+	// Start after ourselves, so the thieves don't all go for the same victim
+	for (std::size_t k = 1; k <= nworkers; k++) {
+		std::size_t victim = (self + k) % nworkers;
+		if (victim == self)
+			continue;
+
+		Worker &other = *workers_[victim];
+		std::lock_guard<std::mutex> lock(other.mutex);
+		if (!other.tasks.empty()) {
+			task = std::move(other.tasks.front());
+			other.tasks.pop_front();
+			queued_--;
+			if (self < nworkers)
+				workers_[self]->steals++;
+			return true;
+		}
+	}
+
+	if (self < nworkers)
+		workers_[self]->failed_steals++;
+	return false;
+}
+
+void nn::parallel::ThreadPool::run_task(std::size_t self, Task &task)
+{
+	task();
+	if (self < workers_.size())
+		workers_[self]->executed++;
+}
+
+bool nn::parallel::ThreadPool::run_chunk(std::size_t self)
+{
+	if (open_jobs_ == 0)
+		return false;
+
+	for (JobSlot &slot : jobs_) {
+		if (slot.job.load() == nullptr)
+			continue;
+
+		// Announce ourselves before looking again, the owner waits for us before it retires the job
+		slot.users++;
+		Job *job = slot.job.load();
+		bool ran = job != nullptr && claim_chunk(*job);
+		slot.users--;
+
+		if (ran) {
+			if (self < workers_.size())
+				workers_[self]->executed++;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool nn::parallel::ThreadPool::claim_chunk(Job &job)
+{
+	std::size_t c = job.next++;
+	if (c >= job.nchunks) {
+		// The first one to run out closes the job, the idle threads stop looking at it
+		if (c == job.nchunks)
+			open_jobs_--;
+		return false;
+	}
+
+	try {
+		(*job.body)(job.n * c / job.nchunks, job.n * (c + 1) / job.nchunks);
+	} catch (...) {
+		if (!job.failed.exchange(true))
+			job.error = std::current_exception();
+	}
+
+	if (--job.remaining == 0)
+		notify_waiters();
+	return true;
+}
+
+nn::parallel::TaskGroup::TaskGroup(ThreadPool &pool)
+	: pool_(pool), pending_(0)
+{
+}
+
+nn::parallel::TaskGroup::~TaskGroup(void)
+{
+	try {
+		wait();
+	} catch (...) {
+	}
+}
+
+TaskGroup &nn::parallel::TaskGroup::run(std::function<void(void)> fn)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		pending_++;
+	}
+
+	pool_.submit([this, pool = &pool_, fn = std::move(fn)] {
+		std::exception_ptr error;
+		try {
+			fn();
+		} catch (...) {
+			error = std::current_exception();
+		}
+
+		bool done;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (error != nullptr && error_ == nullptr)
+				error_ = error;
+			done = --pending_ == 0;
+		}
+		// The group could be gone once the lock is released, only the pool is left to touch
+		if (done)
+			pool->notify_waiters();
+	});
+
+	return *this;
+}
+
+TaskGroup &nn::parallel::TaskGroup::wait(void)
+{
+	// Our tasks are either queued (we help with them) or running somewhere else
+	pool_.help_until([this] {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return pending_ == 0;
+	});
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (error_ != nullptr)
+		std::rethrow_exception(std::exchange(error_, nullptr));
+
+	return *this;
+}
+
+nn::parallel::WorkerGroup::WorkerGroup(std::size_t nworkers)
+	: nworkers_(nworkers)
+{
+	if (nworkers_ == 0)
+		throw std::invalid_argument("invalid argument: a worker group needs at least one worker");
+}
+
+/* Runs fn(id) as the worker `id`, the previous worker comes back after it */
+static void run_as(const std::function<void(std::size_t)> &fn, std::size_t id)
+{
+	struct Scope {
+		std::size_t previous;
+		~Scope(void) { current_worker = previous; }
+	} scope{std::exchange(current_worker, id)};
+	fn(id);
+}
+
+WorkerGroup &nn::parallel::WorkerGroup::run(const std::function<void(std::size_t)> &fn)
+{
+	TaskGroup group;
+	for (std::size_t id = 1; id < nworkers_; id++)
+		group.run([&fn, id] { run_as(fn, id); });
+
+	// The worker zero is the thread that calls `run`
+	std::exception_ptr error;
+	try {
+		run_as(fn, 0);
+	} catch (...) {
+		error = std::current_exception();
+	}
+
+	group.wait();
+	if (error != nullptr)
+		std::rethrow_exception(error);
+
+	return *this;
+}
+
+std::size_t nn::parallel::WorkerGroup::size(void) const
+{
+	return nworkers_;
+}
+
+std::size_t nn::parallel::WorkerGroup::current(void)
+{
+	return current_worker;
+}
+
+// The libmat kernels run their chunks on the global pool
+static void mat_parallel_for(nn::mathops::Mat_range_fn body, void *ctx, std::size_t n, std::size_t grain)
+{
+	ThreadPool::global().parallel_for(n, grain, [=](std::size_t begin, std::size_t end) { body(ctx, begin, end); });
+}
+
+static const bool mat_hook_installed = (nn::mathops::Mat_set_parallel_for(mat_parallel_for), true);
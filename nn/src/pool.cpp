@@ -0,0 +1,260 @@
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "../include/pool.hpp"
+
+using namespace nn::mathops;
+using namespace nn::layers;
+
+nn::layers::Pool2D::Pool2D(std::size_t channels, std::size_t height, std::size_t width, std::size_t pool_height,
+			   std::size_t pool_width, std::size_t stride, std::string name)
+	: Layer(Shape{channels * height * width, 1}, Shape(), false, std::move(name)),
+	  channels_(channels), height_(height), width_(width), pool_height_(pool_height), pool_width_(pool_width),
+	  stride_(stride == 0 ? pool_height : stride)
+{
+	if (channels == 0 || height == 0 || width == 0 || pool_height == 0 || pool_width == 0)
+		throw std::invalid_argument("invalid argument: a pooling needs images and windows");
+	if (pool_height > height || pool_width > width)
+		throw std::invalid_argument("invalid argument: the window doesn't fit in the image");
+
+	out_height_ = (height - pool_height) / stride_ + 1;
+	out_width_ = (width - pool_width) / stride_ + 1;
+	output_shape_ = Shape{channels_ * out_height_ * out_width_, 1};
+}
+
+// NOTE: Creating a foo deconstructor to avoid linker problems
+nn::layers::Pool2D::~Pool2D(void)
+{
+}
+
+std::size_t nn::layers::Pool2D::get_channels(void) const
+{
+	return channels_;
+}
+
+std::size_t nn::layers::Pool2D::get_height(void) const
+{
+	return height_;
+}
+
+std::size_t nn::layers::Pool2D::get_width(void) const
+{
+	return width_;
+}
+
+std::size_t nn::layers::Pool2D::get_pool_height(void) const
+{
+	return pool_height_;
+}
+
+std::size_t nn::layers::Pool2D::get_pool_width(void) const
+{
+	return pool_width_;
+}
+
+std::size_t nn::layers::Pool2D::get_stride(void) const
+{
+	return stride_;
+}
+
+std::size_t nn::layers::Pool2D::get_out_height(void) const
+{
+	return out_height_;
+}
+
+std::size_t nn::layers::Pool2D::get_out_width(void) const
+{
+	return out_width_;
+}
+
+Pool2D &nn::layers::Pool2D::build(const Shape &input_shape, const Shape &output_shape)
+{
+	if (input_shape != input_shape_ || output_shape != output_shape_)
+		throw std::invalid_argument("Invalid shapes for the geometry of the layer: " + name_);
+	return build();
+}
+
+Pool2D &nn::layers::Pool2D::build(std::size_t input_size, std::size_t output_size)
+{
+	if (input_size != input_shape_.rows || output_size != output_shape_.rows)
+		throw std::invalid_argument("Invalid sizes for the geometry of the layer: " + name_);
+	return build();
+}
+
+Pool2D &nn::layers::Pool2D::build(void)
+{
+	register_funcs();
+	built_ = true;
+	return *this;
+}
+
+Mat_conv2d nn::layers::Pool2D::geometry(std::size_t nbatch) const
+{
+	return Mat_conv2d{channels_, height_, width_, pool_height_, pool_width_,
+			  stride_, 0, 1, out_height_, out_width_, nbatch};
+}
+
+template <typename T>
+nn::layers::MaxPool2D<T>::MaxPool2D(std::size_t channels, std::size_t height, std::size_t width,
+				    std::size_t pool_size, std::size_t stride)
+	: Pool2D(channels, height, width, pool_size, pool_size, stride, "MaxPool2D")
+{
+}
+
+template <typename T>
+void nn::layers::MaxPool2D<T>::forward_argmax(const Mat<T> &X, Mat<T> &Y)
+{
+	if (X.rows() != input_shape_.rows)
+		throw std::invalid_argument("invalid argument: the images don't match the layer: " + name_);
+
+	// The indices only grow, the steady state doesn't allocate
+	Argmax &argmax = argmax_.get();
+	std::size_t n = output_shape_.rows * X.cols();
+	if (argmax.indices.size() < n)
+		argmax.indices.resize(n);
+	argmax.size = n;
+	argmax.input = X.get_mat_raw();
+	MatDispatchOps::Mat_maxpool2d(X.get_mat_raw(), Y.get_mat_raw(), argmax.indices.data(), geometry(X.cols()));
+}
+
+template <typename T>
+const typename MaxPool2D<T>::Argmax &nn::layers::MaxPool2D<T>::thread_argmax(const Mat<T> &X)
+{
+	const Argmax &argmax = argmax_.get();
+	if (argmax.size != output_shape_.rows * X.cols() || argmax.input != X.get_mat_raw())
+		throw std::logic_error("logic error: the backward of a MaxPool2D needs the forward of its batch in the same thread: " + name_);
+	return argmax;
+}
+
+template <typename T>
+MaxPool2D<T> &nn::layers::MaxPool2D<T>::register_funcs(void)
+{
+	register_func<Mat<T>, const Mat<T> &>
+		("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+			Mat<T> Y(Shape{output_shape_.rows, X.cols()});
+			forward_argmax(X, Y);
+			return Y;
+		});
+
+	// A scatter to the maxima of the forward, the windows aren't read again
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			((void) grads);
+			const Argmax &argmax = thread_argmax(X);
+			Mat<T> dX(X.get_shape());
+			MatDispatchOps::Mat_maxpool2d_backward(dY.get_mat_raw(), argmax.indices.data(), dX.get_mat_raw(),
+							       geometry(X.cols()));
+			return dX;
+		});
+
+	// Inside of a bigger tape (a residual block) the maxima go with the node
+	register_func<autodiff::Var, autodiff::Tape<T> &, autodiff::Var, Mat<T> *>
+		("record", [this](autodiff::Tape<T> &tape, autodiff::Var X, Mat<T> *grads) -> autodiff::Var {
+			((void) grads);
+			const Mat<T> &input = tape.value(X);
+			Mat_conv2d conv = geometry(input.cols());
+			Shape shape = input.get_shape();
+			Mat<T> Y(Shape{output_shape_.rows, input.cols()});
+			auto argmax = std::make_shared<std::vector<std::size_t>>(Y.rows() * Y.cols());
+			MatDispatchOps::Mat_maxpool2d(input.get_mat_raw(), Y.get_mat_raw(), argmax->data(), conv);
+
+			// Only the indices are kept, X can be released before the backward
+			return tape.custom(std::move(Y), {X},
+					   [X, conv, shape, argmax](autodiff::Tape<T> &tape, const Mat<T> &g) {
+						   Mat<T> dX(shape);
+						   MatDispatchOps::Mat_maxpool2d_backward(g.get_mat_raw(), argmax->data(),
+											  dX.get_mat_raw(), conv);
+						   tape.accumulate(X, dX);
+					   });
+		});
+
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [this](const Mat<T> &X, Mat<T> &Y) -> void {
+			forward_argmax(X, Y);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [this](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			((void) Y);
+			((void) grads);
+			const Argmax &argmax = thread_argmax(X);
+			MatDispatchOps::Mat_maxpool2d_backward(dY.get_mat_raw(), argmax.indices.data(), dX.get_mat_raw(),
+							       geometry(X.cols()));
+		});
+
+	return *this;
+}
+
+template <typename T>
+nn::layers::AvgPool2D<T>::AvgPool2D(std::size_t channels, std::size_t height, std::size_t width,
+				    std::size_t pool_size, std::size_t stride)
+	: Pool2D(channels, height, width, pool_size, pool_size, stride, "AvgPool2D")
+{
+}
+
+template <typename T>
+AvgPool2D<T> &nn::layers::AvgPool2D<T>::register_funcs(void)
+{
+	register_func<Mat<T>, const Mat<T> &>
+		("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+			if (X.rows() != input_shape_.rows)
+				throw std::invalid_argument("invalid argument: the images don't match the layer: " + name_);
+			Mat<T> Y(Shape{output_shape_.rows, X.cols()});
+			MatDispatchOps::Mat_avgpool2d(X.get_mat_raw(), Y.get_mat_raw(), geometry(X.cols()));
+			return Y;
+		});
+
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			((void) grads);
+			Mat<T> dX(X.get_shape());
+			MatDispatchOps::Mat_avgpool2d_backward(dY.get_mat_raw(), dX.get_mat_raw(), geometry(X.cols()));
+			return dX;
+		});
+
+	register_func<autodiff::Var, autodiff::Tape<T> &, autodiff::Var, Mat<T> *>
+		("record", [this](autodiff::Tape<T> &tape, autodiff::Var X, Mat<T> *grads) -> autodiff::Var {
+			((void) grads);
+			const Mat<T> &input = tape.value(X);
+			Mat_conv2d conv = geometry(input.cols());
+			Shape shape = input.get_shape();
+			Mat<T> Y(Shape{output_shape_.rows, input.cols()});
+			MatDispatchOps::Mat_avgpool2d(input.get_mat_raw(), Y.get_mat_raw(), conv);
+
+			return tape.custom(std::move(Y), {X},
+					   [X, conv, shape](autodiff::Tape<T> &tape, const Mat<T> &g) {
+						   Mat<T> dX(shape);
+						   MatDispatchOps::Mat_avgpool2d_backward(g.get_mat_raw(), dX.get_mat_raw(), conv);
+						   tape.accumulate(X, dX);
+					   });
+		});
+
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [this](const Mat<T> &X, Mat<T> &Y) -> void {
+			MatDispatchOps::Mat_avgpool2d(X.get_mat_raw(), Y.get_mat_raw(), geometry(X.cols()));
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [this](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			((void) Y);
+			((void) grads);
+			MatDispatchOps::Mat_avgpool2d_backward(dY.get_mat_raw(), dX.get_mat_raw(), geometry(X.cols()));
+		});
+
+	return *this;
+}
+
+template <typename T>
+nn::layers::GlobalAvgPool<T>::GlobalAvgPool(std::size_t channels, std::size_t height, std::size_t width)
+	: AvgPool2D<T>(channels, height, width, height, width, 1, "GlobalAvgPool")
+{
+}
+
+template class nn::layers::MaxPool2D<float>;
+// template class nn::layers::MaxPool2D<double>;
+template class nn::layers::AvgPool2D<float>;
+// template class nn::layers::AvgPool2D<double>;
+template class nn::layers::GlobalAvgPool<float>;
+// template class nn::layers::GlobalAvgPool<double>;
@@ -0,0 +1,222 @@
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "../include/residual.hpp"
+
+using namespace nn::mathops;
+using namespace nn::layers;
+
+template <typename T>
+nn::layers::Residual<T>::Residual(std::initializer_list<std::unique_ptr<Layer>> block, bool layer_norm, T eps)
+	: Layer(Shape(), Shape(), false, "Residual"), layer_norm_(layer_norm), eps_(eps)
+{
+	if (eps <= 0)
+		throw std::invalid_argument("invalid argument: eps must be positive");
+	for (auto &layer : block)
+		add(std::move(const_cast<std::unique_ptr<Layer> &>(layer)));
+}
+
+template <typename T>
+const std::vector<std::unique_ptr<Layer>> &nn::layers::Residual<T>::get_block(void) const
+{
+	return block_;
+}
+
+template <typename T>
+Residual<T> &nn::layers::Residual<T>::add(std::unique_ptr<Layer> layer)
+{
+	if (layer == nullptr)
+		throw std::invalid_argument("invalid argument: Can't add an empty layer");
+	block_.push_back(std::move(layer));
+	built_ = false;
+	return *this;
+}
+
+template <typename T>
+bool nn::layers::Residual<T>::has_layer_norm(void) const
+{
+	return layer_norm_;
+}
+
+template <typename T>
+LayerNorm<T> &nn::layers::Residual<T>::get_layer_norm(void) const
+{
+	if (norm_ == nullptr)
+		throw std::invalid_argument("Residual layer not built yet or without a LayerNorm");
+	return *norm_;
+}
+
+template <typename T>
+Residual<T> &nn::layers::Residual<T>::build(const Shape &input_shape, const Shape &output_shape)
+{
+	((void) input_shape);
+	((void) output_shape);
+	return build();
+}
+
+template <typename T>
+Residual<T> &nn::layers::Residual<T>::build(std::size_t input_size, std::size_t output_size)
+{
+	((void) input_size);
+	((void) output_size);
+	return build();
+}
+
+template <typename T>
+Residual<T> &nn::layers::Residual<T>::build(void)
+{
+	if (block_.empty())
+		throw std::invalid_argument("invalid argument: a residual needs a block of layers");
+
+	for (auto &layer_ptr : block_)
+		layer_ptr->build();
+	if (block_.front()->get_input_size() != block_.back()->get_output_size())
+		throw std::invalid_argument("invalid argument: the block of a residual must keep the size of its input");
+
+	input_shape_ = block_.front()->get_input_shape();
+	output_shape_ = input_shape_;
+
+	norm_ = nullptr;
+	if (layer_norm_) {
+		norm_ = std::make_unique<LayerNorm<T>>(input_shape_.rows, eps_);
+		norm_->build();
+	}
+
+	param_offsets_.clear();
+	std::size_t nparams = 0;
+	for (auto &layer_ptr : block_) {
+		param_offsets_.push_back(nparams);
+		nparams += layer_ptr->template parameters<T>().size();
+	}
+	param_offsets_.push_back(nparams);
+
+	register_funcs();
+	built_ = true;
+	return *this;
+}
+
+template <typename T>
+Residual<T> &nn::layers::Residual<T>::set_training(bool training)
+{
+	Layer::set_training(training);
+	for (auto &layer_ptr : block_)
+		layer_ptr->set_training(training);
+	return *this;
+}
+
+template <typename T>
+Mat<T> nn::layers::Residual<T>::forward_trace(const Mat<T> &X)
+{
+	if (X.rows() != input_shape_.rows)
+		throw std::invalid_argument("invalid argument: the features don't match the layer: " + name_);
+
+	// The outputs of the block are new, they move into the trace without a copy
+	Trace &trace = traces_.get();
+	trace.size = 0;
+	trace.inputs.resize(block_.size() - 1);
+	const Mat<T> *A = &X;
+	for (std::size_t i = 0; i + 1 < block_.size(); i++) {
+		trace.inputs[i] = (*block_[i])(*A);
+		A = &trace.inputs[i];
+	}
+	Mat<T> Y = (*block_.back())(*A);
+
+	// The output of the block is new, the input is added on it
+	if (norm_ == nullptr) {
+		Y += X;
+	} else {
+		if (trace.sum.get_shape() != X.get_shape())
+			trace.sum = Mat<T>(X.get_shape());
+		trace.mean.resize(X.cols());
+		trace.invstd.resize(X.cols());
+		MatDispatchOps::Mat_layernorm_forward(Y.get_mat_raw(), X.get_mat_raw(), trace.sum.get_mat_raw(),
+						      Y.get_mat_raw(), norm_->get_gamma().get_mat_raw(),
+						      norm_->get_beta().get_mat_raw(), trace.mean.data(), trace.invstd.data(),
+						      X.get_shape(), eps_);
+	}
+	trace.size = X.cols();
+	trace.input = X.get_mat_raw();
+	return Y;
+}
+
+template <typename T>
+typename Residual<T>::Trace &nn::layers::Residual<T>::thread_trace(const Mat<T> &X)
+{
+	Trace &trace = traces_.get();
+	if (trace.size != X.cols() || trace.input != X.get_mat_raw())
+		throw std::logic_error("logic error: the backward of a Residual needs the forward of its batch in the same thread: " + name_);
+	return trace;
+}
+
+template <typename T>
+Residual<T> &nn::layers::Residual<T>::register_funcs(void)
+{
+	register_func<Mat<T>, const Mat<T> &>
+		("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+			return forward_trace(X);
+		});
+
+	// The identity adds dY (or dS) to what the block gives back
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			Trace &trace = thread_trace(X);
+			Mat<T> dS = norm_ == nullptr ? dY : Mat<T>(dY.get_shape());
+			if (norm_ != nullptr) {
+				Mat<T> *norm_grads = grads == nullptr ? nullptr : grads + param_offsets_.back();
+				MatDispatchOps::Mat_layernorm_backward(trace.sum.get_mat_raw(), dY.get_mat_raw(),
+								       norm_->get_gamma().get_mat_raw(), trace.mean.data(),
+								       trace.invstd.data(), dS.get_mat_raw(),
+								       norm_grads == nullptr ? nullptr : norm_grads[0].get_mat_raw(),
+								       norm_grads == nullptr ? nullptr : norm_grads[1].get_mat_raw(),
+								       X.get_shape());
+			}
+
+			Mat<T> dA = dS;
+			for (std::size_t i = block_.size(); i-- > 0;) {
+				Mat<T> *layer_grads = grads == nullptr ? nullptr : grads + param_offsets_[i];
+				const Mat<T> &input = i == 0 ? X : trace.inputs[i - 1];
+				dA = block_[i]->template backward<T>(input, dA, layer_grads);
+			}
+			return dA += dS;
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("parameters", [this]() -> std::vector<Mat<T> *> {
+			std::vector<Mat<T> *> params;
+			for (auto &layer_ptr : block_)
+				for (Mat<T> *param : layer_ptr->template parameters<T>())
+					params.push_back(param);
+			if (norm_ != nullptr)
+				for (Mat<T> *param : norm_->template parameters<T>())
+					params.push_back(param);
+			return params;
+		});
+
+	// External memory only if every layer with parameters takes it, like `Sequential`
+	for (std::size_t i = 0; i < block_.size(); i++)
+		if (param_offsets_[i] != param_offsets_[i + 1] && !block_[i]->template can_bind_parameters<T>())
+			return *this;
+
+	register_func<void, const std::vector<T *> &>
+		("bind_parameters", [this](const std::vector<T *> &memory) -> void {
+			std::size_t nparams = param_offsets_.back() + (norm_ == nullptr ? 0 : 2);
+			if (memory.size() != nparams)
+				throw std::invalid_argument("invalid argument: a Residual layer binds one pointer per parameter");
+
+			for (std::size_t i = 0; i < block_.size(); i++) {
+				if (param_offsets_[i] == param_offsets_[i + 1])
+					continue;
+				block_[i]->template bind_parameters<T>(std::vector<T *>(memory.begin() + param_offsets_[i],
+											memory.begin() + param_offsets_[i + 1]));
+			}
+			if (norm_ != nullptr)
+				norm_->template bind_parameters<T>(std::vector<T *>(memory.end() - 2, memory.end()));
+		});
+
+	return *this;
+}
+
+template class nn::layers::Residual<float>;
+// template class nn::layers::Residual<double>;
@@ -0,0 +1,452 @@
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "../include/rnn.hpp"
+
+using namespace nn::mathops;
+using namespace nn::layers;
+
+template <typename T>
+nn::layers::Recurrent<T>::Recurrent(std::size_t input_size, std::size_t hidden_size, std::size_t seq_len,
+				    bool return_sequences, std::size_t ngates, std::size_t nbiases, bool cell_state,
+				    std::shared_ptr<RandInitializer> rand_init, std::string name)
+	: WeightedLayer(Shape{seq_len * input_size, 1}, Shape{(return_sequences ? seq_len : 1) * hidden_size, 1},
+			name, nullptr, rand_init),
+	  hidden_size_(hidden_size), seq_len_(seq_len), return_sequences_(return_sequences), ngates_(ngates),
+	  params_(2 + nbiases), cell_state_(cell_state)
+{
+	if (input_size == 0 || hidden_size == 0 || seq_len == 0)
+		throw std::invalid_argument("invalid argument: a recurrent layer needs inputs, units and steps");
+}
+
+template <typename T>
+nn::layers::Recurrent<T>::~Recurrent(void)
+{
+}
+
+template <typename T>
+std::size_t nn::layers::Recurrent<T>::get_hidden_size(void) const
+{
+	return hidden_size_;
+}
+
+template <typename T>
+std::size_t nn::layers::Recurrent<T>::get_seq_len(void) const
+{
+	return seq_len_;
+}
+
+template <typename T>
+bool nn::layers::Recurrent<T>::returns_sequences(void) const
+{
+	return return_sequences_;
+}
+
+template <typename T>
+Mat<T> &nn::layers::Recurrent<T>::get_input_weights(void) const
+{
+	if (params_[0] == nullptr)
+		throw std::invalid_argument(name_ + " layer not built yet");
+	return *params_[0];
+}
+
+template <typename T>
+Mat<T> &nn::layers::Recurrent<T>::get_recurrent_weights(void) const
+{
+	if (params_[1] == nullptr)
+		throw std::invalid_argument(name_ + " layer not built yet");
+	return *params_[1];
+}
+
+template <typename T>
+Mat<T> &nn::layers::Recurrent<T>::get_bias(void) const
+{
+	if (params_[2] == nullptr)
+		throw std::invalid_argument(name_ + " layer not built yet");
+	return *params_[2];
+}
+
+template <typename T>
+Recurrent<T> &nn::layers::Recurrent<T>::build(const Shape &input_shape, const Shape &output_shape)
+{
+	if (input_shape != input_shape_ || output_shape != output_shape_)
+		throw std::invalid_argument("Invalid shapes for the features of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+Recurrent<T> &nn::layers::Recurrent<T>::build(std::size_t input_size, std::size_t output_size)
+{
+	if (input_size != input_shape_.rows || output_size != output_shape_.rows)
+		throw std::invalid_argument("Invalid sizes for the features of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+Recurrent<T> &nn::layers::Recurrent<T>::build(void)
+{
+	alloc_weights();
+	register_funcs();
+	built_ = true;
+	return *this;
+}
+
+template <typename T>
+void nn::layers::Recurrent<T>::init_biases(void)
+{
+}
+
+template <typename T>
+Recurrent<T> &nn::layers::Recurrent<T>::alloc_weights(void)
+{
+	grads_.clear();
+	grad_count_ = 0;
+
+	// Weights moved to external memory by `bind_parameters` are kept
+	if (weights_bound_)
+		return *this;
+
+	std::size_t input_size = input_shape_.rows / seq_len_;
+	params_[0] = add_weights<T>(Shape{ngates_ * hidden_size_, input_size}, rand_init_);
+	params_[1] = add_weights<T>(Shape{ngates_ * hidden_size_, hidden_size_}, rand_init_);
+	for (std::size_t k = 2; k < params_.size(); k++)
+		params_[k] = add_weights<T>(ngates_ * hidden_size_);
+	init_biases();
+	return *this;
+}
+
+template <typename T>
+Recurrent<T> &nn::layers::Recurrent<T>::alloc_gradients(void)
+{
+	if (!grads_.empty())
+		return *this;
+
+	for (auto &param : params_)
+		grads_.push_back(std::make_unique<Mat<T>>(param->get_shape()));
+	for (auto &grad : grads_)
+		grad->fill(static_cast<T>(0));
+	grad_count_ = 0;
+	return *this;
+}
+
+template <typename T>
+void nn::layers::Recurrent<T>::reserve(Trace &trace, std::size_t ncols) const
+{
+	if (trace.ncols >= ncols)
+		return;
+
+	std::size_t input_size = input_shape_.rows / seq_len_;
+	std::size_t steps = seq_len_ * ncols;
+	std::size_t gate_rows = ngates_ * hidden_size_;
+	trace.inputs.resize(input_size * steps);
+	trace.projection.resize(gate_rows * steps);
+	trace.states.resize(hidden_size_ * steps);
+	trace.cells.resize(cell_state_ ? hidden_size_ * steps : 0);
+	trace.gates.resize(4 * hidden_size_ * steps);
+	trace.recurrent.resize(gate_rows * ncols);
+	trace.dprojection.resize(gate_rows * steps);
+	trace.dh.resize(hidden_size_ * ncols);
+	trace.dc.resize(cell_state_ ? hidden_size_ * ncols : 0);
+	trace.dskip.resize(hidden_size_ * ncols);
+	trace.dinputs.resize(input_size * steps);
+	trace.ncols = ncols;
+}
+
+template <typename T>
+void nn::layers::Recurrent<T>::forward_steps(const Mat<T> &X, Trace &trace, Mat<T> &Y) const
+{
+	if (X.rows() != input_shape_.rows)
+		throw std::invalid_argument("invalid argument: the features don't match the layer: " + name_);
+
+	std::size_t b = X.cols();
+	std::size_t n = input_shape_.rows / seq_len_;
+	std::size_t H = hidden_size_;
+	std::size_t ld = seq_len_ * b;
+	reserve(trace, b);
+	trace.size = b;
+	trace.input = X.get_mat_raw();
+
+	// The steps side by side, then the projection of all of them is one product
+	const T *x = X.get_mat_raw();
+	for (std::size_t t = 0; t < seq_len_; t++)
+		for (std::size_t i = 0; i < n; i++)
+			std::memcpy(trace.inputs.data() + i * ld + t * b, x + (t * n + i) * b, b * sizeof(T));
+	MatDispatchOps::Mat_dot(params_[0]->get_mat_raw(), trace.inputs.data(), trace.projection.data(),
+				params_[0]->get_shape(), ld);
+
+	T *Z = trace.recurrent.data();
+	for (std::size_t t = 0; t < seq_len_; t++) {
+		const T *h_prev = t == 0 ? nullptr : trace.states.data() + (t - 1) * H * b;
+		const T *c_prev = t == 0 || !cell_state_ ? nullptr : trace.cells.data() + (t - 1) * H * b;
+		if (h_prev == nullptr)
+			MatDispatchOps::Mat_fill(Z, Shape{ngates_ * H, b}, static_cast<T>(0));
+		else
+			MatDispatchOps::Mat_dot(params_[1]->get_mat_raw(), h_prev, Z, params_[1]->get_shape(), b);
+
+		cell_forward(trace.projection.data() + t * b, ld, Z, h_prev, c_prev,
+			     trace.gates.data() + t * 4 * H * b,
+			     cell_state_ ? trace.cells.data() + t * H * b : nullptr,
+			     trace.states.data() + t * H * b, b);
+	}
+
+	const T *output = trace.states.data() + (return_sequences_ ? 0 : (seq_len_ - 1) * H * b);
+	MatDispatchOps::Mat_copy(output, Y.get_mat_raw(), Y.get_shape());
+}
+
+template <typename T>
+void nn::layers::Recurrent<T>::backward_steps(Trace &trace, const Mat<T> &dY, Mat<T> *dX, Mat<T> *grads) const
+{
+	std::size_t b = dY.cols();
+	std::size_t H = hidden_size_;
+	std::size_t ld = seq_len_ * b;
+	Shape state_shape{H, b};
+	Shape recurrent_shape{ngates_ * H, b};
+
+	T *dh = trace.dh.data();
+	T *dc = cell_state_ ? trace.dc.data() : nullptr;
+	T *dZ = trace.recurrent.data();
+	MatDispatchOps::Mat_fill(dh, state_shape, static_cast<T>(0));
+	if (dc != nullptr)
+		MatDispatchOps::Mat_fill(dc, state_shape, static_cast<T>(0));
+
+	for (std::size_t t = seq_len_; t-- > 0;) {
+		if (return_sequences_)
+			MatDispatchOps::Mat_add(dh, dY.get_mat_raw() + t * H * b, dh, state_shape);
+		else if (t == seq_len_ - 1)
+			MatDispatchOps::Mat_add(dh, dY.get_mat_raw(), dh, state_shape);
+
+		const T *h_prev = t == 0 ? nullptr : trace.states.data() + (t - 1) * H * b;
+		const T *c_prev = t == 0 || !cell_state_ ? nullptr : trace.cells.data() + (t - 1) * H * b;
+		bool skip = cell_backward(trace.gates.data() + t * 4 * H * b, h_prev, c_prev,
+					  cell_state_ ? trace.cells.data() + t * H * b : nullptr, dh, dc, dZ,
+					  trace.dprojection.data() + t * b, ld, trace.dskip.data(), b);
+
+		if (grads != nullptr && params_.size() > 3)
+			MatDispatchOps::Mat_add_row_sum(dZ, grads[3].get_mat_raw(), recurrent_shape);
+		if (h_prev == nullptr)
+			break;
+		if (grads != nullptr)
+			MatDispatchOps::Mat_dot_nt_acc(dZ, h_prev, grads[1].get_mat_raw(), recurrent_shape, H);
+		// dh of the step before, the last use of dh of this one
+		MatDispatchOps::Mat_dot_tn(params_[1]->get_mat_raw(), dZ, dh, params_[1]->get_shape(), b);
+		if (skip)
+			MatDispatchOps::Mat_add(dh, trace.dskip.data(), dh, state_shape);
+	}
+
+	// The input projection of the whole sequence, one product each way
+	Shape projection_shape{ngates_ * H, ld};
+	if (grads != nullptr) {
+		MatDispatchOps::Mat_dot_nt_acc(trace.dprojection.data(), trace.inputs.data(), grads[0].get_mat_raw(),
+					       projection_shape, params_[0]->cols());
+		MatDispatchOps::Mat_add_row_sum(trace.dprojection.data(), grads[2].get_mat_raw(), projection_shape);
+	}
+	if (dX == nullptr)
+		return;
+
+	std::size_t n = input_shape_.rows / seq_len_;
+	MatDispatchOps::Mat_dot_tn(params_[0]->get_mat_raw(), trace.dprojection.data(), trace.dinputs.data(),
+				   params_[0]->get_shape(), ld);
+	T *dx = dX->get_mat_raw();
+	for (std::size_t t = 0; t < seq_len_; t++)
+		for (std::size_t i = 0; i < n; i++)
+			std::memcpy(dx + (t * n + i) * b, trace.dinputs.data() + i * ld + t * b, b * sizeof(T));
+}
+
+template <typename T>
+typename Recurrent<T>::Trace &nn::layers::Recurrent<T>::thread_trace(const Mat<T> &X)
+{
+	Trace &trace = traces_.get();
+	if (trace.size != X.cols() || trace.input != X.get_mat_raw())
+		throw std::logic_error("logic error: the backward of a Recurrent needs the forward of its batch in the same thread: " + name_);
+	return trace;
+}
+
+template <typename T>
+void nn::layers::Recurrent<T>::gradient_steps(const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads)
+{
+	Trace &trace = traces_.get();
+	Mat<T> Y(output_shape_.rows, X.cols());
+	forward_steps(X, trace, Y);
+	backward_steps(trace, dY, nullptr, grads);
+}
+
+template <typename T>
+Recurrent<T> &nn::layers::Recurrent<T>::register_funcs(void)
+{
+	register_func<Mat<T>, const Mat<T> &>
+		("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+			Mat<T> Y(output_shape_.rows, X.cols());
+			forward_steps(X, traces_.get(), Y);
+			return Y;
+		});
+
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			Mat<T> dX(X.get_shape());
+			backward_steps(thread_trace(X), dY, &dX, grads);
+			return dX;
+		});
+
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [this](const Mat<T> &X, Mat<T> &Y) -> void {
+			forward_steps(X, trace_, Y);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [this](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			((void) X);
+			((void) Y);
+			backward_steps(trace_, dY, &dX, grads);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("fit", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			std::vector<Mat<T>> grads;
+			for (auto &param : params_)
+				grads.emplace_back(Mat<T>(param->get_shape()).fill(static_cast<T>(0)));
+			gradient_steps(input, signal_update, grads.data());
+			for (std::size_t k = 0; k < params_.size(); k++)
+				optimizer_->apply(*params_[k], grads[k]);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("accumulate", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			alloc_gradients();
+			std::vector<Mat<T>> grads;
+			for (auto &grad : grads_)
+				grads.emplace_back(Mat<T>(grad->get_shape(), grad->get_mat_raw()));
+			gradient_steps(input, signal_update, grads.data());
+			grad_count_ += input.cols();
+		});
+
+	register_func<void>
+		("step", [this]() -> void {
+			if (grad_count_ == 0)
+				return;
+
+			T scale = static_cast<T>(1) / static_cast<T>(grad_count_);
+			for (std::size_t k = 0; k < params_.size(); k++) {
+				*grads_[k] *= scale;
+				optimizer_->apply(*params_[k], *grads_[k]);
+				grads_[k]->fill(static_cast<T>(0));
+			}
+			grad_count_ = 0;
+		});
+
+	register_func<void>
+		("zero_grad", [this]() -> void {
+			for (auto &grad : grads_)
+				grad->fill(static_cast<T>(0));
+			grad_count_ = 0;
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("gradients", [this]() -> std::vector<Mat<T> *> {
+			alloc_gradients();
+			std::vector<Mat<T> *> grads;
+			for (auto &grad : grads_)
+				grads.push_back(grad.get());
+			return grads;
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("parameters", [this]() -> std::vector<Mat<T> *> {
+			std::vector<Mat<T> *> params;
+			for (auto &param : params_)
+				params.push_back(param.get());
+			return params;
+		});
+
+	register_func<void, const std::vector<T *> &>
+		("bind_parameters", [this](const std::vector<T *> &memory) -> void {
+			if (memory.size() != params_.size())
+				throw std::invalid_argument("invalid argument: a recurrent layer binds one pointer per parameter");
+			// The matrices are replaced in place, pointers to them (optimizer state) stay valid
+			for (std::size_t k = 0; k < params_.size(); k++)
+				*params_[k] = Mat<T>(params_[k]->get_shape(), memory[k]);
+			weights_bound_ = true;
+		});
+
+	return *this;
+}
+
+template <typename T>
+nn::layers::LSTM<T>::LSTM(std::size_t input_size, std::size_t hidden_size, std::size_t seq_len,
+			  bool return_sequences, std::shared_ptr<RandInitializer> rand_init)
+	: Recurrent<T>(input_size, hidden_size, seq_len, return_sequences, 4, 1, true, rand_init, "LSTM")
+{
+}
+
+template <typename T>
+void nn::layers::LSTM<T>::cell_forward(const T *Gx, std::size_t ldx, const T *Z, const T *h_prev, const T *c_prev,
+				       T *gates, T *c, T *h, std::size_t ncols) const
+{
+	((void) h_prev);
+	MatDispatchOps::Mat_lstm_cell(Gx, ldx, Z, this->params_[2]->get_mat_raw(), c_prev, gates, c, h,
+				      this->hidden_size_, ncols);
+}
+
+template <typename T>
+bool nn::layers::LSTM<T>::cell_backward(const T *gates, const T *h_prev, const T *c_prev, const T *c, const T *dh,
+					T *dc, T *dZ, T *dG, std::size_t ldg, T *dh_skip, std::size_t ncols) const
+{
+	((void) h_prev);
+	((void) dh_skip);
+	MatDispatchOps::Mat_lstm_cell_backward(gates, c_prev, c, dh, dc, dZ, dG, ldg, this->hidden_size_, ncols);
+	return false;
+}
+
+template <typename T>
+void nn::layers::LSTM<T>::init_biases(void)
+{
+	T *bias = this->params_[2]->get_mat_raw();
+	for (std::size_t k = this->hidden_size_; k < 2 * this->hidden_size_; k++)
+		bias[k] = static_cast<T>(1);
+}
+
+template <typename T>
+nn::layers::GRU<T>::GRU(std::size_t input_size, std::size_t hidden_size, std::size_t seq_len,
+			bool return_sequences, std::shared_ptr<RandInitializer> rand_init)
+	: Recurrent<T>(input_size, hidden_size, seq_len, return_sequences, 3, 2, false, rand_init, "GRU")
+{
+}
+
+template <typename T>
+Mat<T> &nn::layers::GRU<T>::get_recurrent_bias(void) const
+{
+	if (this->params_[3] == nullptr)
+		throw std::invalid_argument("GRU layer not built yet");
+	return *this->params_[3];
+}
+
+template <typename T>
+void nn::layers::GRU<T>::cell_forward(const T *Gx, std::size_t ldx, const T *Z, const T *h_prev, const T *c_prev,
+				      T *gates, T *c, T *h, std::size_t ncols) const
+{
+	((void) c_prev);
+	((void) c);
+	MatDispatchOps::Mat_gru_cell(Gx, ldx, Z, this->params_[2]->get_mat_raw(), this->params_[3]->get_mat_raw(),
+				     h_prev, gates, h, this->hidden_size_, ncols);
+}
+
+template <typename T>
+bool nn::layers::GRU<T>::cell_backward(const T *gates, const T *h_prev, const T *c_prev, const T *c, const T *dh,
+				       T *dc, T *dZ, T *dG, std::size_t ldg, T *dh_skip, std::size_t ncols) const
+{
+	((void) c_prev);
+	((void) c);
+	((void) dc);
+	MatDispatchOps::Mat_gru_cell_backward(gates, h_prev, dh, dZ, dG, ldg, h_prev == nullptr ? nullptr : dh_skip,
+					      this->hidden_size_, ncols);
+	return h_prev != nullptr;
+}
+
+template class nn::layers::Recurrent<float>;
+// template class nn::layers::Recurrent<double>;
+template class nn::layers::LSTM<float>;
+// template class nn::layers::LSTM<double>;
+template class nn::layers::GRU<float>;
+// template class nn::layers::GRU<double>;
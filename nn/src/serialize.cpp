@@ -0,0 +1,872 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/serialize.hpp"
+#include "../include/activation_func.hpp"
+
+using namespace nn::io;
+using namespace nn::activation_funcs;
+
+static std::size_t align_up(std::size_t n)
+{
+	return (n + model_file_alignment - 1) / model_file_alignment * model_file_alignment;
+}
+
+static std::runtime_error io_error(const std::string &what, const std::string &path)
+{
+	return std::runtime_error(what + ": " + path + " (" + std::strerror(errno) + ")");
+}
+
+static void write_all(int fd, const void *buf, std::size_t n, const std::string &path)
+{
+	const unsigned char *p = static_cast<const unsigned char *>(buf);
+	while (n > 0) {
+		ssize_t written = ::write(fd, p, n);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			throw io_error("Couldn't write the model file", path);
+		}
+		p += written;
+		n -= static_cast<std::size_t>(written);
+	}
+}
+
+static void copy_name(char *dst, const std::string &name)
+{
+	if (name.size() >= model_file_name_size)
+		throw std::invalid_argument("invalid argument: Layer name too long to be serialized: " + name);
+	std::memset(dst, 0, model_file_name_size);
+	std::memcpy(dst, name.data(), name.size());
+}
+
+static std::string read_name(const char *src)
+{
+	return std::string(src, strnlen(src, model_file_name_size));
+}
+
+// Real hyper-parameters are stored as the bits of a double
+static void put_real(std::uint64_t &dst, double value)
+{
+	std::memcpy(&dst, &value, sizeof(value));
+}
+
+static double get_real(std::uint64_t src)
+{
+	double value;
+	std::memcpy(&value, &src, sizeof(value));
+	return value;
+}
+
+
+// ===================== MODEL IMAGE =====================
+
+template <typename T>
+LayerRecord &nn::io::ModelImage<T>::add_layer(const Layer &layer, const std::string &activation)
+{
+	LayerRecord record;
+	std::memset(&record, 0, sizeof(record));
+	copy_name(record.name, layer.get_name());
+	copy_name(record.activation, activation);
+	record.input_rows = layer.get_input_shape().rows;
+	record.input_cols = layer.get_input_shape().cols;
+	record.output_rows = layer.get_output_shape().rows;
+	record.output_cols = layer.get_output_shape().cols;
+	record.first_tensor = static_cast<std::uint32_t>(records.size());
+	record.ntensors = 0;
+
+	layers.push_back(record);
+	return layers.back();
+}
+
+template <typename T>
+LayerRecord &nn::io::ModelImage<T>::add_state(const Optimizer &optimizer)
+{
+	LayerRecord record;
+	std::memset(&record, 0, sizeof(record));
+	copy_name(record.name, optimizer.get_name());
+	put_real(record.config[0], optimizer.get_learning_rate());
+	record.first_tensor = static_cast<std::uint32_t>(records.size());
+	record.ntensors = 0;
+
+	layers.push_back(record);
+	nstate++;
+	return layers.back();
+}
+
+template <typename T>
+void nn::io::ModelImage<T>::add_tensor(const Mat<T> &A)
+{
+	if (layers.empty())
+		throw std::logic_error("A tensor needs a layer record before it");
+
+	records.push_back(TensorRecord{0, A.rows(), A.cols()});
+	tensors.push_back(A.get_mat_raw());
+	layers.back().ntensors++;
+}
+
+template <typename T>
+std::size_t nn::io::ModelImage<T>::data_size(void) const
+{
+	std::size_t size = 0;
+	for (const auto &record : records)
+		size = align_up(size) + record.rows * record.cols * sizeof(T);
+	return size;
+}
+
+template struct nn::io::ModelImage<float>;
+// template struct nn::io::ModelImage<double>;
+
+
+// ===================== MAPPED FILE =====================
+
+nn::io::MappedFile::MappedFile(const std::string &path)
+	: path_(path), data_(nullptr), size_(0)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw io_error("Couldn't open the model file", path);
+
+	struct stat st;
+	if (::fstat(fd, &st) < 0) {
+		::close(fd);
+		throw io_error("Couldn't stat the model file", path);
+	}
+	size_ = static_cast<std::size_t>(st.st_size);
+	if (size_ == 0) {
+		::close(fd);
+		throw std::runtime_error("Empty model file: " + path);
+	}
+
+	// Private mapping: the pages are shared with the page cache (and every
+	// other process) until they are written, then they are copied
+	void *addr = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED)
+		throw io_error("Couldn't map the model file", path);
+
+	data_ = static_cast<unsigned char *>(addr);
+}
+
+nn::io::MappedFile::~MappedFile(void)
+{
+	if (data_ != nullptr)
+		::munmap(data_, size_);
+	data_ = nullptr;
+}
+
+unsigned char *nn::io::MappedFile::data(void) const
+{
+	return data_;
+}
+
+std::size_t nn::io::MappedFile::size(void) const
+{
+	return size_;
+}
+
+const std::string &nn::io::MappedFile::get_path(void) const
+{
+	return path_;
+}
+
+
+// ===================== WRITING =====================
+
+// layer_kind: the name of the record of a layer, its class (a renamed Dense is still a "Dense")
+template <typename T>
+static std::string layer_kind(const Layer &layer)
+{
+	if (dynamic_cast<const Dense<T> *>(&layer) != nullptr)
+		return "Dense";
+	if (dynamic_cast<const SparseDense<T> *>(&layer) != nullptr)
+		return "SparseDense";
+	if (dynamic_cast<const Embedding<T> *>(&layer) != nullptr)
+		return "Embedding";
+	if (dynamic_cast<const Dropout<T> *>(&layer) != nullptr)
+		return "Dropout";
+	if (dynamic_cast<const BatchNorm<T> *>(&layer) != nullptr)
+		return "BatchNorm";
+	if (dynamic_cast<const LayerNorm<T> *>(&layer) != nullptr)
+		return "LayerNorm";
+	if (dynamic_cast<const Residual<T> *>(&layer) != nullptr)
+		return "Residual";
+	if (dynamic_cast<const Conv2D<T> *>(&layer) != nullptr)
+		return "Conv2D";
+	if (dynamic_cast<const MaxPool2D<T> *>(&layer) != nullptr)
+		return "MaxPool2D";
+	// A GlobalAvgPool is an AvgPool2D too
+	if (dynamic_cast<const GlobalAvgPool<T> *>(&layer) != nullptr)
+		return "GlobalAvgPool";
+	if (dynamic_cast<const AvgPool2D<T> *>(&layer) != nullptr)
+		return "AvgPool2D";
+	if (dynamic_cast<const LSTM<T> *>(&layer) != nullptr)
+		return "LSTM";
+	if (dynamic_cast<const GRU<T> *>(&layer) != nullptr)
+		return "GRU";
+	if (dynamic_cast<const MultiHeadAttention<T> *>(&layer) != nullptr)
+		return "MultiHeadAttention";
+	if (dynamic_cast<const ActivationFunc *>(&layer) != nullptr)
+		return layer.get_name();
+	throw std::invalid_argument("invalid argument: Layer not supported by the model format: " + layer.get_name());
+}
+
+/*
+ * layer_tensors: the tensors of the record of a layer, its parameters and
+ * its non-trainable state (the running statistics of a BatchNorm). The
+ * layers of the block of a Residual have their own records after it.
+ */
+template <typename T>
+static std::vector<Mat<T> *> layer_tensors(const Layer &layer, const std::string &kind)
+{
+	if (kind == "Dense") {
+		const Dense<T> &dense = static_cast<const Dense<T> &>(layer);
+		return {&dense.get_weights(), &dense.get_bias()};
+	}
+	if (kind == "Embedding")
+		return {&static_cast<const Embedding<T> &>(layer).get_table()};
+	if (kind == "BatchNorm") {
+		const BatchNorm<T> &norm = static_cast<const BatchNorm<T> &>(layer);
+		return {&norm.get_gamma(), &norm.get_beta(), &norm.get_running_mean(), &norm.get_running_var()};
+	}
+	if (kind == "Residual") {
+		const Residual<T> &residual = static_cast<const Residual<T> &>(layer);
+		if (!residual.has_layer_norm())
+			return {};
+		return {&residual.get_layer_norm().get_gamma(), &residual.get_layer_norm().get_beta()};
+	}
+	// The other ones have no state but their parameters
+	return const_cast<Layer &>(layer).template parameters<T>();
+}
+
+// sparse_pattern: the stored blocks of a sparse matrix, (block rows, block columns) of zeros and ones
+template <typename T>
+static Mat<T> sparse_pattern(const SparseMat<T> &weights)
+{
+	Mat<T> pattern(weights.rows() / weights.get_block_rows(), weights.cols() / weights.get_block_cols());
+	pattern.fill(static_cast<T>(0));
+	const std::vector<std::size_t> &row_ptr = weights.get_row_ptr();
+	const std::vector<std::uint32_t> &col_idx = weights.get_col_idx();
+	for (std::size_t ib = 0; ib < pattern.rows(); ib++)
+		for (std::size_t k = row_ptr[ib]; k < row_ptr[ib + 1]; k++)
+			pattern(ib, col_idx[k]) = static_cast<T>(1);
+	return pattern;
+}
+
+/*
+ * add_record: the record of a layer with its hyper-parameters in `config`
+ * and its tensors, a Residual is followed by the records of its block
+ */
+template <typename T>
+static void add_record(ModelImage<T> &image, const Layer &layer)
+{
+	std::string kind = layer_kind<T>(layer);
+	const WeightedLayer *weighted = dynamic_cast<const WeightedLayer *>(&layer);
+	std::string activation = weighted != nullptr && weighted->has_activation_func()
+		? weighted->get_activation_func()->get_name() : "";
+
+	LayerRecord &record = image.add_layer(layer, activation);
+	copy_name(record.name, kind);
+	std::uint64_t *config = record.config;
+	if (kind == "Embedding") {
+		const Embedding<T> &embedding = static_cast<const Embedding<T> &>(layer);
+		config[0] = embedding.get_vocab_size();
+		config[1] = embedding.get_dim();
+	} else if (kind == "Dropout") {
+		const Dropout<T> &dropout = static_cast<const Dropout<T> &>(layer);
+		put_real(config[0], dropout.get_rate());
+		config[1] = dropout.get_seed();
+	} else if (kind == "BatchNorm") {
+		const BatchNorm<T> &norm = static_cast<const BatchNorm<T> &>(layer);
+		put_real(config[0], norm.get_momentum());
+		put_real(config[1], norm.get_eps());
+	} else if (kind == "LayerNorm") {
+		put_real(config[0], static_cast<const LayerNorm<T> &>(layer).get_eps());
+	} else if (kind == "Residual") {
+		const Residual<T> &residual = static_cast<const Residual<T> &>(layer);
+		config[0] = residual.get_block().size();
+		config[1] = residual.has_layer_norm();
+		if (residual.has_layer_norm())
+			put_real(config[2], residual.get_layer_norm().get_eps());
+	} else if (kind == "Conv2D") {
+		const Conv2D<T> &conv = static_cast<const Conv2D<T> &>(layer);
+		config[0] = conv.get_channels();
+		config[1] = conv.get_height();
+		config[2] = conv.get_width();
+		config[3] = conv.get_filters();
+		config[4] = conv.get_kernel_size();
+		config[5] = conv.get_stride();
+		config[6] = conv.get_padding();
+		config[7] = conv.get_dilation();
+	} else if (kind == "MaxPool2D" || kind == "AvgPool2D" || kind == "GlobalAvgPool") {
+		const Pool2D &pool = static_cast<const Pool2D &>(layer);
+		config[0] = pool.get_channels();
+		config[1] = pool.get_height();
+		config[2] = pool.get_width();
+		config[3] = pool.get_pool_height();
+		config[4] = pool.get_pool_width();
+		config[5] = pool.get_stride();
+	} else if (kind == "LSTM" || kind == "GRU") {
+		const Recurrent<T> &recurrent = static_cast<const Recurrent<T> &>(layer);
+		config[0] = recurrent.get_input_size() / recurrent.get_seq_len();
+		config[1] = recurrent.get_hidden_size();
+		config[2] = recurrent.get_seq_len();
+		config[3] = recurrent.returns_sequences();
+	} else if (kind == "MultiHeadAttention") {
+		const MultiHeadAttention<T> &attention = static_cast<const MultiHeadAttention<T> &>(layer);
+		config[0] = attention.get_dim();
+		config[1] = attention.get_nheads();
+		config[2] = attention.get_seq_len();
+		config[3] = attention.is_causal();
+	} else if (kind == "SparseDense") {
+		const SparseMat<T> &weights = static_cast<const SparseDense<T> &>(layer).get_weights();
+		config[0] = static_cast<std::uint64_t>(weights.get_format());
+		config[1] = weights.get_block_rows();
+		config[2] = weights.get_block_cols();
+	}
+
+	for (Mat<T> *tensor : layer_tensors<T>(layer, kind))
+		image.add_tensor(*tensor);
+	// The pattern has no matrix in the layer, the image keeps it
+	if (kind == "SparseDense") {
+		const SparseMat<T> &weights = static_cast<const SparseDense<T> &>(layer).get_weights();
+		image.owned.push_back(std::make_unique<Mat<T>>(sparse_pattern(weights)));
+		image.add_tensor(*image.owned.back());
+	}
+	if (kind == "Residual")
+		for (const auto &block_layer : static_cast<const Residual<T> &>(layer).get_block())
+			add_record(image, *block_layer);
+}
+
+template <typename T>
+ModelImage<T> nn::io::make_image(const Dense<T> &layer)
+{
+	ModelImage<T> image;
+	image.kind = ModelKind::Dense;
+	add_record(image, layer);
+	return image;
+}
+
+template <typename T>
+ModelImage<T> nn::io::make_image(const Perceptron<T> &model)
+{
+	ModelImage<T> image;
+	image.kind = ModelKind::Perceptron;
+	image.add_layer(model, "StepFunc");
+	image.add_tensor(model.get_weights());
+	image.add_tensor(model.get_bias());
+	return image;
+}
+
+template <typename T>
+ModelImage<T> nn::io::make_image(const Adeline<T> &model)
+{
+	ModelImage<T> image;
+	image.kind = ModelKind::Adeline;
+	image.add_layer(model, "SigmoidFunc");
+	image.add_tensor(model.get_weights());
+	image.add_tensor(model.get_bias());
+	return image;
+}
+
+template <typename T>
+ModelImage<T> nn::io::make_image(const Sequential<T> &model)
+{
+	ModelImage<T> image;
+	image.kind = ModelKind::Sequential;
+
+	for (const auto &layer_ptr : model.get_layers())
+		add_record(image, *layer_ptr);
+
+	return image;
+}
+
+template <typename T>
+void nn::io::write_image(const std::string &path, const ModelImage<T> &image, bool sync)
+{
+	FileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, model_file_magic, sizeof(header.magic));
+	header.version = model_file_version;
+	header.dtype_size = sizeof(T);
+	header.kind = static_cast<std::uint32_t>(image.kind);
+	header.nlayers = static_cast<std::uint32_t>(image.layers.size() - image.nstate);
+	header.nstate = image.nstate;
+	header.ntensors = static_cast<std::uint32_t>(image.records.size());
+	header.epoch = image.epoch;
+
+	std::size_t tables_size = sizeof(FileHeader)
+		+ image.layers.size() * sizeof(LayerRecord)
+		+ image.records.size() * sizeof(TensorRecord);
+	header.data_offset = align_up(tables_size);
+
+	// Place every tensor in an aligned offset
+	std::vector<TensorRecord> records = image.records;
+	std::size_t offset = header.data_offset;
+	for (auto &record : records) {
+		offset = align_up(offset);
+		record.offset = offset;
+		offset += record.rows * record.cols * sizeof(T);
+	}
+	header.file_size = offset;
+
+	std::string tmp_path = path + ".tmp";
+	int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		throw io_error("Couldn't create the model file", tmp_path);
+
+	try {
+		static const unsigned char padding[model_file_alignment] = {0};
+
+		write_all(fd, &header, sizeof(header), tmp_path);
+		write_all(fd, image.layers.data(), image.layers.size() * sizeof(LayerRecord), tmp_path);
+		write_all(fd, records.data(), records.size() * sizeof(TensorRecord), tmp_path);
+
+		std::size_t position = tables_size;
+		for (std::size_t i = 0; i < records.size(); i++) {
+			write_all(fd, padding, records[i].offset - position, tmp_path);
+			std::size_t nbytes = records[i].rows * records[i].cols * sizeof(T);
+			write_all(fd, image.tensors[i], nbytes, tmp_path);
+			position = records[i].offset + nbytes;
+		}
+		write_all(fd, padding, header.file_size - position, tmp_path);
+
+		if (sync && ::fsync(fd) < 0)
+			throw io_error("Couldn't sync the model file", tmp_path);
+	} catch (...) {
+		::close(fd);
+		::unlink(tmp_path.c_str());
+		throw;
+	}
+
+	if (::close(fd) < 0) {
+		::unlink(tmp_path.c_str());
+		throw io_error("Couldn't close the model file", tmp_path);
+	}
+	if (std::rename(tmp_path.c_str(), path.c_str()) < 0) {
+		::unlink(tmp_path.c_str());
+		throw io_error("Couldn't rename the model file", path);
+	}
+
+	// The rename is only durable once the directory entry reaches the disk
+	if (sync) {
+		std::size_t slash = path.find_last_of('/');
+		std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+		int dir_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+		if (dir_fd < 0)
+			throw io_error("Couldn't open the directory of the model file", directory);
+		int status = ::fsync(dir_fd);
+		::close(dir_fd);
+		if (status < 0)
+			throw io_error("Couldn't sync the directory of the model file", directory);
+	}
+}
+
+template <typename T>
+void nn::io::save(const std::string &path, const Dense<T> &layer)
+{
+	write_image(path, make_image(layer));
+}
+
+template <typename T>
+void nn::io::save(const std::string &path, const Perceptron<T> &model)
+{
+	write_image(path, make_image(model));
+}
+
+template <typename T>
+void nn::io::save(const std::string &path, const Adeline<T> &model)
+{
+	write_image(path, make_image(model));
+}
+
+template <typename T>
+void nn::io::save(const std::string &path, const Sequential<T> &model)
+{
+	write_image(path, make_image(model));
+}
+
+
+// ===================== LOADING =====================
+
+template <typename T>
+const FileHeader &nn::io::read_header(const MappedFile &file)
+{
+	if (file.size() < sizeof(FileHeader))
+		throw std::runtime_error("Truncated model file: " + file.get_path());
+
+	const FileHeader &header = *reinterpret_cast<const FileHeader *>(file.data());
+	if (std::memcmp(header.magic, model_file_magic, sizeof(header.magic)) != 0)
+		throw std::runtime_error("Not a model file: " + file.get_path());
+	if (header.version < model_file_min_version || header.version > model_file_version)
+		throw std::runtime_error("Unsupported model file version: " + std::to_string(header.version));
+	// Version 1 had no state records, the field was reserved
+	if (header.version < 2 && header.nstate != 0)
+		throw std::runtime_error("Corrupted model file: " + file.get_path());
+	if (header.dtype_size != sizeof(T))
+		throw std::runtime_error("The model file was saved with a different data type: " + file.get_path());
+	if (header.file_size != file.size())
+		throw std::runtime_error("Truncated model file: " + file.get_path());
+
+	std::size_t nrecords = static_cast<std::size_t>(header.nlayers) + header.nstate;
+	std::size_t tables_size = sizeof(FileHeader)
+		+ nrecords * sizeof(LayerRecord)
+		+ static_cast<std::size_t>(header.ntensors) * sizeof(TensorRecord);
+	if (tables_size > header.data_offset || header.data_offset > file.size())
+		throw std::runtime_error("Corrupted model file: " + file.get_path());
+
+	const LayerRecord *layers = reinterpret_cast<const LayerRecord *>(file.data() + sizeof(FileHeader));
+	const TensorRecord *tensors = reinterpret_cast<const TensorRecord *>(layers + nrecords);
+	for (std::size_t i = 0; i < nrecords; i++)
+		if (static_cast<std::size_t>(layers[i].first_tensor) + layers[i].ntensors > header.ntensors)
+			throw std::runtime_error("Corrupted model file: " + file.get_path());
+	for (std::uint32_t i = 0; i < header.ntensors; i++) {
+		const TensorRecord &t = tensors[i];
+		if (t.offset % model_file_alignment != 0 || t.offset < header.data_offset || t.offset > file.size()
+		    || t.rows == 0 || t.cols == 0)
+			throw std::runtime_error("Corrupted model file: " + file.get_path());
+		// rows * cols * sizeof(T) can wrap around, compare against the room left instead
+		std::size_t room = (file.size() - t.offset) / sizeof(T);
+		if (t.rows > room || t.cols > room / t.rows)
+			throw std::runtime_error("Corrupted model file: " + file.get_path());
+	}
+
+	return header;
+}
+
+template <typename T>
+static std::unique_ptr<Layer> make_activation(const std::string &name)
+{
+	if (name.empty())
+		return nullptr;
+	if (name == "StepFunc")
+		return std::make_unique<StepFunc<T>>();
+	if (name == "SigmoidFunc")
+		return std::make_unique<SigmoidFunc<T>>();
+	if (name == "TanhFunc")
+		return std::make_unique<TanhFunc<T>>();
+	if (name == "ReluFunc")
+		return std::make_unique<ReluFunc<T>>();
+	if (name == "SoftmaxFunc")
+		return std::make_unique<SoftmaxFunc<T>>();
+	throw std::runtime_error("Unknown activation function in the model file: " + name);
+}
+
+/* View of the tables of a mapped file */
+template <typename T>
+struct MappedModel {
+	std::shared_ptr<MappedFile> file;
+	const FileHeader *header;
+	const LayerRecord *layers;
+	const TensorRecord *tensors;
+
+	MappedModel(const std::string &path, ModelKind kind)
+		: file(std::make_shared<MappedFile>(path))
+	{
+		header = &read_header<T>(*file);
+		if (header->kind != static_cast<std::uint32_t>(kind))
+			throw std::runtime_error("The model file stores a different kind of model: " + path);
+		layers = reinterpret_cast<const LayerRecord *>(file->data() + sizeof(FileHeader));
+		tensors = reinterpret_cast<const TensorRecord *>(layers + header->nlayers + header->nstate);
+	}
+
+	T *tensor(const LayerRecord &layer, std::uint32_t i, const Shape &expected) const
+	{
+		if (i >= layer.ntensors)
+			throw std::runtime_error("Missing tensor in the model file: " + file->get_path());
+		const TensorRecord &t = tensors[layer.first_tensor + i];
+		if (Shape(t.rows, t.cols) != expected)
+			throw std::runtime_error("Tensor of unexpected shape in the model file: " + file->get_path());
+		return reinterpret_cast<T *>(file->data() + t.offset);
+	}
+
+	const LayerRecord &single_layer(void) const
+	{
+		if (header->nlayers != 1)
+			throw std::runtime_error("Corrupted model file: " + file->get_path());
+		return layers[0];
+	}
+};
+
+static Shape input_shape_of(const LayerRecord &record)
+{
+	return Shape(record.input_rows, record.input_cols);
+}
+
+static Shape output_shape_of(const LayerRecord &record)
+{
+	return Shape(record.output_rows, record.output_cols);
+}
+
+template <typename T>
+static std::unique_ptr<Dense<T>> load_dense_layer(const MappedModel<T> &model, const LayerRecord &record)
+{
+	auto dense = std::make_unique<Dense<T>>(input_shape_of(record), output_shape_of(record),
+						make_activation<T>(read_name(record.activation)));
+	dense->bind_weights(model.tensor(record, 0, Shape(record.output_rows, record.input_rows)),
+			    model.tensor(record, 1, Shape(record.output_rows, 1)),
+			    model.file);
+	return dense;
+}
+
+template <typename T>
+static void copy_tensor(const MappedModel<T> &model, const LayerRecord &record, std::uint32_t i, Mat<T> &dst)
+{
+	const T *src = model.tensor(record, i, dst.get_shape());
+	std::memcpy(dst.get_mat_raw(), src, dst.rows() * dst.cols() * sizeof(T));
+}
+
+// The table is copied into the layer once it is built, see `copy_layer`
+template <typename T>
+static std::unique_ptr<Embedding<T>> load_embedding_layer(const MappedModel<T> &model, const LayerRecord &record)
+{
+	if (record.config[0] == 0 || record.config[1] == 0 || record.input_rows == 0
+	    || record.output_rows != record.input_rows * record.config[1])
+		throw std::runtime_error("Corrupted model file: " + model.file->get_path());
+	return std::make_unique<Embedding<T>>(record.config[0], record.config[1], record.input_rows);
+}
+
+// The stored values are copied once the layer is built, the pattern is the third tensor
+template <typename T>
+static std::unique_ptr<SparseDense<T>> load_sparse_dense_layer(const MappedModel<T> &model, const LayerRecord &record)
+{
+	std::size_t rows = record.output_rows, cols = record.input_rows;
+	std::size_t block_rows = record.config[1], block_cols = record.config[2];
+	if (record.config[0] > static_cast<std::uint64_t>(SparseFormat::BSR) || block_rows == 0 || block_cols == 0
+	    || rows % block_rows != 0 || cols % block_cols != 0)
+		throw std::runtime_error("Corrupted model file: " + model.file->get_path());
+
+	Shape blocks(rows / block_rows, cols / block_cols);
+	const T *pattern = model.tensor(record, 2, blocks);
+	std::vector<bool> keep(blocks.rows * blocks.cols);
+	for (std::size_t i = 0; i < keep.size(); i++)
+		keep[i] = pattern[i] != static_cast<T>(0);
+
+	Mat<T> zeros(rows, cols);
+	zeros.fill(static_cast<T>(0));
+	SparseMat<T> weights(zeros, keep, static_cast<SparseFormat>(record.config[0]), block_rows, block_cols);
+	return std::make_unique<SparseDense<T>>(weights, make_activation<T>(read_name(record.activation)));
+}
+
+/*
+ * load_layer: the layer of the record `index`, a Residual with the layers of
+ * its block, `index` moves past their records. The Dense weights point into
+ * the mapping, the other tensors are copied by `copy_layer` after the build
+ */
+template <typename T>
+static std::unique_ptr<Layer> load_layer(const MappedModel<T> &model, std::uint32_t &index)
+{
+	if (index >= model.header->nlayers)
+		throw std::runtime_error("Corrupted model file: " + model.file->get_path());
+
+	const LayerRecord &record = model.layers[index++];
+	std::string kind = read_name(record.name);
+	const std::uint64_t *config = record.config;
+	std::size_t size = record.input_rows;
+	std::shared_ptr<Layer> activation = make_activation<T>(read_name(record.activation));
+
+	if (kind == "Dense")
+		return load_dense_layer(model, record);
+	if (kind == "SparseDense")
+		return load_sparse_dense_layer(model, record);
+	if (kind == "Embedding")
+		return load_embedding_layer(model, record);
+	if (kind == "Dropout")
+		return std::make_unique<Dropout<T>>(size, static_cast<T>(get_real(config[0])), config[1]);
+	if (kind == "BatchNorm")
+		return std::make_unique<BatchNorm<T>>(size, activation, static_cast<T>(get_real(config[0])),
+						      static_cast<T>(get_real(config[1])));
+	if (kind == "LayerNorm")
+		return std::make_unique<LayerNorm<T>>(size, static_cast<T>(get_real(config[0])));
+	if (kind == "Conv2D")
+		return std::make_unique<Conv2D<T>>(config[0], config[1], config[2], config[3], config[4], config[5],
+						   config[6], config[7], activation);
+	if (kind == "MaxPool2D" || kind == "AvgPool2D") {
+		// The windows of these pools are squares
+		if (config[3] != config[4])
+			throw std::runtime_error("Corrupted model file: " + model.file->get_path());
+		if (kind == "MaxPool2D")
+			return std::make_unique<MaxPool2D<T>>(config[0], config[1], config[2], config[3], config[5]);
+		return std::make_unique<AvgPool2D<T>>(config[0], config[1], config[2], config[3], config[5]);
+	}
+	if (kind == "GlobalAvgPool")
+		return std::make_unique<GlobalAvgPool<T>>(config[0], config[1], config[2]);
+	if (kind == "LSTM")
+		return std::make_unique<LSTM<T>>(config[0], config[1], config[2], config[3] != 0);
+	if (kind == "GRU")
+		return std::make_unique<GRU<T>>(config[0], config[1], config[2], config[3] != 0);
+	if (kind == "MultiHeadAttention")
+		return std::make_unique<MultiHeadAttention<T>>(config[0], config[1], config[2], config[3] != 0);
+	if (kind == "Residual") {
+		bool layer_norm = config[1] != 0;
+		auto residual = std::make_unique<Residual<T>>(std::initializer_list<std::unique_ptr<Layer>>{}, layer_norm,
+							      layer_norm ? static_cast<T>(get_real(config[2])) : static_cast<T>(1e-5));
+		for (std::uint64_t i = 0; i < config[0]; i++)
+			residual->add(load_layer(model, index));
+		return residual;
+	}
+
+	// The activation functions are the only records without a kind of their own
+	std::unique_ptr<Layer> func = make_activation<T>(kind);
+	if (func == nullptr)
+		throw std::runtime_error("Corrupted model file: " + model.file->get_path());
+	return func;
+}
+
+/*
+ * copy_layer: the tensors of the record `index` into a built layer of the
+ * same kind, and the ones of its block for a Residual. `mapped_dense` skips
+ * the Dense layers, their weights point into the file already
+ */
+template <typename T>
+static void copy_layer(const MappedModel<T> &model, std::uint32_t &index, Layer &layer, bool mapped_dense)
+{
+	const std::string &path = model.file->get_path();
+	std::string kind = layer_kind<T>(layer);
+	if (index >= model.header->nlayers || read_name(model.layers[index].name) != kind)
+		throw std::runtime_error("The model file has a different architecture: " + path);
+	const LayerRecord &record = model.layers[index++];
+
+	// The values of a sparse matrix are only the same weights with the same pattern
+	if (kind == "SparseDense") {
+		Mat<T> pattern = sparse_pattern(static_cast<SparseDense<T> &>(layer).get_weights());
+		const T *stored = model.tensor(record, 2, pattern.get_shape());
+		if (std::memcmp(stored, pattern.get_mat_raw(), pattern.rows() * pattern.cols() * sizeof(T)) != 0)
+			throw std::runtime_error("The model file has a different architecture: " + path);
+	}
+
+	if (kind != "Dense" || !mapped_dense) {
+		std::vector<Mat<T> *> tensors = layer_tensors<T>(layer, kind);
+		for (std::uint32_t i = 0; i < tensors.size(); i++)
+			copy_tensor(model, record, i, *tensors[i]);
+	}
+
+	if (kind == "Residual") {
+		const Residual<T> &residual = static_cast<Residual<T> &>(layer);
+		if (record.config[0] != residual.get_block().size() || (record.config[1] != 0) != residual.has_layer_norm())
+			throw std::runtime_error("The model file has a different architecture: " + path);
+		for (const auto &block_layer : residual.get_block())
+			copy_layer(model, index, *block_layer, mapped_dense);
+	}
+}
+
+template <typename T>
+std::shared_ptr<Dense<T>> nn::io::load_dense(const std::string &path)
+{
+	MappedModel<T> model(path, ModelKind::Dense);
+	std::shared_ptr<Dense<T>> dense = load_dense_layer(model, model.single_layer());
+	dense->build();
+	return dense;
+}
+
+template <typename T>
+std::shared_ptr<Perceptron<T>> nn::io::load_perceptron(const std::string &path, std::shared_ptr<Optimizer> optimizer)
+{
+	MappedModel<T> model(path, ModelKind::Perceptron);
+	const LayerRecord &record = model.single_layer();
+
+	auto perceptron = std::make_shared<Perceptron<T>>(input_shape_of(record), output_shape_of(record));
+	perceptron->set_optimizer(optimizer != nullptr ? optimizer : std::make_shared<PerceptronOptimizer<T>>());
+	perceptron->bind_weights(model.tensor(record, 0, Shape(record.output_rows, record.input_rows)),
+				 model.tensor(record, 1, Shape(record.output_rows, 1)),
+				 model.file);
+	perceptron->build();
+	return perceptron;
+}
+
+template <typename T>
+std::shared_ptr<Adeline<T>> nn::io::load_adeline(const std::string &path, std::shared_ptr<Optimizer> optimizer)
+{
+	MappedModel<T> model(path, ModelKind::Adeline);
+	const LayerRecord &record = model.single_layer();
+
+	auto adeline = std::make_shared<Adeline<T>>(input_shape_of(record), output_shape_of(record));
+	adeline->set_optimizer(optimizer != nullptr ? optimizer : std::make_shared<GradientDescentOptimizer<T>>());
+	adeline->bind_weights(model.tensor(record, 0, Shape(record.output_rows, record.input_rows)),
+			      model.tensor(record, 1, Shape(record.output_rows, 1)),
+			      model.file);
+	adeline->build();
+	return adeline;
+}
+
+template <typename T>
+std::shared_ptr<Sequential<T>> nn::io::load_sequential(const std::string &path, std::shared_ptr<Optimizer> optimizer)
+{
+	MappedModel<T> model(path, ModelKind::Sequential);
+
+	auto sequential = std::make_shared<Sequential<T>>(std::initializer_list<std::unique_ptr<Layer>>{});
+	std::uint32_t index = 0;
+	try {
+		while (index < model.header->nlayers)
+			sequential->add(load_layer(model, index));
+	} catch (const std::invalid_argument &) {
+		// The layers reject the hyper-parameters of a corrupted record
+		throw std::runtime_error("Corrupted model file: " + path);
+	}
+
+	// Copying the weights to a slab would defeat the mapping
+	sequential->set_optimizer(optimizer != nullptr ? optimizer : std::make_shared<GradientDescentOptimizer<T>>());
+	sequential->set_flat_parameters(false);
+	sequential->build();
+
+	// A step of a few rows would copy whole pages of a mapped table anyway, the
+	// tensors but the Dense weights are copied
+	index = 0;
+	for (const auto &layer_ptr : sequential->get_layers())
+		copy_layer(model, index, *layer_ptr, true);
+	return sequential;
+}
+
+template <typename T>
+std::uint64_t nn::io::restore(const std::string &path, Sequential<T> &model)
+{
+	MappedModel<T> mapped(path, ModelKind::Sequential);
+
+	std::uint32_t index = 0;
+	for (const auto &layer_ptr : model.get_layers())
+		copy_layer(mapped, index, *layer_ptr, false);
+	if (index != mapped.header->nlayers)
+		throw std::runtime_error("The model file has a different architecture: " + path);
+
+	// The optimizer state, if the file has it and the model has an optimizer of the same kind
+	std::shared_ptr<Optimizer> optimizer = model.get_optimizer();
+	if (mapped.header->nstate > 0 && optimizer != nullptr) {
+		const LayerRecord &record = mapped.layers[mapped.header->nlayers];
+		if (read_name(record.name) != optimizer->get_name())
+			throw std::runtime_error("The checkpoint was saved with a different optimizer: " + path);
+
+		optimizer->set_learning_rate(get_real(record.config[0]));
+
+		optimizer->prepare(model.optimizer_parameters());
+		std::vector<Mat<T> *> state = optimizer->template get_state<T>();
+		if (state.size() != record.ntensors)
+			throw std::runtime_error("The checkpoint has a different optimizer state: " + path);
+		for (std::uint32_t i = 0; i < record.ntensors; i++)
+			copy_tensor(mapped, record, i, *state[i]);
+	}
+
+	return mapped.header->epoch;
+}
+
+template ModelImage<float> nn::io::make_image(const Dense<float> &layer);
+template ModelImage<float> nn::io::make_image(const Perceptron<float> &model);
+template ModelImage<float> nn::io::make_image(const Adeline<float> &model);
+template ModelImage<float> nn::io::make_image(const Sequential<float> &model);
+template void nn::io::write_image(const std::string &path, const ModelImage<float> &image, bool sync);
+template void nn::io::save(const std::string &path, const Dense<float> &layer);
+template void nn::io::save(const std::string &path, const Perceptron<float> &model);
+template void nn::io::save(const std::string &path, const Adeline<float> &model);
+template void nn::io::save(const std::string &path, const Sequential<float> &model);
+template std::shared_ptr<Dense<float>> nn::io::load_dense(const std::string &path);
+template std::shared_ptr<Perceptron<float>> nn::io::load_perceptron(const std::string &path, std::shared_ptr<Optimizer> optimizer);
+template std::shared_ptr<Adeline<float>> nn::io::load_adeline(const std::string &path, std::shared_ptr<Optimizer> optimizer);
+template std::shared_ptr<Sequential<float>> nn::io::load_sequential(const std::string &path, std::shared_ptr<Optimizer> optimizer);
+template std::uint64_t nn::io::restore(const std::string &path, Sequential<float> &model);
+template const FileHeader &nn::io::read_header<float>(const MappedFile &file);
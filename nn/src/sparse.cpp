@@ -0,0 +1,474 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+#include "../include/sparse.hpp"
+
+using namespace nn::mathops;
+using namespace nn::layers;
+
+// The blocks with a sum of squares above `threshold`
+template <typename T>
+static std::vector<bool> blocks_above(const std::vector<T> &norms, T threshold)
+{
+	std::vector<bool> keep(norms.size());
+	for (std::size_t k = 0; k < norms.size(); k++)
+		keep[k] = norms[k] > threshold;
+	return keep;
+}
+
+template <typename T>
+nn::mathops::SparseMat<T>::SparseMat(const Mat<T> &A, SparseFormat format, std::size_t block_rows,
+				     std::size_t block_cols, T threshold)
+	: SparseMat(A, blocks_above(block_norms(A, block_rows, block_cols), threshold), format, block_rows, block_cols)
+{
+}
+
+template <typename T>
+nn::mathops::SparseMat<T>::SparseMat(const Mat<T> &A, const std::vector<bool> &keep, SparseFormat format,
+				     std::size_t block_rows, std::size_t block_cols)
+	: shape_(A.get_shape()), format_(format), block_rows_(block_rows), block_cols_(block_cols)
+{
+	if (format == SparseFormat::CSR && (block_rows != 1 || block_cols != 1))
+		throw std::invalid_argument("invalid argument: a CSR matrix stores single elements");
+	if (block_rows == 0 || block_cols == 0 || A.rows() % block_rows != 0 || A.cols() % block_cols != 0)
+		throw std::invalid_argument("invalid argument: the blocks don't divide the sparse matrix");
+	if (A.cols() / block_cols > std::numeric_limits<std::uint32_t>::max())
+		throw std::invalid_argument("invalid argument: too many block columns for a sparse matrix");
+
+	std::size_t nbrows = A.rows() / block_rows, nbcols = A.cols() / block_cols;
+	if (keep.size() != nbrows * nbcols)
+		throw std::invalid_argument("invalid argument: one flag per block is needed to build a sparse matrix");
+
+	row_ptr_.assign(1, 0);
+	for (std::size_t ib = 0; ib < nbrows; ib++) {
+		for (std::size_t jb = 0; jb < nbcols; jb++)
+			if (keep[ib * nbcols + jb])
+				col_idx_.push_back(static_cast<std::uint32_t>(jb));
+		row_ptr_.push_back(col_idx_.size());
+	}
+	if (col_idx_.empty())
+		throw std::invalid_argument("invalid argument: a sparse matrix needs a block to store");
+
+	// The blocks one after the other, each one row major
+	std::size_t bsize = block_rows * block_cols;
+	values_ = Mat<T>(Shape{col_idx_.size() * bsize, 1});
+	T *values = values_.get_mat_raw();
+	for (std::size_t ib = 0; ib < nbrows; ib++)
+		for (std::size_t k = row_ptr_[ib]; k < row_ptr_[ib + 1]; k++)
+			for (std::size_t r = 0; r < block_rows; r++)
+				for (std::size_t c = 0; c < block_cols; c++)
+					values[k * bsize + r * block_cols + c] = A(ib * block_rows + r, col_idx_[k] * block_cols + c);
+}
+
+template <typename T>
+std::vector<T> nn::mathops::SparseMat<T>::block_norms(const Mat<T> &A, std::size_t block_rows, std::size_t block_cols)
+{
+	if (block_rows == 0 || block_cols == 0 || A.rows() % block_rows != 0 || A.cols() % block_cols != 0)
+		throw std::invalid_argument("invalid argument: the blocks don't divide the sparse matrix");
+
+	std::size_t nbcols = A.cols() / block_cols;
+	std::vector<T> norms((A.rows() / block_rows) * nbcols, static_cast<T>(0));
+	for (std::size_t i = 0; i < A.rows(); i++)
+		for (std::size_t j = 0; j < A.cols(); j++)
+			norms[(i / block_rows) * nbcols + j / block_cols] += A(i, j) * A(i, j);
+	return norms;
+}
+
+template <typename T>
+const Shape &nn::mathops::SparseMat<T>::get_shape(void) const
+{
+	return shape_;
+}
+
+template <typename T>
+std::size_t nn::mathops::SparseMat<T>::rows(void) const
+{
+	return shape_.rows;
+}
+
+template <typename T>
+std::size_t nn::mathops::SparseMat<T>::cols(void) const
+{
+	return shape_.cols;
+}
+
+template <typename T>
+SparseFormat nn::mathops::SparseMat<T>::get_format(void) const
+{
+	return format_;
+}
+
+template <typename T>
+std::size_t nn::mathops::SparseMat<T>::get_block_rows(void) const
+{
+	return block_rows_;
+}
+
+template <typename T>
+std::size_t nn::mathops::SparseMat<T>::get_block_cols(void) const
+{
+	return block_cols_;
+}
+
+template <typename T>
+std::size_t nn::mathops::SparseMat<T>::nnz(void) const
+{
+	return values_.rows();
+}
+
+template <typename T>
+std::size_t nn::mathops::SparseMat<T>::nblocks(void) const
+{
+	return col_idx_.size();
+}
+
+template <typename T>
+double nn::mathops::SparseMat<T>::density(void) const
+{
+	return static_cast<double>(nnz()) / static_cast<double>(shape_.rows * shape_.cols);
+}
+
+template <typename T>
+Mat<T> &nn::mathops::SparseMat<T>::get_values(void)
+{
+	return values_;
+}
+
+template <typename T>
+const Mat<T> &nn::mathops::SparseMat<T>::get_values(void) const
+{
+	return values_;
+}
+
+template <typename T>
+const std::vector<std::size_t> &nn::mathops::SparseMat<T>::get_row_ptr(void) const
+{
+	return row_ptr_;
+}
+
+template <typename T>
+const std::vector<std::uint32_t> &nn::mathops::SparseMat<T>::get_col_idx(void) const
+{
+	return col_idx_;
+}
+
+template <typename T>
+Mat_bsr nn::mathops::SparseMat<T>::layout(void) const
+{
+	return Mat_bsr{shape_.rows, shape_.cols, block_rows_, block_cols_, row_ptr_.data(), col_idx_.data()};
+}
+
+template <typename T>
+Mat<T> nn::mathops::SparseMat<T>::to_dense(void) const
+{
+	Mat<T> A(shape_);
+	A.fill(static_cast<T>(0));
+	std::size_t bsize = block_rows_ * block_cols_;
+	const T *values = values_.get_mat_raw();
+	for (std::size_t ib = 0; ib + 1 < row_ptr_.size(); ib++)
+		for (std::size_t k = row_ptr_[ib]; k < row_ptr_[ib + 1]; k++)
+			for (std::size_t r = 0; r < block_rows_; r++)
+				for (std::size_t c = 0; c < block_cols_; c++)
+					A(ib * block_rows_ + r, col_idx_[k] * block_cols_ + c) = values[k * bsize + r * block_cols_ + c];
+	return A;
+}
+
+template <typename T>
+Mat<T> nn::mathops::SparseMat<T>::dot(const Mat<T> &B) const
+{
+	if (B.rows() != shape_.cols)
+		throw std::invalid_argument("invalid argument: the shapes of the sparse product don't match");
+
+	Mat<T> C(shape_.rows, B.cols());
+	MatDispatchOps::Mat_bsr_dot(layout(), values_.get_mat_raw(), B.get_mat_raw(), C.get_mat_raw(), B.cols());
+	return C;
+}
+
+template <typename T>
+Mat<T> nn::mathops::SparseMat<T>::transpose_dot(const Mat<T> &B) const
+{
+	if (B.rows() != shape_.rows)
+		throw std::invalid_argument("invalid argument: the shapes of the sparse product don't match");
+
+	Mat<T> C(shape_.cols, B.cols());
+	MatDispatchOps::Mat_bsr_dot_tn(layout(), values_.get_mat_raw(), B.get_mat_raw(), C.get_mat_raw(), B.cols());
+	return C;
+}
+
+template <typename T>
+const SparseMat<T> &nn::mathops::SparseMat<T>::add_sampled_dot_transposed(const Mat<T> &A, const Mat<T> &B,
+									   Mat<T> &G) const
+{
+	if (A.rows() != shape_.rows || B.rows() != shape_.cols || A.cols() != B.cols()
+	    || G.get_shape() != values_.get_shape())
+		throw std::invalid_argument("invalid argument: the shapes of the sparse product don't match");
+
+	MatDispatchOps::Mat_bsr_sampled_dot_nt_acc(layout(), A.get_mat_raw(), B.get_mat_raw(), G.get_mat_raw(), A.cols());
+	return *this;
+}
+
+template class nn::mathops::SparseMat<float>;
+// template class nn::mathops::SparseMat<double>;
+
+template <typename T>
+nn::layers::SparseDense<T>::SparseDense(const SparseMat<T> &weights, std::shared_ptr<Layer> activation_func)
+	: SparseDense(weights, Mat<T>(weights.rows(), 1).fill(static_cast<T>(0)), activation_func)
+{
+}
+
+template <typename T>
+nn::layers::SparseDense<T>::SparseDense(const SparseMat<T> &weights, const Mat<T> &bias,
+					std::shared_ptr<Layer> activation_func)
+	: WeightedLayer(weights.cols(), weights.rows(), "SparseDense", activation_func),
+	  weights_(std::make_unique<SparseMat<T>>(weights)), bias_(std::make_unique<Mat<T>>(bias))
+{
+	if (bias.get_shape() != Shape(weights.rows(), 1))
+		throw std::invalid_argument("invalid argument: the bias doesn't match the sparse weights");
+}
+
+template <typename T>
+SparseMat<T> &nn::layers::SparseDense<T>::get_weights(void) const
+{
+	return *weights_;
+}
+
+template <typename T>
+Mat<T> &nn::layers::SparseDense<T>::get_bias(void) const
+{
+	return *bias_;
+}
+
+template <typename T>
+SparseDense<T> &nn::layers::SparseDense<T>::alloc_gradients(void)
+{
+	if (grad_values_ != nullptr)
+		return *this;
+
+	grad_values_ = std::make_unique<Mat<T>>(weights_->get_values().get_shape());
+	grad_bias_ = std::make_unique<Mat<T>>(bias_->get_shape());
+	grad_values_->fill(static_cast<T>(0));
+	grad_bias_->fill(static_cast<T>(0));
+	grad_count_ = 0;
+
+	return *this;
+}
+
+template <typename T>
+SparseDense<T> &nn::layers::SparseDense<T>::build(const Shape &input_shape, const Shape &output_shape)
+{
+	if (input_shape.rows != weights_->cols() || output_shape.rows != weights_->rows())
+		throw std::invalid_argument("Invalid shapes for the sparse weights of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+SparseDense<T> &nn::layers::SparseDense<T>::build(std::size_t input_size, std::size_t output_size)
+{
+	if (input_size != weights_->cols() || output_size != weights_->rows())
+		throw std::invalid_argument("Invalid sizes for the sparse weights of the layer: " + name_);
+	return build();
+}
+
+template <typename T>
+SparseDense<T> &nn::layers::SparseDense<T>::build(void)
+{
+	// The weights come with the layer, only the accumulators start again
+	grad_values_ = nullptr;
+	grad_bias_ = nullptr;
+	grad_count_ = 0;
+
+	if (activation_func_ != nullptr)
+		activation_func_->build(output_shape_, output_shape_);
+
+	// After the activation, its in place functions are captured
+	register_funcs();
+
+	built_ = true;
+	return *this;
+}
+
+template <typename T>
+SparseDense<T> &nn::layers::SparseDense<T>::register_funcs(void)
+{
+	register_func<Mat<T>, const Mat<T> &>
+		("logits", [this](const Mat<T> &X) -> Mat<T> {
+			// Z = W . X + B with the stored weights only
+			Mat<T> Z = weights_->dot(X);
+			Z.add_colvec(*bias_);
+			return Z;
+		});
+
+	register_func<Mat<T>, const Mat<T> &>
+		("feedforward", [this](const Mat<T> &X) -> Mat<T> {
+			Mat<T> Z = logits<T>(X);
+			if (activation_func_ != nullptr)
+				return (*activation_func_)(Z);
+			return Z;
+		});
+
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward_logits", [this](const Mat<T> &X, const Mat<T> &dZ, Mat<T> *grads) -> Mat<T> {
+			// dL/dW only where W is stored, dL/dX = W^T . dL/dZ
+			weights_->add_sampled_dot_transposed(dZ, X, grads[0]);
+			grads[1].add_row_sum(dZ);
+			return weights_->transpose_dot(dZ);
+		});
+
+	register_func<Mat<T>, const Mat<T> &, const Mat<T> &, Mat<T> *>
+		("backward", [this](const Mat<T> &X, const Mat<T> &dY, Mat<T> *grads) -> Mat<T> {
+			if (activation_func_ != nullptr) {
+				Mat<T> dZ = activation_func_->backward(logits<T>(X), dY, static_cast<Mat<T> *>(nullptr));
+				return backward_logits<T>(X, dZ, grads);
+			}
+			return backward_logits<T>(X, dY, grads);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("fit", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			Mat<T> grad_values(weights_->get_values().get_shape());
+			grad_values.fill(static_cast<T>(0));
+			weights_->add_sampled_dot_transposed(signal_update, input, grad_values);
+			Mat<T> grad_bias(bias_->get_shape());
+			grad_bias.fill(static_cast<T>(0));
+			grad_bias.add_row_sum(signal_update);
+			optimizer_->apply(weights_->get_values(), grad_values);
+			optimizer_->apply(*bias_, grad_bias);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &>
+		("accumulate", [this](const Mat<T> &signal_update, const Mat<T> &input) -> void {
+			alloc_gradients();
+			weights_->add_sampled_dot_transposed(signal_update, input, *grad_values_);
+			grad_bias_->add_row_sum(signal_update);
+			grad_count_ += input.cols();
+		});
+
+	register_func<void>
+		("step", [this]() -> void {
+			if (grad_count_ == 0)
+				return;
+
+			T scale = static_cast<T>(1) / static_cast<T>(grad_count_);
+			*grad_values_ *= scale;
+			*grad_bias_ *= scale;
+			optimizer_->apply(weights_->get_values(), *grad_values_);
+			optimizer_->apply(*bias_, *grad_bias_);
+
+			grad_values_->fill(static_cast<T>(0));
+			grad_bias_->fill(static_cast<T>(0));
+			grad_count_ = 0;
+		});
+
+	register_func<void>
+		("zero_grad", [this]() -> void {
+			if (grad_values_ == nullptr)
+				return;
+			grad_values_->fill(static_cast<T>(0));
+			grad_bias_->fill(static_cast<T>(0));
+			grad_count_ = 0;
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("gradients", [this]() -> std::vector<Mat<T> *> {
+			alloc_gradients();
+			return {grad_values_.get(), grad_bias_.get()};
+		});
+
+	// The in place functions of the activation are looked up once, not on every call
+	ForwardInto<T> activation_forward;
+	BackwardInto<T> activation_backward;
+	if (activation_func_ != nullptr && activation_func_->can_run_into<T>()) {
+		activation_forward = activation_func_->get_forward_into<T>();
+		activation_backward = activation_func_->get_backward_into<T>();
+	}
+
+	register_func<void, const Mat<T> &, Mat<T> &>
+		("forward_into", [this, activation_forward](const Mat<T> &X, Mat<T> &Y) -> void {
+			MatDispatchOps::Mat_bsr_dot(weights_->layout(), weights_->get_values().get_mat_raw(),
+						    X.get_mat_raw(), Y.get_mat_raw(), X.cols());
+			MatDispatchOps::Mat_add_colvec(Y.get_mat_raw(), bias_->get_mat_raw(), Y.get_shape());
+			if (activation_forward)
+				activation_forward(Y, Y);
+			else if (activation_func_ != nullptr)
+				Y = (*activation_func_)(Y);
+		});
+
+	register_func<void, const Mat<T> &, const Mat<T> &, Mat<T> &, Mat<T> &, Mat<T> *>
+		("backward_into", [this, activation_backward](const Mat<T> &X, const Mat<T> &Y, Mat<T> &dY, Mat<T> &dX, Mat<T> *grads) -> void {
+			// dL/dZ over dY, the activation differentiates from its output
+			if (activation_backward)
+				activation_backward(Y, Y, dY, dY, nullptr);
+			else if (activation_func_ != nullptr)
+				dY = activation_func_->backward(logits<T>(X), dY, static_cast<Mat<T> *>(nullptr));
+
+			Mat_bsr layout = weights_->layout();
+			if (grads != nullptr) {
+				MatDispatchOps::Mat_bsr_sampled_dot_nt_acc(layout, dY.get_mat_raw(), X.get_mat_raw(),
+									   grads[0].get_mat_raw(), dY.cols());
+				MatDispatchOps::Mat_add_row_sum(dY.get_mat_raw(), grads[1].get_mat_raw(), dY.get_shape());
+			}
+			MatDispatchOps::Mat_bsr_dot_tn(layout, weights_->get_values().get_mat_raw(), dY.get_mat_raw(),
+						       dX.get_mat_raw(), dY.cols());
+		});
+
+	register_func<std::vector<Mat<T> *>>
+		("parameters", [this]() -> std::vector<Mat<T> *> {
+			return {&weights_->get_values(), bias_.get()};
+		});
+
+	register_func<void, const std::vector<T *> &>
+		("bind_parameters", [this](const std::vector<T *> &memory) -> void {
+			if (memory.size() != 2)
+				throw std::invalid_argument("invalid argument: a SparseDense layer binds two matrices");
+			// Replaced in place, pointers to them (optimizer state) stay valid
+			Mat<T> &values = weights_->get_values();
+			values = Mat<T>(values.get_shape(), memory[0]);
+			*bias_ = Mat<T>(bias_->get_shape(), memory[1]);
+		});
+
+	return *this;
+}
+
+template class nn::layers::SparseDense<float>;
+// template class nn::layers::SparseDense<double>;
+
+template <typename T>
+std::unique_ptr<SparseDense<T>> nn::layers::prune_dense(const Dense<T> &dense, double sparsity, SparseFormat format,
+							std::size_t block_rows, std::size_t block_cols)
+{
+	if (!(sparsity >= 0.0 && sparsity < 1.0))
+		throw std::invalid_argument("invalid argument: the sparsity must be in [0, 1)");
+
+	// The blocks by decreasing magnitude, the first ones on ties
+	const Mat<T> &W = dense.get_weights();
+	std::vector<T> norms = SparseMat<T>::block_norms(W, block_rows, block_cols);
+	std::vector<std::size_t> order(norms.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&norms](std::size_t a, std::size_t b) {
+		return norms[a] > norms[b];
+	});
+
+	std::size_t ndropped = static_cast<std::size_t>(std::floor(sparsity * static_cast<double>(norms.size())));
+	std::size_t nkept = std::max<std::size_t>(norms.size() - ndropped, 1);
+	std::vector<bool> keep(norms.size(), false);
+	for (std::size_t k = 0; k < nkept; k++)
+		keep[order[k]] = true;
+
+	auto pruned = std::make_unique<SparseDense<T>>(SparseMat<T>(W, keep, format, block_rows, block_cols),
+						       dense.get_bias(), dense.get_activation_func());
+	pruned->set_name(dense.get_name());
+	pruned->build();
+	pruned->set_optimizer(dense.get_optimizer());
+	return pruned;
+}
+
+template std::unique_ptr<SparseDense<float>> nn::layers::prune_dense(const Dense<float> &dense, double sparsity,
+								     SparseFormat format, std::size_t block_rows,
+								     std::size_t block_cols);
@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "../../include/nn.hpp"
+#include "../../include/activation_func.hpp"
+#include "../test_helpers.hpp"
+
+using namespace nn::models;
+using namespace nn::activation_funcs;
+using namespace nn::test;
+
+/*
+ * A binary of its own: the allocator of the whole process is replaced.
+ * Every path ends in the C allocator, so it is counted there: the plain,
+ * array and aligned `new` of libstdc++, the aligned buffers of the library
+ * and the mallocs of libmat
+ */
+static std::atomic<std::size_t> allocations{0};
+
+#ifdef __GLIBC__
+extern "C" {
+	void *__libc_malloc(std::size_t size);
+	void *__libc_calloc(std::size_t n, std::size_t size);
+	void *__libc_realloc(void *ptr, std::size_t size);
+	void *__libc_memalign(std::size_t alignment, std::size_t size);
+	void __libc_free(void *ptr);
+
+	void *malloc(std::size_t size)
+	{
+		allocations++;
+		return __libc_malloc(size);
+	}
+
+	void *calloc(std::size_t n, std::size_t size)
+	{
+		allocations++;
+		return __libc_calloc(n, size);
+	}
+
+	void *realloc(void *ptr, std::size_t size)
+	{
+		allocations++;
+		return __libc_realloc(ptr, size);
+	}
+
+	void *memalign(std::size_t alignment, std::size_t size)
+	{
+		allocations++;
+		return __libc_memalign(alignment, size);
+	}
+
+	void *aligned_alloc(std::size_t alignment, std::size_t size)
+	{
+		allocations++;
+		return __libc_memalign(alignment, size);
+	}
+
+	int posix_memalign(void **ptr, std::size_t alignment, std::size_t size)
+	{
+		allocations++;
+		*ptr = __libc_memalign(alignment, size);
+		return *ptr == nullptr ? ENOMEM : 0;
+	}
+
+	void free(void *ptr)
+	{
+		__libc_free(ptr);
+	}
+}
+#define NN_COUNTS_ALLOCATIONS 1
+#else
+#define NN_COUNTS_ALLOCATIONS 0
+#endif
+
+// steady_state: allocations of 20 compiled training steps after a first one
+static std::size_t steady_state(Sequential<float> &model, const Mat<float> &X, const Mat<float> &dY)
+{
+	std::vector<Mat<float>> grads = zero_gradients(model);
+	model.compile(X.cols(), true);
+
+	// The first run starts the pool, its workers and their traces
+	model.forward_compiled(X);
+	model.backward_compiled(X, dY, grads.data());
+
+	std::size_t before = allocations.load();
+	for (std::size_t n = 0; n < 20; n++) {
+		model.forward_compiled(X);
+		model.backward_compiled(X, dY, grads.data());
+	}
+	return allocations.load() - before;
+}
+
+TEST(AllocationTest, CountsEveryPath) {
+	if (!NN_COUNTS_ALLOCATIONS)
+		GTEST_SKIP() << "the allocator is only replaced on glibc";
+
+	// Through volatile pointers, a new and its delete side by side may be elided
+	int *volatile one = nullptr;
+	float *volatile array = nullptr;
+	void *volatile aligned = nullptr;
+	void *volatile c_aligned = nullptr;
+	std::size_t before = allocations.load();
+	one = new int(1);
+	array = new float[16];
+	aligned = ::operator new(256, std::align_val_t{64});
+	c_aligned = std::aligned_alloc(64, 256);
+	EXPECT_EQ(allocations.load() - before, 4u);
+	delete one;
+	delete[] array;
+	::operator delete(aligned, std::align_val_t{64});
+	std::free(c_aligned);
+}
+
+TEST(AllocationTest, CompiledDenseStepsDoNotAllocate) {
+	if (!NN_COUNTS_ALLOCATIONS)
+		GTEST_SKIP() << "the allocator is only replaced on glibc";
+
+	// Big enough for the products to be split over the thread pool
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Dense<float>>(256, 256, std::make_shared<ReluFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<Dense<float>>(256, 10, std::make_shared<SoftmaxFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+	model->build();
+	Mat<float> X = make_batch(256, 256, 0.01f);
+	EXPECT_EQ(steady_state(*model, X, make_batch(10, 256, 0.05f)), 0u);
+
+	// The uncompiled forward allocates its activations
+	std::size_t before = allocations.load();
+	Mat<float> Y = (*model)(X);
+	EXPECT_GT(allocations.load(), before);
+}
+
+TEST(AllocationTest, CompiledAttentionStepsDoNotAllocate) {
+	if (!NN_COUNTS_ALLOCATIONS)
+		GTEST_SKIP() << "the allocator is only replaced on glibc";
+
+	// Two blocks of queries and keys per sequence, the kernels use the scratch of the trace
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<MultiHeadAttention<float>>(8, 2, 40, true),
+			std::make_unique<Dense<float>>(320, 4, std::make_shared<TanhFunc<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+	model->build();
+	fill_parameters(*model);
+	EXPECT_EQ(steady_state(*model, make_batch(320, 16, 0.1f), make_batch(4, 16, 0.1f)), 0u);
+}
@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <cmath>
 #include "../include/activation_func.hpp"
 
 using namespace nn::activation_funcs;
@@ -156,3 +157,54 @@ TEST_F(SigmoidTest, Construction) {
 	EXPECT_FALSE(sigmoid.is_trainable());
 	EXPECT_EQ(sigmoid.get_name(), "SigmoidFunc");
 }
+
+class SoftmaxTest : public ::testing::Test {
+protected:
+	void SetUp() override {
+		softmax.build();
+	}
+
+	SoftmaxFunc<float> softmax;
+};
+
+// Every column is a distribution, also for huge logits
+TEST_F(SoftmaxTest, ColumnsAreDistributions) {
+	Mat<float> X = {{1.0f, 1000.0f},
+			{2.0f, 1000.0f},
+			{3.0f, -1000.0f}};
+	Mat<float> P = softmax(X);
+
+	float sum = std::exp(1.0f) + std::exp(2.0f) + std::exp(3.0f);
+	EXPECT_NEAR(P(0, 0), std::exp(1.0f) / sum, 1e-6f);
+	EXPECT_NEAR(P(2, 0), std::exp(3.0f) / sum, 1e-6f);
+	EXPECT_FLOAT_EQ(P(0, 1), 0.5f);
+	EXPECT_FLOAT_EQ(P(1, 1), 0.5f);
+	EXPECT_FLOAT_EQ(P(2, 1), 0.0f);
+	for (std::size_t j = 0; j < 2; j++)
+		EXPECT_NEAR(P(0, j) + P(1, j) + P(2, j), 1.0f, 1e-6f);
+
+	// Shifting the logits doesn't change the probabilities
+	Mat<float> shifted = softmax(X + 10.0f);
+	for (std::size_t i = 0; i < 3; i++)
+		for (std::size_t j = 0; j < 2; j++)
+			EXPECT_NEAR(shifted(i, j), P(i, j), 1e-6f);
+}
+
+// The backward is the product with the transposed Jacobian, without building it
+TEST_F(SoftmaxTest, BackwardMatchesTheJacobian) {
+	Mat<float> X = {{0.5f, -1.0f},
+			{1.0f, 0.25f},
+			{-2.0f, 0.0f}};
+	Mat<float> dY = {{1.0f, 0.5f},
+			 {-1.0f, 2.0f},
+			 {0.25f, 0.0f}};
+	Mat<float> dX = softmax.backward(X, dY, static_cast<Mat<float> *>(nullptr));
+
+	for (std::size_t j = 0; j < 2; j++) {
+		Mat<float> x = {{X(0, j)}, {X(1, j)}, {X(2, j)}};
+		Mat<float> dy = {{dY(0, j)}, {dY(1, j)}, {dY(2, j)}};
+		Mat<float> expected = softmax.jacobian(x).transpose_copy().dot(dy);
+		for (std::size_t i = 0; i < 3; i++)
+			EXPECT_NEAR(dX(i, j), expected(i, 0), 1e-6f);
+	}
+}
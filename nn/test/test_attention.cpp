@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+#include "test_helpers.hpp"
+
+using namespace nn::models;
+using namespace nn::activation_funcs;
+using namespace nn::parallel;
+using namespace nn::test;
+
+// The output of the sample j with the whole matrix of scores of every head
+static std::vector<float> reference_output(MultiHeadAttention<float> &layer, const Mat<float> &X, std::size_t j)
+{
+	std::size_t D = layer.get_dim(), T = layer.get_seq_len(), dh = D / layer.get_nheads();
+	Mat<float> &Wqkv = layer.get_qkv_weights(), &bqkv = layer.get_qkv_bias();
+	Mat<float> &Wo = layer.get_output_weights(), &bo = layer.get_output_bias();
+
+	std::vector<float> qkv(T * 3 * D), heads(T * D, 0.0f), Y(T * D);
+	for (std::size_t t = 0; t < T; t++) {
+		for (std::size_t r = 0; r < 3 * D; r++) {
+			qkv[t * 3 * D + r] = bqkv(r, 0);
+			for (std::size_t i = 0; i < D; i++)
+				qkv[t * 3 * D + r] += Wqkv(r, i) * X(t * D + i, j);
+		}
+	}
+
+	for (std::size_t h = 0; h < layer.get_nheads(); h++) {
+		for (std::size_t q = 0; q < T; q++) {
+			std::vector<float> scores(T);
+			std::size_t nkeys = layer.is_causal() ? q + 1 : T;
+			float maximum = -INFINITY, sum = 0.0f;
+			for (std::size_t k = 0; k < nkeys; k++) {
+				scores[k] = 0.0f;
+				for (std::size_t d = 0; d < dh; d++)
+					scores[k] += qkv[q * 3 * D + h * dh + d] * qkv[k * 3 * D + D + h * dh + d];
+				scores[k] /= std::sqrt(static_cast<float>(dh));
+				maximum = std::max(maximum, scores[k]);
+			}
+			for (std::size_t k = 0; k < nkeys; k++)
+				sum += scores[k] = std::exp(scores[k] - maximum);
+			for (std::size_t k = 0; k < nkeys; k++)
+				for (std::size_t d = 0; d < dh; d++)
+					heads[q * D + h * dh + d] += scores[k] / sum * qkv[k * 3 * D + 2 * D + h * dh + d];
+		}
+	}
+
+	for (std::size_t t = 0; t < T; t++) {
+		for (std::size_t r = 0; r < D; r++) {
+			Y[t * D + r] = bo(r, 0);
+			for (std::size_t i = 0; i < D; i++)
+				Y[t * D + r] += Wo(r, i) * heads[t * D + i];
+		}
+	}
+	return Y;
+}
+
+TEST(MultiHeadAttentionTest, TilesMatchTheWholeSoftmax) {
+	// 70 tokens are three tiles of queries and keys, the last one partial
+	for (bool causal : {false, true}) {
+		MultiHeadAttention<float> attention(4, 2, 70, causal);
+		attention.build();
+		EXPECT_EQ(attention.get_input_size(), 280u);
+		EXPECT_EQ(attention.get_output_size(), 280u);
+		EXPECT_EQ(attention.parameters<float>().size(), 4u);
+		fill_parameters(attention);
+
+		Mat<float> X = make_batch(280, 3, 0.3f);
+		Mat<float> Y = attention(X);
+		ASSERT_EQ(Y.get_shape(), X.get_shape());
+		for (std::size_t j = 0; j < 3; j++) {
+			std::vector<float> expected = reference_output(attention, X, j);
+			for (std::size_t i = 0; i < 280; i++)
+				EXPECT_NEAR(Y(i, j), expected[i], 1e-5f);
+		}
+	}
+
+	EXPECT_THROW(MultiHeadAttention<float>(6, 4, 3), std::invalid_argument);
+	EXPECT_THROW(MultiHeadAttention<float>(4, 2, 3).get_qkv_weights(), std::invalid_argument);
+}
+
+TEST(MultiHeadAttentionTest, BackwardMatchesFiniteDifferences) {
+	// 36 tokens, the backward goes over two tiles of keys
+	for (bool causal : {false, true}) {
+		MultiHeadAttention<float> attention(4, 2, 36, causal);
+		attention.build();
+		fill_parameters(attention);
+		Mat<float> X = make_batch(144, 2, 0.3f);
+		Mat<float> dY = make_batch(144, 2, 0.1f);
+
+		EXPECT_THROW(attention.backward<float>(X, dY, nullptr), std::logic_error);
+		attention(X);
+		std::vector<Mat<float>> grads = zero_gradients(attention);
+		Mat<float> dX = attention.backward<float>(X, dY, grads.data());
+		EXPECT_THROW(attention.backward<float>(Mat<float>(X), dY, nullptr), std::logic_error);
+
+		// The compiled path writes the same dX in place of dY
+		Mat<float> Y(X.get_shape()), dY_into = dY;
+		attention.forward_into<float>(X, Y);
+		attention.backward_into<float>(X, Y, dY_into, dY_into, nullptr);
+		expect_near(dX, dY_into, 1e-5f);
+
+		std::vector<Mat<float> *> params = attention.parameters<float>();
+		std::vector<std::pair<Mat<float> *, const Mat<float> *>> checks = {{&X, &dX}};
+		for (std::size_t k = 0; k < params.size(); k++)
+			checks.emplace_back(params[k], &grads[k]);
+		expect_gradients([&](void) { return dot(attention(X), dY); }, checks, 1e-2f, 5e-3);
+	}
+}
+
+TEST(MultiHeadAttentionTest, ConcurrentBatchesKeepTheirTraces) {
+	MultiHeadAttention<float> attention(8, 2, 6, true);
+	attention.build();
+	fill_parameters(attention);
+
+	// Batches of different widths, a backward against the trace of another one would throw
+	const std::size_t nbatches = 6;
+	std::vector<Mat<float>> X, dY, dX(nbatches);
+	std::vector<std::vector<Mat<float>>> grads;
+	for (std::size_t k = 0; k < nbatches; k++) {
+		X.push_back(make_batch(48, 4 + k, 0.05f * static_cast<float>(k + 1)));
+		dY.push_back(make_batch(48, 4 + k, 0.1f));
+		grads.push_back(zero_gradients(attention));
+	}
+
+	TaskGroup tasks;
+	for (std::size_t k = 0; k < nbatches; k++) {
+		tasks.run([&, k] {
+			attention(X[k]);
+			dX[k] = attention.backward<float>(X[k], dY[k], grads[k].data());
+		});
+	}
+	tasks.wait();
+
+	for (std::size_t k = 0; k < nbatches; k++) {
+		attention(X[k]);
+		std::vector<Mat<float>> expected = zero_gradients(attention);
+		expect_near(attention.backward<float>(X[k], dY[k], expected.data()), dX[k], 1e-6f);
+		for (std::size_t p = 0; p < expected.size(); p++)
+			expect_near(expected[p], grads[k][p], 1e-5f);
+	}
+}
+
+TEST(MultiHeadAttentionTest, SequentialBackwardMatchesTheCompiledPlan) {
+	// The plain backward of the model reads the trace of its own forward, not a second pass
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<MultiHeadAttention<float>>(4, 2, 3, true),
+			std::make_unique<Dense<float>>(12, 2, std::make_shared<TanhFunc<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+	model->build();
+	fill_parameters(*model);
+	EXPECT_EQ(model->parameters<float>().size(), 6u);
+
+	Mat<float> X = make_batch(12, 8, 0.2f);
+	Mat<float> dY = make_batch(2, 8, 0.1f);
+	std::vector<Mat<float>> grads = zero_gradients(*model);
+	Mat<float> dX = model->backward<float>(X, dY, grads.data());
+
+	model->compile(8, true);
+	std::vector<Mat<float>> compiled = zero_gradients(*model);
+	model->forward_compiled(X);
+	expect_near(dX, model->backward_compiled(X, dY, compiled.data()), 1e-5f);
+	for (std::size_t k = 0; k < grads.size(); k++)
+		expect_near(compiled[k], grads[k], 1e-5f);
+}
@@ -0,0 +1,194 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "../include/autodiff.hpp"
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+
+using namespace nn::autodiff;
+using namespace nn::models;
+using namespace nn::activation_funcs;
+
+// Central differences of f with respect to every element of P
+static Mat<float> numerical_gradient(Mat<float> &P, const std::function<float(void)> &f)
+{
+	const float h = 1e-2f;
+	Mat<float> G(P.get_shape());
+	for (std::size_t i = 0; i < P.rows() * P.cols(); i++) {
+		float saved = P.get_mat_raw()[i];
+		P.get_mat_raw()[i] = saved + h;
+		float up = f();
+		P.get_mat_raw()[i] = saved - h;
+		float down = f();
+		P.get_mat_raw()[i] = saved;
+		G.get_mat_raw()[i] = (up - down) / (2.0f * h);
+	}
+	return G;
+}
+
+TEST(AutodiffTest, GradientsMatchFiniteDifferences) {
+	Mat<float> X = {{0.5f, -1.0f, 2.0f}, {1.5f, 0.25f, -0.5f}};
+	Mat<float> W = {{0.1f, -0.3f}, {0.7f, 0.2f}, {-0.4f, 0.5f}};
+	Mat<float> B = {{0.1f}, {-0.2f}, {0.3f}};
+	Mat<float> dW = Mat<float>(3, 2).fill(0.0f), dB = Mat<float>(3, 1).fill(0.0f);
+
+	// sum(softmax(relu(W . X + B) * tanh(W . X)) - 0.5 sigmoid(W . X))
+	auto record = [&](Tape<float> &tape) {
+		Var x = tape.constant(X);
+		Var w = tape.parameter(W, dW);
+		Var z = tape.dot(w, x);
+		Var a = tape.relu(tape.add_colvec(z, tape.parameter(B, dB)));
+		Var s = tape.sub(tape.softmax(tape.mul(a, tape.tanh(z))), tape.scale(tape.sigmoid(z), 0.5f));
+		return tape.sum(tape.mul(s, s));
+	};
+	auto loss = [&](void) {
+		Tape<float> tape;
+		return tape.value(record(tape))(0, 0);
+	};
+
+	Tape<float> tape;
+	tape.backward(record(tape));
+
+	Mat<float> expected_W = numerical_gradient(W, loss);
+	Mat<float> expected_B = numerical_gradient(B, loss);
+	for (std::size_t i = 0; i < 6; i++)
+		EXPECT_NEAR(dW.get_mat_raw()[i], expected_W.get_mat_raw()[i], 1e-3);
+	for (std::size_t i = 0; i < 3; i++)
+		EXPECT_NEAR(dB.get_mat_raw()[i], expected_B.get_mat_raw()[i], 1e-3);
+
+	// A tape is backpropagated once
+	EXPECT_THROW(tape.constant(X), std::logic_error);
+	EXPECT_THROW(tape.backward(Var{tape.size() - 1}), std::logic_error);
+	tape.clear();
+	EXPECT_EQ(tape.size(), 0u);
+	EXPECT_THROW(tape.value(Var{0}), std::invalid_argument);
+}
+
+TEST(AutodiffTest, ReleasesTheIntermediatesEagerly) {
+	Tape<float> tape;
+	Var x = tape.input(Mat<float>(4, 3).fill(0.5f));
+	Var y = x;
+	std::vector<Var> chain;
+	for (std::size_t i = 0; i < 20; i++) {
+		y = tape.tanh(y);
+		chain.push_back(y);
+	}
+	Var out = tape.sum(y);
+	EXPECT_EQ(tape.live_buffers(), 22u);
+
+	tape.backward(out);
+	// Only the output and the gradient of the input survive the backward
+	EXPECT_EQ(tape.live_buffers(), 2u);
+	EXPECT_NO_THROW(tape.value(out));
+	EXPECT_THROW(tape.value(chain[3]), std::logic_error);
+	EXPECT_THROW(tape.value(x), std::logic_error);
+	EXPECT_THROW(tape.grad(chain[3]), std::logic_error);
+
+	// d/dx of 20 nested tanh
+	float v = 0.5f, d = 1.0f;
+	for (std::size_t i = 0; i < 20; i++) {
+		v = std::tanh(v);
+		d *= 1.0f - v * v;
+	}
+	EXPECT_NEAR(tape.grad(x)(2, 1), d, 1e-6);
+
+	// The constants need no gradients, nor their values in the backward
+	Tape<float> constants;
+	Var c = constants.constant(Mat<float>(2, 2).fill(1.0f));
+	Var t = constants.tanh(c);
+	EXPECT_FALSE(constants.requires_grad(t));
+	constants.backward(constants.sum(t));
+	EXPECT_EQ(constants.live_buffers(), 1u);
+}
+
+// A layer that only records its forward: x^2
+class SquareLayer : public Layer {
+public:
+	SquareLayer(void) : Layer(0, 0, false, "SquareLayer") { register_funcs(); }
+
+	SquareLayer &build(const Shape &, const Shape &) override { return *this; }
+	SquareLayer &build(std::size_t, std::size_t) override { return *this; }
+	SquareLayer &build(void) override { return *this; }
+
+protected:
+	SquareLayer &register_funcs(void) override
+	{
+		register_func<Mat<float>, const Mat<float> &>
+			("feedforward", [](const Mat<float> &X) -> Mat<float> {
+				return X * X;
+			});
+		register_func<Var, Tape<float> &, Var, Mat<float> *>
+			("record", [](Tape<float> &tape, Var X, Mat<float> *) -> Var {
+				return tape.mul(X, X);
+			});
+		return *this;
+	}
+};
+
+TEST(AutodiffTest, LayersGetTheirBackwardFromTheTape) {
+	SquareLayer square;
+	EXPECT_TRUE(square.can_record<float>());
+	Mat<float> X = {{1.0f, -2.0f}, {3.0f, 0.5f}};
+	Mat<float> dY = {{1.0f, 1.0f}, {2.0f, -1.0f}};
+	Mat<float> dX = square.backward<float>(X, dY, nullptr);
+	EXPECT_FLOAT_EQ(dX(0, 1), -4.0f);
+	EXPECT_FLOAT_EQ(dX(1, 0), 12.0f);
+	EXPECT_FLOAT_EQ(dX(1, 1), -1.0f);
+
+	// The same gradients from the tape and from the hand written backward of Dense
+	Dense<float> dense(2, 3, std::make_shared<TanhFunc<float>>(), std::make_shared<RandNormalInitializer<float>>());
+	dense.build();
+	EXPECT_TRUE(dense.can_record<float>());
+	std::vector<Mat<float>> by_hand, by_tape;
+	for (Mat<float> *param : dense.parameters<float>()) {
+		by_hand.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+		by_tape.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+	}
+	Mat<float> dZ = {{1.0f, 0.5f}, {-1.0f, 2.0f}, {0.25f, 0.0f}};
+	Mat<float> dX_hand = dense.backward<float>(X, dZ, by_hand.data());
+
+	Tape<float> tape;
+	Var x = tape.input(X);
+	tape.backward(dense.record<float>(tape, x, by_tape.data()), dZ);
+	for (std::size_t k = 0; k < by_hand.size(); k++)
+		for (std::size_t i = 0; i < by_hand[k].rows() * by_hand[k].cols(); i++)
+			EXPECT_NEAR(by_tape[k].get_mat_raw()[i], by_hand[k].get_mat_raw()[i], 1e-5);
+	for (std::size_t i = 0; i < 4; i++)
+		EXPECT_NEAR(tape.grad(x).get_mat_raw()[i], dX_hand.get_mat_raw()[i], 1e-5);
+}
+
+TEST(AutodiffTest, SequentialFitStepsWithTheTapeGradients) {
+	auto make = [](void) {
+		auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				std::make_unique<Dense<float>>(2, 3, std::make_shared<SigmoidFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+				std::make_unique<Dense<float>>(3, 1, std::make_shared<SigmoidFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+			});
+		model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.5f));
+		model->set_loss(std::make_shared<MeanSquaredError<float>>());
+		model->build();
+		return model;
+	};
+	auto fitted = make(), reference = make();
+	auto src = fitted->parameters<float>(), dst = reference->parameters<float>();
+	for (std::size_t k = 0; k < src.size(); k++)
+		dst[k]->assign(*src[k]);
+
+	Mat<float> X = {{0.0f, 1.0f}, {1.0f, 1.0f}};
+	Mat<float> Y = {{1.0f, 0.0f}};
+	Mat<float> dY = fitted->get_loss()->gradient((*fitted)(X), Y);
+	fitted->WeightedLayer::fit(dY, X);
+
+	// One gradient descent step with the mean gradient of the hand written backward
+	std::vector<Mat<float>> grads;
+	for (Mat<float> *param : dst)
+		grads.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+	reference->backward<float>(X, dY, grads.data());
+	for (std::size_t k = 0; k < dst.size(); k++) {
+		dst[k]->axpy(-0.5f / 2.0f, grads[k]);
+		for (std::size_t i = 0; i < dst[k]->rows() * dst[k]->cols(); i++)
+			EXPECT_NEAR(src[k]->get_mat_raw()[i], dst[k]->get_mat_raw()[i], 1e-5);
+	}
+}
@@ -0,0 +1,226 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "../include/checkpoint.hpp"
+#include "../include/activation_func.hpp"
+
+using namespace nn::io;
+using namespace nn::activation_funcs;
+
+namespace fs = std::filesystem;
+
+static std::string temp_dir(const std::string &name)
+{
+	std::string path = ::testing::TempDir() + name;
+	fs::remove_all(path);
+	return path;
+}
+
+static std::shared_ptr<Sequential<float>> xor_model(void)
+{
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Dense<float>>(2, 2, std::make_shared<SigmoidFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<Dense<float>>(2, 1, std::make_shared<SigmoidFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.5f));
+	model->set_loss(std::make_shared<CrossEntropy<float>>());
+	model->build();
+	return model;
+}
+
+static void xor_data(std::shared_ptr<std::vector<Mat<float>>> &X, std::shared_ptr<std::vector<Mat<float>>> &Y)
+{
+	X = std::make_shared<std::vector<Mat<float>>>(std::vector<Mat<float>>{
+			{{0.0f}, {0.0f}}, {{0.0f}, {1.0f}}, {{1.0f}, {0.0f}}, {{1.0f}, {1.0f}}});
+	Y = std::make_shared<std::vector<Mat<float>>>(std::vector<Mat<float>>{
+			{{0.0f}}, {{1.0f}}, {{1.0f}}, {{0.0f}}});
+}
+
+TEST(CheckpointTest, KeepsOnlyTheNewest) {
+	std::string dir = temp_dir("ckpt_keep");
+	auto checkpointer = std::make_shared<Checkpointer<float>>(dir, 2, 2);
+
+	std::shared_ptr<std::vector<Mat<float>>> X, Y;
+	xor_data(X, Y);
+	auto model = xor_model();
+	model->set_checkpointer(checkpointer);
+	model->fit(X, Y, 10);
+
+	// Epochs 2, 4, 6, 8 and 10 were saved, only the last two survive
+	std::vector<std::string> paths = checkpointer->list();
+	ASSERT_EQ(paths.size(), 2u);
+	EXPECT_EQ(paths[0], checkpointer->path_of(8));
+	EXPECT_EQ(paths[1], checkpointer->path_of(10));
+
+	// The newest checkpoint holds the final weights
+	auto loaded = load_sequential<float>(checkpointer->latest());
+	for (std::size_t i = 0; i < 2; i++) {
+		auto *a = static_cast<Dense<float> *>(model->get_layers()[i].get());
+		auto *b = static_cast<Dense<float> *>(loaded->get_layers()[i].get());
+		EXPECT_EQ(a->get_weights(), b->get_weights());
+		EXPECT_EQ(a->get_bias(), b->get_bias());
+	}
+
+	fs::remove_all(dir);
+}
+
+TEST(CheckpointTest, ResumeFromTheLatest) {
+	std::string dir = temp_dir("ckpt_resume");
+	std::shared_ptr<std::vector<Mat<float>>> X, Y;
+	xor_data(X, Y);
+
+	auto first = xor_model();
+	first->get_optimizer()->set_learning_rate(0.25);
+	first->set_checkpointer(std::make_shared<Checkpointer<float>>(dir, 1, 0));
+	first->fit(X, Y, 3);
+
+	// A new run restores the weights and the learning rate of epoch 3
+	auto second = xor_model();
+	auto checkpointer = std::make_shared<Checkpointer<float>>(dir, 1, 0);
+	EXPECT_EQ(checkpointer->resume(*second), 3u);
+	EXPECT_DOUBLE_EQ(second->get_optimizer()->get_learning_rate(), 0.25);
+	for (std::size_t i = 0; i < 2; i++) {
+		auto *a = static_cast<Dense<float> *>(first->get_layers()[i].get());
+		auto *b = static_cast<Dense<float> *>(second->get_layers()[i].get());
+		EXPECT_EQ(a->get_weights(), b->get_weights());
+	}
+
+	// fit only trains the remaining epochs
+	second->set_checkpointer(checkpointer);
+	second->fit(X, Y, 5);
+	EXPECT_EQ(checkpointer->list().size(), 5u);
+	EXPECT_EQ(checkpointer->latest(), checkpointer->path_of(5));
+
+	// Nothing left to train, the weights are the ones of the newest checkpoint
+	Mat<float> before = static_cast<Dense<float> *>(second->get_layers()[0].get())->get_weights();
+	second->fit(X, Y, 5);
+	EXPECT_EQ(static_cast<Dense<float> *>(second->get_layers()[0].get())->get_weights(), before);
+
+	fs::remove_all(dir);
+}
+
+TEST(CheckpointTest, InvalidArguments) {
+	EXPECT_THROW(Checkpointer<float>("", 1), std::invalid_argument);
+	EXPECT_THROW(Checkpointer<float>(temp_dir("ckpt_invalid"), 0), std::invalid_argument);
+	EXPECT_THROW(Checkpointer<float>(temp_dir("ckpt_invalid"), 1, 3, "a/b"), std::invalid_argument);
+}
+
+TEST(CheckpointTest, ResumeRestoresTheAdamMoments) {
+	std::string dir = temp_dir("ckpt_adam");
+	std::shared_ptr<std::vector<Mat<float>>> X, Y;
+	xor_data(X, Y);
+
+	auto first = xor_model();
+	first->set_optimizer(std::make_shared<AdamOptimizer<float>>(0.05f));
+	first->build();
+	first->set_checkpointer(std::make_shared<Checkpointer<float>>(dir, 1, 0));
+	first->fit(X, Y, 2);
+
+	// A fresh optimizer gets its state allocated and filled by the resume
+	auto second = xor_model();
+	second->set_optimizer(std::make_shared<AdamOptimizer<float>>(0.05f));
+	second->build();
+	Checkpointer<float> checkpointer(dir, 1, 0);
+	EXPECT_EQ(checkpointer.resume(*second), 2u);
+
+	auto a = first->get_optimizer()->get_state<float>();
+	auto b = second->get_optimizer()->get_state<float>();
+	// m, v and t of the whole parameter slab
+	ASSERT_EQ(a.size(), 3u);
+	EXPECT_EQ(a[0]->get_shape(), first->get_flat_parameters().get_shape());
+	ASSERT_EQ(a.size(), b.size());
+	for (std::size_t i = 0; i < a.size(); i++)
+		EXPECT_EQ(*a[i], *b[i]);
+
+	fs::remove_all(dir);
+}
+
+TEST(CheckpointTest, ResumeRestoresTheEmbeddingTable) {
+	std::string dir = temp_dir("ckpt_embedding");
+	auto make_model = [](void) {
+		auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				std::make_unique<Embedding<float>>(20, 3, 2, std::make_shared<RandNormalInitializer<float>>()),
+				std::make_unique<Dense<float>>(6, 2, std::make_shared<SigmoidFunc<float>>(),
+							       std::make_shared<RandNormalInitializer<float>>()),
+			});
+		model->set_optimizer(std::make_shared<AdamOptimizer<float>>(0.05f));
+		model->set_loss(std::make_shared<MeanSquaredError<float>>());
+		model->build();
+		return model;
+	};
+
+	auto first = make_model();
+	Mat<float> X{{1.0f, 4.0f, 7.0f}, {2.0f, 4.0f, 19.0f}};
+	Mat<float> Y{{1.0f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.0f}};
+	for (std::size_t n = 0; n < 3; n++) {
+		first->accumulate_batch(X, Y);
+		first->step();
+	}
+	Checkpointer<float> checkpointer(dir, 1, 0);
+	checkpointer.snapshot(*first, 3).flush();
+
+	// The table of a fresh model is random, the resume brings back the trained one and its moments
+	auto second = make_model();
+	EXPECT_EQ(checkpointer.resume(*second), 3u);
+	auto &a = static_cast<Embedding<float> &>(*first->get_layers()[0]);
+	auto &b = static_cast<Embedding<float> &>(*second->get_layers()[0]);
+	EXPECT_EQ(a.get_table(), b.get_table());
+
+	auto state_a = first->get_optimizer()->get_state<float>();
+	auto state_b = second->get_optimizer()->get_state<float>();
+	// m, v and t of the slab, then of the table
+	ASSERT_EQ(state_a.size(), 6u);
+	ASSERT_EQ(state_a.size(), state_b.size());
+	EXPECT_EQ(state_a[3]->get_shape(), a.get_table().get_shape());
+	for (std::size_t i = 0; i < state_a.size(); i++)
+		EXPECT_EQ(*state_a[i], *state_b[i]);
+
+	// The saved model carries the table too
+	auto loaded = load_sequential<float>(checkpointer.latest());
+	EXPECT_EQ(static_cast<Embedding<float> &>(*loaded->get_layers()[0]).get_table(), a.get_table());
+	EXPECT_EQ((*loaded)(X), (*first)(X));
+
+	fs::remove_all(dir);
+}
+
+TEST(CheckpointTest, ResumeRestoresTheBatchNormStatistics) {
+	std::string dir = temp_dir("ckpt_batchnorm");
+	auto make_model = [](void) {
+		auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				std::make_unique<Dense<float>>(2, 4, nullptr, std::make_shared<RandNormalInitializer<float>>()),
+				std::make_unique<BatchNorm<float>>(4, std::make_shared<ReluFunc<float>>()),
+				std::make_unique<Dropout<float>>(4, 0.2f, 3),
+				std::make_unique<Dense<float>>(4, 1, std::make_shared<SigmoidFunc<float>>(),
+							       std::make_shared<RandNormalInitializer<float>>()),
+			});
+		model->set_optimizer(std::make_shared<AdamOptimizer<float>>(0.05f));
+		model->set_loss(std::make_shared<MeanSquaredError<float>>());
+		model->build();
+		return model;
+	};
+
+	auto first = make_model();
+	Mat<float> X{{0.0f, 0.0f, 1.0f, 1.0f}, {0.0f, 1.0f, 0.0f, 1.0f}};
+	Mat<float> Y{{0.0f, 1.0f, 1.0f, 0.0f}};
+	first->set_training(true);
+	for (std::size_t n = 0; n < 3; n++) {
+		first->accumulate_batch(X, Y);
+		first->step();
+	}
+	first->set_training(false);
+	Checkpointer<float> checkpointer(dir, 1, 0);
+	checkpointer.snapshot(*first, 3).flush();
+
+	// The running statistics are not parameters, the checkpoint carries them anyway
+	auto second = make_model();
+	EXPECT_EQ(checkpointer.resume(*second), 3u);
+	auto &a = static_cast<BatchNorm<float> &>(*first->get_layers()[1]);
+	auto &b = static_cast<BatchNorm<float> &>(*second->get_layers()[1]);
+	EXPECT_EQ(a.get_running_mean(), b.get_running_mean());
+	EXPECT_EQ(a.get_running_var(), b.get_running_var());
+	EXPECT_EQ((*second)(X), (*first)(X));
+
+	fs::remove_all(dir);
+}
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+#include "test_helpers.hpp"
+
+using namespace nn::models;
+using namespace nn::activation_funcs;
+using namespace nn::test;
+
+static std::shared_ptr<Sequential<float>> make_model(void)
+{
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Dense<float>>(4, 16, std::make_shared<ReluFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<Dense<float>>(16, 8, std::make_shared<TanhFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<Dense<float>>(8, 8, std::make_shared<SigmoidFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<Dense<float>>(8, 3, std::make_shared<SoftmaxFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+	model->build();
+	return model;
+}
+
+TEST(CompileTest, PlanMatchesTheModel) {
+	auto model = make_model();
+	Mat<float> X = make_batch(4, 5, 0.1f);
+	Mat<float> dY = make_batch(3, 5, 0.2f);
+
+	// A forward alone ping-pongs between two buffers
+	model->compile(5);
+	EXPECT_TRUE(model->is_compiled());
+	EXPECT_EQ(model->get_plan_buffers(), 2u);
+	EXPECT_EQ(reinterpret_cast<std::uintptr_t>(model->forward_compiled(X).get_mat_raw()) % 64, 0u);
+	Mat<float> expected = (*model)(X);
+	const Mat<float> &Y = model->forward_compiled(X);
+	for (std::size_t i = 0; i < 3 * 5; i++)
+		EXPECT_NEAR(Y.get_mat_raw()[i], expected.get_mat_raw()[i], 1e-6);
+	EXPECT_THROW(model->backward_compiled(X, dY, nullptr), std::logic_error);
+	EXPECT_THROW(model->forward_compiled(make_batch(4, 4, 0.1f)), std::invalid_argument);
+
+	// Training keeps the activations, the gradients reuse what the backward frees:
+	// the 4 activations, dL/dY and the gradient of the last input at most
+	model->compile(5, true);
+	EXPECT_EQ(model->get_plan_buffers(), 6u);
+
+	std::vector<Mat<float>> by_hand, by_plan;
+	for (Mat<float> *param : model->parameters<float>()) {
+		by_hand.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+		by_plan.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+	}
+	Mat<float> dX = model->backward<float>(X, dY, by_hand.data());
+	model->forward_compiled(X);
+	const Mat<float> &dX_plan = model->backward_compiled(X, dY, by_plan.data());
+	for (std::size_t i = 0; i < 4 * 5; i++)
+		EXPECT_NEAR(dX_plan.get_mat_raw()[i], dX.get_mat_raw()[i], 1e-5);
+	for (std::size_t k = 0; k < by_hand.size(); k++)
+		for (std::size_t i = 0; i < by_hand[k].rows() * by_hand[k].cols(); i++)
+			EXPECT_NEAR(by_plan[k].get_mat_raw()[i], by_hand[k].get_mat_raw()[i], 1e-5);
+
+	// Building again drops the plan
+	model->build();
+	EXPECT_FALSE(model->is_compiled());
+	EXPECT_THROW(model->forward_compiled(X), std::logic_error);
+}
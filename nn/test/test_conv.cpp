@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+#include "test_helpers.hpp"
+
+using namespace nn::models;
+using namespace nn::activation_funcs;
+using namespace nn::test;
+
+// Geometry of a test convolution
+struct ConvCase {
+	std::size_t channels, height, width, filters, kernel, stride, padding, dilation;
+};
+
+// Y(f, oh, ow) = b(f) + sum_{c, u, v} W(f, c, u, v) X(c, oh * s + u * d - p, ow * s + v * d - p)
+static Mat<float> naive_conv(const ConvCase &k, std::size_t out_h, std::size_t out_w,
+			     const Mat<float> &W, const Mat<float> &b, const Mat<float> &X)
+{
+	Mat<float> Y(k.filters * out_h * out_w, X.cols());
+	for (std::size_t j = 0; j < X.cols(); j++)
+	for (std::size_t f = 0; f < k.filters; f++)
+	for (std::size_t oh = 0; oh < out_h; oh++)
+	for (std::size_t ow = 0; ow < out_w; ow++) {
+		float sum = b(f, 0);
+		for (std::size_t c = 0; c < k.channels; c++)
+		for (std::size_t u = 0; u < k.kernel; u++)
+		for (std::size_t v = 0; v < k.kernel; v++) {
+			long ih = static_cast<long>(oh * k.stride + u * k.dilation) - static_cast<long>(k.padding);
+			long iw = static_cast<long>(ow * k.stride + v * k.dilation) - static_cast<long>(k.padding);
+			if (ih < 0 || iw < 0 || ih >= static_cast<long>(k.height) || iw >= static_cast<long>(k.width))
+				continue;
+			sum += W(f, (c * k.kernel + u) * k.kernel + v)
+				* X((c * k.height + ih) * k.width + iw, j);
+		}
+		Y((f * out_h + oh) * out_w + ow, j) = sum;
+	}
+	return Y;
+}
+
+TEST(ConvTest, MatchesTheNaiveConvolution) {
+	const std::vector<ConvCase> cases = {
+		{2, 6, 5, 3, 3, 1, 1, 1},	// 3x3 same, direct in auto
+		{3, 7, 7, 4, 3, 2, 1, 1},	// strided
+		{1, 8, 6, 2, 2, 1, 0, 2},	// dilated
+		{2, 5, 5, 3, 1, 1, 0, 1},	// 1x1
+	};
+	for (const ConvCase &k : cases) {
+		Conv2D<float> conv(k.channels, k.height, k.width, k.filters, k.kernel, k.stride, k.padding, k.dilation,
+				   nullptr, std::make_shared<RandNormalInitializer<float>>());
+		conv.build();
+		Mat<float> X = make_batch(k.channels * k.height * k.width, 3, 0.1f);
+		Mat<float> expected = naive_conv(k, conv.get_out_height(), conv.get_out_width(),
+						 conv.get_weights(), conv.get_bias(), X);
+
+		conv.set_algorithm(ConvAlgorithm::Im2col);
+		expect_near(expected, conv(X), 1e-4f);
+		if (k.stride == 1) {
+			conv.set_algorithm(ConvAlgorithm::Direct);
+			expect_near(expected, conv(X), 1e-4f);
+		} else {
+			EXPECT_THROW(conv.set_algorithm(ConvAlgorithm::Direct), std::invalid_argument);
+		}
+	}
+
+	EXPECT_THROW(Conv2D<float>(1, 2, 2, 1, 5), std::invalid_argument);
+	EXPECT_THROW(Conv2D<float>(1, 4, 4, 1, 3, 0), std::invalid_argument);
+}
+
+TEST(ConvTest, BackwardMatchesFiniteDifferences) {
+	const ConvCase k = {2, 5, 4, 2, 3, 1, 1, 1};
+	for (ConvAlgorithm algorithm : {ConvAlgorithm::Im2col, ConvAlgorithm::Direct}) {
+		Conv2D<float> conv(k.channels, k.height, k.width, k.filters, k.kernel, k.stride, k.padding, k.dilation,
+				   std::make_shared<TanhFunc<float>>(), std::make_shared<RandNormalInitializer<float>>());
+		conv.build();
+		conv.set_algorithm(algorithm);
+		Mat<float> X = make_batch(k.channels * k.height * k.width, 2, 0.1f);
+		Mat<float> dY = make_batch(conv.get_output_shape().rows, 2, 0.05f);
+
+		// L = sum dY * f(conv(X))
+		auto loss = [&](void) {
+			Mat<float> Y = conv(X);
+			double sum = 0.0;
+			for (std::size_t i = 0; i < Y.rows() * Y.cols(); i++)
+				sum += Y.get_mat_raw()[i] * dY.get_mat_raw()[i];
+			return sum;
+		};
+
+		Mat<float> grads[2] = {Mat<float>(conv.get_weights().get_shape()).fill(0.0f),
+				       Mat<float>(conv.get_bias().get_shape()).fill(0.0f)};
+		Mat<float> dX = conv.backward<float>(X, dY, grads);
+
+		const float h = 1e-2f;
+		std::vector<std::pair<Mat<float> *, Mat<float> *>> checks = {
+			{&conv.get_weights(), &grads[0]}, {&conv.get_bias(), &grads[1]}, {&X, &dX}};
+		for (auto [param, grad] : checks) {
+			for (std::size_t i = 0; i < param->rows() * param->cols(); i += 3) {
+				float saved = param->get_mat_raw()[i];
+				param->get_mat_raw()[i] = saved + h;
+				double up = loss();
+				param->get_mat_raw()[i] = saved - h;
+				double down = loss();
+				param->get_mat_raw()[i] = saved;
+				EXPECT_NEAR(grad->get_mat_raw()[i], (up - down) / (2 * h), 2e-3);
+			}
+		}
+	}
+}
+
+TEST(ConvTest, CompiledSequentialMatchesTheModel) {
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Conv2D<float>>(1, 6, 6, 4, 3, 1, 1, 1, std::make_shared<ReluFunc<float>>(),
+							std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<Conv2D<float>>(4, 6, 6, 2, 2, 2, 0, 1, std::make_shared<TanhFunc<float>>(),
+							std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<Dense<float>>(2 * 3 * 3, 3, std::make_shared<SoftmaxFunc<float>>(),
+						       std::make_shared<RandNormalInitializer<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+	model->build();
+
+	Mat<float> X = make_batch(36, 4, 0.1f);
+	Mat<float> dY = make_batch(3, 4, 0.2f);
+	std::vector<Mat<float>> by_hand, by_plan;
+	for (Mat<float> *param : model->parameters<float>()) {
+		by_hand.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+		by_plan.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+	}
+
+	Mat<float> expected = (*model)(X);
+	Mat<float> dX = model->backward<float>(X, dY, by_hand.data());
+	model->compile(4, true);
+	const Mat<float> &Y = model->forward_compiled(X);
+	expect_near(expected, Y, 1e-5f);
+	expect_near(dX, model->backward_compiled(X, dY, by_plan.data()), 1e-5f);
+	for (std::size_t k = 0; k < by_hand.size(); k++)
+		expect_near(by_hand[k], by_plan[k], 1e-4f);
+}
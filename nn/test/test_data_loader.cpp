@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "../include/data_loader.hpp"
+
+using namespace nn::mathops;
+using namespace nn::data;
+
+static std::shared_ptr<std::vector<Mat<float>>> make_column_samples(std::size_t n, std::size_t rows, float offset)
+{
+	auto samples = std::make_shared<std::vector<Mat<float>>>();
+	for (std::size_t i = 0; i < n; i++) {
+		Mat<float> x(rows, 1);
+		for (std::size_t r = 0; r < rows; r++)
+			x(r, 0) = offset + static_cast<float>(i * rows + r);
+		samples->push_back(std::move(x));
+	}
+	return samples;
+}
+
+TEST(DataLoaderTest, OrderedBatchesWithoutShuffle) {
+	auto X = make_column_samples(5, 2, 0.0f);
+	auto Y = make_column_samples(5, 1, 100.0f);
+
+	DataLoader<float> loader(X, Y, 2, false);
+	loader.start(1);
+
+	std::vector<std::size_t> sizes;
+	std::size_t sample = 0;
+	while (const Batch<float> *batch = loader.next()) {
+		sizes.push_back(batch->size);
+		EXPECT_EQ(batch->X.get_shape(), Shape(2, batch->size));
+		EXPECT_EQ(batch->Y.get_shape(), Shape(1, batch->size));
+		for (std::size_t j = 0; j < batch->size; j++, sample++) {
+			EXPECT_FLOAT_EQ(batch->X(0, j), (*X)[sample](0, 0));
+			EXPECT_FLOAT_EQ(batch->X(1, j), (*X)[sample](1, 0));
+			EXPECT_FLOAT_EQ(batch->Y(0, j), (*Y)[sample](0, 0));
+		}
+	}
+
+	EXPECT_EQ(sample, 5u);
+	EXPECT_EQ(sizes, (std::vector<std::size_t>{2, 2, 1}));
+	EXPECT_EQ(loader.get_nbatches(), 3u);
+}
+
+TEST(DataLoaderTest, ShuffledEpochsArePermutations) {
+	auto X = make_column_samples(64, 1, 0.0f);
+	auto Y = make_column_samples(64, 1, 0.0f);
+
+	DataLoader<float> loader(X, Y, 8, true, 3, 1234);
+	loader.start(4);
+
+	std::vector<std::vector<float>> seen(4);
+	while (const Batch<float> *batch = loader.next()) {
+		for (std::size_t j = 0; j < batch->size; j++) {
+			// The targets must travel with their inputs
+			EXPECT_FLOAT_EQ(batch->X(0, j), batch->Y(0, j));
+			seen[batch->epoch].push_back(batch->X(0, j));
+		}
+	}
+
+	std::vector<float> expected(64);
+	for (std::size_t i = 0; i < 64; i++)
+		expected[i] = static_cast<float>(i);
+
+	for (auto &epoch : seen) {
+		EXPECT_NE(epoch, expected);
+		std::sort(epoch.begin(), epoch.end());
+		EXPECT_EQ(epoch, expected);
+	}
+}
+
+TEST(DataLoaderTest, TheDefaultSeedIsReproducible) {
+	auto X = make_column_samples(32, 1, 0.0f);
+	auto Y = make_column_samples(32, 1, 0.0f);
+
+	auto order = [&](void) {
+		DataLoader<float> loader(X, Y, 4);
+		loader.start(2);
+		std::vector<float> seen;
+		while (const Batch<float> *batch = loader.next())
+			for (std::size_t j = 0; j < batch->size; j++)
+				seen.push_back(batch->X(0, j));
+		EXPECT_EQ(loader.get_indices().size(), 32u);
+		return seen;
+	};
+	EXPECT_EQ(order(), order());
+}
+
+TEST(DataLoaderTest, GetSampleCopiesTheColumn) {
+	auto X = make_column_samples(3, 3, 0.0f);
+	auto Y = make_column_samples(3, 1, 10.0f);
+
+	DataLoader<float> loader(X, Y, 3, false, 1);
+	loader.start(1);
+
+	const Batch<float> *batch = loader.next();
+	ASSERT_NE(batch, nullptr);
+
+	Mat<float> x(3, 1), y(1, 1);
+	batch->get_sample(1, x, y);
+	EXPECT_EQ(x, (*X)[1]);
+	EXPECT_EQ(y, (*Y)[1]);
+	EXPECT_THROW(batch->get_sample(3, x, y), std::out_of_range);
+
+	EXPECT_EQ(loader.next(), nullptr);
+}
+
+TEST(DataLoaderTest, StopBeforeConsumingEverything) {
+	auto X = make_column_samples(100, 1, 0.0f);
+	auto Y = make_column_samples(100, 1, 0.0f);
+
+	DataLoader<float> loader(X, Y, 1, true, 2, 7);
+	loader.start(10);
+	ASSERT_NE(loader.next(), nullptr);
+	loader.stop();
+	EXPECT_EQ(loader.next(), nullptr);
+}
+
+TEST(DataLoaderTest, InvalidArguments) {
+	auto X = make_column_samples(4, 1, 0.0f);
+	auto Y = make_column_samples(3, 1, 0.0f);
+
+	EXPECT_THROW(DataLoader<float>(X, Y, 1), std::invalid_argument);
+	EXPECT_THROW(DataLoader<float>(X, X, 0), std::invalid_argument);
+	EXPECT_THROW(DataLoader<float>(X, X, 1, true, 0), std::invalid_argument);
+	EXPECT_THROW(DataLoader<float>(nullptr, X, 1), std::invalid_argument);
+}
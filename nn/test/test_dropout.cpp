@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+#include "test_helpers.hpp"
+
+using namespace nn::models;
+using namespace nn::activation_funcs;
+using namespace nn::parallel;
+using namespace nn::test;
+
+TEST(DropoutTest, DropsAtTheRateWhileTraining) {
+	Dropout<float> dropout(8, 0.25f, 42);
+	dropout.build();
+	Mat<float> X = make_batch(8, 500, 1.0f, 5.5f);
+
+	// Out of training it is the identity
+	EXPECT_TRUE(dropout.is_identity());
+	EXPECT_TRUE(dropout(X) == X);
+
+	dropout.set_training(true);
+	EXPECT_FALSE(dropout.is_identity());
+	Mat<float> Y = dropout(X);
+	std::size_t dropped = 0;
+	for (std::size_t i = 0; i < 8 * 500; i++) {
+		if (Y.get_mat_raw()[i] == 0.0f)
+			dropped++;
+		else
+			EXPECT_FLOAT_EQ(Y.get_mat_raw()[i], X.get_mat_raw()[i] / 0.75f);
+	}
+	EXPECT_NEAR(static_cast<double>(dropped) / (8 * 500), 0.25, 0.03);
+
+	// Every forward draws a new mask, the same seed draws the same masks
+	EXPECT_FALSE(dropout(X) == Y);
+	Dropout<float> same(8, 0.25f, 42);
+	same.build();
+	same.set_training(true);
+	EXPECT_TRUE(same(X) == Y);
+}
+
+TEST(DropoutTest, BackwardUsesTheMaskOfTheForward) {
+	Dropout<float> dropout(4, 0.5f, 7);
+	dropout.build();
+	dropout.set_training(true);
+	Mat<float> X = make_batch(4, 30, 1.0f, 5.5f);
+	Mat<float> dY = make_batch(4, 30, 1.0f, 5.5f);
+
+	// dY = X, then dL/dX is the output of the forward
+	Mat<float> Y = dropout(X);
+	EXPECT_TRUE(dropout.backward<float>(X, dY, nullptr) == Y);
+
+	Mat<float> Y_into(X.get_shape());
+	dropout.forward_into<float>(X, Y_into);
+	dropout.backward_into<float>(X, Y_into, dY, dY, nullptr);
+	EXPECT_TRUE(dY == Y_into);
+	EXPECT_THROW(dropout.backward<float>(make_batch(4, 3, 1.0f, 5.5f), make_batch(4, 3, 1.0f, 5.5f), nullptr), std::logic_error);
+	// The same shape, not the batch of the forward
+	EXPECT_THROW(dropout.backward<float>(Mat<float>(X), dY, nullptr), std::logic_error);
+}
+
+TEST(DropoutTest, ConcurrentBatchesKeepTheirMasks) {
+	// The products are above the grain of the GEMM, a waiting task runs chunks of the others
+	auto dropout = std::make_unique<Dropout<float>>(24, 0.5f, 9);
+	Dropout<float> &drop = *dropout;
+	Residual<float> residual({std::make_unique<Dense<float>>(24, 24, std::make_shared<TanhFunc<float>>()),
+				  std::move(dropout), std::make_unique<Dense<float>>(24, 24)});
+	residual.build();
+	fill_parameters(residual);
+	residual.set_training(true);
+	const auto &block = residual.get_block();
+
+	const std::size_t nbatches = 4;
+	std::vector<Mat<float>> X, dY, scales(nbatches), dX(nbatches);
+	for (std::size_t k = 0; k < nbatches; k++) {
+		X.push_back(make_batch(24, 64, 0.02f * static_cast<float>(k + 1)));
+		dY.push_back(make_batch(24, 64, 0.1f));
+	}
+
+	TaskGroup tasks;
+	for (std::size_t k = 0; k < nbatches; k++) {
+		tasks.run([&, k] {
+			// The block by hand, the backward of the dropout needs the input of its forward
+			Mat<float> H = (*block[0])(X[k]);
+			Mat<float> D = (*block[1])(H);
+			std::vector<Mat<float>> grads = zero_gradients(residual);
+			Mat<float> dD = block[2]->backward<float>(D, dY[k], grads.data() + 2);
+			// The mask of that forward, scaled: what the dropout gives back for a gradient of ones
+			scales[k] = drop.backward<float>(H, Mat<float>(H.get_shape()).fill(1.0f), nullptr);
+			dX[k] = block[0]->backward<float>(X[k], drop.backward<float>(H, dD, nullptr), grads.data()) + dY[k];
+		});
+	}
+	tasks.wait();
+
+	// Every batch against the same residual with its mask fixed, the
+	// columns are independent and the first ones are enough
+	auto columns = [](const Mat<float> &A, std::size_t n) {
+		Mat<float> B(A.rows(), n);
+		for (std::size_t i = 0; i < A.rows(); i++)
+			for (std::size_t j = 0; j < n; j++)
+				B(i, j) = A(i, j);
+		return B;
+	};
+	for (std::size_t k = 0; k < nbatches; k++) {
+		Mat<float> x = columns(X[k], 4), dy = columns(dY[k], 4), scale = columns(scales[k], 4);
+		Mat<float> dx = columns(dX[k], 4);
+		auto fixed = [&](void) {
+			Mat<float> A = (*block[0])(x);
+			for (std::size_t i = 0; i < A.rows() * A.cols(); i++)
+				A.get_mat_raw()[i] *= scale.get_mat_raw()[i];
+			return (*block[2])(A) + x;
+		};
+		expect_gradients([&](void) { return dot(fixed(), dy); }, {{&x, &dx}}, 1e-2f, 5e-3);
+	}
+}
+
+TEST(DropoutTest, CompiledInferenceSkipsIt) {
+	auto make_model = [](bool dropout) {
+		auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				std::make_unique<Dense<float>>(4, 6, std::make_shared<ReluFunc<float>>(),
+							       std::make_shared<RandNormalInitializer<float>>()),
+				std::make_unique<Dense<float>>(6, 6, std::make_shared<TanhFunc<float>>(),
+							       std::make_shared<RandNormalInitializer<float>>()),
+			});
+		if (dropout)
+			model->add(std::make_unique<Dropout<float>>(6, 0.5f));
+		model->add(std::make_unique<Dense<float>>(6, 3, nullptr, std::make_shared<RandNormalInitializer<float>>()));
+		model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+		model->build();
+		return model;
+	};
+	auto model = make_model(true);
+	auto plain = make_model(false);
+
+	Mat<float> X = make_batch(4, 5, 1.0f, 5.5f);
+	Mat<float> expected = (*model)(X);
+	model->compile(5);
+	plain->compile(5);
+	EXPECT_TRUE(model->forward_compiled(X) == expected);
+	EXPECT_EQ(model->get_plan_buffers(), plain->get_plan_buffers());
+
+	// In training the plan runs it again
+	model->set_training(true);
+	EXPECT_FALSE(model->forward_compiled(X) == expected);
+	model->set_training(false);
+	EXPECT_TRUE(model->forward_compiled(X) == expected);
+}
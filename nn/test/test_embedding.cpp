@@ -0,0 +1,175 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+#include "test_helpers.hpp"
+
+using namespace nn::models;
+using namespace nn::activation_funcs;
+
+static Mat<float> make_ids(std::size_t rows, const std::vector<float> &ids)
+{
+	Mat<float> X(rows, ids.size() / rows);
+	for (std::size_t i = 0; i < ids.size(); i++)
+		X.get_mat_raw()[i] = ids[i];
+	return X;
+}
+
+TEST(EmbeddingTest, GathersTheRowsOfTheIDs) {
+	Embedding<float> embedding(10, 3, 2, std::make_shared<RandNormalInitializer<float>>());
+	embedding.build();
+	EXPECT_EQ(embedding.get_output_size(), 6u);
+	EXPECT_TRUE(embedding.parameters<float>().empty());
+
+	// Two IDs per sample, four samples
+	Mat<float> X = make_ids(2, {0, 9, 3, 3, 7, 1, 2, 5});
+	Mat<float> Y = embedding(X);
+	ASSERT_EQ(Y.get_shape(), Shape(6, 4));
+	for (std::size_t t = 0; t < 2; t++)
+		for (std::size_t j = 0; j < 4; j++)
+			for (std::size_t d = 0; d < 3; d++)
+				EXPECT_EQ(Y(t * 3 + d, j), embedding.get_table()(static_cast<std::size_t>(X(t, j)), d));
+
+	EXPECT_THROW(embedding(make_ids(2, {0, 10})), std::invalid_argument);
+	EXPECT_THROW(embedding(make_ids(2, {0, 1.5f})), std::invalid_argument);
+}
+
+TEST(EmbeddingTest, StepsOnlyTheRowsUsed) {
+	Embedding<float> embedding(1000, 2);
+	embedding.build();
+	embedding.set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(1.0f));
+
+	// The ID 4 twice, its gradients add up
+	Mat<float> X = make_ids(1, {4, 17, 4});
+	Mat<float> dY = make_ids(2, {1, 2, 3, 4, 5, 6});
+	embedding.accumulate(dY, X);
+	EXPECT_EQ(embedding.touched_rows(), (std::vector<std::size_t>{4, 17}));
+
+	// The mean over the three samples
+	embedding.step();
+	EXPECT_FLOAT_EQ(embedding.get_table()(4, 0), -(1.0f + 3.0f) / 3.0f);
+	EXPECT_FLOAT_EQ(embedding.get_table()(4, 1), -(4.0f + 6.0f) / 3.0f);
+	EXPECT_FLOAT_EQ(embedding.get_table()(17, 0), -2.0f / 3.0f);
+	EXPECT_FLOAT_EQ(embedding.get_table()(17, 1), -5.0f / 3.0f);
+	std::size_t moved = 0;
+	for (std::size_t i = 0; i < 1000 * 2; i++)
+		moved += embedding.get_table().get_mat_raw()[i] != 0.0f;
+	EXPECT_EQ(moved, 4u);
+	EXPECT_TRUE(embedding.touched_rows().empty());
+}
+
+TEST(EmbeddingTest, WorkersAccumulateApartAndStepInWorkerOrder) {
+	Embedding<float> embedding(20, 1);
+	embedding.build();
+	embedding.set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(1.0f));
+
+	// The worker w sees the IDs 10 - w and 5, whatever the worker that runs first
+	nn::parallel::WorkerGroup workers(3);
+	workers.run([&](std::size_t w) {
+		Mat<float> X = make_ids(1, {static_cast<float>(10 - w), 5.0f});
+		Mat<float> dY = make_ids(1, {static_cast<float>(w + 1), 1.0f});
+		embedding.accumulate(dY, X);
+	});
+	EXPECT_EQ(embedding.touched_rows(), (std::vector<std::size_t>{10, 5, 9, 8}));
+
+	// Out of the group the step sums the workers, the mean over their six samples
+	embedding.step();
+	EXPECT_FLOAT_EQ(embedding.get_table()(10, 0), -1.0f / 6.0f);
+	EXPECT_FLOAT_EQ(embedding.get_table()(8, 0), -3.0f / 6.0f);
+	EXPECT_FLOAT_EQ(embedding.get_table()(5, 0), -3.0f / 6.0f);
+	EXPECT_TRUE(embedding.touched_rows().empty());
+}
+
+TEST(EmbeddingTest, DataParallelTrainingIsReproducible) {
+	auto train = [](void) {
+		auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				std::make_unique<Embedding<float>>(16, 3, 2, std::make_shared<RandNormalInitializer<float>>()),
+				std::make_unique<Dense<float>>(6, 2, std::make_shared<SigmoidFunc<float>>()),
+			});
+		model->set_optimizer(std::make_shared<AdamOptimizer<float>>(0.05f));
+		model->set_loss(std::make_shared<nn::loss_funcs::MeanSquaredError<float>>());
+		model->set_fit_mode(FitMode::DataParallel, 4);
+		model->set_seed(3);
+		model->build();
+		auto &table = static_cast<Embedding<float> &>(*model->get_layers()[0]).get_table();
+		for (std::size_t i = 0; i < table.rows() * table.cols(); i++)
+			table.get_mat_raw()[i] = 0.01f * static_cast<float>(i % 7);
+		nn::test::fill_parameters(*model->get_layers()[1]);
+
+		// Every batch repeats IDs across the shards of the workers
+		auto X = std::make_shared<std::vector<Mat<float>>>();
+		auto Y = std::make_shared<std::vector<Mat<float>>>();
+		for (std::size_t n = 0; n < 24; n++) {
+			X->push_back(Mat<float>{{static_cast<float>(n % 5)}, {static_cast<float>((n * 3) % 16)}});
+			Y->push_back(Mat<float>{{static_cast<float>(n % 2)}, {static_cast<float>((n + 1) % 2)}});
+		}
+		model->fit(X, Y, 5, 8);
+		return table;
+	};
+
+	Mat<float> first = train();
+	for (std::size_t n = 0; n < 3; n++)
+		EXPECT_EQ(train(), first);
+}
+
+TEST(EmbeddingTest, LazyAdamMatchesTheDenseStepOnTheRows) {
+	Mat<float> dense(5, 3), sparse(5, 3), grad(5, 3), rows_grad(2, 3);
+	for (std::size_t i = 0; i < 5 * 3; i++) {
+		dense.get_mat_raw()[i] = sparse.get_mat_raw()[i] = 0.1f * static_cast<float>(i);
+		grad.get_mat_raw()[i] = 0.0f;
+	}
+	for (std::size_t d = 0; d < 3; d++) {
+		grad(1, d) = rows_grad(0, d) = 0.5f - static_cast<float>(d);
+		grad(3, d) = rows_grad(1, d) = 0.2f * static_cast<float>(d);
+	}
+
+	// On the first step Adam doesn't move the rows without gradient
+	AdamOptimizer<float> by_rows(0.1f), whole(0.1f);
+	whole.apply(dense, grad);
+	by_rows.apply_rows(sparse, rows_grad, {1, 3});
+	for (std::size_t i = 0; i < 5 * 3; i++)
+		EXPECT_FLOAT_EQ(sparse.get_mat_raw()[i], dense.get_mat_raw()[i]);
+
+	EXPECT_THROW(by_rows.apply_rows(sparse, rows_grad, {1, 5}), std::invalid_argument);
+}
+
+TEST(EmbeddingTest, TrainsInsideASequential) {
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Embedding<float>>(50, 4, 1, std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<Dense<float>>(4, 2, std::make_shared<SoftmaxFunc<float>>(),
+						       std::make_shared<RandNormalInitializer<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.5f));
+	model->set_loss(std::make_shared<nn::loss_funcs::SoftmaxCrossEntropy<float>>());
+	model->build();
+	auto &embedding = static_cast<Embedding<float> &>(*model->get_layers()[0]);
+	Mat<float> table = embedding.get_table();
+
+	// The even IDs are one class, the odd ones the other
+	Mat<float> X = make_ids(1, {2, 3, 10, 11, 20, 21});
+	Mat<float> Y(2, 6);
+	Y.fill(0.0f);
+	for (std::size_t j = 0; j < 6; j++)
+		Y(j % 2, j) = 1.0f;
+
+	auto cross_entropy = [&](void) {
+		Mat<float> P = (*model)(X);
+		double sum = 0.0;
+		for (std::size_t i = 0; i < 2 * 6; i++)
+			sum -= Y.get_mat_raw()[i] * std::log(P.get_mat_raw()[i] + 1e-7);
+		return sum;
+	};
+
+	double before = cross_entropy();
+	for (std::size_t n = 0; n < 30; n++) {
+		model->accumulate_batch(X, Y);
+		model->step();
+	}
+	EXPECT_LT(cross_entropy(), before);
+	EXPECT_NE(embedding.get_table()(2, 0), table(2, 0));
+	for (std::size_t d = 0; d < 4; d++)
+		EXPECT_EQ(embedding.get_table()(4, d), table(4, d));
+}
@@ -0,0 +1,98 @@
+#ifndef NN_TEST_HELPERS_INCLUDED
+#define NN_TEST_HELPERS_INCLUDED
+
+#include <gtest/gtest.h>
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "../include/nn.hpp"
+
+/*
+ * Shared by the tests of the layers: deterministic inputs and weights, so
+ * the results don't depend on the random initializers, and the central
+ * differences every backward is checked against
+ */
+namespace nn::test {
+	using mathops::Mat;
+
+	// make_batch: a (rows, cols) batch with the values shift + scale * [-5, 5]
+	inline Mat<float> make_batch(std::size_t rows, std::size_t cols, float scale, float shift = 0.0f)
+	{
+		Mat<float> X(rows, cols);
+		for (std::size_t i = 0; i < rows; i++)
+			for (std::size_t j = 0; j < cols; j++)
+				X(i, j) = shift + scale * static_cast<float>(static_cast<int>((i * 7 + j * 5) % 11) - 5);
+		return X;
+	}
+
+	// make_distinct: a (rows, cols) batch in [-1, 1) with no value twice in a column, a window has one maximum
+	inline Mat<float> make_distinct(std::size_t rows, std::size_t cols)
+	{
+		Mat<float> X(rows, cols);
+		for (std::size_t i = 0; i < rows; i++)
+			for (std::size_t j = 0; j < cols; j++)
+				X(i, j) = static_cast<float>((i * 37 + j * 11) % 101) / 50.0f - 1.0f;
+		return X;
+	}
+
+	// fill_parameters: every parameter of the layer in [-0.6, 0.6], a different pattern for every one
+	inline void fill_parameters(layers::Layer &layer)
+	{
+		std::size_t k = 0;
+		for (Mat<float> *param : layer.parameters<float>())
+			for (std::size_t i = 0; i < param->rows() * param->cols(); i++, k++)
+				param->get_mat_raw()[i] = 0.1f * static_cast<float>(static_cast<int>((k * 5 + 3) % 13) - 6);
+	}
+
+	inline void expect_near(const Mat<float> &expected, const Mat<float> &actual, float tolerance)
+	{
+		ASSERT_EQ(expected.get_shape(), actual.get_shape());
+		for (std::size_t i = 0; i < expected.rows() * expected.cols(); i++)
+			EXPECT_NEAR(expected.get_mat_raw()[i], actual.get_mat_raw()[i], tolerance);
+	}
+
+	// zero_gradients: one zeroed matrix per parameter of the layer
+	inline std::vector<Mat<float>> zero_gradients(layers::Layer &layer)
+	{
+		std::vector<Mat<float>> grads;
+		for (Mat<float> *param : layer.parameters<float>())
+			grads.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+		return grads;
+	}
+
+	/*
+	 * expect_gradients: every element of the `first` matrix of `checks`
+	 * moved by +-h, the central difference of `loss` must match that
+	 * element of the `second` one
+	 */
+	inline void expect_gradients(const std::function<double(void)> &loss,
+				     const std::vector<std::pair<Mat<float> *, const Mat<float> *>> &checks,
+				     float h, double tolerance)
+	{
+		for (auto [param, grad] : checks) {
+			ASSERT_EQ(param->get_shape(), grad->get_shape());
+			for (std::size_t i = 0; i < param->rows() * param->cols(); i++) {
+				float saved = param->get_mat_raw()[i];
+				param->get_mat_raw()[i] = saved + h;
+				double up = loss();
+				param->get_mat_raw()[i] = saved - h;
+				double down = loss();
+				param->get_mat_raw()[i] = saved;
+				EXPECT_NEAR(grad->get_mat_raw()[i], (up - down) / (2 * h), tolerance) << "element " << i;
+			}
+		}
+	}
+
+	// dot: sum of A * B, the loss whose dL/dY is B
+	inline double dot(const Mat<float> &A, const Mat<float> &B)
+	{
+		double sum = 0.0;
+		for (std::size_t i = 0; i < A.rows() * A.cols(); i++)
+			sum += A.get_mat_raw()[i] * B.get_mat_raw()[i];
+		return sum;
+	}
+}
+
+#endif
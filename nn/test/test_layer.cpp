@@ -2,9 +2,11 @@
 
 #include "../include/layer.hpp"
 #include "../include/optimizer.hpp"
+#include "../include/activation_func.hpp"
 
 using namespace nn::layers;
 using namespace nn::optimizers;
+using namespace nn::activation_funcs;
 
 // ---- Mock Optimizer ----
 
@@ -243,3 +245,90 @@ TEST(DenseLayerTest, FeedForwardAndDerivate) {
 	EXPECT_EQ(grad.rows(), 2);
 	EXPECT_EQ(grad.cols(), 1);
 }
+
+TEST(DenseLayerTest, BatchedBackward) {
+	Dense<float> d(3, 2, std::make_shared<TanhFunc<float>>(), std::make_shared<RandNormalInitializer<float>>());
+	d.build();
+
+	// Two samples, one per column
+	Mat<float> X = {{0.5f, -1.0f},
+			{1.0f, 0.25f},
+			{-2.0f, 0.0f}};
+	Mat<float> dY = {{1.0f, 0.5f},
+			 {-1.0f, 2.0f}};
+
+	std::vector<Mat<float> *> params = d.parameters<float>();
+	ASSERT_EQ(params.size(), 2u);
+	std::vector<Mat<float>> grads;
+	for (Mat<float> *param : params)
+		grads.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+	Mat<float> dX = d.backward(X, dY, grads.data());
+	EXPECT_EQ(dX.get_shape(), X.get_shape());
+
+	// The batch is the sum of its samples
+	std::vector<Mat<float>> sample_grads;
+	for (Mat<float> *param : params)
+		sample_grads.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+	for (std::size_t j = 0; j < 2; j++) {
+		Mat<float> x = {{X(0, j)}, {X(1, j)}, {X(2, j)}};
+		Mat<float> dy = {{dY(0, j)}, {dY(1, j)}};
+		EXPECT_EQ(d(x), Mat<float>({{d(X)(0, j)}, {d(X)(1, j)}}));
+		Mat<float> dx = d.backward(x, dy, sample_grads.data());
+		for (std::size_t i = 0; i < 3; i++)
+			EXPECT_NEAR(dx(i, 0), dX(i, j), 1e-5);
+	}
+	for (std::size_t k = 0; k < 2; k++)
+		for (std::size_t i = 0; i < grads[k].rows(); i++)
+			for (std::size_t j = 0; j < grads[k].cols(); j++)
+				EXPECT_NEAR(grads[k](i, j), sample_grads[k](i, j), 1e-5);
+
+	// Finite differences of L = sum(dY * Y) with respect to one weight
+	const float eps = 1e-3f;
+	Mat<float> &W = d.get_weights();
+	float w = W(1, 2);
+	W(1, 2) = w + eps;
+	float up = (d(X) * dY).grand_sum();
+	W(1, 2) = w - eps;
+	float down = (d(X) * dY).grand_sum();
+	W(1, 2) = w;
+	EXPECT_NEAR(grads[0](1, 2), (up - down) / (2 * eps), 1e-2);
+}
+
+TEST(DenseLayerTest, AccumulateThenStep) {
+	Dense<float> d(2, 2, nullptr, std::make_shared<RandNormalInitializer<float>>());
+	d.set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.5f));
+	d.build();
+
+	Mat<float> x1 = {{1.0f}, {2.0f}}, x2 = {{-1.0f}, {0.5f}};
+	Mat<float> s1 = {{0.5f}, {-1.0f}}, s2 = {{2.0f}, {1.0f}};
+	Mat<float> W = d.get_weights(), b = d.get_bias();
+
+	// Accumulating leaves the weights alone
+	d.accumulate(s1, x1);
+	d.accumulate(s2, x2);
+	EXPECT_EQ(d.get_weights(), W);
+	std::vector<Mat<float> *> grads = d.gradients<float>();
+	ASSERT_EQ(grads.size(), 2u);
+	EXPECT_EQ(*grads[0], s1.dot(x1.transpose_copy()) + s2.dot(x2.transpose_copy()));
+
+	// One update with the mean of the two samples
+	d.step();
+	W.axpy(-0.25f, s1.dot(x1.transpose_copy()) + s2.dot(x2.transpose_copy()));
+	b.axpy(-0.25f, s1 + s2);
+	for (std::size_t i = 0; i < 2; i++) {
+		for (std::size_t j = 0; j < 2; j++)
+			EXPECT_NEAR(d.get_weights()(i, j), W(i, j), 1e-6);
+		EXPECT_NEAR(d.get_bias()(i, 0), b(i, 0), 1e-6);
+	}
+	EXPECT_EQ(*grads[0], Mat<float>(2, 2).fill(0.0f));
+
+	// Nothing accumulated, nothing to step
+	Mat<float> before = d.get_weights();
+	d.step();
+	EXPECT_EQ(d.get_weights(), before);
+
+	d.accumulate(s1, x1);
+	d.zero_grad();
+	d.step();
+	EXPECT_EQ(d.get_weights(), before);
+}
@@ -397,3 +397,164 @@ TEST_F(MeanAbsoluteErrorTest, GettersAndSetters) {
 	EXPECT_EQ(last_loss.rows(), 2);
 	EXPECT_EQ(last_loss.cols(), 1);
 }
+
+// Test the sigmoid cross-entropy fused from the logits
+TEST(SigmoidCrossEntropyTest, GradientFromTheLogits) {
+	SigmoidCrossEntropy<float> loss;
+	CrossEntropy<float> reference;
+	EXPECT_EQ(loss.get_name(), "SigmoidCrossEntropy");
+	EXPECT_EQ(loss.fused_activation(), "SigmoidFunc");
+	EXPECT_EQ(reference.fused_activation(), "");
+	EXPECT_THROW(reference.gradient_logits(Mat<float>(1, 1), Mat<float>(1, 1)), std::logic_error);
+
+	// Two samples, one per column
+	Mat<float> Z = {{0.5f, -2.0f}};
+	Mat<float> Y = {{1.0f, 0.0f}};
+	float sum = 0.0f;
+	Mat<float> dZ = loss.gradient_logits(Z, Y, &sum);
+
+	// dL/dz = dL/da * a(1 - a) = a - y
+	for (std::size_t j = 0; j < 2; j++) {
+		float a = 1.0f / (1.0f + std::exp(-Z(0, j)));
+		Mat<float> A = {{a}}, y = {{Y(0, j)}};
+		EXPECT_NEAR(dZ(0, j), a - Y(0, j), 1e-6);
+		EXPECT_NEAR(dZ(0, j), reference.gradient(A, y)(0, 0) * a * (1.0f - a), 1e-5);
+	}
+	float expected = -std::log(1.0f / (1.0f + std::exp(-0.5f))) - std::log(1.0f - 1.0f / (1.0f + std::exp(2.0f)));
+	EXPECT_NEAR(sum, expected, 1e-5);
+
+	// Saturated logits don't overflow nor divide by zero
+	Mat<float> extreme = {{100.0f, -100.0f}};
+	Mat<float> wrong = {{0.0f, 1.0f}};
+	Mat<float> dE = loss.gradient_logits(extreme, wrong, &sum);
+	EXPECT_FLOAT_EQ(dE(0, 0), 1.0f);
+	EXPECT_FLOAT_EQ(dE(0, 1), -1.0f);
+	EXPECT_NEAR(sum, 200.0f, 1e-3);
+
+	EXPECT_THROW(loss.gradient_logits(Z, Mat<float>(2, 1)), std::invalid_argument);
+}
+
+// Test the softmax cross-entropy fused from the logits
+TEST(SoftmaxCrossEntropyTest, GradientFromTheLogits) {
+	SoftmaxCrossEntropy<float> loss;
+	EXPECT_EQ(loss.get_name(), "SoftmaxCrossEntropy");
+	EXPECT_EQ(loss.fused_activation(), "SoftmaxFunc");
+
+	// Two samples of three classes, one per column
+	Mat<float> Z = {{1.0f, 0.0f},
+			{2.0f, 0.0f},
+			{3.0f, 0.0f}};
+	Mat<float> Y = {{0.0f, 1.0f},
+			{0.0f, 0.0f},
+			{1.0f, 0.0f}};
+	float sum = 0.0f;
+	Mat<float> dZ = loss.gradient_logits(Z, Y, &sum);
+
+	float total = std::exp(1.0f) + std::exp(2.0f) + std::exp(3.0f);
+	EXPECT_NEAR(dZ(0, 0), std::exp(1.0f) / total, 1e-6);
+	EXPECT_NEAR(dZ(2, 0), std::exp(3.0f) / total - 1.0f, 1e-6);
+	EXPECT_NEAR(dZ(0, 1), 1.0f / 3.0f - 1.0f, 1e-6);
+	EXPECT_NEAR(dZ(1, 1), 1.0f / 3.0f, 1e-6);
+	EXPECT_NEAR(sum, -std::log(std::exp(3.0f) / total) + std::log(3.0f), 1e-5);
+
+	// The same loss on the probabilities, and dL/dp = -y / p
+	Mat<float> p = {{std::exp(1.0f) / total}, {std::exp(2.0f) / total}, {std::exp(3.0f) / total}};
+	Mat<float> y = {{0.0f}, {0.0f}, {1.0f}};
+	EXPECT_NEAR(loss.gradient(p, y)(2, 0), -1.0f / p(2, 0), 1e-4);
+	EXPECT_FLOAT_EQ(loss.gradient(p, y)(0, 0), 0.0f);
+
+	// A wrong class with a huge margin costs the margin, not an infinity
+	Mat<float> far = {{1000.0f}, {0.0f}};
+	Mat<float> wrong = {{0.0f}, {1.0f}};
+	loss.gradient_logits(far, wrong, &sum);
+	EXPECT_NEAR(sum, 1000.0f, 1e-2);
+
+	EXPECT_THROW(loss.gradient_logits(Z, Mat<float>(3, 1)), std::invalid_argument);
+}
+
+// A model that works on batches: every column is scaled by a half
+class HalfModel : public Model {
+public:
+	HalfModel &build(void) {
+		register_funcs();
+		return *this;
+	}
+
+protected:
+	GenericVTable &register_funcs(void) override {
+		register_func<Mat<float>, const Mat<float> &>
+			("feedforward", [](const Mat<float> &X) -> Mat<float> {
+				Mat<float> Y(X.get_shape());
+				for (std::size_t i = 0; i < X.rows(); i++)
+					for (std::size_t j = 0; j < X.cols(); j++)
+						Y(i, j) = 0.5f * X(i, j);
+				return Y;
+			});
+		return *this;
+	}
+};
+
+// Test that the batched evaluation matches the one sample at a time
+TEST(LossEvaluationTest, BatchesMatchSingleSamples) {
+	auto model = std::make_shared<HalfModel>();
+	model->build();
+
+	auto inputs = std::make_shared<std::vector<Mat<float>>>();
+	auto outputs = std::make_shared<std::vector<Mat<float>>>();
+	for (std::size_t n = 0; n < 10; n++) {
+		float t = static_cast<float>(n) / 10.0f;
+		inputs->push_back(Mat<float>({{t}, {1.0f - t}}));
+		outputs->push_back(Mat<float>({{t * t}, {0.5f}}));
+	}
+
+	std::vector<std::shared_ptr<Loss<float>>> losses = {
+		std::make_shared<MeanAbsoluteError<float>>(inputs, outputs),
+		std::make_shared<MeanSquaredError<float>>(inputs, outputs),
+		std::make_shared<CrossEntropy<float>>(inputs, outputs),
+		std::make_shared<SoftmaxCrossEntropy<float>>(inputs, outputs),
+	};
+	for (auto &loss : losses) {
+		loss->set_model(model);
+		Mat<float> single = loss->set_batch_size(1)();
+		const std::vector<Mat<float>> predictions = loss->get_predictions();
+
+		// The last batch of 3 has a single sample
+		Mat<float> batched = loss->set_batch_size(3)();
+		ASSERT_EQ(batched.get_shape(), single.get_shape()) << loss->get_name();
+		for (std::size_t i = 0; i < single.rows(); i++)
+			EXPECT_NEAR(batched(i, 0), single(i, 0), 1e-5) << loss->get_name();
+
+		ASSERT_EQ(loss->get_predictions().size(), inputs->size());
+		for (std::size_t n = 0; n < inputs->size(); n++)
+			EXPECT_EQ(loss->get_predictions()[n], predictions[n]);
+	}
+
+	// The mean absolute error of the first output by hand
+	float expected = 0.0f;
+	for (std::size_t n = 0; n < inputs->size(); n++)
+		expected += std::abs(0.5f * (*inputs)[n](0, 0) - (*outputs)[n](0, 0));
+	EXPECT_NEAR((*losses[0])()(0, 0), expected / 10.0f, 1e-6);
+
+	EXPECT_THROW(losses[0]->set_batch_size(0), std::invalid_argument);
+}
+
+// Test that the predictions can be dropped
+TEST(LossEvaluationTest, WithoutKeepingThePredictions) {
+	auto model = std::make_shared<HalfModel>();
+	model->build();
+
+	auto inputs = std::make_shared<std::vector<Mat<float>>>(5, Mat<float>({{1.0f}, {2.0f}}));
+	auto outputs = std::make_shared<std::vector<Mat<float>>>(5, Mat<float>({{0.0f}, {0.0f}}));
+	MeanSquaredError<float> mse(inputs, outputs);
+	mse.set_model(model);
+	EXPECT_TRUE(mse.get_keep_predictions());
+
+	mse();
+	EXPECT_EQ(mse.get_predictions().size(), 5u);
+
+	Mat<float> loss = mse.set_keep_predictions(false)();
+	EXPECT_FALSE(mse.get_keep_predictions());
+	EXPECT_TRUE(mse.get_predictions().empty());
+	EXPECT_FLOAT_EQ(loss(0, 0), 0.25f);
+	EXPECT_FLOAT_EQ(loss(1, 0), 1.0f);
+}
@@ -490,3 +490,48 @@ TEST(MatTest, RandNormalFill) {
 	float var_empirical = sq_sum / (A.rows() * A.cols());
 	EXPECT_NEAR(var_empirical, 1.0f, 0.5f);
 }
+
+TEST(MatTest, BatchedHelpers) {
+	Mat<float> A = {{1, 2, 3},
+			{4, 5, 6}};
+	Mat<float> v = {{10}, {20}};
+
+	Mat<float> B = A;
+	B.add_colvec(v);
+	EXPECT_EQ(B, Mat<float>({{11, 12, 13}, {24, 25, 26}}));
+
+	Mat<float> sums = Mat<float>(2, 1).fill(0.0f);
+	sums.add_row_sum(A);
+	EXPECT_EQ(sums, Mat<float>({{6}, {15}}));
+
+	// A^T . A ~ (3, 3) and A . A^T ~ (2, 2) without transposing
+	EXPECT_EQ(A.transpose_dot(A), A.transpose_copy().dot(A));
+	Mat<float> C = Mat<float>(2, 2).fill(0.0f);
+	C.add_dot_transposed(A, A);
+	EXPECT_EQ(C, A.dot(A.transpose_copy()));
+
+	B = A;
+	B.axpy(-1.0f, A);
+	EXPECT_EQ(B, Mat<float>(2, 3).fill(0.0f));
+
+	EXPECT_THROW(B.add_colvec(sums.transpose_copy()), std::invalid_argument);
+}
+
+TEST(MatTest, CopyOfAViewOwnsItsMemory) {
+	float memory[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+	Mat<float> view(Shape{2, 2}, memory);
+
+	// Copy-assigning gives an owned copy, the viewed memory is left alone
+	Mat<float> values = {{1.0f, 2.0f}, {3.0f, 4.0f}};
+	view = values;
+	EXPECT_NE(view.get_mat_raw(), memory);
+	EXPECT_EQ(view, values);
+	EXPECT_EQ(memory[3], 0.0f);
+
+	// `assign` writes the values through a view, the shapes must match
+	Mat<float> target(Shape{2, 2}, memory);
+	target.assign(values);
+	EXPECT_EQ(target.get_mat_raw(), memory);
+	EXPECT_EQ(memory[3], 4.0f);
+	EXPECT_THROW(target.assign(Mat<float>{{5.0f, 6.0f, 7.0f}}), std::invalid_argument);
+}
@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "../include/metrics.hpp"
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+
+using namespace nn::metrics;
+using namespace nn::models;
+using namespace nn::activation_funcs;
+
+TEST(MetricsTest, BinaryClassification) {
+	Metrics<float> metrics;
+	EXPECT_EQ(metrics.get_nsamples(), 0u);
+	EXPECT_FLOAT_EQ(metrics.accuracy(), 0.0f);
+	EXPECT_FLOAT_EQ(metrics.auc(), 0.0f);
+
+	// TP, FP, TN, FN, TP
+	Mat<float> P = {{0.9f, 0.6f, 0.2f, 0.4f, 0.8f}};
+	Mat<float> Y = {{1.0f, 0.0f, 0.0f, 1.0f, 1.0f}};
+	metrics.update(P, Y, 5.0f);
+
+	EXPECT_EQ(metrics.get_nsamples(), 5u);
+	EXPECT_EQ(metrics.get_nclasses(), 1u);
+	EXPECT_FLOAT_EQ(metrics.loss(), 1.0f);
+	EXPECT_FLOAT_EQ(metrics.accuracy(), 3.0f / 5.0f);
+	EXPECT_FLOAT_EQ(metrics.precision(), 2.0f / 3.0f);
+	EXPECT_FLOAT_EQ(metrics.recall(), 2.0f / 3.0f);
+	// Positives 0.9, 0.4, 0.8 against negatives 0.6, 0.2: 5 of the 6 pairs are ordered
+	EXPECT_FLOAT_EQ(metrics.auc(), 5.0f / 6.0f);
+
+	EXPECT_THROW(metrics.update(P, Mat<float>(1, 4)), std::invalid_argument);
+	EXPECT_THROW(metrics.update(Mat<float>(2, 1), Mat<float>(2, 1)), std::invalid_argument);
+	EXPECT_THROW(Metrics<float>(0.5f, 0), std::invalid_argument);
+}
+
+TEST(MetricsTest, MulticlassClassification) {
+	Metrics<float> metrics;
+	// Classes 0, 1, 2, 1 predicted as 0, 1, 1, 1
+	Mat<float> P = {{0.7f, 0.1f, 0.2f, 0.3f},
+			{0.2f, 0.8f, 0.5f, 0.4f},
+			{0.1f, 0.1f, 0.3f, 0.3f}};
+	Mat<float> Y = {{1.0f, 0.0f, 0.0f, 0.0f},
+			{0.0f, 1.0f, 0.0f, 1.0f},
+			{0.0f, 0.0f, 1.0f, 0.0f}};
+	metrics.update(P, Y);
+
+	EXPECT_EQ(metrics.get_nclasses(), 3u);
+	EXPECT_FLOAT_EQ(metrics.accuracy(), 3.0f / 4.0f);
+	// Precision 1, 2/3, 0 and recall 1, 1, 0
+	EXPECT_FLOAT_EQ(metrics.precision(), (1.0f + 2.0f / 3.0f) / 3.0f);
+	EXPECT_FLOAT_EQ(metrics.recall(), 2.0f / 3.0f);
+	EXPECT_GT(metrics.auc(), 0.5f);
+}
+
+TEST(MetricsTest, MergeMatchesOneAccumulator) {
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+	Metrics<float> whole, first, second;
+	for (std::size_t n = 0; n < 64; n++) {
+		Mat<float> P = {{uniform(rng)}};
+		Mat<float> Y = {{uniform(rng) > 0.5f ? 1.0f : 0.0f}};
+		whole.update(P, Y, 0.5f);
+		(n < 20 ? first : second).update(P, Y, 0.5f);
+	}
+
+	Metrics<float> merged;
+	merged.merge(first).merge(second);
+	EXPECT_EQ(merged.get_nsamples(), whole.get_nsamples());
+	EXPECT_FLOAT_EQ(merged.loss(), whole.loss());
+	EXPECT_FLOAT_EQ(merged.accuracy(), whole.accuracy());
+	EXPECT_FLOAT_EQ(merged.precision(), whole.precision());
+	EXPECT_FLOAT_EQ(merged.recall(), whole.recall());
+	EXPECT_FLOAT_EQ(merged.auc(), whole.auc());
+
+	EXPECT_THROW(merged.merge(Metrics<float>(0.3f)), std::invalid_argument);
+	EXPECT_EQ(merged.reset().get_nsamples(), 0u);
+}
+
+TEST(MetricsTest, ParallelEvaluateMatchesTheLoss) {
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Dense<float>>(2, 3, std::make_shared<SigmoidFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<Dense<float>>(3, 1, std::make_shared<SigmoidFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.5f));
+	model->set_loss(std::make_shared<CrossEntropy<float>>());
+	model->build();
+
+	std::mt19937 rng(3);
+	std::normal_distribution<float> normal(0.0f, 1.0f);
+	auto X = std::make_shared<std::vector<Mat<float>>>();
+	auto Y = std::make_shared<std::vector<Mat<float>>>();
+	for (std::size_t n = 0; n < 1000; n++) {
+		float a = normal(rng), b = normal(rng);
+		X->push_back(Mat<float>({{a}, {b}}));
+		Y->push_back(Mat<float>({{a + b > 0.0f ? 1.0f : 0.0f}}));
+	}
+
+	Metrics<float> serial = model->evaluate(*X, *Y, 1, 64);
+	Metrics<float> sharded = model->evaluate(*X, *Y, 4, 64);
+	EXPECT_EQ(serial.get_nsamples(), 1000u);
+	EXPECT_EQ(sharded.get_nsamples(), 1000u);
+	EXPECT_NEAR(sharded.loss(), serial.loss(), 1e-4);
+	EXPECT_FLOAT_EQ(sharded.accuracy(), serial.accuracy());
+	EXPECT_FLOAT_EQ(sharded.auc(), serial.auc());
+
+	// The cross-entropy is summed by `test`, the metrics average it
+	float summed = model->test(X, Y)(0, 0);
+	EXPECT_NEAR(serial.loss(), summed / 1000.0f, 1e-3);
+
+	EXPECT_THROW(model->evaluate(*X, std::vector<Mat<float>>(), 1), std::invalid_argument);
+	EXPECT_THROW(model->evaluate(*X, *Y, 1, 0), std::invalid_argument);
+}
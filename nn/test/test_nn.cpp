@@ -1,9 +1,11 @@
 #include "gtest/gtest.h"
 #include <gtest/gtest.h>
+#include <cstdint>
 #include <memory>
 #include <vector>
 #include "../include/nn.hpp"
 #include "../include/activation_func.hpp"
+#include "test_helpers.hpp"
 
 using namespace nn::models;
 using namespace nn::activation_funcs;
@@ -268,3 +270,516 @@ TEST(NNTest, SequentialXor) {
 	
 }
 
+
+static std::shared_ptr<Sequential<float>> make_mlp(std::shared_ptr<Sequential<float>> like = nullptr)
+{
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Dense<float>>(2, 8, std::make_shared<TanhFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<Dense<float>>(8, 1, std::make_shared<SigmoidFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.5f));
+	model->set_loss(std::make_shared<CrossEntropy<float>>());
+	model->set_shuffle(false);
+	model->build();
+
+	// Same initial weights than `like`
+	if (like != nullptr) {
+		auto src = like->parameters<float>();
+		auto dst = model->parameters<float>();
+		for (std::size_t k = 0; k < src.size(); k++)
+			dst[k]->assign(*src[k]);
+	}
+	return model;
+}
+
+static void xor_data(std::shared_ptr<std::vector<Mat<float>>> &X, std::shared_ptr<std::vector<Mat<float>>> &Y)
+{
+	X = std::make_shared<std::vector<Mat<float>>>();
+	Y = std::make_shared<std::vector<Mat<float>>>();
+	for (int i = 0; i < 64; i++) {
+		float a = static_cast<float>(i % 2), b = static_cast<float>((i / 2) % 2);
+		X->push_back(Mat<float>({{a}, {b}}));
+		Y->push_back(Mat<float>({{a != b ? 1.0f : 0.0f}}));
+	}
+}
+
+TEST(NNTest, DataParallelIsDeterministic) {
+	std::shared_ptr<std::vector<Mat<float>>> X, Y;
+	xor_data(X, Y);
+
+	auto a = make_mlp();
+	auto b = make_mlp(a);
+	auto c = make_mlp(a);
+	a->set_fit_mode(FitMode::DataParallel, 3).fit(X, Y, 20, 16);
+	b->set_fit_mode(FitMode::DataParallel, 3).fit(X, Y, 20, 16);
+	c->set_fit_mode(FitMode::DataParallel, 1).fit(X, Y, 20, 16);
+
+	auto pa = a->parameters<float>(), pb = b->parameters<float>(), pc = c->parameters<float>();
+	ASSERT_EQ(pa.size(), 4u);
+	for (std::size_t k = 0; k < pa.size(); k++) {
+		// Bitwise equal with the same number of threads
+		for (std::size_t i = 0; i < pa[k]->rows() * pa[k]->cols(); i++)
+			EXPECT_EQ(pa[k]->get_mat_raw()[i], pb[k]->get_mat_raw()[i]);
+		// Only the order of the sums changes with another number of threads
+		for (std::size_t i = 0; i < pa[k]->rows() * pa[k]->cols(); i++)
+			EXPECT_NEAR(pa[k]->get_mat_raw()[i], pc[k]->get_mat_raw()[i], 1e-4);
+	}
+}
+
+TEST(NNTest, DataParallelMatchesTheMeanGradient) {
+	std::shared_ptr<std::vector<Mat<float>>> X, Y;
+	xor_data(X, Y);
+
+	auto model = make_mlp();
+	auto reference = make_mlp(model);
+
+	// One epoch of one batch with all the samples is a single step with the mean gradient
+	model->set_fit_mode(FitMode::DataParallel, 4).fit(X, Y, 1, X->size());
+
+	Mat<float> Xb(2, X->size()), Yb(1, X->size());
+	for (std::size_t j = 0; j < X->size(); j++) {
+		Xb(0, j) = (*X)[j](0, 0);
+		Xb(1, j) = (*X)[j](1, 0);
+		Yb(0, j) = (*Y)[j](0, 0);
+	}
+	auto params = reference->parameters<float>();
+	std::vector<Mat<float>> grads;
+	for (Mat<float> *param : params)
+		grads.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+	reference->accumulate_gradients(Xb, Yb, grads.data());
+	for (std::size_t k = 0; k < params.size(); k++)
+		params[k]->axpy(-0.5f / X->size(), grads[k]);
+
+	auto trained = model->parameters<float>();
+	for (std::size_t k = 0; k < params.size(); k++)
+		for (std::size_t i = 0; i < params[k]->rows() * params[k]->cols(); i++)
+			EXPECT_NEAR(trained[k]->get_mat_raw()[i], params[k]->get_mat_raw()[i], 1e-5);
+}
+
+TEST(NNTest, HogwildReducesTheLoss) {
+	auto X = std::make_shared<std::vector<Mat<float>>>();
+	auto Y = std::make_shared<std::vector<Mat<float>>>();
+	for (int i = 0; i < 64; i++) {
+		float a = static_cast<float>(i % 2), b = static_cast<float>((i / 2) % 2);
+		X->push_back(Mat<float>({{a}, {b}}));
+		Y->push_back(Mat<float>({{a + b > 0.0f ? 1.0f : 0.0f}}));	// OR gate
+	}
+
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Dense<float>>(2, 1, std::make_shared<SigmoidFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.5f));
+	model->set_loss(std::make_shared<CrossEntropy<float>>());
+	model->build();
+
+	float before = model->test(X, Y).grand_sum();
+	model->set_fit_mode(FitMode::Hogwild, 3).fit(X, Y, 50, 4);
+	float after = model->test(X, Y).grand_sum();
+
+	EXPECT_LT(after, before);
+	EXPECT_LT(after / X->size(), 0.2f);
+	for (std::size_t i = 0; i < X->size(); i++)
+		EXPECT_EQ((*model)((*X)[i])(0, 0) > 0.5f, (*Y)[i](0, 0) > 0.5f);
+}
+
+TEST(NNTest, FlatParameterSlab) {
+	auto model = make_mlp();
+	ASSERT_TRUE(model->has_flat_parameters());
+	Mat<float> &flat = model->get_flat_parameters();
+	const float *base = flat.get_mat_raw();
+	EXPECT_EQ(reinterpret_cast<std::uintptr_t>(base) % 64, 0u);
+
+	// Every parameter is an aligned view inside the slab, in order
+	auto params = model->parameters<float>();
+	ASSERT_EQ(params.size(), 4u);
+	const float *previous = nullptr;
+	for (Mat<float> *param : params) {
+		const float *data = param->get_mat_raw();
+		EXPECT_GE(data, base);
+		EXPECT_LE(data + param->rows() * param->cols(), base + flat.cols());
+		EXPECT_EQ(reinterpret_cast<std::uintptr_t>(data) % 64, 0u);
+		EXPECT_GT(data, previous);
+		previous = data;
+	}
+
+	// Writes to the slab are seen by the layers
+	auto *dense = static_cast<Dense<float> *>(model->get_layers()[0].get());
+	flat.fill(0.25f);
+	EXPECT_EQ(dense->get_weights()(3, 1), 0.25f);
+
+	// A rebuild moves the parameters to a new slab with the same values
+	params[0]->fill(-1.0f);
+	Mat<float> before = dense->get_weights();
+	model->set_optimizer(std::make_shared<AdamOptimizer<float>>());
+	model->build();
+	EXPECT_EQ(dense->get_weights(), before);
+	EXPECT_EQ(model->parameters<float>(), params);
+
+	// Without the slab every layer owns its parameters
+	auto fresh = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Dense<float>>(2, 1, std::make_shared<SigmoidFunc<float>>()),
+		});
+	fresh->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>());
+	fresh->set_flat_parameters(false);
+	fresh->build();
+	EXPECT_FALSE(fresh->has_flat_parameters());
+	EXPECT_THROW(fresh->get_flat_parameters(), std::logic_error);
+	EXPECT_EQ(fresh->optimizer_parameters(), fresh->parameters<float>());
+}
+
+TEST(NNTest, FlatAndPerParameterTrainingMatch) {
+	std::shared_ptr<std::vector<Mat<float>>> X, Y;
+	xor_data(X, Y);
+
+	auto flat = make_mlp();
+	auto split = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Dense<float>>(2, 8, std::make_shared<TanhFunc<float>>()),
+			std::make_unique<Dense<float>>(8, 1, std::make_shared<SigmoidFunc<float>>()),
+		});
+	split->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.5f));
+	split->set_loss(std::make_shared<CrossEntropy<float>>());
+	split->set_shuffle(false);
+	split->set_flat_parameters(false);
+	split->build();
+	auto src = flat->parameters<float>(), dst = split->parameters<float>();
+	for (std::size_t k = 0; k < src.size(); k++)
+		dst[k]->assign(*src[k]);
+
+	flat->set_fit_mode(FitMode::DataParallel, 2).fit(X, Y, 5, 16);
+	split->set_fit_mode(FitMode::DataParallel, 2).fit(X, Y, 5, 16);
+	ASSERT_FALSE(split->has_flat_parameters());
+
+	// The padding of the slab doesn't change the steps
+	src = flat->parameters<float>();
+	dst = split->parameters<float>();
+	for (std::size_t k = 0; k < src.size(); k++)
+		EXPECT_EQ(*src[k], *dst[k]);
+}
+
+TEST(NNTest, AccumulatedMicroBatchesMatchOneBatch) {
+	std::shared_ptr<std::vector<Mat<float>>> X, Y;
+	xor_data(X, Y);
+
+	// 4 micro-batches of 8 samples are one step with the mean gradient of 32
+	auto accumulated = make_mlp();
+	auto reference = make_mlp(accumulated);
+	accumulated->set_accumulation_steps(4).set_fit_mode(FitMode::DataParallel, 2).fit(X, Y, 3, 8);
+	reference->set_fit_mode(FitMode::DataParallel, 2).fit(X, Y, 3, 32);
+
+	auto pa = accumulated->parameters<float>(), pr = reference->parameters<float>();
+	for (std::size_t k = 0; k < pa.size(); k++)
+		for (std::size_t i = 0; i < pa[k]->rows() * pa[k]->cols(); i++)
+			EXPECT_NEAR(pa[k]->get_mat_raw()[i], pr[k]->get_mat_raw()[i], 1e-5);
+
+	// The same by hand with the accumulators of the model
+	auto manual = make_mlp(reference);
+	Mat<float> Xb(2, 4), Yb(1, 4);
+	for (std::size_t j = 0; j < 4; j++) {
+		Xb(0, j) = (*X)[j](0, 0);
+		Xb(1, j) = (*X)[j](1, 0);
+		Yb(0, j) = (*Y)[j](0, 0);
+	}
+	std::vector<Mat<float>> before;
+	for (Mat<float> *param : manual->parameters<float>())
+		before.push_back(*param);
+	manual->zero_grad();
+	manual->accumulate_batch(Xb, Yb).accumulate_batch(Xb, Yb);
+	EXPECT_EQ(*manual->parameters<float>()[0], before[0]);
+
+	// Twice the same batch, the mean is the gradient of one
+	std::vector<Mat<float> *> grads = manual->gradients<float>();
+	ASSERT_EQ(grads.size(), 4u);
+	std::vector<Mat<float>> expected;
+	for (Mat<float> *param : manual->parameters<float>())
+		expected.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+	manual->accumulate_gradients(Xb, Yb, expected.data());
+
+	manual->step();
+	auto params = manual->parameters<float>();
+	for (std::size_t k = 0; k < params.size(); k++) {
+		before[k].axpy(-0.5f / 4, expected[k]);
+		for (std::size_t i = 0; i < before[k].rows() * before[k].cols(); i++)
+			EXPECT_NEAR(params[k]->get_mat_raw()[i], before[k].get_mat_raw()[i], 1e-6);
+		EXPECT_EQ(*grads[k], Mat<float>(params[k]->get_shape()).fill(0.0f));
+	}
+
+	EXPECT_THROW(manual->set_accumulation_steps(0), std::invalid_argument);
+}
+
+TEST(NNTest, SigmoidCrossEntropyIsFused) {
+	std::shared_ptr<std::vector<Mat<float>>> X, Y;
+	xor_data(X, Y);
+	Mat<float> Xb(2, 4), Yb(1, 4);
+	for (std::size_t j = 0; j < 4; j++) {
+		Xb(0, j) = (*X)[j](0, 0);
+		Xb(1, j) = (*X)[j](1, 0);
+		Yb(0, j) = (*Y)[j](0, 0);
+	}
+
+	// Same gradients than the cross-entropy chained with the sigmoid
+	auto fused = make_mlp();
+	auto reference = make_mlp(fused);
+	fused->set_loss(std::make_shared<SigmoidCrossEntropy<float>>());
+
+	std::vector<Mat<float>> a, b;
+	for (Mat<float> *param : fused->parameters<float>()) {
+		a.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+		b.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+	}
+	fused->accumulate_gradients(Xb, Yb, a.data());
+	reference->accumulate_gradients(Xb, Yb, b.data());
+	for (std::size_t k = 0; k < a.size(); k++)
+		for (std::size_t i = 0; i < a[k].rows() * a[k].cols(); i++)
+			EXPECT_NEAR(a[k].get_mat_raw()[i], b[k].get_mat_raw()[i], 1e-4);
+
+	// It trains and still evaluates on the probabilities of the model
+	fused->set_fit_mode(FitMode::DataParallel, 2).fit(X, Y, 200, 8);
+	EXPECT_LT(fused->test(X, Y).grand_sum() / X->size(), 0.2f);
+}
+
+// The softmax cross-entropy without the fusion, the gradient goes through SoftmaxFunc::backward
+class UnfusedSoftmaxCrossEntropy : public SoftmaxCrossEntropy<float> {
+public:
+	std::string fused_activation(void) const override { return ""; }
+};
+
+TEST(NNTest, SoftmaxClassifier) {
+	// Three blobs, one-hot targets
+	auto X = std::make_shared<std::vector<Mat<float>>>();
+	auto Y = std::make_shared<std::vector<Mat<float>>>();
+	const float centers[3][2] = {{0.0f, 2.0f}, {2.0f, -1.0f}, {-2.0f, -1.0f}};
+	for (int i = 0; i < 60; i++) {
+		int k = i % 3;
+		float dx = 0.1f * static_cast<float>(i % 5) - 0.2f, dy = 0.1f * static_cast<float>(i % 7) - 0.3f;
+		X->push_back(Mat<float>({{centers[k][0] + dx}, {centers[k][1] + dy}}));
+		Mat<float> y = Mat<float>(3, 1).fill(0.0f);
+		y(k, 0) = 1.0f;
+		Y->push_back(y);
+	}
+
+	auto make = [](std::shared_ptr<Loss<float>> loss) {
+		auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				std::make_unique<Dense<float>>(2, 8, std::make_shared<TanhFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+				std::make_unique<Dense<float>>(8, 3, std::make_shared<SoftmaxFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+			});
+		model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.5f));
+		model->set_loss(loss);
+		model->set_shuffle(false);
+		model->build();
+		return model;
+	};
+	auto fused = make(std::make_shared<SoftmaxCrossEntropy<float>>());
+	auto unfused = make(std::make_shared<UnfusedSoftmaxCrossEntropy>());
+	auto src = fused->parameters<float>(), dst = unfused->parameters<float>();
+	for (std::size_t k = 0; k < src.size(); k++)
+		dst[k]->assign(*src[k]);
+
+	// The fused gradients are the ones of the chain rule (up to the epsilon of -y / p)
+	Mat<float> Xb(2, 6), Yb(3, 6);
+	for (std::size_t j = 0; j < 6; j++) {
+		for (std::size_t i = 0; i < 2; i++)
+			Xb(i, j) = (*X)[j](i, 0);
+		for (std::size_t i = 0; i < 3; i++)
+			Yb(i, j) = (*Y)[j](i, 0);
+	}
+	std::vector<Mat<float>> a, b;
+	for (Mat<float> *param : src) {
+		a.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+		b.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+	}
+	fused->accumulate_gradients(Xb, Yb, a.data());
+	unfused->accumulate_gradients(Xb, Yb, b.data());
+	for (std::size_t k = 0; k < a.size(); k++)
+		for (std::size_t i = 0; i < a[k].rows() * a[k].cols(); i++)
+			EXPECT_NEAR(a[k].get_mat_raw()[i], b[k].get_mat_raw()[i], 1e-3);
+
+	fused->set_fit_mode(FitMode::DataParallel, 2).fit(X, Y, 100, 10);
+	std::size_t correct = 0;
+	for (std::size_t i = 0; i < X->size(); i++) {
+		Mat<float> p = (*fused)((*X)[i]);
+		std::size_t best = 0;
+		for (std::size_t k = 1; k < 3; k++)
+			if (p(k, 0) > p(best, 0))
+				best = k;
+		correct += (*Y)[i](best, 0) == 1.0f;
+	}
+	EXPECT_EQ(correct, X->size());
+}
+
+TEST(NNTest, PruneNeuronsShrinksTheDenseLayers) {
+	// 4 -> 6 -> (6 ->) 3, the hidden layers can lose neurons
+	auto make = [](bool deep) {
+		auto model = deep ? std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				std::make_unique<Dense<float>>(4, 6, std::make_shared<TanhFunc<float>>()),
+				std::make_unique<Dense<float>>(6, 6, std::make_shared<TanhFunc<float>>()),
+				std::make_unique<Dense<float>>(6, 3),
+			}) : std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				std::make_unique<Dense<float>>(4, 6, std::make_shared<TanhFunc<float>>()),
+				std::make_unique<Dense<float>>(6, 3),
+			});
+		model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+		model->set_loss(std::make_shared<MeanSquaredError<float>>());
+		model->build();
+		for (Mat<float> *param : model->parameters<float>())
+			for (std::size_t i = 0; i < param->rows() * param->cols(); i++)
+				param->get_mat_raw()[i] = 0.1f * static_cast<float>(static_cast<int>((i * 5 + 3) % 11) - 5);
+		return model;
+	};
+	auto weights = [](Sequential<float> &model, std::size_t i) -> Mat<float> & {
+		return static_cast<Dense<float> &>(*model.get_layers()[i]).get_weights();
+	};
+	auto expect_near = [](const Mat<float> &expected, const Mat<float> &actual) {
+		ASSERT_EQ(expected.get_shape(), actual.get_shape());
+		for (std::size_t k = 0; k < expected.rows() * expected.cols(); k++)
+			EXPECT_NEAR(expected.get_mat_raw()[k], actual.get_mat_raw()[k], 1e-5);
+	};
+	Mat<float> X(4, 10);
+	for (std::size_t i = 0; i < 4; i++)
+		for (std::size_t j = 0; j < 10; j++)
+			X(i, j) = 0.3f * static_cast<float>(static_cast<int>((i * 7 + j * 3) % 9) - 4);
+
+	// By weight: the neurons 1 and 4 feed nothing, the smaller model is the same function
+	auto by_weight = make(false);
+	for (std::size_t o = 0; o < 3; o++)
+		weights(*by_weight, 1)(o, 1) = weights(*by_weight, 1)(o, 4) = 0.0f;
+	Mat<float> expected = (*by_weight)(X);
+	EXPECT_EQ(by_weight->prune_neurons(0.34), 2u);
+	EXPECT_EQ(by_weight->get_layers()[0]->get_output_size(), 4u);
+	EXPECT_EQ(by_weight->get_layers()[1]->get_input_size(), 4u);
+	EXPECT_EQ(weights(*by_weight, 0).get_shape(), Shape(4, 4));
+	expect_near(expected, (*by_weight)(X));
+
+	// With a batch: the neurons 0 and 2 have a constant output, the next bias takes it
+	auto by_activation = make(false);
+	Mat<float> W0 = weights(*by_activation, 0);
+	for (std::size_t c = 0; c < 4; c++)
+		weights(*by_activation, 0)(0, c) = weights(*by_activation, 0)(2, c) = 0.0f;
+	expected = (*by_activation)(X);
+	EXPECT_EQ(by_activation->prune_neurons(0.34, X), 2u);
+	EXPECT_TRUE(weights(*by_activation, 0).get_row(0) == W0.get_row(1));
+	expect_near(expected, (*by_activation)(X));
+
+	// Every hidden layer shrinks and the smaller model still trains
+	auto deep = make(true);
+	EXPECT_EQ(deep->prune_neurons(0.5, X), 6u);
+	EXPECT_EQ(weights(*deep, 1).get_shape(), Shape(3, 3));
+	EXPECT_EQ(deep->get_output_size(), 3u);
+	Mat<float> Y(3, 10);
+	Y.fill(0.5f);
+	auto mse = [&](void) {
+		Mat<float> P = (*deep)(X);
+		double sum = 0.0;
+		for (std::size_t k = 0; k < 3 * 10; k++)
+			sum += (P.get_mat_raw()[k] - 0.5) * (P.get_mat_raw()[k] - 0.5);
+		return sum;
+	};
+	double before = mse();
+	for (std::size_t n = 0; n < 20; n++) {
+		deep->accumulate_batch(X, Y);
+		deep->step();
+	}
+	EXPECT_LT(mse(), before);
+	EXPECT_EQ(deep->prune_neurons(0.0), 0u);
+	EXPECT_THROW(deep->prune_neurons(1.0), std::invalid_argument);
+}
+
+TEST(NNTest, PruneNeuronsByWeightFoldsTheBias) {
+	// The neurons 0 and 2 have no inputs, their output tanh(B) goes to the next bias
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Dense<float>>(4, 6, std::make_shared<TanhFunc<float>>()),
+			std::make_unique<Dense<float>>(6, 3),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+	model->build();
+	nn::test::fill_parameters(*model);
+	Mat<float> &W = static_cast<Dense<float> &>(*model->get_layers()[0]).get_weights();
+	for (std::size_t c = 0; c < 4; c++)
+		W(0, c) = W(2, c) = 0.0f;
+	Mat<float> &B = static_cast<Dense<float> &>(*model->get_layers()[0]).get_bias();
+	B(0, 0) = 0.4f;
+	B(2, 0) = -0.3f;
+
+	Mat<float> X = nn::test::make_batch(4, 10, 0.3f);
+	Mat<float> expected = (*model)(X);
+	EXPECT_EQ(model->prune_neurons(0.34), 2u);
+	EXPECT_EQ(model->get_layers()[0]->get_output_size(), 4u);
+	nn::test::expect_near(expected, (*model)(X), 1e-5f);
+}
+
+TEST(NNTest, PruneNeuronsThroughBatchNormAndDropout) {
+	// Dense -> BatchNorm -> Dropout -> Dense, the rows of the layers in between follow the neurons
+	auto make = [](void) {
+		auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				std::make_unique<Dense<float>>(4, 6),
+				std::make_unique<BatchNorm<float>>(6, std::make_shared<TanhFunc<float>>()),
+				std::make_unique<Dropout<float>>(6, 0.5f, 3),
+				std::make_unique<Dense<float>>(6, 3),
+			});
+		model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+		model->build();
+		nn::test::fill_parameters(*model);
+		auto &norm = static_cast<BatchNorm<float> &>(*model->get_layers()[1]);
+		for (std::size_t r = 0; r < 6; r++) {
+			norm.get_running_mean()(r, 0) = 0.1f * static_cast<float>(r) - 0.2f;
+			norm.get_running_var()(r, 0) = 0.5f + 0.25f * static_cast<float>(r);
+		}
+		Mat<float> &W = static_cast<Dense<float> &>(*model->get_layers()[0]).get_weights();
+		for (std::size_t c = 0; c < 4; c++)
+			W(1, c) = W(4, c) = 0.0f;
+		return model;
+	};
+	Mat<float> X = nn::test::make_batch(4, 10, 0.3f);
+
+	for (bool calibrated : {false, true}) {
+		auto model = make();
+		auto &norm = static_cast<BatchNorm<float> &>(*model->get_layers()[1]);
+		Mat<float> gamma = norm.get_gamma(), running_var = norm.get_running_var();
+		Mat<float> expected = (*model)(X);
+		EXPECT_EQ(calibrated ? model->prune_neurons(0.34, X) : model->prune_neurons(0.34), 2u);
+
+		const auto &layers = model->get_layers();
+		ASSERT_EQ(layers.size(), 4u);
+		auto *shrunk_norm = dynamic_cast<BatchNorm<float> *>(layers[1].get());
+		auto *shrunk_dropout = dynamic_cast<Dropout<float> *>(layers[2].get());
+		ASSERT_NE(shrunk_norm, nullptr);
+		ASSERT_NE(shrunk_dropout, nullptr);
+		EXPECT_EQ(shrunk_norm->get_output_size(), 4u);
+		EXPECT_EQ(shrunk_dropout->get_output_size(), 4u);
+		EXPECT_FLOAT_EQ(shrunk_dropout->get_rate(), 0.5f);
+		EXPECT_EQ(shrunk_dropout->get_seed(), 3u);
+		EXPECT_EQ(layers[3]->get_input_size(), 4u);
+		// The neurons 1 and 4 went, the rows after them moved up
+		EXPECT_EQ(shrunk_norm->get_gamma()(1, 0), gamma(2, 0));
+		EXPECT_EQ(shrunk_norm->get_running_var()(3, 0), running_var(5, 0));
+		nn::test::expect_near(expected, (*model)(X), 1e-5f);
+	}
+}
+
+TEST(NNTest, PruneNeuronsForgetsTheOptimizerState) {
+	// A LayerNorm mixes the neurons, the second Dense isn't pruned and the last one keeps its state
+	for (bool flat : {true, false}) {
+		auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				std::make_unique<Dense<float>>(4, 6, std::make_shared<TanhFunc<float>>()),
+				std::make_unique<Dense<float>>(6, 5),
+				std::make_unique<LayerNorm<float>>(5),
+				std::make_unique<Dense<float>>(5, 3),
+			});
+		auto optimizer = std::make_shared<AdamOptimizer<float>>();
+		model->set_optimizer(optimizer);
+		model->set_loss(std::make_shared<MeanSquaredError<float>>());
+		model->set_flat_parameters(flat);
+		model->build();
+		nn::test::fill_parameters(*model);
+
+		Mat<float> X = nn::test::make_batch(4, 6, 0.2f);
+		Mat<float> Y = nn::test::make_batch(3, 6, 0.1f);
+		model->accumulate_batch(X, Y);
+		model->step();
+		// Two moments and a step counter per parameter, or for the slab
+		ASSERT_EQ(optimizer->get_state<float>().size(), flat ? 3u : 8u * 3u);
+
+		EXPECT_EQ(model->prune_neurons(0.34), 2u);
+		EXPECT_EQ(model->get_layers()[1]->get_output_size(), 5u);
+		EXPECT_EQ(optimizer->get_state<float>().size(), flat ? 0u : 4u * 3u);
+	}
+}
@@ -0,0 +1,248 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+#include "test_helpers.hpp"
+
+using namespace nn::models;
+using namespace nn::activation_funcs;
+using namespace nn::test;
+
+TEST(BatchNormTest, TrainingNormalizesTheBatch) {
+	BatchNorm<float> norm(3, nullptr, 0.5f);
+	norm.build();
+	Mat<float> X = make_batch(3, 8, 0.3f, 2.0f);
+
+	// Without training the running statistics (0, 1) leave X as it is
+	Mat<float> Y = norm(X);
+	for (std::size_t i = 0; i < 3 * 8; i++)
+		EXPECT_NEAR(Y.get_mat_raw()[i], X.get_mat_raw()[i], 1e-4);
+
+	norm.set_training(true);
+	Y = norm(X);
+	for (std::size_t i = 0; i < 3; i++) {
+		double mean = 0.0, var = 0.0, x_mean = 0.0, x_var = 0.0;
+		for (std::size_t j = 0; j < 8; j++) {
+			mean += Y(i, j) / 8.0;
+			x_mean += X(i, j) / 8.0;
+		}
+		for (std::size_t j = 0; j < 8; j++) {
+			var += (Y(i, j) - mean) * (Y(i, j) - mean) / 8.0;
+			x_var += (X(i, j) - x_mean) * (X(i, j) - x_mean) / 7.0;
+		}
+		EXPECT_NEAR(mean, 0.0, 1e-5);
+		EXPECT_NEAR(var, 1.0, 1e-3);
+		// Half way from (0, 1) to the statistics of the batch
+		EXPECT_NEAR(norm.get_running_mean()(i, 0), 0.5 * x_mean, 1e-4);
+		EXPECT_NEAR(norm.get_running_var()(i, 0), 0.5 + 0.5 * x_var, 1e-3);
+	}
+
+	EXPECT_THROW(norm(make_batch(3, 1, 1.0f)), std::invalid_argument);
+}
+
+TEST(BatchNormTest, BackwardMatchesFiniteDifferences) {
+	BatchNorm<float> norm(2, std::make_shared<TanhFunc<float>>());
+	norm.build();
+	norm.set_training(true);
+	norm.get_gamma()(0, 0) = 1.5f;
+	norm.get_beta()(1, 0) = -0.3f;
+	Mat<float> X = make_batch(2, 5, 0.4f, 1.0f);
+	Mat<float> dY = make_batch(2, 5, 0.1f, -0.2f);
+
+	// L = sum dY * f(BN(X))
+	auto loss = [&](void) {
+		Mat<float> Y = norm(X);
+		double sum = 0.0;
+		for (std::size_t i = 0; i < 2 * 5; i++)
+			sum += Y.get_mat_raw()[i] * dY.get_mat_raw()[i];
+		return sum;
+	};
+
+	Mat<float> grads[2] = {Mat<float>(2, 1).fill(0.0f), Mat<float>(2, 1).fill(0.0f)};
+	Mat<float> dX = norm.backward<float>(X, dY, grads);
+
+	const float h = 1e-2f;
+	std::vector<std::pair<Mat<float> *, Mat<float> *>> checks = {
+		{&norm.get_gamma(), &grads[0]}, {&norm.get_beta(), &grads[1]}, {&X, &dX}};
+	for (auto [param, grad] : checks) {
+		for (std::size_t i = 0; i < param->rows() * param->cols(); i++) {
+			float saved = param->get_mat_raw()[i];
+			param->get_mat_raw()[i] = saved + h;
+			double up = loss();
+			param->get_mat_raw()[i] = saved - h;
+			double down = loss();
+			param->get_mat_raw()[i] = saved;
+			EXPECT_NEAR(grad->get_mat_raw()[i], (up - down) / (2 * h), 2e-3);
+		}
+	}
+}
+
+TEST(BatchNormTest, FoldsIntoTheDenseLayer) {
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Dense<float>>(4, 6, nullptr, std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<BatchNorm<float>>(6, std::make_shared<ReluFunc<float>>()),
+			std::make_unique<Dense<float>>(6, 3, std::make_shared<SoftmaxFunc<float>>(),
+						       std::make_shared<RandNormalInitializer<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+	model->build();
+
+	// A few training batches move the running statistics and gamma, beta away from the identity
+	Mat<float> X = make_batch(4, 6, 0.2f, 0.5f);
+	Mat<float> Y = make_batch(3, 6, 0.0f);
+	for (std::size_t j = 0; j < 6; j++)
+		Y(j % 3, j) = 1.0f;
+	model->set_loss(std::make_shared<nn::loss_funcs::SoftmaxCrossEntropy<float>>());
+	model->set_training(true);
+	for (std::size_t n = 0; n < 5; n++) {
+		model->accumulate_batch(X, Y);
+		model->step();
+	}
+	model->set_training(false);
+
+	Mat<float> expected = (*model)(X);
+	EXPECT_EQ(model->fold_batchnorm(), 1u);
+	EXPECT_EQ(model->get_layers().size(), 2u);
+	EXPECT_EQ(model->parameters<float>().size(), 4u);
+	Mat<float> folded = (*model)(X);
+	for (std::size_t i = 0; i < 3 * 6; i++)
+		EXPECT_NEAR(folded.get_mat_raw()[i], expected.get_mat_raw()[i], 1e-5);
+	EXPECT_EQ(model->fold_batchnorm(), 0u);
+}
+
+TEST(BatchNormTest, FoldingForgetsTheOptimizerState) {
+	for (bool flat : {true, false}) {
+		auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				std::make_unique<Dense<float>>(4, 6),
+				std::make_unique<BatchNorm<float>>(6, std::make_shared<ReluFunc<float>>()),
+				std::make_unique<Dense<float>>(6, 3),
+			});
+		auto optimizer = std::make_shared<AdamOptimizer<float>>();
+		model->set_optimizer(optimizer);
+		model->set_flat_parameters(flat);
+		model->build();
+
+		Mat<float> X = make_batch(4, 6, 0.2f, 0.5f);
+		Mat<float> Y = make_batch(3, 6, 0.1f);
+		model->set_loss(std::make_shared<nn::loss_funcs::MeanSquaredError<float>>());
+		model->set_training(true);
+		model->accumulate_batch(X, Y);
+		model->step();
+		model->set_training(false);
+		// Two moments and a step counter per parameter, or for the slab
+		ASSERT_EQ(optimizer->get_state<float>().size(), flat ? 3u : 6u * 3u);
+
+		EXPECT_EQ(model->fold_batchnorm(), 1u);
+		// Only the untouched last Dense keeps its moments
+		EXPECT_EQ(optimizer->get_state<float>().size(), flat ? 0u : 2u * 3u);
+	}
+}
+
+TEST(BatchNormTest, FitsOnWholeBatches) {
+	// 10 samples by 4: the last batch has two, a shard of the data parallel mode never has one
+	auto X = std::make_shared<std::vector<Mat<float>>>();
+	auto Y = std::make_shared<std::vector<Mat<float>>>();
+	Mat<float> inputs = make_batch(3, 10, 0.2f, 0.5f);
+	for (std::size_t j = 0; j < 10; j++) {
+		X->push_back(Mat<float>{{inputs(0, j)}, {inputs(1, j)}, {inputs(2, j)}});
+		Y->push_back(Mat<float>{{static_cast<float>(j % 2)}, {static_cast<float>((j + 1) % 2)}});
+	}
+
+	for (FitMode mode : {FitMode::Serial, FitMode::DataParallel}) {
+		auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				std::make_unique<Dense<float>>(3, 4),
+				std::make_unique<BatchNorm<float>>(4, std::make_shared<ReluFunc<float>>()),
+				std::make_unique<Dense<float>>(4, 2, std::make_shared<SoftmaxFunc<float>>()),
+			});
+		model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+		model->set_loss(std::make_shared<nn::loss_funcs::SoftmaxCrossEntropy<float>>());
+		model->set_fit_mode(mode, 4);
+		model->set_shuffle(false);
+		model->build();
+		fill_parameters(*model);
+
+		auto &norm = static_cast<BatchNorm<float> &>(*model->get_layers()[1]);
+		EXPECT_NO_THROW(model->fit(X, Y, 3, 4));
+		EXPECT_FALSE(model->is_training());
+		EXPECT_NE(norm.get_running_mean()(0, 0), 0.0f);
+		EXPECT_NE(norm.get_running_var()(0, 0), 1.0f);
+
+		// A last batch of a single sample has no statistics
+		auto X_odd = std::make_shared<std::vector<Mat<float>>>(X->begin(), X->begin() + 9);
+		auto Y_odd = std::make_shared<std::vector<Mat<float>>>(Y->begin(), Y->begin() + 9);
+		EXPECT_THROW(model->fit(X_odd, Y_odd, 1, 4), std::invalid_argument);
+		EXPECT_THROW(model->fit(X, Y, 1, 1), std::invalid_argument);
+	}
+}
+
+TEST(LayerNormTest, NormalizesEverySample) {
+	LayerNorm<float> norm(4);
+	norm.build();
+	norm.get_gamma()(2, 0) = 2.0f;
+	norm.get_beta()(2, 0) = 0.5f;
+	// More samples than a block of columns of the kernel
+	Mat<float> X = make_batch(4, 70, 0.3f, 2.0f);
+
+	Mat<float> Y = norm(X);
+	for (std::size_t j = 0; j < 70; j++) {
+		double mean = 0.0, var = 0.0;
+		for (std::size_t i = 0; i < 4; i++)
+			mean += X(i, j) / 4.0;
+		for (std::size_t i = 0; i < 4; i++)
+			var += (X(i, j) - mean) * (X(i, j) - mean) / 4.0;
+		for (std::size_t i = 0; i < 4; i++) {
+			double xhat = (X(i, j) - mean) / std::sqrt(var + 1e-5);
+			EXPECT_NEAR(Y(i, j), i == 2 ? 2.0 * xhat + 0.5 : xhat, 1e-4);
+		}
+	}
+
+	// The same in training, a sample is enough
+	norm.set_training(true);
+	Mat<float> x = make_batch(4, 1, 0.3f, 2.0f);
+	EXPECT_NEAR(norm(x)(0, 0), Y(0, 0), 1e-6);
+}
+
+TEST(LayerNormTest, BackwardMatchesFiniteDifferences) {
+	LayerNorm<float> norm(3);
+	norm.build();
+	norm.get_gamma()(0, 0) = 1.5f;
+	norm.get_beta()(1, 0) = -0.3f;
+	Mat<float> X = make_batch(3, 4, 0.4f, 1.0f);
+	Mat<float> dY = make_batch(3, 4, 0.1f, -0.2f);
+
+	auto loss = [&](void) {
+		Mat<float> Y = norm(X);
+		double sum = 0.0;
+		for (std::size_t i = 0; i < 3 * 4; i++)
+			sum += Y.get_mat_raw()[i] * dY.get_mat_raw()[i];
+		return sum;
+	};
+
+	Mat<float> grads[2] = {Mat<float>(3, 1).fill(0.0f), Mat<float>(3, 1).fill(0.0f)};
+	Mat<float> dX = norm.backward<float>(X, dY, grads);
+
+	// The compiled path writes the same dX in place of dY
+	Mat<float> Y(X.get_shape()), dY_into = dY;
+	norm.forward_into<float>(X, Y);
+	norm.backward_into<float>(X, Y, dY_into, dY_into, nullptr);
+	for (std::size_t i = 0; i < 3 * 4; i++)
+		EXPECT_NEAR(dY_into.get_mat_raw()[i], dX.get_mat_raw()[i], 1e-5);
+
+	const float h = 1e-2f;
+	std::vector<std::pair<Mat<float> *, Mat<float> *>> checks = {
+		{&norm.get_gamma(), &grads[0]}, {&norm.get_beta(), &grads[1]}, {&X, &dX}};
+	for (auto [param, grad] : checks) {
+		for (std::size_t i = 0; i < param->rows() * param->cols(); i++) {
+			float saved = param->get_mat_raw()[i];
+			param->get_mat_raw()[i] = saved + h;
+			double up = loss();
+			param->get_mat_raw()[i] = saved - h;
+			double down = loss();
+			param->get_mat_raw()[i] = saved;
+			EXPECT_NEAR(grad->get_mat_raw()[i], (up - down) / (2 * h), 2e-3);
+		}
+	}
+}
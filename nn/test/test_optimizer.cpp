@@ -1,6 +1,9 @@
 #include "../include/optimizer.hpp"
 #include <gtest/gtest.h>
+#include <cmath>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 using namespace nn::mathops;
 using namespace nn::optimizers;
@@ -81,3 +84,144 @@ TEST(PerceptronOptimizerTest, UpdateWeights) {
 	EXPECT_FLOAT_EQ(weights(1, 0), -0.05f);
 	EXPECT_FLOAT_EQ(weights(1, 1), -0.1f);
 }
+
+TEST(MomentumOptimizerTest, AccumulatesTheVelocity) {
+	Mat<float> param = {{1.0f, 2.0f}};
+	Mat<float> grad = {{0.5f, -1.0f}};
+
+	MomentumOptimizer<float> opt(0.1f, 0.9f);
+	opt.apply(param, grad);		// v = g
+	opt.apply(param, grad);		// v = 0.9 g + g
+
+	EXPECT_FLOAT_EQ(param(0, 0), 1.0f - 0.1f * (0.5f + 1.9f * 0.5f));
+	EXPECT_FLOAT_EQ(param(0, 1), 2.0f + 0.1f * (1.0f + 1.9f * 1.0f));
+
+	std::vector<Mat<float> *> state = opt.get_state<float>();
+	ASSERT_EQ(state.size(), 1u);
+	EXPECT_FLOAT_EQ((*state[0])(0, 0), 1.9f * 0.5f);
+}
+
+TEST(MomentumOptimizerTest, NesterovLooksAhead) {
+	Mat<float> param = {{0.0f}};
+	Mat<float> grad = {{1.0f}};
+
+	MomentumOptimizer<float> opt(0.1f, 0.5f, true);
+	EXPECT_EQ(opt.get_name(), "NesterovOptimizer");
+	opt.apply(param, grad);		// v = 1, step = g + mu v = 1.5
+	EXPECT_FLOAT_EQ(param(0, 0), -0.15f);
+
+	EXPECT_THROW(MomentumOptimizer<float>(0.1f, 1.0f), std::invalid_argument);
+}
+
+TEST(RMSPropOptimizerTest, ScalesByTheGradientMagnitude) {
+	Mat<float> param = {{0.0f, 0.0f}};
+	Mat<float> grad = {{100.0f, 0.01f}};
+
+	RMSPropOptimizer<float> opt(0.01f, 0.9f, 1e-8f);
+	opt.apply(param, grad);
+
+	// s = 0.1 g^2, the step is lr / sqrt(0.1) whatever the size of the gradient
+	EXPECT_NEAR(param(0, 0), -0.01f / std::sqrt(0.1f), 1e-6);
+	EXPECT_NEAR(param(0, 1), -0.01f / std::sqrt(0.1f), 1e-5);
+}
+
+TEST(AdamOptimizerTest, FirstStepIsTheLearningRate) {
+	Mat<float> param = {{1.0f, 1.0f, 1.0f}};
+	Mat<float> grad = {{3.0f, -0.001f, 0.0f}};
+
+	AdamOptimizer<float> opt(0.01f);
+	opt.apply(param, grad);
+
+	// With the bias correction m / sqrt(v) = sign(g) on the first step
+	EXPECT_NEAR(param(0, 0), 0.99f, 1e-6);
+	EXPECT_NEAR(param(0, 1), 1.01f, 1e-4);
+	EXPECT_FLOAT_EQ(param(0, 2), 1.0f);
+
+	// m, v and the step counter
+	std::vector<Mat<float> *> state = opt.get_state<float>();
+	ASSERT_EQ(state.size(), 3u);
+	EXPECT_FLOAT_EQ((*state[0])(0, 0), 0.1f * 3.0f);
+	EXPECT_NEAR((*state[1])(0, 0), 0.001f * 9.0f, 1e-6);
+	EXPECT_FLOAT_EQ((*state[2])(0, 0), 1.0f);
+}
+
+TEST(AdamOptimizerTest, AdamWDecaysTheWeights) {
+	Mat<float> param = {{2.0f}};
+	Mat<float> grad = {{0.0f}};
+
+	AdamWOptimizer<float> opt(0.1f, 0.5f);
+	EXPECT_EQ(opt.get_name(), "AdamWOptimizer");
+	opt.apply(param, grad);
+
+	// No gradient, only the decoupled decay: θ ← θ - η λ θ
+	EXPECT_FLOAT_EQ(param(0, 0), 2.0f * (1.0f - 0.1f * 0.5f));
+}
+
+TEST(AdamOptimizerTest, StateFollowsThePreparedParameters) {
+	Mat<float> weights(3, 2), bias(3, 1);
+	weights.fill(1.0f);
+	bias.fill(1.0f);
+
+	AdamOptimizer<float> opt;
+	EXPECT_TRUE(opt.get_state<float>().empty());
+	opt.prepare<float>({&weights, &bias});
+
+	std::vector<Mat<float> *> state = opt.get_state<float>();
+	ASSERT_EQ(state.size(), 6u);
+	EXPECT_EQ(state[0]->get_shape(), weights.get_shape());
+	EXPECT_EQ(state[3]->get_shape(), bias.get_shape());
+	// The moments are aligned views over flat memory
+	EXPECT_EQ(reinterpret_cast<std::uintptr_t>(state[0]->get_mat_raw()) % 64, 0u);
+	EXPECT_EQ(reinterpret_cast<std::uintptr_t>(state[1]->get_mat_raw()) % 64, 0u);
+
+	// Preparing again doesn't allocate a second state
+	opt.prepare<float>({&weights, &bias});
+	EXPECT_EQ(opt.get_state<float>(), state);
+
+	Mat<float> wrong(2, 2);
+	EXPECT_THROW(opt.apply(weights, wrong), std::invalid_argument);
+}
+
+TEST(AdamOptimizerTest, ForgetDropsTheStateOfAParameter) {
+	Mat<float> weights(3, 2), bias(3, 1);
+	AdamOptimizer<float> opt;
+	opt.prepare<float>({&weights, &bias});
+	ASSERT_EQ(opt.get_state<float>().size(), 6u);
+
+	opt.forget(weights);
+	std::vector<Mat<float> *> state = opt.get_state<float>();
+	ASSERT_EQ(state.size(), 3u);
+	EXPECT_EQ(state[0]->get_shape(), bias.get_shape());
+	// Forgetting twice is fine, the next step starts from zero moments
+	opt.forget(weights);
+	opt.prepare<float>({&weights});
+	state = opt.get_state<float>();
+	ASSERT_EQ(state.size(), 6u);
+	for (std::size_t i = 0; i < 3 * 2; i++)
+		EXPECT_EQ(state[3]->get_mat_raw()[i], 0.0f);
+}
+
+TEST(AdamOptimizerTest, PerSampleUpdateMatchesApply) {
+	Mat<float> input = {{1.0f}, {2.0f}};
+	Mat<float> signal = {{0.5f}, {-0.5f}};
+	Mat<float> a(2, 2), b(2, 2);
+	a.fill(0.0f);
+	b.fill(0.0f);
+
+	// update() builds dL/dW = signal . input^T and takes the same step
+	AdamOptimizer<float> first(0.01f), second(0.01f);
+	first.update(a, signal, input);
+	second.apply(b, signal.dot(input.transpose_copy()));
+	EXPECT_EQ(a, b);
+}
+
+TEST(OptimizerStateTest, SlotsHaveNoScratchUntilAPerSampleUpdate) {
+	OptimizerState<float> state(2, true);
+	Mat<float> W(3, 4);
+	auto &slot = state.get(W);
+	EXPECT_EQ(slot.shape, W.get_shape());
+	EXPECT_EQ(slot.scratch.rows() * slot.scratch.cols(), 0u);
+	// The block only holds the two moments and the counter
+	EXPECT_EQ(state.tensors().size(), 3u);
+	EXPECT_EQ(slot.memory.size(), 2 * AlignedBuffer<float>::round_up(12) + AlignedBuffer<float>::round_up(1));
+}
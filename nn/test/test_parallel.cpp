@@ -0,0 +1,187 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "../include/parallel.hpp"
+
+using namespace nn::parallel;
+
+TEST(WorkerGroupTest, RunsEveryWorkerOnce) {
+	WorkerGroup workers(4);
+	EXPECT_EQ(workers.size(), 4u);
+
+	std::vector<int> calls(4, 0);
+	for (int round = 0; round < 50; round++)
+		workers.run([&](std::size_t i) { calls[i]++; });
+
+	for (int c : calls)
+		EXPECT_EQ(c, 50);
+}
+
+TEST(WorkerGroupTest, RethrowsAfterAllFinished) {
+	WorkerGroup workers(3);
+	std::atomic<int> finished(0);
+	EXPECT_THROW(workers.run([&](std::size_t i) {
+				if (i == 2)
+					throw std::runtime_error("worker failed");
+				finished++;
+			}), std::runtime_error);
+	EXPECT_EQ(finished.load(), 2);
+
+	// Still usable after an error
+	workers.run([&](std::size_t) { finished++; });
+	EXPECT_EQ(finished.load(), 5);
+}
+
+TEST(WorkerGroupTest, InvalidSize) {
+	EXPECT_THROW(WorkerGroup(0), std::invalid_argument);
+	EXPECT_GE(hardware_threads(), 1u);
+}
+
+TEST(ThreadPoolTest, ParallelForCoversTheRange) {
+	ThreadPool pool(3);
+	std::vector<int> hits(10000, 0);
+	pool.parallel_for(hits.size(), 100, [&](std::size_t begin, std::size_t end) {
+			for (std::size_t i = begin; i < end; i++)
+				hits[i]++;
+		});
+
+	for (int h : hits)
+		EXPECT_EQ(h, 1);
+}
+
+TEST(ThreadPoolTest, ParallelForRethrowsAfterAllChunks) {
+	ThreadPool pool(3);
+	std::atomic<std::size_t> covered(0);
+	EXPECT_THROW(pool.parallel_for(1000, 10, [&](std::size_t begin, std::size_t end) {
+				covered += end - begin;
+				if (begin == 0)
+					throw std::runtime_error("chunk failed");
+			}), std::runtime_error);
+	EXPECT_EQ(covered.load(), 1000u);
+
+	// The slot was given back
+	pool.parallel_for(1000, 10, [&](std::size_t begin, std::size_t end) { covered += end - begin; });
+	EXPECT_EQ(covered.load(), 2000u);
+}
+
+TEST(ThreadPoolTest, NestedParallelismDoesNotDeadlock) {
+	// Every outer task blocks on inner tasks, more of them than workers
+	ThreadPool pool(2);
+	std::atomic<int> inner(0);
+	pool.parallel_for(16, 1, [&](std::size_t begin, std::size_t end) {
+			for (std::size_t i = begin; i < end; i++) {
+				TaskGroup group(pool);
+				for (int k = 0; k < 8; k++)
+					group.run([&] {
+						pool.parallel_for(4, 1, [&](std::size_t b, std::size_t e) { inner += e - b; });
+					});
+				group.wait();
+			}
+		});
+
+	EXPECT_EQ(inner.load(), 16 * 8 * 4);
+}
+
+TEST(ThreadPoolTest, TaskGroupRethrows) {
+	ThreadPool pool(2);
+	TaskGroup group(pool);
+	std::atomic<int> finished(0);
+	for (int i = 0; i < 4; i++)
+		group.run([&, i] {
+			if (i == 1)
+				throw std::runtime_error("task failed");
+			finished++;
+		});
+
+	EXPECT_THROW(group.wait(), std::runtime_error);
+	EXPECT_EQ(finished.load(), 3);
+	EXPECT_NO_THROW(group.wait());
+}
+
+TEST(ThreadPoolTest, WaitersSleepUntilNotified) {
+	ThreadPool pool(2);
+	std::atomic<bool> flag(false);
+	std::atomic<int> checks(0);
+
+	// The condition comes from outside the pool, only the notification wakes us
+	std::thread setter([&] {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		flag = true;
+		pool.notify_waiters();
+	});
+	pool.help_until([&] {
+		checks++;
+		return flag.load();
+	});
+	setter.join();
+
+	// A polling wait would have checked about once per millisecond
+	EXPECT_TRUE(flag.load());
+	EXPECT_LT(checks.load(), 10);
+}
+
+TEST(ThreadPoolTest, WorkerCounters) {
+	ThreadPool pool(2);
+	EXPECT_EQ(pool.size(), 2u);
+	EXPECT_EQ(pool.worker_index(), 2u);
+
+	std::atomic<std::size_t> index(0);
+	TaskGroup group(pool);
+	group.run([&] { index = pool.worker_index(); });
+	group.wait();
+	// The task either ran on a worker or was helped by the waiting thread
+	EXPECT_LE(index.load(), 2u);
+
+	pool.reset_stats();
+	{
+		TaskGroup tasks(pool);
+		for (int i = 0; i < 100; i++)
+			tasks.run([] {});
+	}
+
+	// External threads only help, the workers count what they executed
+	std::vector<ThreadPool::WorkerStats> stats = pool.stats();
+	ASSERT_EQ(stats.size(), 2u);
+	std::uint64_t executed = 0;
+	for (const auto &worker : stats)
+		executed += worker.executed;
+	EXPECT_LE(executed, 100u);
+
+	pool.reset_stats();
+	for (const auto &worker : pool.stats()) {
+		EXPECT_EQ(worker.executed, 0u);
+		EXPECT_EQ(worker.steals, 0u);
+		EXPECT_EQ(worker.failed_steals, 0u);
+		EXPECT_EQ(worker.idles, 0u);
+	}
+}
+
+TEST(ThreadPoolTest, GlobalConfiguration) {
+	ThreadPool &pool = ThreadPool::global();
+	EXPECT_GE(pool.size(), 1u);
+	EXPECT_EQ(&pool, &ThreadPool::global());
+	EXPECT_THROW(ThreadPool::configure(2), std::logic_error);
+
+	// The threads that ask for it at the same time all see the one pool
+	std::vector<std::thread> threads;
+	std::vector<ThreadPool *> seen(8, nullptr);
+	for (std::size_t i = 0; i < seen.size(); i++)
+		threads.emplace_back([&seen, i] { seen[i] = &ThreadPool::global(); });
+	for (auto &thread : threads)
+		thread.join();
+	for (ThreadPool *other : seen)
+		EXPECT_EQ(other, &pool);
+	EXPECT_THROW(ThreadPool(0), std::invalid_argument);
+
+	ThreadPool pinned(1, true);
+	EXPECT_TRUE(pinned.is_pinned());
+	std::atomic<bool> ran(false);
+	TaskGroup group(pinned);
+	group.run([&] { ran = true; });
+	group.wait();
+	EXPECT_TRUE(ran.load());
+}
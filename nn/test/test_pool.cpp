@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+#include "test_helpers.hpp"
+
+using namespace nn::models;
+using namespace nn::activation_funcs;
+using namespace nn::test;
+
+TEST(PoolTest, MaxPoolForwardAndScatter) {
+	// 2 channels of 4x4, 2x2 windows
+	MaxPool2D<float> pool(2, 4, 4, 2);
+	pool.build();
+	EXPECT_EQ(pool.get_output_shape(), Shape(2 * 2 * 2, 1));
+	Mat<float> X = make_distinct(32, 3);
+	Mat<float> Y = pool(X);
+	Mat<float> dY = make_distinct(8, 3);
+	Mat<float> dX = pool.backward<float>(X, dY, nullptr);
+
+	for (std::size_t j = 0; j < 3; j++)
+	for (std::size_t c = 0; c < 2; c++)
+	for (std::size_t oh = 0; oh < 2; oh++)
+	for (std::size_t ow = 0; ow < 2; ow++) {
+		std::size_t best = 0;
+		float expected = -1e9f;
+		for (std::size_t u = 0; u < 2; u++)
+			for (std::size_t v = 0; v < 2; v++) {
+				std::size_t at = (c * 4 + oh * 2 + u) * 4 + ow * 2 + v;
+				if (X(at, j) > expected) {
+					expected = X(at, j);
+					best = at;
+				}
+			}
+		std::size_t out = (c * 2 + oh) * 2 + ow;
+		EXPECT_FLOAT_EQ(Y(out, j), expected);
+		// Only the maximum of the window gets the gradient
+		for (std::size_t u = 0; u < 2; u++)
+			for (std::size_t v = 0; v < 2; v++) {
+				std::size_t at = (c * 4 + oh * 2 + u) * 4 + ow * 2 + v;
+				EXPECT_FLOAT_EQ(dX(at, j), at == best ? dY(out, j) : 0.0f);
+			}
+	}
+
+	// Every thread scatters to the maxima of its own forward, nothing is pooled again
+	Mat<float> flipped(32, 3), dX_flipped;
+	for (std::size_t i = 0; i < 32; i++)
+		for (std::size_t j = 0; j < 3; j++)
+			flipped(i, j) = -X(i, j);
+	std::thread other([&] {
+		pool(flipped);
+		dX_flipped = pool.backward<float>(flipped, dY, nullptr);
+	});
+	other.join();
+	EXPECT_TRUE(pool.backward<float>(X, dY, nullptr) == dX);
+	EXPECT_FALSE(dX_flipped == dX);
+	// A batch of the same shape is not the one of the forward of this thread
+	EXPECT_THROW(pool.backward<float>(flipped, dY, nullptr), std::logic_error);
+
+	MaxPool2D<float> fresh(2, 4, 4, 2);
+	fresh.build();
+	EXPECT_THROW(fresh.backward<float>(X, dY, nullptr), std::logic_error);
+	EXPECT_THROW(MaxPool2D<float>(1, 2, 2, 3), std::invalid_argument);
+}
+
+TEST(PoolTest, AvgPoolsAreMeans) {
+	AvgPool2D<float> pool(1, 4, 6, 2);
+	GlobalAvgPool<float> global(3, 3, 2);
+	pool.build();
+	global.build();
+	EXPECT_EQ(global.get_output_shape(), Shape(3, 1));
+
+	Mat<float> X = make_distinct(24, 2);
+	Mat<float> Y = pool(X);
+	for (std::size_t j = 0; j < 2; j++)
+		for (std::size_t oh = 0; oh < 2; oh++)
+			for (std::size_t ow = 0; ow < 3; ow++) {
+				std::size_t at = (oh * 2) * 6 + ow * 2;
+				float mean = (X(at, j) + X(at + 1, j) + X(at + 6, j) + X(at + 7, j)) / 4.0f;
+				EXPECT_NEAR(Y(oh * 3 + ow, j), mean, 1e-6);
+			}
+
+	// The mean of every channel, the backward spreads dY over it
+	Mat<float> G = make_distinct(18, 2);
+	Mat<float> dY = make_distinct(3, 2);
+	Mat<float> M = global(G);
+	Mat<float> dG = global.backward<float>(G, dY, nullptr);
+	for (std::size_t j = 0; j < 2; j++)
+		for (std::size_t c = 0; c < 3; c++) {
+			float sum = 0.0f;
+			for (std::size_t i = 0; i < 6; i++) {
+				sum += G(c * 6 + i, j);
+				EXPECT_NEAR(dG(c * 6 + i, j), dY(c, j) / 6.0f, 1e-6);
+			}
+			EXPECT_NEAR(M(c, j), sum / 6.0f, 1e-6);
+		}
+}
+
+TEST(PoolTest, CompiledSequentialMatchesTheModel) {
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Conv2D<float>>(1, 8, 8, 4, 3, 1, 1, 1, std::make_shared<ReluFunc<float>>(),
+							std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<MaxPool2D<float>>(4, 8, 8, 2),
+			std::make_unique<AvgPool2D<float>>(4, 4, 4, 2),
+			std::make_unique<GlobalAvgPool<float>>(4, 2, 2),
+			std::make_unique<Dense<float>>(4, 3, std::make_shared<SoftmaxFunc<float>>(),
+						       std::make_shared<RandNormalInitializer<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+	model->build();
+
+	Mat<float> X = make_distinct(64, 4);
+	Mat<float> dY = make_distinct(3, 4);
+	std::vector<Mat<float>> by_hand = zero_gradients(*model), by_plan = zero_gradients(*model);
+
+	Mat<float> expected = (*model)(X);
+	Mat<float> dX = model->backward<float>(X, dY, by_hand.data());
+	model->compile(4, true);
+	expect_near(expected, model->forward_compiled(X), 1e-5f);
+	expect_near(dX, model->backward_compiled(X, dY, by_plan.data()), 1e-5f);
+	for (std::size_t k = 0; k < by_hand.size(); k++)
+		expect_near(by_hand[k], by_plan[k], 1e-4f);
+}
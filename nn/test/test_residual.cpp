@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+#include "test_helpers.hpp"
+
+using namespace nn::models;
+using namespace nn::activation_funcs;
+using namespace nn::test;
+
+static std::unique_ptr<Layer> make_dense(std::size_t input_size, std::size_t output_size,
+					 std::shared_ptr<Layer> activation = nullptr)
+{
+	return std::make_unique<Dense<float>>(input_size, output_size, activation);
+}
+
+TEST(ResidualTest, AddsTheInputToTheBlock) {
+	for (bool layer_norm : {false, true}) {
+		Residual<float> residual({make_dense(3, 5, std::make_shared<TanhFunc<float>>()), make_dense(5, 3)},
+					 layer_norm);
+		residual.build();
+		fill_parameters(residual);
+		EXPECT_EQ(residual.get_input_size(), 3u);
+		EXPECT_EQ(residual.get_output_size(), 3u);
+		EXPECT_EQ(residual.parameters<float>().size(), layer_norm ? 6u : 4u);
+
+		Mat<float> X = make_batch(3, 4, 0.2f);
+		Mat<float> expected = (*residual.get_block()[1])((*residual.get_block()[0])(X)) + X;
+		if (layer_norm)
+			expected = residual.get_layer_norm()(expected);
+		expect_near(expected, residual(X), 1e-5f);
+	}
+
+	EXPECT_THROW(Residual<float>({make_dense(3, 2)}).build(), std::invalid_argument);
+}
+
+TEST(ResidualTest, BackwardMatchesFiniteDifferences) {
+	Residual<float> residual({make_dense(3, 4, std::make_shared<TanhFunc<float>>()), make_dense(4, 3)}, true);
+	residual.build();
+	fill_parameters(residual);
+	residual.get_layer_norm().get_gamma()(1, 0) = 1.5f;
+	Mat<float> X = make_batch(3, 5, 0.3f);
+	Mat<float> dY = make_batch(3, 5, 0.1f);
+
+	// The backward takes the trace of the forward of this thread
+	std::vector<Mat<float>> grads = zero_gradients(residual);
+	EXPECT_THROW(residual.backward<float>(X, dY, grads.data()), std::logic_error);
+	residual(X);
+	Mat<float> dX = residual.backward<float>(X, dY, grads.data());
+	EXPECT_THROW(residual.backward<float>(Mat<float>(X), dY, nullptr), std::logic_error);
+
+	std::vector<Mat<float> *> params = residual.parameters<float>();
+	std::vector<std::pair<Mat<float> *, const Mat<float> *>> checks = {{&X, &dX}};
+	for (std::size_t k = 0; k < params.size(); k++)
+		checks.emplace_back(params[k], &grads[k]);
+	expect_gradients([&](void) { return dot(residual(X), dY); }, checks, 2e-3f, 3e-3);
+}
+
+TEST(ResidualTest, DropoutInTheBlockKeepsTheMaskOfTheForward) {
+	Residual<float> residual({make_dense(3, 4, std::make_shared<TanhFunc<float>>()),
+				  std::make_unique<Dropout<float>>(4, 0.5f, 42), make_dense(4, 3)}, true);
+	residual.build();
+	fill_parameters(residual);
+	residual.set_training(true);
+	Mat<float> X = make_batch(3, 6, 0.3f);
+	Mat<float> dY = make_batch(3, 6, 0.1f);
+
+	Mat<float> Y = residual(X);
+	// The first draw of a twin with the same seed is the mask of that forward, scaled:
+	// what the dropout gives back for a gradient of ones
+	const auto &block = residual.get_block();
+	Dropout<float> twin(4, 0.5f, 42);
+	twin.build();
+	twin.set_training(true);
+	Mat<float> H = (*block[0])(X);
+	twin(H);
+	Mat<float> scale = twin.backward<float>(H, Mat<float>(H.get_shape()).fill(1.0f), nullptr);
+
+	std::vector<Mat<float>> grads = zero_gradients(residual);
+	Mat<float> dX = residual.backward<float>(X, dY, grads.data());
+
+	// The same residual with that mask fixed
+	auto fixed = [&](void) {
+		Mat<float> A = (*block[0])(X);
+		for (std::size_t i = 0; i < A.rows() * A.cols(); i++)
+			A.get_mat_raw()[i] *= scale.get_mat_raw()[i];
+		return residual.get_layer_norm()((*block[2])(A) + X);
+	};
+	expect_near(fixed(), Y, 1e-5f);
+
+	std::vector<Mat<float> *> params = residual.parameters<float>();
+	std::vector<std::pair<Mat<float> *, const Mat<float> *>> checks = {{&X, &dX}};
+	for (std::size_t k = 0; k < params.size(); k++)
+		checks.emplace_back(params[k], &grads[k]);
+	expect_gradients([&](void) { return dot(fixed(), dY); }, checks, 2e-3f, 3e-3);
+}
+
+TEST(ResidualTest, TrainsInsideASequential) {
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			make_dense(4, 3, std::make_shared<TanhFunc<float>>()),
+			std::make_unique<Residual<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+					make_dense(3, 3, std::make_shared<ReluFunc<float>>())}, true),
+			make_dense(3, 2, std::make_shared<SoftmaxFunc<float>>()),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.5f));
+	model->set_loss(std::make_shared<nn::loss_funcs::SoftmaxCrossEntropy<float>>());
+	model->build();
+	fill_parameters(*model);
+	EXPECT_EQ(model->parameters<float>().size(), 8u);
+
+	Mat<float> X = make_batch(4, 6, 0.2f);
+	Mat<float> Y(2, 6);
+	Y.fill(0.0f);
+	for (std::size_t j = 0; j < 6; j++)
+		Y(j % 2, j) = 1.0f;
+
+	auto cross_entropy = [&](void) {
+		Mat<float> P = (*model)(X);
+		double sum = 0.0;
+		for (std::size_t i = 0; i < 2 * 6; i++)
+			sum -= Y.get_mat_raw()[i] * std::log(P.get_mat_raw()[i] + 1e-7);
+		return sum;
+	};
+
+	// The parameters of the block and its normalization move with the rest
+	double before = cross_entropy();
+	Mat<float> gamma = *model->parameters<float>()[6];
+	for (std::size_t n = 0; n < 20; n++) {
+		model->accumulate_batch(X, Y);
+		model->step();
+	}
+	EXPECT_LT(cross_entropy(), before);
+	EXPECT_FALSE(*model->parameters<float>()[6] == gamma);
+}
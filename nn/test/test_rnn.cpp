@@ -0,0 +1,190 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+#include "test_helpers.hpp"
+
+using namespace nn::models;
+using namespace nn::activation_funcs;
+using namespace nn::parallel;
+using namespace nn::test;
+
+static float sigmoid(float x)
+{
+	return 1.0f / (1.0f + std::exp(-x));
+}
+
+// The hidden states of every step of one sample, one step at a time from the formulas
+static std::vector<std::vector<float>> reference_states(Recurrent<float> &layer, bool lstm, const Mat<float> &X,
+							 std::size_t j)
+{
+	std::size_t H = layer.get_hidden_size();
+	std::size_t T = layer.get_seq_len();
+	std::size_t n = X.rows() / T;
+	Mat<float> &Wx = layer.get_input_weights();
+	Mat<float> &Wh = layer.get_recurrent_weights();
+	Mat<float> &bias = layer.get_bias();
+	std::vector<float> h(H, 0.0f), c(H, 0.0f);
+	std::vector<std::vector<float>> states;
+
+	for (std::size_t t = 0; t < T; t++) {
+		std::size_t gates = lstm ? 4 : 3;
+		std::vector<float> gx(gates * H), gh(gates * H);
+		for (std::size_t r = 0; r < gates * H; r++) {
+			gx[r] = bias(r, 0);
+			gh[r] = lstm ? 0.0f : static_cast<GRU<float> &>(layer).get_recurrent_bias()(r, 0);
+			for (std::size_t i = 0; i < n; i++)
+				gx[r] += Wx(r, i) * X(t * n + i, j);
+			for (std::size_t i = 0; i < H; i++)
+				gh[r] += Wh(r, i) * h[i];
+		}
+
+		std::vector<float> next(H);
+		for (std::size_t k = 0; k < H; k++) {
+			if (lstm) {
+				float i = sigmoid(gx[k] + gh[k]);
+				float f = sigmoid(gx[H + k] + gh[H + k]);
+				float g = std::tanh(gx[2 * H + k] + gh[2 * H + k]);
+				float o = sigmoid(gx[3 * H + k] + gh[3 * H + k]);
+				c[k] = f * c[k] + i * g;
+				next[k] = o * std::tanh(c[k]);
+			} else {
+				float r = sigmoid(gx[k] + gh[k]);
+				float u = sigmoid(gx[H + k] + gh[H + k]);
+				float cand = std::tanh(gx[2 * H + k] + r * gh[2 * H + k]);
+				next[k] = (1.0f - u) * cand + u * h[k];
+			}
+		}
+		h = next;
+		states.push_back(h);
+	}
+	return states;
+}
+
+static std::unique_ptr<Recurrent<float>> make_cell(bool lstm, std::size_t input_size, std::size_t hidden_size,
+						   std::size_t seq_len, bool return_sequences)
+{
+	if (lstm)
+		return std::make_unique<LSTM<float>>(input_size, hidden_size, seq_len, return_sequences);
+	return std::make_unique<GRU<float>>(input_size, hidden_size, seq_len, return_sequences);
+}
+
+TEST(RecurrentTest, StepsMatchTheCellFormulas) {
+	for (bool lstm : {true, false}) {
+		for (bool sequences : {false, true}) {
+			auto layer = make_cell(lstm, 2, 3, 4, sequences);
+			layer->build();
+			EXPECT_EQ(layer->get_input_size(), 8u);
+			EXPECT_EQ(layer->get_output_size(), sequences ? 12u : 3u);
+			EXPECT_EQ(layer->parameters<float>().size(), lstm ? 3u : 4u);
+			EXPECT_EQ(layer->get_input_weights().get_shape(), Shape(lstm ? 12 : 9, 2));
+			fill_parameters(*layer);
+
+			Mat<float> X = make_batch(8, 5, 0.3f);
+			Mat<float> Y = (*layer)(X);
+			ASSERT_EQ(Y.get_shape(), Shape(sequences ? 12 : 3, 5));
+			for (std::size_t j = 0; j < 5; j++) {
+				auto states = reference_states(*layer, lstm, X, j);
+				for (std::size_t t = sequences ? 0 : 3; t < 4; t++)
+					for (std::size_t k = 0; k < 3; k++)
+						EXPECT_NEAR(Y((sequences ? t * 3 : 0) + k, j), states[t][k], 1e-5f);
+			}
+		}
+	}
+
+	EXPECT_THROW(LSTM<float>(2, 0, 4), std::invalid_argument);
+	EXPECT_THROW(GRU<float>(2, 3).get_bias(), std::invalid_argument);
+}
+
+TEST(RecurrentTest, BackwardThroughTimeMatchesFiniteDifferences) {
+	for (bool lstm : {true, false}) {
+		for (bool sequences : {false, true}) {
+			auto layer = make_cell(lstm, 2, 3, 3, sequences);
+			layer->build();
+			fill_parameters(*layer);
+			Mat<float> X = make_batch(6, 4, 0.3f);
+			Mat<float> dY = make_batch(layer->get_output_size(), 4, 0.1f);
+
+			EXPECT_THROW(layer->backward<float>(X, dY, nullptr), std::logic_error);
+			(*layer)(X);
+			std::vector<Mat<float>> grads = zero_gradients(*layer);
+			Mat<float> dX = layer->backward<float>(X, dY, grads.data());
+			EXPECT_THROW(layer->backward<float>(Mat<float>(X), dY, nullptr), std::logic_error);
+
+			// The compiled path reads the trace of its forward and writes dX over dY
+			Mat<float> Y(dY.get_shape()), dY_into = dY, dX_into(X.get_shape());
+			layer->forward_into<float>(X, Y);
+			layer->backward_into<float>(X, Y, dY_into, dX_into, nullptr);
+			expect_near(dX, dX_into, 1e-5f);
+
+			std::vector<Mat<float> *> params = layer->parameters<float>();
+			std::vector<std::pair<Mat<float> *, const Mat<float> *>> checks = {{&X, &dX}};
+			for (std::size_t k = 0; k < params.size(); k++)
+				checks.emplace_back(params[k], &grads[k]);
+			expect_gradients([&](void) { return dot((*layer)(X), dY); }, checks, 1e-2f, 2e-3);
+		}
+	}
+}
+
+TEST(RecurrentTest, ConcurrentBatchesKeepTheirTraces) {
+	for (bool lstm : {true, false}) {
+		auto layer = make_cell(lstm, 4, 8, 5, true);
+		layer->build();
+		fill_parameters(*layer);
+
+		// Batches of different widths, a backward against the trace of another one would throw
+		const std::size_t nbatches = 6;
+		std::vector<Mat<float>> X, dY, dX(nbatches);
+		std::vector<std::vector<Mat<float>>> grads;
+		for (std::size_t k = 0; k < nbatches; k++) {
+			X.push_back(make_batch(20, 8 + k, 0.05f * static_cast<float>(k + 1)));
+			dY.push_back(make_batch(40, 8 + k, 0.1f));
+			grads.push_back(zero_gradients(*layer));
+		}
+
+		TaskGroup tasks;
+		for (std::size_t k = 0; k < nbatches; k++) {
+			tasks.run([&, k] {
+				(*layer)(X[k]);
+				dX[k] = layer->backward<float>(X[k], dY[k], grads[k].data());
+			});
+		}
+		tasks.wait();
+
+		for (std::size_t k = 0; k < nbatches; k++) {
+			(*layer)(X[k]);
+			std::vector<Mat<float>> expected = zero_gradients(*layer);
+			expect_near(layer->backward<float>(X[k], dY[k], expected.data()), dX[k], 1e-6f);
+			for (std::size_t p = 0; p < expected.size(); p++)
+				expect_near(expected[p], grads[k][p], 1e-5f);
+		}
+	}
+}
+
+TEST(RecurrentTest, SequentialBackwardMatchesTheCompiledPlan) {
+	// The plain backward of the model reads the traces of its own forward, not a second pass
+	for (bool lstm : {true, false}) {
+		auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				make_cell(lstm, 2, 5, 4, false),
+				std::make_unique<Dense<float>>(5, 3, std::make_shared<TanhFunc<float>>()),
+			});
+		model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+		model->build();
+		fill_parameters(*model);
+
+		Mat<float> X = make_batch(8, 6, 0.3f);
+		Mat<float> dY = make_batch(3, 6, 0.1f);
+		std::vector<Mat<float>> grads = zero_gradients(*model);
+		Mat<float> dX = model->backward<float>(X, dY, grads.data());
+
+		model->compile(6, true);
+		std::vector<Mat<float>> compiled = zero_gradients(*model);
+		model->forward_compiled(X);
+		expect_near(dX, model->backward_compiled(X, dY, compiled.data()), 1e-5f);
+		for (std::size_t k = 0; k < grads.size(); k++)
+			expect_near(compiled[k], grads[k], 1e-5f);
+	}
+}
@@ -0,0 +1,318 @@
+#include <gtest/gtest.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../include/serialize.hpp"
+#include "../include/activation_func.hpp"
+#include "test_helpers.hpp"
+
+using namespace nn::io;
+using namespace nn::activation_funcs;
+using nn::test::expect_near;
+
+static std::string temp_path(const std::string &name)
+{
+	return ::testing::TempDir() + name;
+}
+
+/*
+ * expect_round_trip: the model saved, loaded back and restored into a fresh
+ * one of `make` (other random weights) gives the outputs of the model on X
+ */
+static void expect_round_trip(const std::function<std::shared_ptr<Sequential<float>>(void)> &make,
+			      const Mat<float> &X, const std::string &name)
+{
+	auto model = make();
+	std::vector<Mat<float> *> params = model->optimizer_parameters();
+	for (std::size_t k = 0; k < params.size(); k++)
+		for (std::size_t i = 0; i < params[k]->rows() * params[k]->cols(); i++)
+			params[k]->get_mat_raw()[i] = 0.05f * static_cast<float>(static_cast<int>((i * 7 + k * 3) % 13) - 6);
+	Mat<float> expected = (*model)(X);
+
+	std::string path = temp_path(name);
+	save(path, *model);
+
+	auto loaded = load_sequential<float>(path);
+	ASSERT_EQ(loaded->get_layers().size(), model->get_layers().size());
+	expect_near(expected, (*loaded)(X), 1e-5f);
+
+	auto fresh = make();
+	restore(path, *fresh);
+	expect_near(expected, (*fresh)(X), 1e-5f);
+
+	std::remove(path.c_str());
+}
+
+static std::shared_ptr<Sequential<float>> built(std::initializer_list<std::unique_ptr<Layer>> layers)
+{
+	auto model = std::make_shared<Sequential<float>>(layers);
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+	model->build();
+	return model;
+}
+
+TEST(SerializeTest, SequentialRoundTripIsZeroCopy) {
+	auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+			std::make_unique<Dense<float>>(3, 4, std::make_shared<ReluFunc<float>>(), std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<Dense<float>>(4, 2, nullptr, std::make_shared<RandNormalInitializer<float>>()),
+			std::make_unique<SigmoidFunc<float>>(),
+		});
+	model->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+	model->build();
+
+	std::string path = temp_path("sequential.nnm");
+	save(path, *model);
+
+	auto loaded = load_sequential<float>(path);
+	ASSERT_EQ(loaded->get_layers().size(), 3u);
+	EXPECT_EQ(loaded->get_layers()[0]->get_name(), "Dense");
+	EXPECT_EQ(loaded->get_layers()[2]->get_name(), "SigmoidFunc");
+
+	for (std::size_t i = 0; i < 2; i++) {
+		auto *a = static_cast<Dense<float> *>(model->get_layers()[i].get());
+		auto *b = static_cast<Dense<float> *>(loaded->get_layers()[i].get());
+		EXPECT_EQ(a->get_weights(), b->get_weights());
+		EXPECT_EQ(a->get_bias(), b->get_bias());
+		EXPECT_TRUE(b->has_bound_weights());
+		// The weights live inside of the aligned mapping
+		EXPECT_EQ(reinterpret_cast<std::uintptr_t>(b->get_weights().get_mat_raw()) % model_file_alignment, 0u);
+	}
+	EXPECT_EQ(loaded->get_layers()[1]->get_input_shape(), Shape(4, 1));
+
+	Mat<float> x = {{0.5f}, {-1.0f}, {2.0f}};
+	EXPECT_EQ((*model)(x), (*loaded)(x));
+
+	std::remove(path.c_str());
+}
+
+TEST(SerializeTest, LoadedWeightsCanBeTrained) {
+	Dense<float> layer(2, 1, nullptr, std::make_shared<RandUniformInitializer<float>>());
+	layer.build();
+
+	std::string path = temp_path("dense.nnm");
+	save(path, layer);
+
+	auto loaded = load_dense<float>(path);
+	loaded->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(1.0f));
+	Mat<float> before = loaded->get_weights();
+	loaded->fit(Mat<float>{{1.0f}}, Mat<float>{{1.0f}, {1.0f}});
+	EXPECT_FLOAT_EQ(loaded->get_weights()(0, 0), before(0, 0) - 1.0f);
+
+	// Copy-on-write mapping: the file keeps the saved weights
+	auto again = load_dense<float>(path);
+	EXPECT_EQ(again->get_weights(), before);
+
+	std::remove(path.c_str());
+}
+
+TEST(SerializeTest, PerceptronAndAdeline) {
+	auto perceptron = std::make_shared<Perceptron<float>>(2, 1, std::make_shared<RandUniformInitializer<float>>());
+	perceptron->set_optimizer(std::make_shared<PerceptronOptimizer<float>>(0.1f));
+	perceptron->build();
+
+	auto adeline = std::make_shared<Adeline<float>>(2, 1, std::make_shared<RandUniformInitializer<float>>());
+	adeline->set_optimizer(std::make_shared<GradientDescentOptimizer<float>>(0.1f));
+	adeline->build();
+
+	std::string perceptron_path = temp_path("perceptron.nnm");
+	std::string adeline_path = temp_path("adeline.nnm");
+	save(perceptron_path, *perceptron);
+	save(adeline_path, *adeline);
+
+	auto loaded_perceptron = load_perceptron<float>(perceptron_path);
+	auto loaded_adeline = load_adeline<float>(adeline_path);
+	EXPECT_EQ(loaded_perceptron->get_weights(), perceptron->get_weights());
+	EXPECT_EQ(loaded_adeline->get_bias(), adeline->get_bias());
+
+	Mat<float> x = {{1.0f}, {0.0f}};
+	EXPECT_EQ((*loaded_adeline)(x), (*adeline)(x));
+
+	// A file only loads as the kind of model that was saved
+	EXPECT_THROW(load_adeline<float>(perceptron_path), std::runtime_error);
+
+	std::remove(perceptron_path.c_str());
+	std::remove(adeline_path.c_str());
+}
+
+TEST(SerializeTest, RejectsInvalidFiles) {
+	std::string path = temp_path("garbage.nnm");
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << "definitely not a model file, just some bytes to fill the header up";
+	}
+	EXPECT_THROW(load_sequential<float>(path), std::runtime_error);
+	EXPECT_THROW(load_sequential<float>(temp_path("missing.nnm")), std::runtime_error);
+
+	std::remove(path.c_str());
+}
+
+TEST(SerializeTest, RejectsTensorsOutOfTheFile) {
+	Dense<float> layer(3, 2);
+	layer.build();
+	std::string path = temp_path("wrapping.nnm");
+	save(path, layer);
+
+	// rows * cols * sizeof(float) of 2^62 * 4 * 4 wraps around to zero
+	FileHeader header;
+	{
+		std::ifstream in(path, std::ios::binary);
+		in.read(reinterpret_cast<char *>(&header), sizeof(header));
+	}
+	std::uint64_t rows = std::uint64_t(1) << 62, cols = 4;
+	{
+		std::fstream out(path, std::ios::binary | std::ios::in | std::ios::out);
+		std::size_t record = sizeof(FileHeader) + (header.nlayers + header.nstate) * sizeof(LayerRecord);
+		out.seekp(static_cast<std::streamoff>(record + offsetof(TensorRecord, rows)));
+		out.write(reinterpret_cast<const char *>(&rows), sizeof(rows));
+		out.write(reinterpret_cast<const char *>(&cols), sizeof(cols));
+	}
+	// The header alone must catch it, before any tensor is looked at
+	MappedFile file(path);
+	EXPECT_THROW(read_header<float>(file), std::runtime_error);
+
+	std::remove(path.c_str());
+}
+
+TEST(SerializeTest, LoadsTheOlderVersions) {
+	Dense<float> layer(3, 2, nullptr, std::make_shared<RandUniformInitializer<float>>());
+	layer.build();
+	std::string path = temp_path("versions.nnm");
+	save(path, layer);
+
+	auto patch = [&](std::uint32_t version, std::uint32_t nstate) {
+		std::fstream out(path, std::ios::binary | std::ios::in | std::ios::out);
+		out.seekp(offsetof(FileHeader, version));
+		out.write(reinterpret_cast<const char *>(&version), sizeof(version));
+		out.seekp(offsetof(FileHeader, nstate));
+		out.write(reinterpret_cast<const char *>(&nstate), sizeof(nstate));
+	};
+
+	// A version 1 file is the same layout with a zero reserved field
+	patch(1, 0);
+	EXPECT_EQ(load_dense<float>(path)->get_weights(), layer.get_weights());
+	patch(1, 1);
+	EXPECT_THROW(load_dense<float>(path), std::runtime_error);
+	patch(model_file_version + 1, 0);
+	EXPECT_THROW(load_dense<float>(path), std::runtime_error);
+
+	std::remove(path.c_str());
+}
+
+TEST(SerializeTest, ConvolutionsPoolsAndNormsRoundTrip) {
+	auto make = [](void) {
+		return built({
+				std::make_unique<Conv2D<float>>(1, 6, 6, 2, 3, 1, 1, 1, std::make_shared<ReluFunc<float>>(),
+								std::make_shared<RandNormalInitializer<float>>()),
+				std::make_unique<MaxPool2D<float>>(2, 6, 6, 2),
+				std::make_unique<AvgPool2D<float>>(2, 3, 3, 2, 1),
+				std::make_unique<BatchNorm<float>>(8, std::make_shared<TanhFunc<float>>(), 0.2f, 1e-3f),
+				std::make_unique<Dropout<float>>(8, 0.25f, 7),
+				std::make_unique<Dense<float>>(8, 3, nullptr, std::make_shared<RandNormalInitializer<float>>()),
+				std::make_unique<SoftmaxFunc<float>>(),
+			});
+	};
+	expect_round_trip(make, nn::test::make_batch(36, 3, 0.2f), "conv.nnm");
+
+	// The hyper-parameters and the running statistics of the batch normalization come back
+	auto model = make();
+	auto &norm = static_cast<BatchNorm<float> &>(*model->get_layers()[3]);
+	for (std::size_t i = 0; i < 8; i++) {
+		norm.get_running_mean()(i, 0) = 0.1f * static_cast<float>(i);
+		norm.get_running_var()(i, 0) = 1.0f + 0.5f * static_cast<float>(i);
+	}
+	std::string path = temp_path("batchnorm.nnm");
+	save(path, *model);
+	auto loaded = load_sequential<float>(path);
+	auto &loaded_norm = static_cast<BatchNorm<float> &>(*loaded->get_layers()[3]);
+	EXPECT_EQ(loaded_norm.get_running_mean(), norm.get_running_mean());
+	EXPECT_EQ(loaded_norm.get_running_var(), norm.get_running_var());
+	EXPECT_FLOAT_EQ(loaded_norm.get_momentum(), 0.2f);
+	EXPECT_FLOAT_EQ(loaded_norm.get_eps(), 1e-3f);
+	auto &dropout = static_cast<Dropout<float> &>(*loaded->get_layers()[4]);
+	EXPECT_FLOAT_EQ(dropout.get_rate(), 0.25f);
+	EXPECT_EQ(dropout.get_seed(), 7u);
+	auto &conv = static_cast<Conv2D<float> &>(*loaded->get_layers()[0]);
+	EXPECT_EQ(conv.get_padding(), 1u);
+	EXPECT_TRUE(conv.has_activation_func());
+
+	std::remove(path.c_str());
+}
+
+TEST(SerializeTest, SequenceLayersRoundTrip) {
+	auto make = [](void) {
+		return built({
+				std::make_unique<Embedding<float>>(20, 4, 3, std::make_shared<RandNormalInitializer<float>>()),
+				std::make_unique<MultiHeadAttention<float>>(4, 2, 3, true),
+				std::make_unique<Residual<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+						std::make_unique<Dense<float>>(12, 12, std::make_shared<ReluFunc<float>>()),
+						std::make_unique<LayerNorm<float>>(12, 1e-4f),
+					}, true),
+				std::make_unique<LSTM<float>>(4, 5, 3, true),
+				std::make_unique<GRU<float>>(5, 3, 3),
+				std::make_unique<Dense<float>>(3, 2),
+			});
+	};
+	Mat<float> X{{1.0f, 4.0f}, {7.0f, 19.0f}, {0.0f, 3.0f}};
+	expect_round_trip(make, X, "sequence.nnm");
+
+	// The block of a residual has its own records after it
+	std::string path = temp_path("residual.nnm");
+	save(path, *make());
+	MappedFile file(path);
+	EXPECT_EQ(read_header<float>(file).nlayers, 8u);
+	auto loaded = load_sequential<float>(path);
+	auto &residual = static_cast<Residual<float> &>(*loaded->get_layers()[2]);
+	ASSERT_EQ(residual.get_block().size(), 2u);
+	EXPECT_TRUE(residual.has_layer_norm());
+	EXPECT_TRUE(static_cast<Dense<float> &>(*residual.get_block()[0]).has_bound_weights());
+	EXPECT_TRUE(static_cast<MultiHeadAttention<float> &>(*loaded->get_layers()[1]).is_causal());
+	EXPECT_TRUE(static_cast<LSTM<float> &>(*loaded->get_layers()[3]).returns_sequences());
+
+	std::remove(path.c_str());
+}
+
+TEST(SerializeTest, SparseLayersRoundTripWithTheirPattern) {
+	// A BSR layer with half of its blocks, the ones of a checkerboard
+	auto make = [](void) {
+		Mat<float> A = nn::test::make_batch(4, 8, 0.1f);
+		std::vector<bool> keep(8);
+		for (std::size_t i = 0; i < keep.size(); i++)
+			keep[i] = (i / 4 + i % 4) % 2 == 0;
+		SparseMat<float> weights(A, keep, SparseFormat::BSR, 2, 2);
+		auto sparse = std::make_unique<SparseDense<float>>(weights, std::make_shared<ReluFunc<float>>());
+		// A pruned Dense keeps the name of the layer it replaces
+		sparse->set_name("Dense");
+		return built({
+				std::move(sparse),
+				std::make_unique<Dense<float>>(4, 8),
+				std::make_unique<GlobalAvgPool<float>>(2, 2, 2),
+			});
+	};
+	expect_round_trip(make, nn::test::make_batch(8, 3, 0.3f), "sparse.nnm");
+
+	std::string path = temp_path("pattern.nnm");
+	auto model = make();
+	save(path, *model);
+	auto loaded = load_sequential<float>(path);
+	auto &a = static_cast<SparseDense<float> &>(*model->get_layers()[0]).get_weights();
+	auto &b = static_cast<SparseDense<float> &>(*loaded->get_layers()[0]).get_weights();
+	EXPECT_EQ(b.get_format(), SparseFormat::BSR);
+	EXPECT_EQ(b.get_row_ptr(), a.get_row_ptr());
+	EXPECT_EQ(b.get_col_idx(), a.get_col_idx());
+
+	// The values of another pattern would land on other weights
+	auto other = built({
+			std::make_unique<SparseDense<float>>(SparseMat<float>(nn::test::make_batch(4, 8, 0.1f), SparseFormat::BSR, 2, 2)),
+			std::make_unique<Dense<float>>(4, 8),
+			std::make_unique<GlobalAvgPool<float>>(2, 2, 2),
+		});
+	EXPECT_THROW(restore(path, *other), std::runtime_error);
+
+	std::remove(path.c_str());
+}
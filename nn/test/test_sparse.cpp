@@ -0,0 +1,189 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "../include/nn.hpp"
+#include "../include/activation_func.hpp"
+#include "test_helpers.hpp"
+
+using namespace nn::models;
+using namespace nn::activation_funcs;
+using namespace nn::test;
+
+// Weights of both signs, a third of them zero
+static Mat<float> make_weights(std::size_t rows, std::size_t cols)
+{
+	Mat<float> W(rows, cols);
+	for (std::size_t i = 0; i < rows; i++)
+		for (std::size_t j = 0; j < cols; j++)
+			W(i, j) = (i + 2 * j) % 3 == 0 ? 0.0f : 0.1f * static_cast<float>(static_cast<int>((i * 5 + j * 3) % 13) - 6);
+	return W;
+}
+
+TEST(SparseMatTest, ProductsMatchTheDenseMatrix) {
+	Mat<float> W = make_weights(8, 12);
+	Mat<float> X = make_batch(12, 70, 0.1f);
+	Mat<float> dY = make_batch(8, 70, 0.2f);
+
+	SparseMat<float> csr(W);
+	std::size_t nonzeros = 0;
+	for (std::size_t i = 0; i < 8 * 12; i++)
+		nonzeros += W.get_mat_raw()[i] != 0.0f;
+	EXPECT_EQ(csr.nnz(), nonzeros);
+	EXPECT_EQ(csr.nblocks(), csr.nnz());
+	EXPECT_TRUE(csr.to_dense() == W);
+
+	// The blocks with a nonzero are stored whole, zeros included
+	for (SparseMat<float> sparse : {csr, SparseMat<float>(W, SparseFormat::BSR, 2, 3),
+					SparseMat<float>(W, SparseFormat::BSR, 4, 4)}) {
+		EXPECT_TRUE(sparse.to_dense() == W);
+		EXPECT_LE(sparse.density(), 1.0);
+		expect_near(W.dot(X), sparse.dot(X), 1e-5f);
+		expect_near(W.transpose_dot(dY), sparse.transpose_dot(dY), 1e-5f);
+		Mat<float> column = make_batch(12, 1, 0.1f);
+		expect_near(W.dot(column), sparse.dot(column), 1e-5f);
+
+		// dY . X^T, only where W is stored
+		Mat<float> full = Mat<float>(8, 12).fill(0.0f).add_dot_transposed(dY, X);
+		Mat<float> G = Mat<float>(sparse.get_values().get_shape()).fill(0.0f);
+		sparse.add_sampled_dot_transposed(dY, X, G);
+		SparseMat<float> sampled = sparse, stored = sparse;
+		sampled.get_values() = G;
+		stored.get_values().fill(1.0f);
+		Mat<float> dense = sampled.to_dense(), mask = stored.to_dense();
+		for (std::size_t i = 0; i < 8; i++)
+			for (std::size_t j = 0; j < 12; j++)
+				EXPECT_NEAR(dense(i, j), mask(i, j) * full(i, j), 1e-4f);
+	}
+
+	EXPECT_THROW(SparseMat<float>(W, SparseFormat::BSR, 3, 4), std::invalid_argument);
+	EXPECT_THROW(SparseMat<float>(W, SparseFormat::CSR, 2, 2), std::invalid_argument);
+	EXPECT_THROW(SparseMat<float>(Mat<float>(2, 2).fill(0.0f)), std::invalid_argument);
+}
+
+TEST(SparseMatTest, CsrProductsCoverWholeAndPartialLaneBlocks) {
+	// Rows of 26 or 27 nonzeros and an empty one, batches around the blocks of 8 samples
+	Mat<float> W = make_weights(5, 40);
+	for (std::size_t j = 0; j < 40; j++)
+		W(2, j) = 0.0f;
+	SparseMat<float> csr(W);
+	EXPECT_EQ(csr.get_row_ptr()[3], csr.get_row_ptr()[2]);
+
+	for (std::size_t ncols : {1ul, 7ul, 8ul, 19ul}) {
+		Mat<float> X = make_batch(40, ncols, 0.1f);
+		Mat<float> Y = csr.dot(X);
+		for (std::size_t j = 0; j < ncols; j++)
+			EXPECT_EQ(Y(2, j), 0.0f);
+		expect_near(W.dot(X), Y, 1e-5f);
+	}
+}
+
+TEST(SparseDenseTest, PrunedLayerMatchesTheMaskedDense) {
+	for (auto [format, block] : {std::pair{SparseFormat::CSR, 1ul}, std::pair{SparseFormat::BSR, 2ul}}) {
+		Dense<float> dense(12, 8, std::make_shared<TanhFunc<float>>());
+		dense.build();
+		dense.get_weights() = make_weights(8, 12);
+		dense.get_bias() = make_batch(8, 1, 0.1f);
+
+		// 75% of the blocks go, the largest ones stay
+		std::unique_ptr<SparseDense<float>> pruned = prune_dense(dense, 0.75, format, block, block);
+		SparseMat<float> &W = pruned->get_weights();
+		EXPECT_EQ(W.nblocks(), 96u / (block * block) / 4);
+		EXPECT_EQ(pruned->get_name(), "Dense");
+		Mat<float> masked = W.to_dense();
+		float smallest_kept = INFINITY, largest_dropped = 0.0f;
+		std::vector<float> norms = SparseMat<float>::block_norms(dense.get_weights(), block, block);
+		std::vector<float> kept = SparseMat<float>::block_norms(masked, block, block);
+		for (std::size_t k = 0; k < norms.size(); k++) {
+			if (kept[k] > 0.0f)
+				smallest_kept = std::min(smallest_kept, norms[k]);
+			else
+				largest_dropped = std::max(largest_dropped, norms[k]);
+		}
+		EXPECT_GE(smallest_kept, largest_dropped);
+
+		// The same layer with the dropped weights at zero
+		dense.get_weights() = masked;
+		Mat<float> X = make_batch(12, 5, 0.1f);
+		Mat<float> dY = make_batch(8, 5, 0.2f);
+		expect_near(dense(X), (*pruned)(X), 1e-5f);
+
+		std::vector<Mat<float>> grads, dense_grads;
+		for (Mat<float> *param : pruned->parameters<float>())
+			grads.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+		for (Mat<float> *param : dense.parameters<float>())
+			dense_grads.emplace_back(Mat<float>(param->get_shape()).fill(0.0f));
+		Mat<float> dX = pruned->backward<float>(X, dY, grads.data());
+		expect_near(dense.backward<float>(X, dY, dense_grads.data()), dX, 1e-5f);
+		expect_near(dense_grads[1], grads[1], 1e-5f);
+
+		// The gradient of a stored weight is the one of the dense weight
+		const std::vector<std::size_t> &row_ptr = W.get_row_ptr();
+		const std::vector<std::uint32_t> &col_idx = W.get_col_idx();
+		for (std::size_t ib = 0; ib + 1 < row_ptr.size(); ib++)
+			for (std::size_t k = row_ptr[ib]; k < row_ptr[ib + 1]; k++)
+				for (std::size_t r = 0; r < block; r++)
+					for (std::size_t c = 0; c < block; c++)
+						EXPECT_NEAR(grads[0](k * block * block + r * block + c, 0),
+							    dense_grads[0](ib * block + r, col_idx[k] * block + c), 1e-5f);
+
+		// The compiled path gives the same output and dX
+		Mat<float> Y(8, 5), dY_into = dY, dX_into(12, 5);
+		pruned->forward_into<float>(X, Y);
+		expect_near(dense(X), Y, 1e-5f);
+		pruned->backward_into<float>(X, Y, dY_into, dX_into, nullptr);
+		expect_near(dX, dX_into, 1e-5f);
+	}
+
+	Dense<float> dense(4, 2);
+	dense.build();
+	EXPECT_THROW(prune_dense(dense, 1.0), std::invalid_argument);
+}
+
+TEST(SparseDenseTest, PruningForgetsTheOptimizerState) {
+	for (bool flat : {true, false}) {
+		auto model = std::make_shared<Sequential<float>>(std::initializer_list<std::unique_ptr<Layer>>{
+				std::make_unique<Dense<float>>(6, 16, std::make_shared<TanhFunc<float>>()),
+				std::make_unique<LayerNorm<float>>(16),
+				std::make_unique<Dense<float>>(16, 2, std::make_shared<SoftmaxFunc<float>>()),
+			});
+		auto optimizer = std::make_shared<AdamOptimizer<float>>(0.05f);
+		model->set_optimizer(optimizer);
+		model->set_loss(std::make_shared<nn::loss_funcs::SoftmaxCrossEntropy<float>>());
+		model->set_flat_parameters(flat);
+		model->build();
+		fill_parameters(*model);
+
+		Mat<float> X = make_batch(6, 8, 0.2f);
+		Mat<float> Y(2, 8);
+		Y.fill(0.0f);
+		for (std::size_t j = 0; j < 8; j++)
+			Y(X(0, j) > 0.0f, j) = 1.0f;
+
+		model->accumulate_batch(X, Y);
+		model->step();
+		// Two moments and a step counter per parameter, or for the slab
+		ASSERT_EQ(optimizer->get_state<float>().size(), flat ? 3u : 6u * 3u);
+
+		EXPECT_EQ(model->prune_weights(0.5), 2u);
+		// The moments of the dense weights don't carry to the stored values, only the LayerNorm keeps its own
+		EXPECT_EQ(optimizer->get_state<float>().size(), flat ? 0u : 2u * 3u);
+		auto *first = dynamic_cast<SparseDense<float> *>(model->get_layers()[0].get());
+		ASSERT_NE(first, nullptr);
+		EXPECT_EQ(first->get_weights().nnz(), 48u);
+		Mat<float> pattern = first->get_weights().to_dense();
+
+		// The stored weights move with a fresh state and the dropped ones stay at zero
+		for (std::size_t n = 0; n < 5; n++) {
+			model->accumulate_batch(X, Y);
+			model->step();
+		}
+		EXPECT_EQ(optimizer->get_state<float>().size(), flat ? 3u : 6u * 3u);
+		Mat<float> tuned = first->get_weights().to_dense();
+		EXPECT_FALSE(tuned == pattern);
+		for (std::size_t i = 0; i < 16; i++)
+			for (std::size_t j = 0; j < 6; j++)
+				EXPECT_TRUE(pattern(i, j) != 0.0f || tuned(i, j) == 0.0f);
+	}
+}